@@ -1,1672 +1,4553 @@
-// Copyright (c) Werner Strydom. All rights reserved.
-// Licensed under the MIT license. See LICENSE in the project root for license information.
-
-#include "stdafx.h"
-#include "wrapper-error.h"
-#include "wrapper-memory.h"
-#include "wrapper-log.h"
-#include "service_config.h"
-#include "wrapper-string.h"
-#include "wrapper-utils.h"
-
-VOID WINAPI wrapper_service_main(DWORD dwArgc, LPTSTR* lpszArgv);
-VOID WINAPI wrapper_service_control_handler(DWORD dwCtrl);
-
-int wrapper_service_init(wrapper_config_t* config, wrapper_error_t** error);
-int wrapper_service_report_status(DWORD dwCurrentState, DWORD dwWin32ExitCode, DWORD dwWaitHint,
-                                  wrapper_config_t* config, wrapper_error_t** error);
-
-
-SERVICE_STATUS_HANDLE status_handle; // TODO: Move to methods and pass around like variables
-TCHAR* stop_event_name = _T("PHAKA_WINDOWS_SERVICE_STOP_EVENT");
-
-
-const TCHAR* wrapper_service_get_status_text(const unsigned long status)
-{
-	switch (status)
-	{
-	case SERVICE_STOPPED:
-		return _T("SERVICE_STOPPED");
-	case SERVICE_START_PENDING:
-		return _T("SERVICE_START_PENDING");
-	case SERVICE_STOP_PENDING:
-		return _T("SERVICE_STOP_PENDING");
-	case SERVICE_RUNNING:
-		return _T("SERVICE_RUNNING");
-	case SERVICE_CONTINUE_PENDING:
-		return _T("SERVICE_CONTINUE_PENDING");
-	case SERVICE_PAUSE_PENDING:
-		return _T("SERVICE_PAUSE_PENDING");
-	case SERVICE_PAUSED:
-		return _T("SERVICE_PAUSED");
-	default:
-		return _T("UNKNOWN");
-	}
-}
-
-// Inspired from http://stackoverflow.com/a/15281070/1529139
-// and http://stackoverflow.com/q/40059902/1529139
-BOOL SendConsoleCtrlEvent(DWORD dwProcessId, DWORD dwCtrlEvent)
-{
-	BOOL success = FALSE;
-	DWORD thisConsoleId = GetCurrentProcessId();
-	// Leave current console if it exists
-	// (otherwise AttachConsole will return ERROR_ACCESS_DENIED)
-	BOOL consoleDetached = FreeConsole() != FALSE;
-
-	if (AttachConsole(dwProcessId) != FALSE)
-	{
-		SetConsoleCtrlHandler(NULL, TRUE);
-		success = GenerateConsoleCtrlEvent(dwCtrlEvent, 0) != FALSE;
-		FreeConsole();
-	}
-
-	if (consoleDetached)
-	{
-		// Create a new console if previous was deleted by OS
-		if (AttachConsole(thisConsoleId) == FALSE)
-		{
-			int errorCode = GetLastError();
-			if (errorCode == 31) // 31=ERROR_GEN_FAILURE
-			{
-				AllocConsole();
-			}
-		}
-	}
-	return success;
-}
-
-//
-// Purpose: 
-//   Entry point for the service
-//
-// Parameters:
-//   dwArgc - Number of arguments in the lpszArgv array
-//   lpszArgv - Array of strings. The first string is the name of
-//     the service and subsequent strings are passed by the process
-//     that called the StartService function to start the service.
-// 
-// Return value:
-//   None.
-//
-VOID WINAPI wrapper_service_main(DWORD dwArgc, LPTSTR* lpszArgv)
-{
-	UNUSED(dwArgc);
-	UNUSED(lpszArgv);
-
-	HRESULT hr = S_OK;
-	wrapper_error_t* error = NULL;
-	wrapper_config_t* config = NULL;
-	TCHAR* configuration_path = wrapper_allocate_string(_MAX_PATH);
-	if (NULL == configuration_path)
-	{
-		hr = E_OUTOFMEMORY;
-	}
-
-	if (SUCCEEDED(hr))
-	{
-		if (!wrapper_config_get_path(configuration_path, _MAX_PATH, &error))
-		{
-			wrapper_error_log(error);
-			hr = E_FAIL;
-		}
-	}
-
-	if (SUCCEEDED(hr))
-	{
-		config = wrapper_config_alloc();
-		if (NULL == config)
-		{
-			hr = E_OUTOFMEMORY;
-		}
-	}
-
-	TCHAR* service_name = NULL;
-	if (SUCCEEDED(hr))
-	{
-		WRAPPER_INFO(_T("Reading configuration '%s'"), configuration_path);
-		if (!wrapper_config_read(configuration_path, config, &error))
-		{
-			wrapper_error_log(error);
-			hr = E_FAIL;
-		}
-		else
-		{
-			WRAPPER_INFO(_T("Configuration Settings:"));
-			WRAPPER_INFO(_T("  %-20s: %s"), _T("Name"), config->name);
-			WRAPPER_INFO(_T("  %-20s: %s"), _T("Title"), config->title);
-			WRAPPER_INFO(_T("  %-20s: %s"), _T("Description"), config->description);
-			WRAPPER_INFO(_T("  %-20s: %s"), _T("Working Directory"), config->working_directory);
-			WRAPPER_INFO(_T("  %-20s: %s"), _T("Command Line"), config->command_line);
-			WRAPPER_INFO(_T(""));
-			service_name = config->name;
-		}
-	}
-
-	if (SUCCEEDED(hr))
-	{
-		WRAPPER_INFO(_T("Register a service control handler for service '%s'"), service_name);
-		status_handle = RegisterServiceCtrlHandler(service_name, wrapper_service_control_handler);
-		if (!status_handle)
-		{
-			DWORD last_error = GetLastError();
-			error = wrapper_error_from_system(last_error, _T("Failed to register the control handler for service '%s'"),
-			                                  service_name);
-			wrapper_error_log(error);
-			hr = HRESULT_FROM_WIN32(last_error);
-		}
-		else
-		{
-			WRAPPER_INFO(_T("Succesfully created a service control handler for service '%s'"), service_name);
-		}
-	}
-
-	if (SUCCEEDED(hr))
-	{
-		wrapper_service_init(config, &error);
-	}
-	else
-	{
-		wrapper_error_log(error);
-		wrapper_service_report_status(SERVICE_STOPPED, NO_ERROR, 0, config, &error);
-	}
-
-	wrapper_free(configuration_path);
-	wrapper_error_free(error);
-	wrapper_config_free(config);
-}
-
-HANDLE wrapper_create_child_process(wrapper_config_t* config, wrapper_error_t** error)
-{
-	HRESULT hr = S_OK;
-	STARTUPINFO* startupinfo = NULL;
-	PROCESS_INFORMATION* process_information = NULL;
-
-	if (SUCCEEDED(hr))
-	{
-		process_information = wrapper_allocate(sizeof*process_information);
-		if (!process_information)
-		{
-			hr = E_OUTOFMEMORY;
-			if (error)
-			{
-				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the process information"));
-			}
-		}
-	}
-
-	if (SUCCEEDED(hr))
-	{
-		startupinfo = wrapper_allocate(sizeof*startupinfo);
-		if (!startupinfo)
-		{
-			hr = E_OUTOFMEMORY;
-			if (error)
-			{
-				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the process startup information"));
-			}
-		}
-	}
-
-	TCHAR* command_line = NULL;
-	const int command_line_max_size = 32768;
-	if (SUCCEEDED(hr))
-	{
-		command_line = wrapper_allocate_string(command_line_max_size);
-		if (!command_line)
-		{
-			if (error)
-			{
-				*error = wrapper_error_from_hresult(E_OUTOFMEMORY, _T("Failed to allocate a buffer for the command line"));
-			}
-			hr = E_OUTOFMEMORY;
-		}
-	}
-
-	if (SUCCEEDED(hr))
-	{
-		hr = StringCbCopy(command_line, command_line_max_size, config->command_line);
-		if (FAILED(hr))
-		{
-			if (error)
-			{
-				*error = wrapper_error_from_hresult(hr, _T("Failed to copy the command line from the configuration file to a local buffer"));
-			}
-		}
-	}
-
-	if (SUCCEEDED(hr))
-	{
-		startupinfo->cb = sizeof startupinfo;
-		startupinfo->dwFlags |= STARTF_USESTDHANDLES;
-
-		WRAPPER_INFO(_T("Starting process with command line '%s'"), command_line);
-
-		if (!CreateProcess(NULL,
-		                   command_line,
-		                   NULL,
-		                   NULL,
-		                   FALSE,
-		                   0,
-		                   NULL,
-		                   NULL,
-		                   startupinfo,
-		                   process_information)
-		)
-		{
-			DWORD last_error = GetLastError();
-			if (error)
-			{
-				*error = wrapper_error_from_system(last_error, _T("Failed to start the process with command line '%s'"),
-				                                   command_line);
-			}
-			hr = HRESULT_FROM_WIN32(last_error);
-		}
-	}
-
-	HANDLE process = NULL;
-
-	wrapper_free(command_line);
-	wrapper_free(startupinfo);
-
-	if (process_information)
-	{
-		process = process_information->hProcess;
-
-		if (process_information->hThread)
-		{
-			CloseHandle(process_information->hThread);
-		}
-		wrapper_free(process_information);
-	}
-
-	return process;
-}
-
-int wrapper_wait(HANDLE process, wrapper_config_t* config, wrapper_error_t** error)
-{
-	DWORD last_error;
-	HRESULT hr = S_OK;
-	HANDLE events[2];
-	HANDLE stop_event = NULL;
-
-	if (SUCCEEDED(hr))
-	{
-		stop_event = OpenEvent(EVENT_ALL_ACCESS, TRUE, stop_event_name);
-		if (!stop_event)
-		{
-			last_error = GetLastError();
-			if (error)
-			{
-				*error = wrapper_error_from_system(
-					last_error, _T("Failed to wait either for the process to terminate or for the stop event to be raised"));
-			}
-			hr = HRESULT_FROM_WIN32(last_error);
-		}
-	}
-
-	if (SUCCEEDED(hr))
-	{
-		events[0] = process;
-		events[1] = stop_event;
-
-		const unsigned count = sizeof events / sizeof events[0];
-		const int wait_all = FALSE;
-
-		DWORD event = WaitForMultipleObjects(count, events, wait_all, INFINITE);
-		switch (event)
-		{
-		case WAIT_OBJECT_0 + 0:
-			// TODO: Display more information about the state of the process, like whether it was killed, crashed or terminated gracefully 
-			WRAPPER_INFO(_T("The child process has ended."));
-			wrapper_service_report_status(SERVICE_STOP_PENDING, NO_ERROR, 0, config, error);
-			break;
-
-		case WAIT_OBJECT_0 + 1:
-			WRAPPER_INFO(_T("A request was received to stop the service. Sending a CTRL+C signal to the child process."));
-			wrapper_service_report_status(SERVICE_STOP_PENDING, NO_ERROR, 0, config, error);
-			DWORD pid = GetProcessId(process);
-			SendConsoleCtrlEvent(pid, CTRL_C_EVENT);
-
-			// TODO: Should we forcefully terminate the process if it doesn't respond in say 10 minutes?
-			const int timeout = 5000;
-			DWORD status;
-			do
-			{
-				wrapper_service_report_status(SERVICE_STOP_PENDING, NO_ERROR, timeout, config, error);
-				WRAPPER_INFO(_T("Waiting up to %dms for the child process to termimate."), timeout);
-				status = WaitForSingleObject(process, timeout);
-			}
-			while (status == WAIT_TIMEOUT);
-			WRAPPER_INFO(_T("The child process succesfully termimated."));
-			break;
-
-		case WAIT_TIMEOUT:
-			WRAPPER_WARNING(_T("Wait timed out while waiting for the process to terminate or for the stop event.\n"));
-			wrapper_service_report_status(SERVICE_STOP_PENDING, NO_ERROR, 0, config, error);
-			hr = HRESULT_FROM_WIN32(ERROR_TIMEOUT);
-			if (error)
-			{
-				*error = wrapper_error_from_hresult(
-					hr, _T("Failed to wait either for the process to terminate or for the stop event to be raised"));
-			}
-			break;
-
-		default:
-			wrapper_service_report_status(SERVICE_STOP_PENDING, NO_ERROR, 0, config, error);
-			last_error = GetLastError();
-			if (error)
-			{
-				*error = wrapper_error_from_system(
-					last_error, _T("Failed to wait either for the process to terminate or for the stop event to be raised"));
-			}
-			hr = HRESULT_FROM_WIN32(last_error);
-			break;
-		}
-	}
-
-	if (stop_event)
-	{
-		CloseHandle(stop_event);
-	}
-
-	if (FAILED(hr))
-	{
-		return 0;
-	}
-
-	return 1;
-}
-
-//
-// Purpose: 
-//   The service code
-//
-// Parameters:
-//   dwArgc - Number of arguments in the lpszArgv array
-//   lpszArgv - Array of strings. The first string is the name of
-//     the service and subsequent strings are passed by the process
-//     that called the StartService function to start the service.
-// 
-// Return value:
-//   None
-//
-int wrapper_service_init(wrapper_config_t* config, wrapper_error_t** error)
-{
-	HRESULT hr = S_OK;
-	DWORD last_error;
-	HANDLE process = NULL;
-
-	wrapper_service_report_status(SERVICE_START_PENDING, NO_ERROR, 3000, config, error);
-
-	if (SUCCEEDED(hr))
-	{
-		HANDLE stop_event = CreateEvent(NULL, TRUE, FALSE, stop_event_name);
-		if (stop_event == NULL)
-		{
-			last_error = GetLastError();
-			if (error)
-			{
-				*error = wrapper_error_from_system(
-					last_error, _T("Failed to register the event for service '%s' that would be used to say the process has stopped."),
-					config->name);
-			}
-			hr = HRESULT_FROM_WIN32(last_error);
-		}
-	}
-
-
-	if (SUCCEEDED(hr))
-	{
-		process = wrapper_create_child_process(config, error);
-		if (process)
-		{
-			DWORD pid = GetProcessId(process);
-			// TODO: Display more information that could help the user diagnose when there is a failure to execute the process 
-			WRAPPER_INFO(_T("Successfully started process with command line '%s'"), config->command_line);
-			WRAPPER_INFO(_T("  Process ID: %d (0x%08x)"), pid, pid);
-
-			wrapper_service_report_status(SERVICE_RUNNING, NO_ERROR, 0, config, error);
-		}
-		else
-		{
-			if (error)
-			{
-				wrapper_error_log(*error);
-			}
-			hr = E_FAIL;
-		}
-	}
-
-	if (SUCCEEDED(hr))
-	{
-		if (!wrapper_wait(process, config, error))
-		{
-			if (error)
-			{
-				wrapper_error_log(*error);
-			}
-			hr = E_FAIL;
-		}
-	}
-
-	if (error && *error)
-	{
-		const long code = (*error)->code;
-		WRAPPER_INFO(_T("The windows service stopped with errors."));
-		wrapper_service_report_status(SERVICE_STOPPED, code, 0, config, error);
-	}
-	else
-	{
-		WRAPPER_INFO(_T("The windows service stopped succesfully."));
-		wrapper_service_report_status(SERVICE_STOPPED, NO_ERROR, 0, config, error);
-	}
-
-	if (process)
-	{
-		CloseHandle(process);
-	}
-	return 1;
-}
-
-//
-// Purpose: 
-//   Sets the current service status and reports it to the SCM.
-//
-// Parameters:
-//   state - The current state (see SERVICE_STATUS)
-//   exit_code - The system error code
-//   timeout - Estimated time for pending operation, 
-//     in milliseconds
-// 
-// Return value:
-//   None
-//
-int wrapper_service_report_status(DWORD state,
-                                  DWORD exit_code,
-                                  DWORD timeout,
-                                  wrapper_config_t* config,
-                                  wrapper_error_t** error)
-{
-	UNUSED(config);
-
-	static DWORD dwCheckPoint = 1;
-
-	SERVICE_STATUS service_status = {0};
-
-	service_status.dwServiceSpecificExitCode = 0;
-	service_status.dwCurrentState = state;
-	service_status.dwWin32ExitCode = exit_code;
-	service_status.dwWaitHint = timeout;
-	service_status.dwServiceType = SERVICE_WIN32_OWN_PROCESS;
-
-	if (state == SERVICE_START_PENDING)
-		service_status.dwControlsAccepted = 0;
-	else
-		service_status.dwControlsAccepted = SERVICE_ACCEPT_STOP;
-
-	if (state == SERVICE_RUNNING ||
-		state == SERVICE_STOPPED)
-		service_status.dwCheckPoint = 0;
-	else
-		service_status.dwCheckPoint = dwCheckPoint++;
-
-	const TCHAR* status_text = wrapper_service_get_status_text(state);
-	WRAPPER_INFO(_T("Setting the status of the service to '%s'"), status_text);
-	if (SetServiceStatus(status_handle, &service_status))
-	{
-		WRAPPER_INFO(_T("Set the status of the service to '%s'"), status_text);
-	}
-	else
-	{
-		DWORD last_error = GetLastError();
-		if (error)
-		{
-			*error = wrapper_error_from_system(
-				last_error, _T("Failed to set the status of the service to '%s'"),
-				status_text);
-		}
-
-		return 0;
-	}
-	return 1;
-}
-
-//
-// Purpose: 
-//   Called by SCM whenever a control code is sent to the service
-//   using the ControlService function.
-//
-// Parameters:
-//   dwCtrl - control code
-// 
-// Return value:
-//   None
-//
-VOID WINAPI wrapper_service_control_handler(DWORD dwCtrl)
-{
-	switch (dwCtrl)
-	{
-	case SERVICE_CONTROL_STOP:
-		{
-			wrapper_error_t* error = NULL;
-			HANDLE stop_event = OpenEvent(EVENT_ALL_ACCESS, TRUE, stop_event_name);
-			if (stop_event)
-			{
-				WRAPPER_INFO(_T("Received stop request from the service manager."));
-				if (SetEvent(stop_event))
-				{
-					WRAPPER_INFO(_T("Succesfully set the event '%s'."), stop_event_name);
-				}
-				else
-				{
-					error = wrapper_error_from_system(GetLastError(), _T("Failed to set the event '%s'. The service may not stop."),
-					                                  stop_event_name);
-				}
-				CloseHandle(stop_event);
-			}
-			else
-			{
-				error = wrapper_error_from_system(GetLastError(), _T("Failed to set the event '%s'."), stop_event_name);
-			}
-
-			if (error)
-			{
-				wrapper_error_log(error);
-				wrapper_error_free(error);
-			}
-		}
-		break;
-
-	case SERVICE_CONTROL_INTERROGATE:
-		break;
-
-	default:
-		break;
-	}
-}
-
-int wrapper_log_get_path(TCHAR* destination, const size_t size, wrapper_config_t* config, wrapper_error_t** error)
-{
-	UNUSED(config);
-
-	HRESULT hr = S_OK;
-	if (!GetModuleFileName(NULL, destination, (DWORD)size))
-	{
-		hr = HRESULT_FROM_WIN32(GetLastError());
-		if (error)
-		{
-			*error = wrapper_error_from_hresult(hr, _T("Failed to get the path of the current process."));
-		}
-	}
-
-	if (SUCCEEDED(hr))
-	{
-		PathCchRenameExtension(destination, size, _T(".log"));
-	}
-
-	if (FAILED(hr))
-	{
-		return 0;
-	}
-
-	return 1;
-}
-
-int do_run(wrapper_config_t* config, wrapper_error_t** error)
-{
-	HRESULT hr = S_OK;
-	TCHAR* log_path = NULL;
-
-	if (SUCCEEDED(hr))
-	{
-		log_path = wrapper_allocate_string(MAX_PATH);
-		if (!log_path)
-		{
-			hr = E_OUTOFMEMORY;
-		}
-	}
-
-	if (SUCCEEDED(hr))
-	{
-		if (!wrapper_log_get_path(log_path, _MAX_PATH, config, error))
-		{
-			hr = E_FAIL;
-		}
-	}
-
-	if (SUCCEEDED(hr))
-	{
-		wrapper_log_set_handler(wrapper_log_file_handler, log_path);
-	}
-
-	if (SUCCEEDED(hr))
-	{
-		WRAPPER_INFO(_T("Starting Service"));
-		
-#pragma warning( push )
-#pragma warning( disable: 4204 ) // nonstandard extension used: non-constant aggregate initializer
-		SERVICE_TABLE_ENTRY DispatchTable[] =
-		{
-			{
-				.lpServiceName = config->name,
-				.lpServiceProc = (LPSERVICE_MAIN_FUNCTION)wrapper_service_main
-			},
-			{
-				.lpServiceName = NULL,
-				.lpServiceProc = NULL
-			}
-		};
-#pragma warning( pop )
-
-		if (!StartServiceCtrlDispatcher(DispatchTable))
-		{
-			hr = E_FAIL;
-			if (error)
-			{
-				*error = wrapper_error_from_hresult(hr, _T("Failed to start the service '%s'."), config->name);
-			}
-		}
-		else
-		{
-			WRAPPER_INFO(_T("Done"));
-		}
-	}
-
-	if (FAILED(hr))
-	{
-		return 0;
-	}
-	return 1;
-}
-
-int wrapper_get_current_process_filename(TCHAR* buffer, size_t size, wrapper_config_t* config, wrapper_error_t** error)
-{
-	UNUSED(config);
-
-	if (!GetModuleFileName(NULL, buffer, (DWORD)size))
-	{
-		if (error)
-		{
-			*error = wrapper_error_from_system(GetLastError(), _T("Unable to get the filename of the current process"));
-		}
-		return 0;
-	}
-	return 1;
-}
-
-int wrapper_service_open_manager(SC_HANDLE* manager, wrapper_error_t** error)
-{
-	int rc = 1;
-	*manager = OpenSCManager(NULL, NULL, SC_MANAGER_ALL_ACCESS);
-	if (NULL == *manager)
-	{
-		rc = 0;
-		if (error)
-		{
-			*error = wrapper_error_from_system(GetLastError(), _T("Unable to get the filename of the current process"));
-		}
-	}
-	return rc;
-}
-
-int wrapper_service_create(SC_HANDLE* service, const SC_HANDLE manager, wrapper_config_t* config,
-                           wrapper_error_t** error)
-{
-	int rc = 1;
-	TCHAR* path = NULL;
-	TCHAR* service_name = NULL;
-	TCHAR* display_name = NULL;
-
-	if (rc)
-	{
-		rc = wrapper_string_duplicate(&service_name, config->name, error);
-	}
-
-	if (rc)
-	{
-		if (0 == _tcslen(config->title))
-		{
-			rc = wrapper_string_duplicate(&display_name, config->name, error);
-		}
-		else
-		{
-			rc = wrapper_string_duplicate(&display_name, config->title, error);
-		}
-	}
-
-
-	if (rc)
-	{
-		path = wrapper_allocate_string(_MAX_PATH);
-		if (!path)
-		{
-			rc = 0;
-			if (error)
-			{
-				*error = wrapper_error_from_system(ERROR_OUTOFMEMORY, _T("Unable to get the filename of the current process"));
-			}
-		}
-	}
-
-	if (rc)
-	{
-		rc = wrapper_get_current_process_filename(path, _MAX_PATH, config, error);
-	}
-
-	if (rc)
-	{
-		void* load_order_group = NULL;
-		void* tag_id = NULL;
-		void* dependencies = NULL;
-		void* username = NULL;
-		void* password = NULL;
-		const long desired_access = SERVICE_ALL_ACCESS;
-		const int service_type = SERVICE_WIN32_OWN_PROCESS;
-		const int start_type = SERVICE_DEMAND_START;
-		const int error_control = SERVICE_ERROR_NORMAL;
-
-		*service = CreateService(
-			manager,
-			service_name,
-			display_name,
-			desired_access,
-			service_type,
-			start_type,
-			error_control,
-			path,
-			load_order_group,
-			tag_id,
-			dependencies,
-			username,
-			password);
-
-		if (*service == NULL)
-		{
-			if (error)
-			{
-				*error = wrapper_error_from_system(GetLastError(), _T("Failed to create service '%s' (%s)"), service_name,
-				                                   display_name);
-			}
-			rc = 0;
-		}
-	}
-
-	wrapper_free(service_name);
-	wrapper_free(display_name);
-	wrapper_free(path);
-
-	return rc;
-}
-
-//
-// Purpose: 
-//   Installs a service in the SCM database
-//
-// Parameters:
-//   None
-// 
-// Return value:
-//   None
-//
-int do_install(wrapper_config_t* config, wrapper_error_t** error)
-{
-	int rc = 1;
-	SC_HANDLE service = NULL;
-	SC_HANDLE manager = NULL;
-
-	if (rc)
-	{
-		rc = wrapper_service_open_manager(&manager, error);
-	}
-
-	if (rc)
-	{
-		rc = wrapper_service_create(&service, manager, config, error);
-	}
-
-	if (rc)
-	{
-		WRAPPER_INFO(_T("The service '%s' was successfully installed"), config->name);
-	}
-
-	if (service)
-	{
-		CloseServiceHandle(service);
-	}
-
-	if (manager)
-	{
-		CloseServiceHandle(manager);
-	}
-
-	return rc;
-}
-
-int wrapper_service_open(SC_HANDLE* service, const int desired_access, const SC_HANDLE manager,
-                         wrapper_config_t* config, wrapper_error_t** error)
-{
-	int rc = 1;
-	*service = OpenService(manager, config->name, desired_access);
-	if (*service == NULL)
-	{
-		if (error)
-		{
-			*error = wrapper_error_from_system(GetLastError(), _T("Failed to open service '%s'"), config->name);
-		}
-		rc = 0;
-	}
-	return rc;
-}
-
-int wrapper_service_get_config(LPQUERY_SERVICE_CONFIG* service_config,
-                               const SC_HANDLE service,
-                               wrapper_config_t* config,
-                               wrapper_error_t** error)
-{
-	int rc = 1;
-	DWORD bytes_needed = 0;
-	DWORD buffer_size = 0;
-	DWORD last_error = 0;
-	*service_config = NULL;
-
-	if (rc)
-	{
-		if (!QueryServiceConfig(
-			service,
-			NULL,
-			0,
-			&bytes_needed))
-		{
-			last_error = GetLastError();
-			if (ERROR_INSUFFICIENT_BUFFER == last_error)
-			{
-				buffer_size = bytes_needed;
-				*service_config = (LPQUERY_SERVICE_CONFIG)LocalAlloc(LMEM_FIXED, buffer_size);
-			}
-			else
-			{
-				if (error)
-				{
-					*error = wrapper_error_from_system(last_error, _T("Failed to query the configuration of service '%s'"),
-					                                   config->name);
-				}
-				rc = 0;
-			}
-		}
-	}
-
-	if (rc)
-	{
-		if (!QueryServiceConfig(
-			service,
-			*service_config,
-			buffer_size,
-			&bytes_needed))
-		{
-			if (error)
-			{
-				*error = wrapper_error_from_system(last_error, _T("Failed to query the configuration of service '%s'"),
-				                                   config->name);
-			}
-			rc = 0;
-		}
-	}
-
-	if (!rc)
-	{
-		LocalFree(*service_config);
-		*service_config = NULL;
-	}
-
-	return rc;
-}
-
-int wrapper_service_get_description(LPSERVICE_DESCRIPTION* service_description, SC_HANDLE service,
-                                    wrapper_config_t* config,
-                                    wrapper_error_t** error)
-{
-	int rc = 1;
-	DWORD bytes_needed = 0;
-	DWORD buffer_size = 0;
-	DWORD last_error = 0;
-	*service_description = NULL;
-
-	if (rc)
-	{
-#pragma warning( push )
-#pragma warning( disable: 28020 )
-		if (!QueryServiceConfig2(service, SERVICE_CONFIG_DESCRIPTION, NULL, 0, &bytes_needed))
-#pragma warning( pop )
-		{
-			last_error = GetLastError();
-			if (ERROR_INSUFFICIENT_BUFFER != last_error)
-			{
-				if (error)
-				{
-					*error = wrapper_error_from_system(last_error, _T("Failed to query the description of service '%s'"),
-					                                   config->name);
-				}
-				rc = 0;
-			}
-		}
-	}
-
-	if (rc)
-	{
-		buffer_size = bytes_needed;
-		*service_description = (LPSERVICE_DESCRIPTION)LocalAlloc(LMEM_FIXED, buffer_size);
-	}
-
-	if (rc)
-	{
-		if (!QueryServiceConfig2(service, SERVICE_CONFIG_DESCRIPTION, (LPBYTE)*service_description, buffer_size,
-		                         &bytes_needed))
-		{
-			if (error)
-			{
-				*error = wrapper_error_from_system(last_error, _T("Failed to query the description of service '%s'"), config->name);
-			}
-			rc = 0;
-		}
-	}
-
-	if (!rc)
-	{
-		LocalFree(*service_description);
-		*service_description = NULL;
-	}
-
-	return rc;
-}
-
-//
-// Purpose: 
-//   Retrieves and displays the current service configuration.
-//
-// Parameters:
-//   None
-// 
-// Return value:
-//   None
-//
-int do_status(wrapper_config_t* config, wrapper_error_t** error)
-{
-	SC_HANDLE manager = NULL;
-	SC_HANDLE service = NULL;
-	LPQUERY_SERVICE_CONFIG service_config = NULL;
-	LPSERVICE_DESCRIPTION service_description = NULL;
-
-	int rc = 1;
-
-	if (rc)
-	{
-		rc = wrapper_service_open_manager(&manager, error);
-	}
-
-	if (rc)
-	{
-		rc = wrapper_service_open(&service, SERVICE_QUERY_CONFIG, manager, config, error);
-	}
-
-	if (rc)
-	{
-		rc = wrapper_service_get_config(&service_config, service, config, error);
-	}
-
-	if (rc)
-	{
-		rc = wrapper_service_get_description(&service_description, service, config, error);
-	}
-
-	if (rc)
-	{
-		WRAPPER_INFO(TEXT("Configuration:"));
-		WRAPPER_INFO(TEXT("  %-20s: %s"), _T("Name"), config->name);
-		WRAPPER_INFO(TEXT("  %-20s: %s"), _T("Description"), service_description->lpDescription ? service_description->
-			lpDescription : _T(""));
-		WRAPPER_INFO(TEXT("  %-20s: %-2d (0x%08x)"), _T("Service Type"), service_config->dwServiceType, service_config->
-			dwServiceType);
-		WRAPPER_INFO(TEXT("  %-20s: %-2d (0x%08x)"), _T("Start Type"), service_config->dwStartType, service_config->
-			dwStartType);
-		WRAPPER_INFO(TEXT("  %-20s: %-2d (0x%08x)"), _T("Error Control"), service_config->dwErrorControl, service_config->
-			dwErrorControl);
-		WRAPPER_INFO(TEXT("  %-20s: %s"), _T("Path"), service_config->lpBinaryPathName);
-		WRAPPER_INFO(TEXT("  %-20s: %s"), _T("Account"), service_config->lpServiceStartName);
-		WRAPPER_INFO(TEXT("  %-20s: %s"), _T("Load Order Group"), service_config->lpLoadOrderGroup);
-		WRAPPER_INFO(TEXT("  %-20s: %-2d (0x%08x)"), _T("Tag ID"), service_config->dwTagId, service_config->dwTagId);
-		WRAPPER_INFO(TEXT("  %-20s: %s"), _T("Dependencies"), service_config->lpDependencies);
-	}
-
-	LocalFree(service_config);
-	LocalFree(service_description);
-
-	if (service)
-		CloseServiceHandle(service);
-
-	if (manager)
-		CloseServiceHandle(manager);
-
-	return rc;
-}
-
-int wrapper_service_set_start_type(const SC_HANDLE service, int start_type, wrapper_config_t* config,
-                                   wrapper_error_t** error)
-{
-	int rc = 1;
-	if (rc)
-	{
-		const unsigned service_type = SERVICE_NO_CHANGE;
-		unsigned error_control = SERVICE_NO_CHANGE;
-		void* binary_path_name = NULL;
-		void* load_order_group = NULL;
-		void* tag_id = NULL;
-		void* dependencies = NULL;
-		void* username = NULL;
-		void* password = NULL;
-		void* display_name = NULL;
-
-		if (!ChangeServiceConfig(
-			service,
-			service_type,
-			start_type,
-			error_control,
-			binary_path_name,
-			load_order_group,
-			tag_id,
-			dependencies,
-			username,
-			password,
-			display_name))
-		{
-			if (error)
-			{
-				*error = wrapper_error_from_system(GetLastError(), _T("Failed to disable service '%s'"), config->name);
-			}
-			rc = 0;
-		}
-	}
-	return rc;
-}
-
-//
-// Purpose: 
-//   Disables the service.
-//
-// Parameters:
-//   None
-// 
-// Return value:
-//   None
-//
-int do_disable(wrapper_config_t* config, wrapper_error_t** error)
-{
-	SC_HANDLE manager = NULL;
-	SC_HANDLE service = NULL;
-
-	int rc = 1;
-	if (rc)
-	{
-		rc = wrapper_service_open_manager(&manager, error);
-	}
-
-	if (rc)
-	{
-		rc = wrapper_service_open(&service, SERVICE_CHANGE_CONFIG, manager, config, error);
-	}
-
-	if (rc)
-	{
-		rc = wrapper_service_set_start_type(service, SERVICE_DISABLED, config, error);
-	}
-
-	if (rc)
-	{
-		WRAPPER_INFO(_T("Successfully disabled service '%s'"), config->name);
-	}
-
-	if (service)
-	{
-		CloseServiceHandle(service);
-	}
-
-	if (manager)
-	{
-		CloseServiceHandle(manager);
-	}
-	return rc;
-}
-
-//
-// Purpose: 
-//   Enables the service.
-//
-// Parameters:
-//   None
-// 
-// Return value:
-//   None
-//
-int do_enable(wrapper_config_t* config, wrapper_error_t** error)
-{
-	SC_HANDLE manager = NULL;
-	SC_HANDLE service = NULL;
-
-	int rc = 1;
-	if (rc)
-	{
-		rc = wrapper_service_open_manager(&manager, error);
-	}
-
-	if (rc)
-	{
-		rc = wrapper_service_open(&service, SERVICE_CHANGE_CONFIG, manager, config, error);
-	}
-
-	if (rc)
-	{
-		rc = wrapper_service_set_start_type(service, SERVICE_DEMAND_START, config, error);
-	}
-
-	if (rc)
-	{
-		WRAPPER_INFO(_T("Successfully enabled service '%s'"), config->name);
-	}
-
-	if (service)
-	{
-		CloseServiceHandle(service);
-	}
-
-	if (manager)
-	{
-		CloseServiceHandle(manager);
-	}
-	return rc;
-}
-
-int wrapper_service_set_description(SC_HANDLE service, wrapper_config_t* config, wrapper_error_t** error)
-{
-	int rc = 1;
-	SERVICE_DESCRIPTION service_description = {0};
-	service_description.lpDescription = config->description;
-	if (!ChangeServiceConfig2(service, SERVICE_CONFIG_DESCRIPTION, &service_description))
-	{
-		if (error)
-		{
-			*error = wrapper_error_from_system(GetLastError(), _T("Failed to set the description of service '%s'"),
-			                                   config->name);
-		}
-		rc = 0;
-	}
-	return rc;
-}
-
-int do_update(wrapper_config_t* config, wrapper_error_t** error)
-{
-	SC_HANDLE manager = NULL;
-	SC_HANDLE service = NULL;
-
-	int rc = 1;
-	if (rc)
-	{
-		rc = wrapper_service_open_manager(&manager, error);
-	}
-
-	if (rc)
-	{
-		rc = wrapper_service_open(&service, SERVICE_CHANGE_CONFIG, manager, config, error);
-	}
-
-	if (rc)
-	{
-		rc = wrapper_service_set_description(service, config, error);
-	}
-
-	if (rc)
-	{
-		WRAPPER_INFO(_T("Successfully changed the description of service '%s'"), config->name);
-	}
-
-	if (service)
-	{
-		CloseServiceHandle(service);
-	}
-
-	if (manager)
-	{
-		CloseServiceHandle(manager);
-	}
-	return rc;
-}
-
-int wrapper_service_delete2(SC_HANDLE service, wrapper_config_t* config, wrapper_error_t** error)
-{
-	int rc = 1;
-	if (!DeleteService(service))
-	{
-		if (error)
-		{
-			*error = wrapper_error_from_system(GetLastError(), _T("Failed to delete service '%s'"), config->name);
-		}
-		rc = 0;
-	}
-	return rc;
-}
-
-int do_delete(wrapper_config_t* config, wrapper_error_t** error)
-{
-	SC_HANDLE manager = NULL;
-	SC_HANDLE service = NULL;
-
-	int rc = 1;
-	if (rc)
-	{
-		rc = wrapper_service_open_manager(&manager, error);
-	}
-
-	if (rc)
-	{
-		rc = wrapper_service_open(&service, SERVICE_ALL_ACCESS, manager, config, error);
-	}
-
-	if (rc)
-	{
-		rc = wrapper_service_delete2(service, config, error);
-	}
-
-	if (rc)
-	{
-		WRAPPER_INFO(_T("Successfully deleted service '%s'"), config->name);
-	}
-
-	if (service)
-	{
-		CloseServiceHandle(service);
-	}
-
-	if (manager)
-	{
-		CloseServiceHandle(manager);
-	}
-
-	return rc;
-}
-
-
-BOOL wrapper_service_stop_dependent_services(SC_HANDLE schSCManager, SC_HANDLE schService);
-
-int wrapper_service_get_status(SC_HANDLE service,
-                               SERVICE_STATUS_PROCESS* status,
-                               const wrapper_config_t* config,
-                               wrapper_error_t** error)
-{
-	int rc = 1;
-	DWORD bytes_needed;
-	if (!QueryServiceStatusEx(service, SC_STATUS_PROCESS_INFO, (LPBYTE)status, sizeof(SERVICE_STATUS_PROCESS), &bytes_needed))
-	{
-		if (error)
-		{
-			*error = wrapper_error_from_system(GetLastError(), _T("Failed to query the status of the service '%s'"),
-			                                   config->name);
-		}
-		rc = 0;
-	}
-	else
-	{
-		WRAPPER_DEBUG(_T("Status of service '%s':"), config->name);
-		WRAPPER_DEBUG(TEXT("  %-20s: 0x%08x (%d)"), _T("Check Point"), status->dwCheckPoint, status->dwCheckPoint);
-		WRAPPER_DEBUG(TEXT("  %-20s: 0x%08x (%d)"), _T("Controls Accepted"), status->dwControlsAccepted, status->dwControlsAccepted);
-		WRAPPER_DEBUG(TEXT("  %-20s: 0x%08x (%d)"), _T("Current State"), status->dwCurrentState, status->dwCurrentState);
-		WRAPPER_DEBUG(TEXT("  %-20s: 0x%08x (%d)"), _T("Process Id"), status->dwProcessId, status->dwProcessId);
-		WRAPPER_DEBUG(TEXT("  %-20s: 0x%08x (%d)"), _T("Service Flags"), status->dwServiceFlags, status->dwServiceFlags);
-		WRAPPER_DEBUG(TEXT("  %-20s: 0x%08x (%d)"), _T("Service Type"), status->dwServiceType, status->dwServiceType);
-		WRAPPER_DEBUG(TEXT("  %-20s: 0x%08x (%d)"), _T("Service Exit Code"), status->dwServiceSpecificExitCode, status->dwServiceSpecificExitCode);
-		WRAPPER_DEBUG(TEXT("  %-20s: 0x%08x (%d)"), _T("Wait Hint"), status->dwWaitHint, status->dwWaitHint);
-		WRAPPER_DEBUG(TEXT("  %-20s: 0x%08x (%d)"), _T("Win32 Exit Code"), status->dwWin32ExitCode, status->dwWin32ExitCode);
-	}
-	return rc;
-}
-
-int wrapper_service_is_not_stopped(DWORD status)
-{
-	return status != SERVICE_STOPPED && status != SERVICE_STOP_PENDING;
-}
-
-DWORD wrapper_service_get_recommended_wait_time(const DWORD wait_hint)
-{
-	// Do not wait longer than the wait hint. A good interval is 
-	// one-tenth the wait hint, but no less than 1 second and no 
-	// more than 10 seconds. 
-	const DWORD wait_time = wait_hint / 10;
-	if (wait_time < 1000) 
-	{
-		return 1000;
-	}
-
-	if (wait_time > 10000) 
-	{
-		return 10000;
-	}
-	return wait_time;
-}
-
-int wrapper_service_wait_to_stop(SC_HANDLE service, wrapper_config_t* config, wrapper_error_t** error)
-{
-	int rc = 1;
-
-	SERVICE_STATUS_PROCESS status = {0};
-	if (rc)
-	{
-		rc = wrapper_service_get_status(service, &status, config, error);
-	}
-
-	if (rc)
-	{
-		if (wrapper_service_is_not_stopped(status.dwCurrentState))
-		{
-			WRAPPER_INFO(_T("The service '%s' is running."), config->name);
-			return 1;
-		}
-	}
-
-	WRAPPER_INFO(_T("Waiting for the service '%s' to stop."), config->name);
-	ULONGLONG start_tick_count = GetTickCount64();
-	DWORD old_check_point = status.dwCheckPoint;
-	while (rc && (status.dwCurrentState == SERVICE_STOP_PENDING))
-	{
-		const DWORD milliseconds = wrapper_service_get_recommended_wait_time(status.dwWaitHint);
-		Sleep(milliseconds);
-		if (rc)
-		{
-			rc = wrapper_service_get_status(service, &status, config, error);
-		}
-
-		if (rc)
-		{
-			if (status.dwCurrentState != SERVICE_STOP_PENDING)
-			{
-				break;
-			}
-		}
-
-		if (status.dwCheckPoint > old_check_point)
-		{
-			start_tick_count = GetTickCount64();
-			old_check_point = status.dwCheckPoint;
-			continue;
-		}
-		
-		if (GetTickCount64() - start_tick_count > status.dwWaitHint)
-		{
-			if (error)
-			{
-				*error = wrapper_error_from_system(ERROR_TIMEOUT, _T("An timeout occurred while waiting for the service '%s' to stop."), config->name);
-			}
-			rc = 0;
-		}
-	}
-	return 1;
-}
-
-int wrapper_service_start(const SC_HANDLE service, const wrapper_config_t* config, wrapper_error_t** error)
-{
-	if (!StartService(service, 0, NULL)) 
-	{
-		if (error)
-		{
-			*error = wrapper_error_from_system(GetLastError(), _T("Failed to start the service '%s'"), config->name);
-		}
-		return 0;
-	}
-	return 1;
-}
-
-int wrapper_service_wait_to_start(const SC_HANDLE service, const wrapper_config_t* config, wrapper_error_t** error)
-{
-	int rc = 1;
-	SERVICE_STATUS_PROCESS status = {0};
-
-	if (rc)
-	{
-		rc = wrapper_service_get_status(service, &status, config, error);
-	}
-
-	ULONGLONG start_tick_count = GetTickCount64();
-	DWORD old_check_point = status.dwCheckPoint;
-	WRAPPER_INFO(_T("Waiting for service '%s' to start."), config->name);
-
-	while (rc && (status.dwCurrentState == SERVICE_START_PENDING))
-	{
-		const DWORD milliseconds = wrapper_service_get_recommended_wait_time(status.dwWaitHint);
-		Sleep(milliseconds);
-
-		if (rc)
-		{
-			rc = wrapper_service_get_status(service, &status, config, error);
-		}
-
-		if (rc)
-		{
-			if(status.dwCurrentState != SERVICE_START_PENDING)
-			{
-				break;
-			}
-		}
-
-		if (status.dwCheckPoint > old_check_point)
-		{
-			// Continue to wait and check.
-			start_tick_count = GetTickCount64();
-			old_check_point = status.dwCheckPoint;
-		}
-		else if (GetTickCount64() - start_tick_count > status.dwWaitHint)
-		{
-			if (error)
-			{
-				*error = wrapper_error_from_system(ERROR_TIMEOUT, _T("An timeout occurred while waiting for the service '%s' to start."), config->name);
-			}
-			rc = 0;
-			break;
-		}
-	}
-	return rc;
-}
-
-//
-// Purpose: 
-//   Starts the service if possible.
-//
-// Parameters:
-//   None
-// 
-// Return value:
-//   None
-//
-int do_start(wrapper_config_t* config, wrapper_error_t** error)
-{
-	SC_HANDLE manager = NULL;
-	SC_HANDLE service = NULL;
-
-	int rc = 1;
-	if (rc)
-	{
-		rc = wrapper_service_open_manager(&manager, error);
-	}
-
-	if (rc)
-	{
-		rc = wrapper_service_open(&service, SERVICE_ALL_ACCESS, manager, config, error);
-	}
-
-	if (rc)
-	{
-		rc = wrapper_service_wait_to_stop(service, config, error);
-	}
-
-	if (rc)
-	{
-		rc = wrapper_service_start(service, config, error);
-	}
-
-	if (rc)
-	{
-		rc = wrapper_service_wait_to_start(service, config, error);
-	}
-
-	SERVICE_STATUS_PROCESS status = {0};
-	if (rc)
-	{
-		rc = wrapper_service_get_status(service, &status, config, error);
-	}
-
-	if (rc)
-	{
-		if (status.dwCurrentState == SERVICE_RUNNING)
-		{
-			WRAPPER_INFO(_T("Service '%s' started successfully."), config->name);
-		}
-	}
-
-	if (service)
-	{
-		CloseServiceHandle(service);
-	}
-
-	if (manager)
-	{
-		CloseServiceHandle(manager);
-	}
-
-	return rc;
-}
-
-int wrapper_service_stop(SC_HANDLE service, wrapper_config_t* config, wrapper_error_t** error)
-{
-	SERVICE_STATUS_PROCESS status = {0};
-	if (!ControlService(service, SERVICE_CONTROL_STOP, (LPSERVICE_STATUS)&status))
-	{
-		if (error)
-		{
-			*error = wrapper_error_from_system(GetLastError(), _T("Failed to stop the service '%s'"), config->name);
-		}
-		return 0;
-	}
-	return 1;
-}
-
-int wrapper_service_wait_to_stop2(SC_HANDLE service, wrapper_config_t* config, wrapper_error_t** error)
-{
-	int rc = 1;
-	SERVICE_STATUS_PROCESS status = { 0 };
-
-	if (rc)
-	{
-		rc = wrapper_service_get_status(service, &status, config, error);
-	}
-
-	ULONGLONG start_tick_count = GetTickCount64();
-	DWORD old_check_point = status.dwCheckPoint;
-	while (rc && (status.dwCurrentState != SERVICE_STOPPED))
-	{
-		const DWORD milliseconds = wrapper_service_get_recommended_wait_time(status.dwWaitHint);
-		WRAPPER_INFO(_T("Waiting %dms for service '%s' to stop."), milliseconds, config->name);
-		Sleep(milliseconds);
-
-		if (rc)
-		{
-			rc = wrapper_service_get_status(service, &status, config, error);
-		}
-
-		if (rc)
-		{
-			if (status.dwCurrentState == SERVICE_STOPPED)
-			{
-				break;
-			}
-		}
-
-		if (status.dwCheckPoint > old_check_point)
-		{
-			// Continue to wait and check.
-			start_tick_count = GetTickCount64();
-			old_check_point = status.dwCheckPoint;
-		}
-		else
-		{
-			if (GetTickCount64() - start_tick_count > status.dwWaitHint)
-			{
-				if (error)
-				{
-					*error = wrapper_error_from_system(ERROR_TIMEOUT, _T("An timeout occurred while waiting for the service '%s' to stop."), config->name);
-				}
-				rc = 0;
-				break;
-			}
-		}
-	}
-
-	return rc;
-}
-
-int do_stop(wrapper_config_t* config, wrapper_error_t** error)
-{
-	SC_HANDLE manager = NULL;
-	SC_HANDLE service = NULL;
-
-	int rc = 1;
-	if (rc)
-	{
-		rc = wrapper_service_open_manager(&manager, error);
-	}
-
-	if (rc)
-	{
-		const int desired_access = SERVICE_STOP |
-			SERVICE_QUERY_STATUS |
-			SERVICE_ENUMERATE_DEPENDENTS;
-
-		rc = wrapper_service_open(&service, desired_access, manager, config, error);
-	}
-
-	SERVICE_STATUS_PROCESS status = { 0 };
-	if (rc)
-	{
-		rc = wrapper_service_get_status(service, &status, config, error);
-	}
-
-	if (rc)
-	{
-		if (status.dwCurrentState != SERVICE_STOPPED)
-		{
-			rc = wrapper_service_wait_to_stop(service, config, error);
-
-			if (rc)
-			{
-				rc = wrapper_service_stop(service, config, error);
-			}
-
-			if (rc)
-			{
-				rc = wrapper_service_wait_to_stop2(service, config, error);
-			}
-
-			WRAPPER_INFO(_T("Service '%s' stopped successfully"), config->name);
-		}
-		else
-		{
-			WRAPPER_INFO(_T("Service '%s' is already stopped."), config->name);
-		}
-	}
-
-	if (service)
-	{
-		CloseServiceHandle(service);
-	}
-	if (manager)
-	{
-		CloseServiceHandle(manager);
-	}
-	return rc;
-}
-
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#include "stdafx.h"
+#include "wrapper-environment.h"
+#include "wrapper-error.h"
+#include "wrapper-health.h"
+#include "wrapper-hooks.h"
+#include "wrapper-memory.h"
+#include "wrapper-log.h"
+#include "wrapper-log-writer.h"
+#include "wrapper-http.h"
+#include "wrapper-job.h"
+#include "wrapper-metrics.h"
+#include "wrapper-pipe.h"
+#include "wrapper-process.h"
+#include "wrapper-reactor.h"
+#include "wrapper-relay.h"
+#include "wrapper-restart.h"
+#include "wrapper-sampler.h"
+#include "wrapper-sockets.h"
+#include "service_config.h"
+#include "wrapper-string.h"
+#include "wrapper-utils.h"
+
+VOID WINAPI wrapper_service_main(DWORD dwArgc, LPTSTR* lpszArgv);
+VOID WINAPI wrapper_service_control_handler(DWORD dwCtrl);
+
+int wrapper_service_init(wrapper_config_t* config, wrapper_error_t** error);
+int wrapper_service_report_status(DWORD dwCurrentState, DWORD dwWin32ExitCode, DWORD dwWaitHint,
+                                  wrapper_config_t* config, wrapper_error_t** error);
+
+
+#define WRAPPER_STOP_CHECKPOINT_INTERVAL 1000
+#define WRAPPER_START_CHECKPOINT_INTERVAL 1000
+#define WRAPPER_STOP_EXIT_CODE 1
+
+// A standby that ends on its own is started again after at least this many milliseconds, and,
+// without a RestartMaxDelay, after at most WRAPPER_RESTART_MAX_DELAY_DEFAULT
+#define WRAPPER_STANDBY_RESTART_MIN_DELAY 1000
+#define WRAPPER_INSTANCE_VARIABLE _T("WRAPPER_INSTANCE")
+#define WRAPPER_NOTIFY_VARIABLE _T("NOTIFY_SOCKET")
+#define WRAPPER_NOTIFY_PIPE_NAME_FORMAT _T("phaka-wrapper-notify-%lu")
+#define WRAPPER_CONTROL_PIPE_NAME_FORMAT _T("phaka-wrapper-control-%s")
+#define WRAPPER_CONTROL_REPLY_MAX_LEN 65536
+#define WRAPPER_CONTROL_TIMEOUT 5000
+
+// The ends of the pipes of the relay of the child, for its standard output and standard error
+#define WRAPPER_LAUNCH_RELAY_HANDLES 2
+
+// Editors often save a file in several steps, so the configuration is read again once the file
+// hasn't changed for this many milliseconds.
+#define WRAPPER_RELOAD_DELAY 500
+
+// The directories that are watched for changes to the configuration: the one of the configuration
+// file, with its subdirectories, and those of the files it includes from elsewhere.
+#define WRAPPER_WATCH_MAX 8
+
+typedef enum
+{
+	WRAPPER_INSTANCE_STOPPED,
+	WRAPPER_INSTANCE_RUNNING,
+	WRAPPER_INSTANCE_STOPPING,
+	WRAPPER_INSTANCE_RESTARTING,
+} wrapper_instance_state_t;
+
+//
+// Each instance has its own command line, environment block, output relay, job object and restart
+// state, so that one instance failing doesn't affect the others. A '%i' in the command line is
+// replaced with the number of the instance, which counts from 1. With Standby set, an instance also
+// keeps a standby child warm, to promote when its child ends. The service is only reported as
+// running once the child of every instance is ready, as told by the Type setting.
+//
+typedef struct wrapper_service_t wrapper_service_t;
+
+//
+// What CreateProcess needs to start the child of an instance, prepared when the command line or
+// the environment of the instance change rather than each time it starts. CreateProcess may write
+// to the command line, so it gets a copy in a buffer that is kept for that. The executable is
+// looked for once and then only again when the file it found changed or is gone. The child only
+// inherits the handles in the list: the ends of the pipes of its relay, which are filled in each
+// time it starts, and the listening sockets.
+//
+typedef struct wrapper_launch_t
+{
+	const TCHAR* command_line;
+	size_t command_line_size;
+	const TCHAR* environment;
+	const TCHAR* working_directory;
+	TCHAR application[MAX_PATH];
+	FILETIME application_time;
+	HANDLE handles[WRAPPER_LAUNCH_RELAY_HANDLES + WRAPPER_SOCKETS_MAX];
+	DWORD handle_count;
+	LPPROC_THREAD_ATTRIBUTE_LIST handle_list;
+	TCHAR buffer[WRAPPER_SERVICE_CMDLINE_MAX_LEN + 1];
+} wrapper_launch_t;
+
+//
+// A directory that is watched for changes to the configuration. A change to any file in it ends
+// up in the same place, which then checks whether one of the files that were read changed.
+//
+typedef struct wrapper_watch_t
+{
+	wrapper_service_t* service;
+	TCHAR directory[_MAX_PATH];
+	int subtree;
+	HANDLE handle;
+	wrapper_reactor_source_t* source;
+} wrapper_watch_t;
+
+typedef struct wrapper_instance_t
+{
+	wrapper_service_t* service;
+	DWORD index;
+	DWORD number;
+	TCHAR command_line[WRAPPER_SERVICE_CMDLINE_MAX_LEN + 1];
+	TCHAR* environment;
+	wrapper_launch_t launch;
+	wrapper_instance_state_t state;
+	HANDLE process;
+	wrapper_relay_t* relay;
+	wrapper_job_t* job;
+	wrapper_restart_state_t restart_state;
+	wrapper_timer_t restart_timer;
+	wrapper_reactor_source_t* exit_source;
+	wrapper_reactor_source_t* health_source;
+	wrapper_reactor_source_t* ready_source;
+	int ready;
+
+	// Set while the instance waits for its turn to be restarted, see wrapper_service_restart_next
+	int restart_pending;
+
+	// The phase of the stop the child is in, see wrapper_instance_stop
+	wrapper_timer_t stop_timer;
+	ULONGLONG stop_time;
+	int stop_unhealthy;
+
+	// A second child that is started ahead of time and takes over when the first one ends
+	HANDLE standby;
+	wrapper_relay_t* standby_relay;
+	wrapper_job_t* standby_job;
+	int standby_ready;
+	wrapper_timer_t standby_timer;
+	wrapper_reactor_source_t* standby_source;
+	wrapper_reactor_source_t* standby_ready_source;
+	wrapper_restart_state_t standby_restart_state;
+} wrapper_instance_t;
+
+//
+// Everything the callbacks of the reactor need to supervise the instances.
+//
+struct wrapper_service_t
+{
+	wrapper_config_t* config;
+	wrapper_reactor_t* reactor;
+	wrapper_sampler_t* sampler;
+	wrapper_health_t* health;
+	wrapper_http_server_t* metrics_server;
+	wrapper_pipe_server_t* notify;
+	wrapper_pipe_server_t* control;
+	wrapper_sockets_t* sockets;
+	wrapper_instance_t* instances;
+	wrapper_error_t** error;
+
+	// The service is start pending until all the instances are ready. Once paused, the instances
+	// stay stopped until the service continues. Once stopping, they stay stopped for good.
+	int running;
+	int paused;
+	int stopping;
+	wrapper_timer_t stop_timer;
+
+	// The instance that was restarted last and isn't ready yet. The next instance that waits to be
+	// restarted is only restarted once it is.
+	wrapper_instance_t* rolling;
+	wrapper_timer_t rolling_timer;
+
+	// The hooks of the stage that runs, and what the service manager is told while they do
+	wrapper_hooks_t* hooks;
+	DWORD hook_status;
+	ULONGLONG start_time;
+	wrapper_timer_t start_timer;
+	char ready_pattern[WRAPPER_READY_PATTERN_MAX_LEN * 3 + 1];
+
+	TCHAR config_path[_MAX_PATH];
+	FILETIME config_time;
+	HANDLE reload_event;
+	wrapper_watch_t watches[WRAPPER_WATCH_MAX];
+	DWORD watch_count;
+	wrapper_timer_t reload_timer;
+};
+
+SERVICE_STATUS_HANDLE status_handle; // TODO: Move to methods and pass around like variables
+wrapper_log_writer_t* log_writer = NULL;
+
+// Set by the service control handler or the console control handler to stop the wrapper. It has
+// no name, so that stopping one wrapper doesn't stop the others that run on the same machine.
+static HANDLE stop_event = NULL;
+
+// Set by the service control handler to read the configuration again. It has no name either, so
+// that a reload of one service doesn't wake another one up instead.
+static HANDLE reload_event = NULL;
+
+// Without the service control manager, the wrapper runs in a console and is stopped with CTRL+C
+static int run_in_foreground = 0;
+static HANDLE foreground_stopped = NULL;
+
+// As the entry point of a container, the wrapper ends with the exit code of the child
+static DWORD exit_code_of_child = 0;
+
+
+const TCHAR* wrapper_service_get_status_text(const unsigned long status)
+{
+	switch (status)
+	{
+	case SERVICE_STOPPED:
+		return _T("SERVICE_STOPPED");
+	case SERVICE_START_PENDING:
+		return _T("SERVICE_START_PENDING");
+	case SERVICE_STOP_PENDING:
+		return _T("SERVICE_STOP_PENDING");
+	case SERVICE_RUNNING:
+		return _T("SERVICE_RUNNING");
+	case SERVICE_CONTINUE_PENDING:
+		return _T("SERVICE_CONTINUE_PENDING");
+	case SERVICE_PAUSE_PENDING:
+		return _T("SERVICE_PAUSE_PENDING");
+	case SERVICE_PAUSED:
+		return _T("SERVICE_PAUSED");
+	default:
+		return _T("UNKNOWN");
+	}
+}
+
+// Inspired from http://stackoverflow.com/a/15281070/1529139
+// and http://stackoverflow.com/q/40059902/1529139
+BOOL SendConsoleCtrlEvent(DWORD dwProcessId, DWORD dwCtrlEvent)
+{
+	if (run_in_foreground)
+	{
+		// The child shares the console of the wrapper, which must keep it, but it runs in a process
+		// group of its own, so that only the child and the processes it started get the event.
+		return GenerateConsoleCtrlEvent(dwCtrlEvent, dwProcessId);
+	}
+
+	BOOL success = FALSE;
+	DWORD thisConsoleId = GetCurrentProcessId();
+	// Leave current console if it exists
+	// (otherwise AttachConsole will return ERROR_ACCESS_DENIED)
+	BOOL consoleDetached = FreeConsole() != FALSE;
+
+	if (AttachConsole(dwProcessId) != FALSE)
+	{
+		SetConsoleCtrlHandler(NULL, TRUE);
+		success = GenerateConsoleCtrlEvent(dwCtrlEvent, 0) != FALSE;
+		FreeConsole();
+	}
+
+	if (consoleDetached)
+	{
+		// Create a new console if previous was deleted by OS
+		if (AttachConsole(thisConsoleId) == FALSE)
+		{
+			int errorCode = GetLastError();
+			if (errorCode == 31) // 31=ERROR_GEN_FAILURE
+			{
+				AllocConsole();
+			}
+		}
+	}
+	return success;
+}
+
+//
+// Writes the settings the service runs with to the log.
+//
+static void wrapper_service_log_config(wrapper_config_t* config)
+{
+	WRAPPER_INFO(_T("Configuration Settings:"));
+	WRAPPER_INFO(_T("  %-20s: %s"), _T("Name"), config->name);
+	WRAPPER_INFO(_T("  %-20s: %s"), _T("Title"), config->title);
+	WRAPPER_INFO(_T("  %-20s: %s"), _T("Description"), config->description);
+	WRAPPER_INFO(_T("  %-20s: %s"), _T("Working Directory"), config->working_directory);
+	WRAPPER_INFO(_T("  %-20s: %s"), _T("Command Line"), config->command_line);
+	WRAPPER_INFO(_T("  %-20s: %lu"), _T("Instances"), config->instances);
+	WRAPPER_INFO(_T("  %-20s: %s"), _T("Inherit"),
+	             WRAPPER_ENVIRONMENT_INHERIT_ALL == config->environment.inherit
+		             ? _T("yes")
+		             : WRAPPER_ENVIRONMENT_INHERIT_NONE == config->environment.inherit
+		             ? _T("no")
+		             : config->environment.allow);
+	WRAPPER_INFO(_T("  %-20s: %hs"), _T("Type"), wrapper_service_type_str(config->type));
+	if (WRAPPER_SERVICE_TYPE_LOG == config->type)
+	{
+		WRAPPER_INFO(_T("  %-20s: %s"), _T("Ready Pattern"), config->ready_pattern);
+	}
+	WRAPPER_INFO(_T("  %-20s: %lu ms"), _T("Start Timeout"), config->start_timeout);
+	for (int stage = 0; stage < WRAPPER_HOOK_STAGE_COUNT; stage++)
+	{
+		for (DWORD i = 0; i < config->hooks.count[stage]; i++)
+		{
+			WRAPPER_INFO(_T("  %-20s: %s"), wrapper_hook_stage_str(stage), config->hooks.command_line[stage][i]);
+		}
+	}
+	WRAPPER_INFO(_T("  %-20s: %lu ms"), _T("Hook Timeout"), config->hooks.timeout);
+	WRAPPER_INFO(_T("  %-20s: %lu"), _T("Hook Workers"), config->hooks.workers);
+	for (DWORD i = 0; i < config->sockets.count; i++)
+	{
+		WRAPPER_INFO(_T("  %-20s: %s"), _T("Listen"), config->sockets.listen[i]);
+	}
+	WRAPPER_INFO(_T("  %-20s: %lu ms"), _T("Log Flush Interval"), config->log_flush_interval);
+	WRAPPER_INFO(_T("  %-20s: %lu bytes"), _T("Log Flush Size"), config->log_flush_size);
+	WRAPPER_INFO(_T("  %-20s: %llu bytes"), _T("Log Max Size"), config->log_max_size);
+	WRAPPER_INFO(_T("  %-20s: %lu s"), _T("Log Max Age"), config->log_max_age);
+	WRAPPER_INFO(_T("  %-20s: %lu"), _T("Log Generations"), config->log_generations);
+	WRAPPER_INFO(_T("  %-20s: %s"), _T("Log Compress"), config->log_compress ? _T("yes") : _T("no"));
+	WRAPPER_INFO(_T("  %-20s: %lu ms"), _T("Stop Timeout"), config->stop_timeout);
+	WRAPPER_INFO(_T("  %-20s: %lu ms"), _T("Kill Timeout"), config->kill_timeout);
+	WRAPPER_INFO(_T("  %-20s: %s"), _T("Standby"), config->standby ? _T("yes") : _T("no"));
+	WRAPPER_INFO(_T("  %-20s: %lu ms"), _T("Standby Warmup"), config->standby_warmup);
+	WRAPPER_INFO(_T("  %-20s: %hs"), _T("Restart"), wrapper_restart_mode_str(config->restart.mode));
+	WRAPPER_INFO(_T("  %-20s: %lu ms"), _T("Restart Delay"), config->restart.delay);
+	WRAPPER_INFO(_T("  %-20s: %lu ms"), _T("Restart Max Delay"), config->restart.max_delay);
+	WRAPPER_INFO(_T("  %-20s: %.2f"), _T("Restart Multiplier"), config->restart.multiplier);
+	WRAPPER_INFO(_T("  %-20s: %lu %%"), _T("Restart Jitter"), config->restart.jitter);
+	WRAPPER_INFO(_T("  %-20s: %lu in %lu ms"), _T("Restart Limit"), config->restart.limit_count,
+	             config->restart.limit_interval);
+	WRAPPER_INFO(_T("  %-20s: %llu bytes"), _T("Memory Max"), config->limits.memory_max);
+	WRAPPER_INFO(_T("  %-20s: %lu %%"), _T("CPU Quota"), config->limits.cpu_quota);
+	WRAPPER_INFO(_T("  %-20s: 0x%llx"), _T("CPU Affinity"), config->limits.cpu_affinity);
+	WRAPPER_INFO(_T("  %-20s: %lu"), _T("IO Weight"), config->limits.io_weight);
+	WRAPPER_INFO(_T("  %-20s: %lu"), _T("Process Count Max"), config->limits.process_count_max);
+	WRAPPER_INFO(_T("  %-20s: %s"), _T("Restart On Limit"), config->limits.restart ? _T("yes") : _T("no"));
+	WRAPPER_INFO(_T("  %-20s: %lu ms"), _T("Sample Interval"), config->sample_interval);
+	WRAPPER_INFO(_T("  %-20s: %lu ms"), _T("Sample Log Interval"), config->sample_log_interval);
+	WRAPPER_INFO(_T("  %-20s: %hs"), _T("Health Check"), wrapper_health_type_str(config->health.type));
+	WRAPPER_INFO(_T("  %-20s: %s"), _T("Health Target"), config->health.target);
+	WRAPPER_INFO(_T("  %-20s: %lu ms"), _T("Health Interval"), config->health.interval);
+	WRAPPER_INFO(_T("  %-20s: %lu ms"), _T("Health Timeout"), config->health.timeout);
+	WRAPPER_INFO(_T("  %-20s: %lu"), _T("Health Failures"), config->health.failure_threshold);
+	WRAPPER_INFO(_T("  %-20s: %lu ms"), _T("Health Start Period"), config->health.start_period);
+	WRAPPER_INFO(_T("  %-20s: %s"), _T("Metrics Address"), config->metrics_address);
+	WRAPPER_INFO(_T("  %-20s: %lu"), _T("Metrics Port"), config->metrics_port);
+	WRAPPER_INFO(_T(""));
+}
+
+//
+// Purpose: 
+//   Entry point for the service
+//
+// Parameters:
+//   dwArgc - Number of arguments in the lpszArgv array
+//   lpszArgv - Array of strings. The first string is the name of
+//     the service and subsequent strings are passed by the process
+//     that called the StartService function to start the service.
+// 
+// Return value:
+//   None.
+//
+VOID WINAPI wrapper_service_main(DWORD dwArgc, LPTSTR* lpszArgv)
+{
+	UNUSED(dwArgc);
+	UNUSED(lpszArgv);
+
+	HRESULT hr = S_OK;
+	wrapper_error_t* error = NULL;
+	wrapper_config_t* config = NULL;
+	TCHAR* configuration_path = wrapper_allocate_string(_MAX_PATH);
+	if (NULL == configuration_path)
+	{
+		hr = E_OUTOFMEMORY;
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!wrapper_config_get_path(configuration_path, _MAX_PATH, &error))
+		{
+			wrapper_error_log(error);
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		config = wrapper_config_alloc();
+		if (NULL == config)
+		{
+			hr = E_OUTOFMEMORY;
+		}
+	}
+
+	TCHAR* service_name = NULL;
+	if (SUCCEEDED(hr))
+	{
+		WRAPPER_INFO(_T("Reading configuration '%s'"), configuration_path);
+		if (!wrapper_config_read(configuration_path, config, &error))
+		{
+			wrapper_error_log(error);
+			hr = E_FAIL;
+		}
+		else
+		{
+			wrapper_service_log_config(config);
+			service_name = config->name;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		WRAPPER_INFO(_T("Register a service control handler for service '%s'"), service_name);
+		status_handle = RegisterServiceCtrlHandler(service_name, wrapper_service_control_handler);
+		if (!status_handle)
+		{
+			DWORD last_error = GetLastError();
+			error = wrapper_error_from_system(last_error, _T("Failed to register the control handler for service '%s'"),
+			                                  service_name);
+			wrapper_error_log(error);
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+		else
+		{
+			WRAPPER_INFO(_T("Succesfully created a service control handler for service '%s'"), service_name);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		wrapper_service_init(config, &error);
+	}
+	else
+	{
+		wrapper_error_log(error);
+		wrapper_service_report_status(SERVICE_STOPPED, NO_ERROR, 0, config, &error);
+	}
+
+	wrapper_free(configuration_path);
+	wrapper_error_free(error);
+	wrapper_config_free(config);
+}
+
+//
+// Looks for the executable named by the first token of the command line the way CreateProcess
+// would, i.e. with '.exe' appended when it has no extension. When it isn't found, or it isn't an
+// executable, e.g. a batch file, CreateProcess is left to deal with it as before.
+//
+static void wrapper_launch_resolve(wrapper_launch_t* launch)
+{
+	TCHAR module[MAX_PATH] = {0};
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	const TCHAR* start = launch->command_line;
+	size_t length = 0;
+
+	while (_istspace(*start))
+	{
+		start++;
+	}
+
+	if (_T('"') == *start)
+	{
+		start++;
+		while (start[length] && _T('"') != start[length])
+		{
+			length++;
+		}
+	}
+	else
+	{
+		while (start[length] && !_istspace(start[length]))
+		{
+			length++;
+		}
+	}
+
+	launch->application[0] = _T('\0');
+	if (!length || FAILED(StringCchCopyN(module, _countof(module), start, length)))
+	{
+		return;
+	}
+
+	const DWORD found = SearchPath(NULL, module, _T(".exe"), _countof(launch->application), launch->application, NULL);
+	if (!found || found >= _countof(launch->application) ||
+		0 != lstrcmpi(PathFindExtension(launch->application), _T(".exe")) ||
+		!GetFileAttributesEx(launch->application, GetFileExInfoStandard, &attributes))
+	{
+		WRAPPER_DEBUG(_T("The executable '%s' wasn't found ahead of time."), module);
+		launch->application[0] = _T('\0');
+		return;
+	}
+
+	launch->application_time = attributes.ftLastWriteTime;
+	WRAPPER_DEBUG(_T("The executable '%s' is '%s'."), module, launch->application);
+}
+
+//
+// Prepares the launch of the child of an instance once its command line and environment are set.
+// The handles it inherits don't change while the service runs, so their list is only made once.
+//
+static void wrapper_launch_prepare(wrapper_launch_t* launch, const TCHAR* command_line, const TCHAR* environment,
+                                   const TCHAR* working_directory, wrapper_sockets_t* sockets)
+{
+	launch->command_line = command_line;
+	launch->command_line_size = (_tcslen(command_line) + 1) * sizeof(TCHAR);
+	launch->environment = environment;
+	launch->working_directory = *working_directory ? working_directory : NULL;
+	wrapper_launch_resolve(launch);
+
+	if (!launch->handle_count)
+	{
+		const DWORD relay_count = log_writer ? WRAPPER_LAUNCH_RELAY_HANDLES : 0;
+		launch->handle_count = relay_count + wrapper_sockets_get_handles(sockets, launch->handles + relay_count,
+		                                                                 WRAPPER_SOCKETS_MAX);
+
+		wrapper_error_t* error = NULL;
+		if (launch->handle_count &&
+			!wrapper_process_create_handle_list(&launch->handle_list, launch->handles, launch->handle_count, &error))
+		{
+			wrapper_error_log(error);
+			wrapper_error_free(error);
+			WRAPPER_WARNING(_T("The child process inherits all the inheritable handles of the wrapper."));
+		}
+	}
+}
+
+static void wrapper_launch_free(wrapper_launch_t* launch)
+{
+	wrapper_process_free_handle_list(launch->handle_list);
+	launch->handle_list = NULL;
+	launch->handle_count = 0;
+}
+
+//
+// Returns the executable found earlier, after checking that it is still the same file.
+//
+static const TCHAR* wrapper_launch_get_application(wrapper_launch_t* launch)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+
+	if (launch->application[0] &&
+		(!GetFileAttributesEx(launch->application, GetFileExInfoStandard, &attributes) ||
+			CompareFileTime(&attributes.ftLastWriteTime, &launch->application_time)))
+	{
+		WRAPPER_INFO(_T("The executable '%s' changed, so it is looked for again."), launch->application);
+		wrapper_launch_resolve(launch);
+	}
+
+	return launch->application[0] ? launch->application : NULL;
+}
+
+HANDLE wrapper_create_child_process(wrapper_launch_t* launch, wrapper_relay_t* relay, wrapper_job_t* job,
+                                    wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	STARTUPINFOEX startupinfo = {0};
+	PROCESS_INFORMATION process_information = {0};
+
+	if (SUCCEEDED(hr))
+	{
+		memcpy(launch->buffer, launch->command_line, launch->command_line_size);
+
+		startupinfo.StartupInfo.cb = sizeof startupinfo.StartupInfo;
+		startupinfo.StartupInfo.dwFlags |= STARTF_USESTDHANDLES;
+		startupinfo.StartupInfo.hStdOutput = wrapper_relay_get_output(relay);
+		startupinfo.StartupInfo.hStdError = wrapper_relay_get_error(relay);
+
+		if (launch->handle_list)
+		{
+			if (relay)
+			{
+				launch->handles[0] = startupinfo.StartupInfo.hStdOutput;
+				launch->handles[1] = startupinfo.StartupInfo.hStdError;
+			}
+			startupinfo.StartupInfo.cb = sizeof startupinfo;
+			startupinfo.lpAttributeList = launch->handle_list;
+		}
+
+		WRAPPER_INFO(_T("Starting process with command line '%s'"), launch->command_line);
+
+		if (!CreateProcess(wrapper_launch_get_application(launch),
+		                   launch->buffer,
+		                   NULL,
+		                   NULL,
+		                   launch->handle_count > 0,
+		                   (job ? CREATE_SUSPENDED : 0) | (run_in_foreground ? CREATE_NEW_PROCESS_GROUP : 0) |
+		                   (launch->handle_list ? EXTENDED_STARTUPINFO_PRESENT : 0) | WRAPPER_ENVIRONMENT_CREATE_FLAGS,
+		                   (LPVOID)launch->environment,
+		                   launch->working_directory,
+		                   &startupinfo.StartupInfo,
+		                   &process_information)
+		)
+		{
+			DWORD last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to start the process with command line '%s'"),
+				                                   launch->command_line);
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr) && job)
+	{
+		wrapper_error_t* job_error = NULL;
+		if (!wrapper_job_assign(job, process_information.hProcess, &job_error))
+		{
+			wrapper_error_log(job_error);
+			wrapper_error_free(job_error);
+			WRAPPER_WARNING(_T("The processes started by the child process won't be stopped with it."));
+		}
+		ResumeThread(process_information.hThread);
+	}
+
+	// The child has its own copies of the pipes now, if it was started at all
+	wrapper_relay_detach(relay);
+
+	if (process_information.hThread)
+	{
+		CloseHandle(process_information.hThread);
+	}
+
+	return process_information.hProcess;
+}
+
+static int wrapper_service_metrics_handler(const char* path, char* body, size_t size, size_t* length, void* user_data)
+{
+	UNUSED(user_data);
+
+	if (strcmp(path, "/metrics"))
+	{
+		return 404;
+	}
+	return wrapper_metrics_format(body, size, length) ? 200 : 500;
+}
+
+//
+// Builds the environment block of the instance once, so that each restart reuses it. The block
+// tells the child which instance it is, where to send its notifications with Type=notify, and
+// which sockets it inherited.
+//
+static int wrapper_instance_build_environment(wrapper_instance_t* instance, wrapper_error_t** error)
+{
+	wrapper_service_t* service = instance->service;
+	TCHAR extra[1024] = {0};
+	TCHAR value[WRAPPER_SOCKETS_MAX * 24];
+	size_t length = 0;
+	TCHAR* environment = NULL;
+
+	_sntprintf_s(value, _countof(value), _TRUNCATE, _T("%lu"), instance->number);
+	int rc = wrapper_environment_append(extra, _countof(extra), &length, WRAPPER_INSTANCE_VARIABLE, value);
+
+	if (rc && service->notify)
+	{
+		rc = wrapper_environment_append(extra, _countof(extra), &length, WRAPPER_NOTIFY_VARIABLE,
+		                                wrapper_pipe_server_get_path(service->notify));
+	}
+
+	if (rc && wrapper_sockets_get_count(service->sockets))
+	{
+		_sntprintf_s(value, _countof(value), _TRUNCATE, _T("%lu"), wrapper_sockets_get_count(service->sockets));
+		rc = wrapper_environment_append(extra, _countof(extra), &length, WRAPPER_SOCKETS_COUNT_VARIABLE, value) &&
+			wrapper_sockets_format(service->sockets, value, _countof(value)) &&
+			wrapper_environment_append(extra, _countof(extra), &length, WRAPPER_SOCKETS_VARIABLE, value);
+	}
+
+	if (!rc)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INSUFFICIENT_BUFFER,
+			                                   _T("The variables the wrapper sets for instance %lu are too long"),
+			                                   instance->number);
+		}
+		return 0;
+	}
+
+	if (!wrapper_environment_build(&environment, &instance->service->config->environment, extra, error))
+	{
+		return 0;
+	}
+
+	wrapper_environment_free(instance->environment);
+	instance->environment = environment;
+	return 1;
+}
+
+//
+// Releases everything that belonged to the child of an instance once it ended.
+//
+static void wrapper_instance_cleanup(wrapper_instance_t* instance)
+{
+	wrapper_service_t* service = instance->service;
+
+	wrapper_reactor_remove(service->reactor, &instance->exit_source);
+	wrapper_reactor_remove(service->reactor, &instance->health_source);
+	wrapper_reactor_remove(service->reactor, &instance->ready_source);
+	wrapper_reactor_cancel_timer(service->reactor, &instance->stop_timer);
+	wrapper_health_pause(service->health, instance->index);
+	instance->ready = 0;
+
+	if (instance->process)
+	{
+		CloseHandle(instance->process);
+		instance->process = NULL;
+	}
+
+	// Whatever the child left behind is terminated along with the job, which also breaks the
+	// pipes those processes may have inherited.
+	wrapper_sampler_set_job(service->sampler, instance->index, NULL);
+	wrapper_job_free(instance->job);
+	instance->job = NULL;
+
+	wrapper_relay_free(instance->relay);
+	instance->relay = NULL;
+}
+
+//
+// Terminates the standby of an instance, if it has one. The standby doesn't serve anything yet, so
+// it isn't asked to stop first, and the wrapper doesn't wait for it to go away: whatever is left of
+// it goes with its job.
+//
+static void wrapper_instance_drop_standby(wrapper_instance_t* instance)
+{
+	wrapper_service_t* service = instance->service;
+
+	wrapper_reactor_remove(service->reactor, &instance->standby_source);
+	wrapper_reactor_remove(service->reactor, &instance->standby_ready_source);
+	wrapper_reactor_cancel_timer(service->reactor, &instance->standby_timer);
+	instance->standby_ready = 0;
+
+	if (instance->standby)
+	{
+		TerminateProcess(instance->standby, WRAPPER_STOP_EXIT_CODE);
+		CloseHandle(instance->standby);
+		instance->standby = NULL;
+	}
+
+	wrapper_job_free(instance->standby_job);
+	instance->standby_job = NULL;
+
+	wrapper_relay_free(instance->standby_relay);
+	instance->standby_relay = NULL;
+}
+
+//
+// Makes the service stop with the error, unless it already has one.
+//
+static void wrapper_service_fail(wrapper_service_t* service, wrapper_error_t* error)
+{
+	wrapper_error_log(error);
+	if (service->error && !*service->error)
+	{
+		*service->error = error;
+	}
+	else
+	{
+		wrapper_error_free(error);
+	}
+}
+
+static void wrapper_instance_on_exit(void* user_data);
+static void wrapper_instance_on_unhealthy(void* user_data);
+static void wrapper_instance_start_standby(wrapper_instance_t* instance);
+static void wrapper_service_on_restart_next(void* user_data);
+
+//
+// Lets the next instance that waits to be restarted have its turn, once the instance that was
+// restarted before it is ready again or was given up on. It has its turn from the reactor, rather
+// than from within the start of the instance before it.
+//
+static void wrapper_service_roll_on(wrapper_service_t* service, wrapper_instance_t* instance)
+{
+	if (service->rolling != instance)
+	{
+		return;
+	}
+
+	service->rolling = NULL;
+	wrapper_reactor_set_timer(service->reactor, &service->rolling_timer, 0, wrapper_service_on_restart_next, service);
+}
+
+static void wrapper_service_on_hooks_progress(void* user_data)
+{
+	wrapper_service_t* service = user_data;
+	wrapper_service_report_status(service->hook_status, NO_ERROR, 2 * WRAPPER_START_CHECKPOINT_INTERVAL, service->config,
+	                              NULL);
+}
+
+//
+// Runs the hooks of a stage on the reactor with the environment and working directory of the
+// child, keeps the service manager waiting in the given state while they do, and calls done once
+// they ended. Without hooks for the stage, done is called right away.
+//
+static int wrapper_service_run_hooks(wrapper_service_t* service, wrapper_hook_stage_t stage, DWORD status,
+                                     wrapper_hooks_done_t done, wrapper_error_t** error)
+{
+	wrapper_config_t* config = service->config;
+	TCHAR* environment = NULL;
+
+	if (0 == config->hooks.count[stage])
+	{
+		done(service, NULL);
+		return 1;
+	}
+
+	if (!wrapper_environment_build(&environment, &config->environment, EMPTY_STRING, error))
+	{
+		return 0;
+	}
+
+	service->hook_status = status;
+	return wrapper_hooks_start(&service->hooks, service->reactor, &config->hooks, stage, environment,
+	                           *config->working_directory ? config->working_directory : NULL, log_writer,
+	                           wrapper_service_on_hooks_progress, done, service, error);
+}
+
+static void wrapper_service_on_start_post_done(void* user_data, wrapper_error_t* error)
+{
+	wrapper_service_t* service = user_data;
+
+	wrapper_hooks_free(service->hooks);
+	service->hooks = NULL;
+
+	if (error)
+	{
+		wrapper_service_fail(service, error);
+		wrapper_reactor_stop(service->reactor);
+		return;
+	}
+
+	if (!service->stopping)
+	{
+		wrapper_service_report_status(SERVICE_RUNNING, NO_ERROR, 0, service->config, service->error);
+	}
+}
+
+//
+// Reports the service as running once the child of every instance is ready and the ExecStartPost
+// hooks succeeded. The instances that are restarted afterwards don't take the service back to start
+// pending.
+//
+static void wrapper_service_check_ready(wrapper_service_t* service)
+{
+	if (service->running)
+	{
+		return;
+	}
+
+	for (DWORD i = 0; i < service->config->instances; i++)
+	{
+		if (!service->instances[i].ready)
+		{
+			return;
+		}
+	}
+
+	service->running = 1;
+	wrapper_reactor_cancel_timer(service->reactor, &service->start_timer);
+	WRAPPER_INFO(_T("All instances are ready after %llu ms."), GetTickCount64() - service->start_time);
+
+	wrapper_error_t* error = NULL;
+	if (!wrapper_service_run_hooks(service, WRAPPER_HOOK_START_POST, SERVICE_START_PENDING,
+	                               wrapper_service_on_start_post_done, &error))
+	{
+		wrapper_service_fail(service, error);
+		wrapper_reactor_stop(service->reactor);
+	}
+}
+
+//
+// Keeps the service manager waiting while the instances get ready, until the start timeout.
+//
+static void wrapper_service_on_start_timer(void* user_data)
+{
+	wrapper_service_t* service = user_data;
+	wrapper_config_t* config = service->config;
+
+	const ULONGLONG elapsed = GetTickCount64() - service->start_time;
+	if (config->start_timeout && elapsed >= config->start_timeout)
+	{
+		wrapper_service_fail(service, wrapper_error_from_system(ERROR_SERVICE_REQUEST_TIMEOUT,
+		                                                        _T("The child process wasn't ready within %lu ms"),
+		                                                        config->start_timeout));
+		wrapper_reactor_stop(service->reactor);
+		return;
+	}
+
+	wrapper_service_report_status(SERVICE_START_PENDING, NO_ERROR, 2 * WRAPPER_START_CHECKPOINT_INTERVAL, config,
+	                              NULL);
+	wrapper_reactor_set_timer(service->reactor, &service->start_timer, WRAPPER_START_CHECKPOINT_INTERVAL,
+	                          wrapper_service_on_start_timer, service);
+}
+
+static void wrapper_instance_set_ready(wrapper_instance_t* instance)
+{
+	if (instance->ready || WRAPPER_INSTANCE_RUNNING != instance->state)
+	{
+		return;
+	}
+
+	wrapper_reactor_remove(instance->service->reactor, &instance->ready_source);
+	instance->ready = 1;
+	WRAPPER_INFO(_T("Instance %lu of the child process is ready."), instance->number);
+	wrapper_service_roll_on(instance->service, instance);
+	wrapper_service_check_ready(instance->service);
+}
+
+static void wrapper_instance_on_ready(void* user_data)
+{
+	wrapper_instance_set_ready(user_data);
+}
+
+//
+// Waits for the child of an instance to be ready. A standby that was promoted was ready before it
+// took over, and with Type=notify, the child says so itself through the notification pipe.
+//
+static int wrapper_instance_watch_ready(wrapper_instance_t* instance, int promoted, wrapper_error_t** error)
+{
+	wrapper_service_t* service = instance->service;
+	HANDLE event = NULL;
+
+	switch (promoted ? WRAPPER_SERVICE_TYPE_SIMPLE : service->config->type)
+	{
+	case WRAPPER_SERVICE_TYPE_NOTIFY:
+		return 1;
+
+	case WRAPPER_SERVICE_TYPE_HEALTH:
+		event = wrapper_health_get_ready_event(service->health, instance->index);
+		break;
+
+	case WRAPPER_SERVICE_TYPE_LOG:
+		event = wrapper_relay_get_ready_event(instance->relay);
+		break;
+
+	default:
+		break;
+	}
+
+	if (!event)
+	{
+		wrapper_instance_set_ready(instance);
+		return 1;
+	}
+	return wrapper_reactor_add_handle(service->reactor, event, wrapper_instance_on_ready, instance,
+	                                  &instance->ready_source, error);
+}
+
+//
+// Starts to probe the health of the child of an instance, if there are health checks.
+//
+static int wrapper_instance_watch_health(wrapper_instance_t* instance, wrapper_error_t** error)
+{
+	wrapper_service_t* service = instance->service;
+	if (!service->health)
+	{
+		return 1;
+	}
+
+	wrapper_health_start(service->health, instance->index);
+	return wrapper_reactor_add_handle(service->reactor, wrapper_health_get_event(service->health, instance->index),
+	                                  wrapper_instance_on_unhealthy, instance, &instance->health_source, error);
+}
+
+//
+// Starts a child for the instance, with its own output relay and job object. Both the active child
+// and the standby are started this way.
+//
+static int wrapper_instance_spawn(wrapper_instance_t* instance, HANDLE* process, wrapper_relay_t** relay,
+                                  wrapper_job_t** job, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	wrapper_config_t* config = instance->service->config;
+
+	if (SUCCEEDED(hr) && log_writer)
+	{
+		// Only tag the output with the number of the instance when there is more than one
+		TCHAR tag[16];
+		_sntprintf_s(tag, _countof(tag), _TRUNCATE, _T("%lu"), instance->number);
+		const char* ready_pattern = WRAPPER_SERVICE_TYPE_LOG == config->type ? instance->service->ready_pattern : NULL;
+		if (!wrapper_relay_create(relay, log_writer, config->instances > 1 ? tag : NULL, ready_pattern, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		wrapper_error_t* job_error = NULL;
+		if (!wrapper_job_create(job, &config->limits, &job_error))
+		{
+			wrapper_error_log(job_error);
+			if (wrapper_job_has_limits(&config->limits))
+			{
+				// Running the child without the limits that were asked for is worse than not running it
+				if (error)
+				{
+					*error = job_error;
+					job_error = NULL;
+				}
+				hr = E_FAIL;
+			}
+			else
+			{
+				WRAPPER_WARNING(_T("The processes started by the child process won't be stopped with it."));
+			}
+			wrapper_error_free(job_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		// The child inherits the listening sockets, so that connections queue while it restarts
+		*process = wrapper_create_child_process(&instance->launch, *relay, *job, error);
+		if (!*process)
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (FAILED(hr))
+	{
+		wrapper_job_free(*job);
+		*job = NULL;
+		wrapper_relay_free(*relay);
+		*relay = NULL;
+	}
+
+	return SUCCEEDED(hr);
+}
+
+//
+// Takes over the standby as the child of the instance. It was started with the same command line
+// and environment, so it only needs to be supervised like any other child.
+//
+static void wrapper_instance_promote(wrapper_instance_t* instance)
+{
+	wrapper_service_t* service = instance->service;
+
+	wrapper_reactor_remove(service->reactor, &instance->standby_source);
+	wrapper_reactor_remove(service->reactor, &instance->standby_ready_source);
+	wrapper_reactor_cancel_timer(service->reactor, &instance->standby_timer);
+
+	instance->process = instance->standby;
+	instance->relay = instance->standby_relay;
+	instance->job = instance->standby_job;
+	instance->standby = NULL;
+	instance->standby_relay = NULL;
+	instance->standby_job = NULL;
+	instance->standby_ready = 0;
+
+	WRAPPER_INFO(_T("Promoted the standby of instance %lu, process ID %lu."), instance->number,
+	             GetProcessId(instance->process));
+}
+
+static int wrapper_instance_start(wrapper_instance_t* instance, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	wrapper_service_t* service = instance->service;
+	const int promoted = instance->standby_ready;
+
+	if (promoted)
+	{
+		wrapper_instance_promote(instance);
+	}
+	else if (wrapper_instance_spawn(instance, &instance->process, &instance->relay, &instance->job, error))
+	{
+		DWORD pid = GetProcessId(instance->process);
+		// TODO: Display more information that could help the user diagnose when there is a failure to execute the process
+		WRAPPER_INFO(_T("Successfully started instance %lu with command line '%s'"), instance->number,
+		             instance->command_line);
+		WRAPPER_INFO(_T("  Process ID: %d (0x%08x)"), pid, pid);
+	}
+	else
+	{
+		hr = E_FAIL;
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		instance->state = WRAPPER_INSTANCE_RUNNING;
+		wrapper_restart_started(&instance->restart_state, GetTickCount64());
+		wrapper_metric_set(WRAPPER_METRIC_CHILD_START_TIME, wrapper_metric_now());
+		wrapper_metric_add(WRAPPER_METRIC_INSTANCES_RUNNING, 1);
+		wrapper_sampler_set_job(service->sampler, instance->index, instance->job);
+
+		if (!wrapper_reactor_add_handle(service->reactor, instance->process, wrapper_instance_on_exit, instance,
+		                                &instance->exit_source, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!wrapper_instance_watch_health(instance, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!wrapper_instance_watch_ready(instance, promoted, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (FAILED(hr) && instance->process)
+	{
+		// The child can't be supervised, so it can't be left running either
+		TerminateProcess(instance->process, WRAPPER_STOP_EXIT_CODE);
+		wrapper_metric_add(WRAPPER_METRIC_INSTANCES_RUNNING, -1);
+		instance->state = WRAPPER_INSTANCE_STOPPED;
+	}
+
+	if (FAILED(hr))
+	{
+		wrapper_instance_cleanup(instance);
+	}
+	else
+	{
+		wrapper_instance_start_standby(instance);
+	}
+
+	return SUCCEEDED(hr);
+}
+
+static void wrapper_instance_on_restart(void* user_data)
+{
+	wrapper_instance_t* instance = user_data;
+	wrapper_service_t* service = instance->service;
+	wrapper_error_t* error = NULL;
+
+	if (!wrapper_instance_start(instance, &error))
+	{
+		wrapper_service_fail(service, error);
+		wrapper_reactor_stop(service->reactor);
+	}
+}
+
+static void wrapper_instance_on_standby_ready(void* user_data)
+{
+	wrapper_instance_t* instance = user_data;
+
+	if (!instance->standby || instance->standby_ready)
+	{
+		return;
+	}
+
+	wrapper_reactor_remove(instance->service->reactor, &instance->standby_ready_source);
+	instance->standby_ready = 1;
+	WRAPPER_INFO(_T("The standby of instance %lu is ready."), instance->number);
+}
+
+static void wrapper_instance_on_standby_restart(void* user_data)
+{
+	wrapper_instance_start_standby(user_data);
+}
+
+//
+// A standby that ends on its own is started again after a delay that grows each time it ends soon
+// after it started, so that a standby that can't start doesn't keep the wrapper busy.
+//
+static void wrapper_instance_on_standby_exit(void* user_data)
+{
+	wrapper_instance_t* instance = user_data;
+	wrapper_service_t* service = instance->service;
+	wrapper_restart_policy_t policy = service->config->restart;
+	DWORD exit_code = 0;
+	unsigned long delay = 0;
+
+	GetExitCodeProcess(instance->standby, &exit_code);
+	WRAPPER_WARNING(_T("The standby of instance %lu has ended with exit code %lu (0x%08x)."), instance->number,
+	                exit_code, exit_code);
+
+	// The standby backs off like the child does, but it is never given up on, and it always waits
+	// a while, however the restart policy of the child is set
+	policy.mode = WRAPPER_RESTART_ALWAYS;
+	policy.limit_count = 0;
+	policy.delay = max(policy.delay, WRAPPER_STANDBY_RESTART_MIN_DELAY);
+	policy.max_delay = max(policy.max_delay ? policy.max_delay : WRAPPER_RESTART_MAX_DELAY_DEFAULT, policy.delay);
+	wrapper_restart_next(&policy, &instance->standby_restart_state, GetTickCount64(), exit_code, &delay);
+	delay = max(delay, WRAPPER_STANDBY_RESTART_MIN_DELAY);
+
+	WRAPPER_INFO(_T("Starting the standby of instance %lu again in %lu ms."), instance->number, delay);
+	wrapper_instance_drop_standby(instance);
+	wrapper_reactor_set_timer(service->reactor, &instance->standby_timer, delay, wrapper_instance_on_standby_restart,
+	                          instance);
+}
+
+//
+// Starts a standby for an instance that runs, when Standby is set and it doesn't have one yet. The
+// standby is ready to be promoted once it ran for the warm-up time, or, with Type=notify or
+// Type=log, once it said it is ready. Failing to start it only costs the time it would have saved,
+// so it is logged and the instance runs without it.
+//
+static void wrapper_instance_start_standby(wrapper_instance_t* instance)
+{
+	wrapper_service_t* service = instance->service;
+	wrapper_config_t* config = service->config;
+	wrapper_error_t* error = NULL;
+
+	if (!config->standby || instance->standby || WRAPPER_INSTANCE_RUNNING != instance->state)
+	{
+		return;
+	}
+
+	if (!wrapper_instance_spawn(instance, &instance->standby, &instance->standby_relay, &instance->standby_job,
+	                            &error) ||
+		!wrapper_reactor_add_handle(service->reactor, instance->standby, wrapper_instance_on_standby_exit, instance,
+		                            &instance->standby_source, &error))
+	{
+		wrapper_error_log(error);
+		wrapper_error_free(error);
+		WRAPPER_WARNING(_T("Instance %lu runs without a standby."), instance->number);
+		wrapper_instance_drop_standby(instance);
+		return;
+	}
+
+	wrapper_restart_started(&instance->standby_restart_state, GetTickCount64());
+	WRAPPER_INFO(_T("Started a standby for instance %lu, process ID %lu."), instance->number,
+	             GetProcessId(instance->standby));
+
+	if (WRAPPER_SERVICE_TYPE_NOTIFY == config->type)
+	{
+		return;
+	}
+
+	HANDLE event = wrapper_relay_get_ready_event(instance->standby_relay);
+	if (event && wrapper_reactor_add_handle(service->reactor, event, wrapper_instance_on_standby_ready, instance,
+	                                        &instance->standby_ready_source, NULL))
+	{
+		return;
+	}
+
+	// The health checks only probe the active child, so they can't tell whether the standby is ready
+	wrapper_reactor_set_timer(service->reactor, &instance->standby_timer, config->standby_warmup,
+	                          wrapper_instance_on_standby_ready, instance);
+}
+
+//
+// Deals with a notification of a child, or of a process the child started. The message holds one
+// or more lines of the form 'KEY=VALUE', of which 'READY=1' and 'STATUS=' are understood.
+//
+static DWORD wrapper_service_on_notify(void* user_data, DWORD process_id, const char* message, DWORD length,
+                                       char* reply, DWORD reply_size)
+{
+	wrapper_service_t* service = user_data;
+	UNUSED(reply);
+	UNUSED(reply_size);
+	wrapper_instance_t* instance = NULL;
+	int standby = 0;
+
+	HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, process_id);
+	for (DWORD i = 0; !instance && i < service->config->instances; i++)
+	{
+		wrapper_instance_t* candidate = &service->instances[i];
+		if ((candidate->process && GetProcessId(candidate->process) == process_id) ||
+			(process && wrapper_job_contains(candidate->job, process)))
+		{
+			instance = candidate;
+		}
+		else if ((candidate->standby && GetProcessId(candidate->standby) == process_id) ||
+			(process && wrapper_job_contains(candidate->standby_job, process)))
+		{
+			instance = candidate;
+			standby = 1;
+		}
+	}
+
+	if (process)
+	{
+		CloseHandle(process);
+	}
+
+	if (!instance)
+	{
+		WRAPPER_DEBUG(_T("Ignored a notification of process %lu, which isn't a child process."), process_id);
+		return 0;
+	}
+
+	const char* end = message + length;
+	for (const char* line = message; line < end;)
+	{
+		const char* line_end = memchr(line, '\n', end - line);
+		if (!line_end)
+		{
+			line_end = end;
+		}
+
+		const int line_length = (int)(line_end - line);
+		if (7 == line_length && 0 == memcmp(line, "READY=1", 7))
+		{
+			if (standby)
+			{
+				wrapper_instance_on_standby_ready(instance);
+			}
+			else
+			{
+				wrapper_instance_set_ready(instance);
+			}
+		}
+		else if (line_length > 7 && 0 == memcmp(line, "STATUS=", 7))
+		{
+			WRAPPER_INFO(_T("Instance %lu%s: %.*hs"), instance->number, standby ? _T(" (standby)") : EMPTY_STRING,
+			             line_length - 7, line + 7);
+		}
+		line = line_end + 1;
+	}
+
+	return 0;
+}
+
+//
+// Deals with the child of an instance that ended. Unless the service is stopping, the restart
+// policy decides whether the instance is started again, and if so, when. Returns 0 when the policy
+// gave up on the instance. A child that was stopped keeps its standby, so that an instance that is
+// restarted on request promotes it when it starts; stopping the service or pausing it drops the
+// standbys first, and so does a change to the command line.
+//
+static int wrapper_instance_ended(wrapper_instance_t* instance, int unhealthy, int stopping, wrapper_error_t** error)
+{
+	wrapper_service_t* service = instance->service;
+	wrapper_config_t* config = service->config;
+	DWORD exit_code = 0;
+	unsigned long delay = 0;
+
+	GetExitCodeProcess(instance->process, &exit_code);
+	WRAPPER_INFO(_T("Instance %lu of the child process has ended with exit code %lu (0x%08x)."), instance->number,
+	             exit_code, exit_code);
+
+	wrapper_metric_set(WRAPPER_METRIC_LAST_EXIT_CODE, exit_code);
+	wrapper_metric_add(WRAPPER_METRIC_INSTANCES_RUNNING, -1);
+	if (0 == wrapper_metric_get(WRAPPER_METRIC_INSTANCES_RUNNING))
+	{
+		wrapper_metric_set(WRAPPER_METRIC_CHILD_START_TIME, 0);
+	}
+
+	wrapper_instance_cleanup(instance);
+	instance->state = WRAPPER_INSTANCE_STOPPED;
+
+	if (stopping)
+	{
+		return 1;
+	}
+
+	// A child that was stopped for being unhealthy may well have ended cleanly, but it failed
+	if (unhealthy && 0 == exit_code)
+	{
+		exit_code = WRAPPER_STOP_EXIT_CODE;
+	}
+
+	switch (wrapper_restart_next(&config->restart, &instance->restart_state, GetTickCount64(), exit_code, &delay))
+	{
+	case WRAPPER_RESTART_DECISION_RESTART:
+		wrapper_metric_add(WRAPPER_METRIC_RESTARTS, 1);
+		if (instance->standby_ready)
+		{
+			// The standby is already up, so there is nothing to wait for
+			WRAPPER_INFO(_T("Restarting instance %lu of the child process with its standby (restart %lu, policy '%hs')."),
+			             instance->number, instance->restart_state.restarts,
+			             wrapper_restart_mode_str(config->restart.mode));
+			instance->state = WRAPPER_INSTANCE_RESTARTING;
+			wrapper_instance_on_restart(instance);
+			return 1;
+		}
+
+		WRAPPER_INFO(_T("Restarting instance %lu of the child process in %lu ms (restart %lu, policy '%hs')."),
+		             instance->number, delay, instance->restart_state.restarts,
+		             wrapper_restart_mode_str(config->restart.mode));
+		instance->state = WRAPPER_INSTANCE_RESTARTING;
+		wrapper_reactor_set_timer(service->reactor, &instance->restart_timer, delay, wrapper_instance_on_restart,
+		                          instance);
+		return 1;
+
+	case WRAPPER_RESTART_DECISION_GIVE_UP:
+		wrapper_instance_drop_standby(instance);
+		wrapper_service_roll_on(service, instance);
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_PROCESS_ABORTED,
+			                                   _T("Instance %lu of the child process was restarted %lu times within %lu ms. Giving up."),
+			                                   instance->number, config->restart.limit_count, config->restart.limit_interval);
+		}
+		return 0;
+
+	default:
+		wrapper_instance_drop_standby(instance);
+		return 1;
+	}
+}
+
+static int wrapper_instances_stopped(wrapper_service_t* service)
+{
+	for (DWORD i = 0; i < service->config->instances; i++)
+	{
+		if (WRAPPER_INSTANCE_STOPPED != service->instances[i].state)
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+//
+// Stops the reactor once no instance is running, stopping or waiting to be restarted any more. The
+// instances of a paused service wait for it to continue instead.
+//
+static void wrapper_service_check_done(wrapper_service_t* service)
+{
+	if ((!service->paused || service->stopping) && wrapper_instances_stopped(service))
+	{
+		wrapper_reactor_stop(service->reactor);
+	}
+}
+
+static void wrapper_instance_on_kill_timeout(void* user_data)
+{
+	wrapper_instance_t* instance = user_data;
+	wrapper_service_t* service = instance->service;
+
+	// Processes that won't go away can't be left behind, so the service stops, and whatever is left
+	// of them goes with their job
+	wrapper_service_fail(service, wrapper_error_from_system(ERROR_TIMEOUT,
+	                                                        _T("Instance %lu of the child process didn't end within %lu ms after it was terminated"),
+	                                                        instance->number, service->config->kill_timeout));
+	wrapper_instance_ended(instance, 0, 1, NULL);
+	wrapper_reactor_stop(service->reactor);
+}
+
+//
+// Terminates the child of an instance that is stopping and all of its descendants, and gives them
+// KillTimeout milliseconds to go away.
+//
+static void wrapper_instance_terminate(wrapper_instance_t* instance)
+{
+	wrapper_service_t* service = instance->service;
+	const DWORD pid = GetProcessId(instance->process);
+	DWORD terminated_count = 0;
+	wrapper_error_t* error = NULL;
+
+	WRAPPER_WARNING(_T("Terminating the child process %lu and its descendants."), pid);
+	const int terminated = instance->job
+		                       ? wrapper_job_terminate(instance->job, WRAPPER_STOP_EXIT_CODE, &terminated_count, &error)
+		                       : wrapper_process_terminate_tree(instance->process, WRAPPER_STOP_EXIT_CODE, &terminated_count,
+		                                                        &error);
+	if (terminated)
+	{
+		WRAPPER_INFO(_T("Terminated %lu processes."), terminated_count);
+	}
+	else
+	{
+		wrapper_error_log(error);
+		wrapper_error_free(error);
+		TerminateProcess(instance->process, WRAPPER_STOP_EXIT_CODE);
+	}
+
+	wrapper_reactor_set_timer(service->reactor, &instance->stop_timer, service->config->kill_timeout,
+	                          wrapper_instance_on_kill_timeout, instance);
+}
+
+static void wrapper_instance_on_stop_timeout(void* user_data)
+{
+	wrapper_instance_t* instance = user_data;
+
+	WRAPPER_WARNING(_T("Instance %lu of the child process didn't end within %lu ms."), instance->number,
+	                instance->service->config->stop_timeout);
+	wrapper_instance_terminate(instance);
+}
+
+//
+// Stops the child of an instance that runs in phases, driven by the reactor, so that the other
+// instances are looked after in the meantime. The child is asked to stop with a CTRL+C signal, or
+// CTRL+BREAK in the foreground, since CTRL+C can't be sent to a single process group, and has
+// StopTimeout milliseconds to end. After that, the child and all of its descendants are terminated,
+// so that a hung child can't keep the service in SERVICE_STOP_PENDING forever. The stop is over
+// when the child ends, see wrapper_instance_stopped.
+//
+static void wrapper_instance_stop(wrapper_instance_t* instance, int unhealthy)
+{
+	wrapper_service_t* service = instance->service;
+	const DWORD pid = GetProcessId(instance->process);
+	const DWORD signal = run_in_foreground ? CTRL_BREAK_EVENT : CTRL_C_EVENT;
+	const TCHAR* signal_name = run_in_foreground ? _T("CTRL+BREAK") : _T("CTRL+C");
+
+	if (WRAPPER_INSTANCE_RUNNING != instance->state)
+	{
+		return;
+	}
+
+	instance->state = WRAPPER_INSTANCE_STOPPING;
+	instance->stop_unhealthy = unhealthy;
+	instance->stop_time = GetTickCount64();
+	wrapper_reactor_remove(service->reactor, &instance->health_source);
+	wrapper_reactor_remove(service->reactor, &instance->ready_source);
+	wrapper_health_pause(service->health, instance->index);
+
+	WRAPPER_INFO(_T("Sending a %s signal to the child process %lu (instance %lu)."), signal_name, pid,
+	             instance->number);
+	if (!SendConsoleCtrlEvent(pid, signal))
+	{
+		WRAPPER_WARNING(_T("Failed to send a %s signal to the child process %lu."), signal_name, pid);
+		wrapper_instance_terminate(instance);
+		return;
+	}
+
+	WRAPPER_INFO(_T("Waiting up to %lu ms for the child process %lu to end."), service->config->stop_timeout, pid);
+	wrapper_reactor_set_timer(service->reactor, &instance->stop_timer, service->config->stop_timeout,
+	                          wrapper_instance_on_stop_timeout, instance);
+}
+
+//
+// Deals with the child of an instance that ended after it was asked to stop. A child that was
+// stopped for being unhealthy failed, and the restart policy decides what happens next; any other
+// child is started again when it was only stopped to restart it.
+//
+static void wrapper_instance_stopped(wrapper_instance_t* instance)
+{
+	wrapper_service_t* service = instance->service;
+	wrapper_error_t* error = NULL;
+	const ULONGLONG duration = GetTickCount64() - instance->stop_time;
+	const int stays = service->stopping || service->paused;
+
+	WRAPPER_INFO(_T("Instance %lu of the child process ended %llu ms after it was asked to stop."), instance->number,
+	             duration);
+	wrapper_metric_set(WRAPPER_METRIC_STOP_DURATION, (LONG64)duration);
+
+	if (instance->stop_unhealthy && !stays)
+	{
+		if (!wrapper_instance_ended(instance, 1, 0, &error))
+		{
+			wrapper_service_fail(service, error);
+		}
+	}
+	else
+	{
+		wrapper_instance_ended(instance, 0, 1, NULL);
+		if (!stays && !wrapper_instance_start(instance, &error))
+		{
+			wrapper_service_fail(service, error);
+			wrapper_reactor_stop(service->reactor);
+			return;
+		}
+	}
+	wrapper_service_check_done(service);
+}
+
+static void wrapper_instance_on_exit(void* user_data)
+{
+	wrapper_instance_t* instance = user_data;
+	wrapper_service_t* service = instance->service;
+	wrapper_error_t* error = NULL;
+
+	if (WRAPPER_INSTANCE_STOPPING == instance->state)
+	{
+		wrapper_instance_stopped(instance);
+		return;
+	}
+
+	if (!wrapper_instance_ended(instance, 0, 0, &error))
+	{
+		// The other instances keep running; the service stops with this error once they're done
+		wrapper_service_fail(service, error);
+	}
+	wrapper_service_check_done(service);
+}
+
+static void wrapper_instance_on_unhealthy(void* user_data)
+{
+	wrapper_instance_t* instance = user_data;
+
+	WRAPPER_WARNING(_T("Stopping instance %lu of the child process because it is unhealthy."), instance->number);
+	wrapper_instance_stop(instance, 1);
+}
+
+//
+// Stops the instances that are still running, e.g. when the service is asked to stop, and keeps
+// those that wait to be restarted from starting. Returns the number of instances that are still
+// stopping.
+//
+static DWORD wrapper_instances_stop(wrapper_service_t* service)
+{
+	DWORD stopping = 0;
+
+	service->rolling = NULL;
+	wrapper_reactor_cancel_timer(service->reactor, &service->rolling_timer);
+
+	for (DWORD i = 0; i < service->config->instances; i++)
+	{
+		wrapper_instance_t* instance = &service->instances[i];
+		wrapper_reactor_cancel_timer(service->reactor, &instance->restart_timer);
+		wrapper_instance_drop_standby(instance);
+		instance->restart_pending = 0;
+		if (WRAPPER_INSTANCE_RESTARTING == instance->state)
+		{
+			instance->state = WRAPPER_INSTANCE_STOPPED;
+		}
+
+		wrapper_instance_stop(instance, 0);
+		if (WRAPPER_INSTANCE_STOPPING == instance->state)
+		{
+			stopping++;
+		}
+	}
+	return stopping;
+}
+
+//
+// The service manager expects the checkpoint to advance while the service is stopping, so the
+// status is reported at least once a second until the instances stopped.
+//
+static void wrapper_service_on_stop_timer(void* user_data)
+{
+	wrapper_service_t* service = user_data;
+
+	wrapper_service_report_status(SERVICE_STOP_PENDING, NO_ERROR, 2 * WRAPPER_STOP_CHECKPOINT_INTERVAL, service->config,
+	                              NULL);
+	wrapper_reactor_set_timer(service->reactor, &service->stop_timer, WRAPPER_STOP_CHECKPOINT_INTERVAL,
+	                          wrapper_service_on_stop_timer, service);
+}
+
+//
+// Asks the instances to stop. The reactor keeps running until they did, see
+// wrapper_service_check_done.
+//
+static void wrapper_service_stop_children(wrapper_service_t* service)
+{
+	wrapper_config_t* config = service->config;
+
+	if (service->stopping)
+	{
+		return;
+	}
+
+	service->stopping = 1;
+	wrapper_reactor_cancel_timer(service->reactor, &service->start_timer);
+	wrapper_service_report_status(SERVICE_STOP_PENDING, NO_ERROR, config->stop_timeout + config->kill_timeout, config,
+	                              NULL);
+	if (wrapper_instances_stop(service))
+	{
+		wrapper_reactor_set_timer(service->reactor, &service->stop_timer, WRAPPER_STOP_CHECKPOINT_INTERVAL,
+		                          wrapper_service_on_stop_timer, service);
+	}
+	wrapper_service_check_done(service);
+}
+
+static void wrapper_service_on_stop(void* user_data)
+{
+	WRAPPER_INFO(_T("A request was received to stop the service."));
+	wrapper_service_stop_children(user_data);
+}
+
+//
+// Starts the instances once the ExecStartPre hooks succeeded, and keeps the service manager waiting
+// until they are ready.
+//
+static void wrapper_service_on_start_pre_done(void* user_data, wrapper_error_t* error)
+{
+	wrapper_service_t* service = user_data;
+	wrapper_config_t* config = service->config;
+
+	wrapper_hooks_free(service->hooks);
+	service->hooks = NULL;
+
+	if (error)
+	{
+		wrapper_service_fail(service, error);
+		wrapper_reactor_stop(service->reactor);
+		return;
+	}
+
+	if (service->stopping)
+	{
+		return;
+	}
+
+	for (DWORD i = 0; i < config->instances; i++)
+	{
+		if (!wrapper_instance_start(&service->instances[i], &error))
+		{
+			wrapper_service_fail(service, error);
+			wrapper_reactor_stop(service->reactor);
+			return;
+		}
+	}
+
+	if (!service->running)
+	{
+		WRAPPER_INFO(_T("Waiting for the child process to be ready (type '%hs')."), wrapper_service_type_str(config->type));
+		wrapper_reactor_set_timer(service->reactor, &service->start_timer, WRAPPER_START_CHECKPOINT_INTERVAL,
+		                          wrapper_service_on_start_timer, service);
+	}
+}
+
+static void wrapper_service_on_stop_post_done(void* user_data, wrapper_error_t* error)
+{
+	wrapper_service_t* service = user_data;
+
+	wrapper_hooks_free(service->hooks);
+	service->hooks = NULL;
+
+	if (error)
+	{
+		wrapper_error_log(error);
+		wrapper_error_free(error);
+	}
+	wrapper_reactor_stop(service->reactor);
+}
+
+//
+// Samples the resource use of the instances with the current settings, if it is sampled at all.
+//
+static void wrapper_service_start_sampler(wrapper_service_t* service)
+{
+	wrapper_config_t* config = service->config;
+
+	wrapper_sampler_free(service->sampler);
+	service->sampler = NULL;
+
+	if (config->sample_interval)
+	{
+		wrapper_error_t* sampler_error = NULL;
+		if (!wrapper_sampler_create(&service->sampler, config, &sampler_error))
+		{
+			wrapper_error_log(sampler_error);
+			wrapper_error_free(sampler_error);
+			WRAPPER_WARNING(_T("The resource use of the child process won't be sampled."));
+			return;
+		}
+	}
+
+	for (DWORD i = 0; i < config->instances; i++)
+	{
+		wrapper_sampler_set_job(service->sampler, i, service->instances[i].job);
+	}
+}
+
+//
+// Probes the health of the instances with the current settings, if there are health checks.
+//
+static int wrapper_service_start_health(wrapper_service_t* service, wrapper_error_t** error)
+{
+	wrapper_config_t* config = service->config;
+	const int ready_on_health = WRAPPER_SERVICE_TYPE_HEALTH == config->type;
+
+	// With Type=health, the instances that aren't ready yet wait for the checks that are replaced
+	for (DWORD i = 0; i < config->instances; i++)
+	{
+		wrapper_reactor_remove(service->reactor, &service->instances[i].health_source);
+		if (ready_on_health)
+		{
+			wrapper_reactor_remove(service->reactor, &service->instances[i].ready_source);
+		}
+	}
+	wrapper_health_free(service->health);
+	service->health = NULL;
+
+	if (WRAPPER_HEALTH_NONE == config->health.type)
+	{
+		return 1;
+	}
+
+	if (!wrapper_health_create(&service->health, &config->health, config->instances, config->sample_log_interval,
+	                           error))
+	{
+		return 0;
+	}
+
+	for (DWORD i = 0; i < config->instances; i++)
+	{
+		wrapper_instance_t* instance = &service->instances[i];
+		if (WRAPPER_INSTANCE_RUNNING != instance->state)
+		{
+			continue;
+		}
+
+		if (!wrapper_instance_watch_health(instance, error) ||
+			(ready_on_health && !instance->ready && !wrapper_instance_watch_ready(instance, 0, error)))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+//
+// Serves the metrics on the current address and port, if they are served at all.
+//
+static void wrapper_service_start_metrics(wrapper_service_t* service)
+{
+	wrapper_config_t* config = service->config;
+
+	wrapper_http_server_free(service->metrics_server);
+	service->metrics_server = NULL;
+
+	if (config->metrics_port)
+	{
+		wrapper_error_t* metrics_error = NULL;
+		if (wrapper_http_server_create(&service->metrics_server, config->metrics_address, config->metrics_port,
+		                               wrapper_service_metrics_handler, NULL, &metrics_error))
+		{
+			WRAPPER_INFO(_T("Serving metrics on http://%s:%lu/metrics"), config->metrics_address, config->metrics_port);
+		}
+		else
+		{
+			wrapper_error_log(metrics_error);
+			wrapper_error_free(metrics_error);
+			WRAPPER_WARNING(_T("The metrics won't be served."));
+		}
+	}
+}
+
+//
+// Restarts the next instance that waits to be restarted, unless the instance that was restarted
+// before it isn't ready yet. The instances are restarted one at a time, so that the others keep
+// serving in the meantime. An instance that doesn't run by the time it has its turn isn't
+// restarted; it picks up the new command line when it starts. The instance is stopped, and started
+// again once it ended, see wrapper_instance_stopped.
+//
+static void wrapper_service_restart_next(wrapper_service_t* service)
+{
+	if (service->rolling || service->stopping || service->paused)
+	{
+		return;
+	}
+
+	for (DWORD i = 0; i < service->config->instances; i++)
+	{
+		wrapper_instance_t* instance = &service->instances[i];
+		if (!instance->restart_pending)
+		{
+			continue;
+		}
+
+		instance->restart_pending = 0;
+		if (WRAPPER_INSTANCE_RUNNING != instance->state)
+		{
+			continue;
+		}
+
+		WRAPPER_INFO(_T("Restarting instance %lu of the child process."), instance->number);
+		service->rolling = instance;
+		wrapper_instance_stop(instance, 0);
+		return;
+	}
+}
+
+static void wrapper_service_on_restart_next(void* user_data)
+{
+	wrapper_service_restart_next(user_data);
+}
+
+//
+// Restarts the instances that run one at a time with the new command line. The instances that wait
+// to be restarted pick up the new command line when they are.
+//
+static void wrapper_service_restart_instances(wrapper_service_t* service)
+{
+	wrapper_config_t* config = service->config;
+	wrapper_error_t* error = NULL;
+
+	for (DWORD i = 0; i < config->instances; i++)
+	{
+		wrapper_instance_t* instance = &service->instances[i];
+		if (!wrapper_string_expand_instance(instance->command_line, _countof(instance->command_line), config->command_line,
+		                                    instance->number))
+		{
+			WRAPPER_WARNING(_T("The new command line of instance %lu is too long. It keeps the old one."),
+			                instance->number);
+			continue;
+		}
+
+		if (!wrapper_instance_build_environment(instance, &error))
+		{
+			wrapper_error_log(error);
+			wrapper_error_free(error);
+			error = NULL;
+			WRAPPER_WARNING(_T("Instance %lu keeps its old environment."), instance->number);
+		}
+		wrapper_launch_prepare(&instance->launch, instance->command_line, instance->environment,
+		                       config->working_directory, service->sockets);
+
+		// The standby runs the old command line, so it can't take over
+		wrapper_instance_drop_standby(instance);
+
+		instance->restart_pending = WRAPPER_INSTANCE_RUNNING == instance->state;
+	}
+
+	WRAPPER_INFO(_T("Restarting the instances one at a time because the command line changed."));
+	wrapper_service_restart_next(service);
+}
+
+static void wrapper_service_watch(wrapper_service_t* service);
+static void wrapper_service_unwatch(wrapper_service_t* service);
+static int wrapper_service_get_config_time(wrapper_service_t* service, FILETIME* time);
+
+//
+// Reads the configuration again and applies what changed while the child keeps running. Only a
+// change to the command line restarts the instances. The name of the service and the number of
+// instances only change when the service is started again.
+//
+static void wrapper_service_reload(wrapper_service_t* service)
+{
+	HRESULT hr = S_OK;
+	wrapper_config_t* config = service->config;
+	wrapper_config_t* next = NULL;
+	wrapper_error_t* error = NULL;
+
+	WRAPPER_INFO(_T("Reading configuration '%s' again"), service->config_path);
+
+	if (SUCCEEDED(hr))
+	{
+		next = wrapper_config_alloc();
+		if (!next)
+		{
+			hr = E_OUTOFMEMORY;
+			error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the configuration"));
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!wrapper_config_read(service->config_path, next, &error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (FAILED(hr))
+	{
+		wrapper_error_log(error);
+		wrapper_error_free(error);
+		wrapper_config_free(next);
+		WRAPPER_WARNING(_T("The service keeps running with the configuration it has."));
+		return;
+	}
+
+	// Another Include or EnvironmentFile changes the files to watch, whether or not it changes a setting
+	if (config->files_size != next->files_size ||
+		(config->files_size && memcmp(config->files, next->files, config->files_size * sizeof(TCHAR))))
+	{
+		TCHAR* files = config->files;
+		config->files = next->files;
+		config->files_size = next->files_size;
+		next->files = files;
+
+		if (config->reload_on_change)
+		{
+			wrapper_service_unwatch(service);
+			wrapper_service_watch(service);
+		}
+		wrapper_service_get_config_time(service, &service->config_time);
+	}
+
+	const DWORD changes = wrapper_config_diff(config, next);
+	if (!changes)
+	{
+		WRAPPER_INFO(_T("The configuration didn't change."));
+	}
+
+	if (changes & WRAPPER_CONFIG_CHANGED_SERVICE)
+	{
+		WRAPPER_WARNING(_T("'Name', 'Instances', 'Type', 'ReadyPattern' and 'StartTimeout' only change when the ")
+		                _T("service is started again."));
+	}
+
+	if (changes & WRAPPER_CONFIG_CHANGED_SOCKETS)
+	{
+		WRAPPER_WARNING(_T("The sockets to listen on only change when the service is started again."));
+	}
+
+	if (changes & WRAPPER_CONFIG_CHANGED_DESCRIPTION)
+	{
+		StringCchCopy(config->title, WRAPPER_SERVICE_TITLE_MAX_LEN + 1, next->title);
+		StringCchCopy(config->description, WRAPPER_SERVICE_DESCRIPTION_MAX_LEN + 1, next->description);
+		WRAPPER_INFO(_T("Run the 'update' command to change the description of the service."));
+	}
+
+	if (changes & WRAPPER_CONFIG_CHANGED_STOP)
+	{
+		config->stop_timeout = next->stop_timeout;
+		config->kill_timeout = next->kill_timeout;
+		WRAPPER_INFO(_T("Applied the stop timeout of %lu ms and the kill timeout of %lu ms."), config->stop_timeout,
+		             config->kill_timeout);
+	}
+
+	if (changes & WRAPPER_CONFIG_CHANGED_RESTART)
+	{
+		config->restart = next->restart;
+		WRAPPER_INFO(_T("Applied the restart policy '%hs'."), wrapper_restart_mode_str(config->restart.mode));
+	}
+
+	if (changes & WRAPPER_CONFIG_CHANGED_LIMITS)
+	{
+		config->limits = next->limits;
+		for (DWORD i = 0; i < config->instances; i++)
+		{
+			wrapper_job_t* job = service->instances[i].job;
+			if (job && !wrapper_job_update(job, &config->limits, &error))
+			{
+				wrapper_error_log(error);
+				wrapper_error_free(error);
+				error = NULL;
+				WRAPPER_WARNING(_T("Instance %lu gets the new limits when it is restarted."), service->instances[i].number);
+			}
+		}
+		WRAPPER_INFO(_T("Applied the limits."));
+	}
+
+	if (changes & WRAPPER_CONFIG_CHANGED_LOG)
+	{
+		config->log_flush_interval = next->log_flush_interval;
+		config->log_flush_size = next->log_flush_size;
+		config->log_max_size = next->log_max_size;
+		config->log_max_age = next->log_max_age;
+		config->log_generations = next->log_generations;
+		config->log_compress = next->log_compress;
+		if (log_writer)
+		{
+			wrapper_log_writer_configure(log_writer, config);
+		}
+		WRAPPER_INFO(_T("Applied the settings of the log."));
+	}
+
+	if (changes & WRAPPER_CONFIG_CHANGED_MONITOR)
+	{
+		config->sample_interval = next->sample_interval;
+		config->sample_log_interval = next->sample_log_interval;
+		wrapper_service_start_sampler(service);
+		WRAPPER_INFO(_T("Applied the sample interval of %lu ms."), config->sample_interval);
+	}
+
+	if (changes & WRAPPER_CONFIG_CHANGED_HEALTH)
+	{
+		// With Type=health, the service tells that the child is ready from the health check, so it
+		// keeps one until the service is started again
+		const wrapper_health_settings_t previous = config->health;
+		const int needs_health = WRAPPER_SERVICE_TYPE_HEALTH == config->type;
+
+		if (needs_health && WRAPPER_HEALTH_NONE == next->health.type)
+		{
+			WRAPPER_WARNING(_T("The service has type '%hs', so it keeps its health check until it is started again."),
+			                wrapper_service_type_str(config->type));
+		}
+		else
+		{
+			config->health = next->health;
+			if (wrapper_service_start_health(service, &error))
+			{
+				WRAPPER_INFO(_T("Applied the health check '%hs'."), wrapper_health_type_str(config->health.type));
+			}
+			else
+			{
+				wrapper_error_log(error);
+				wrapper_error_free(error);
+				error = NULL;
+				if (needs_health)
+				{
+					WRAPPER_WARNING(_T("The service keeps its old health check."));
+					config->health = previous;
+				}
+				else
+				{
+					WRAPPER_WARNING(_T("The health of the child process won't be checked."));
+					config->health.type = WRAPPER_HEALTH_NONE;
+				}
+
+				if (!wrapper_service_start_health(service, &error))
+				{
+					// The instances that aren't ready yet would wait for nothing
+					wrapper_service_fail(service, error);
+					wrapper_reactor_stop(service->reactor);
+					wrapper_config_free(next);
+					return;
+				}
+			}
+		}
+	}
+
+	if (changes & WRAPPER_CONFIG_CHANGED_METRICS)
+	{
+		StringCchCopy(config->metrics_address, WRAPPER_METRICS_ADDRESS_MAX_LEN + 1, next->metrics_address);
+		config->metrics_port = next->metrics_port;
+		wrapper_service_start_metrics(service);
+	}
+
+	if (changes & WRAPPER_CONFIG_CHANGED_RELOAD)
+	{
+		config->reload_on_change = next->reload_on_change;
+		wrapper_service_watch(service);
+	}
+
+	if (changes & WRAPPER_CONFIG_CHANGED_STANDBY)
+	{
+		config->standby = next->standby;
+		config->standby_warmup = next->standby_warmup;
+	}
+
+	if (changes & WRAPPER_CONFIG_CHANGED_HOOKS)
+	{
+		// The hooks that run when the child is ready or stopped change right away
+		config->hooks = next->hooks;
+	}
+
+	if (changes & WRAPPER_CONFIG_CHANGED_COMMAND)
+	{
+		StringCchCopy(config->command_line, WRAPPER_SERVICE_CMDLINE_MAX_LEN + 1, next->command_line);
+		StringCchCopy(config->working_directory, WRAPPER_SERVICE_WORKDIR_MAX_LEN + 1, next->working_directory);
+
+		// The old variables go with the next configuration when it is freed
+		const wrapper_environment_settings_t environment = config->environment;
+		config->environment = next->environment;
+		next->environment = environment;
+
+		wrapper_service_restart_instances(service);
+	}
+
+	if (changes & WRAPPER_CONFIG_CHANGED_STANDBY)
+	{
+		// A new warm-up time applies to the next standby that is started
+		for (DWORD i = 0; i < config->instances; i++)
+		{
+			if (config->standby)
+			{
+				wrapper_instance_start_standby(&service->instances[i]);
+			}
+			else
+			{
+				wrapper_instance_drop_standby(&service->instances[i]);
+			}
+		}
+	}
+
+	wrapper_config_free(next);
+}
+
+//
+// Gets the latest time the configuration file, a file it includes, an environment file or a file
+// in its drop-in directory was written. The entry of the drop-in directory itself covers a file
+// that was removed from it. A file that was read before and is gone now is left out, and reading
+// the configuration again then fails on it.
+//
+static int wrapper_service_get_config_time(wrapper_service_t* service, FILETIME* time)
+{
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	WIN32_FIND_DATA find_data;
+	TCHAR pattern[_MAX_PATH];
+
+	if (!GetFileAttributesEx(service->config_path, GetFileExInfoStandard, &data))
+	{
+		return 0;
+	}
+
+	*time = data.ftLastWriteTime;
+
+	for (const TCHAR* file = service->config->files; file && *file; file += _tcslen(file) + 1)
+	{
+		if (GetFileAttributesEx(file, GetFileExInfoStandard, &data) && CompareFileTime(&data.ftLastWriteTime, time) > 0)
+		{
+			*time = data.ftLastWriteTime;
+		}
+	}
+
+	if (SUCCEEDED(StringCchPrintf(pattern, _countof(pattern), _T("%s.d\\*"), service->config_path)))
+	{
+		HANDLE find = FindFirstFile(pattern, &find_data);
+		if (INVALID_HANDLE_VALUE != find)
+		{
+			do
+			{
+				if (CompareFileTime(&find_data.ftLastWriteTime, time) > 0)
+				{
+					*time = find_data.ftLastWriteTime;
+				}
+			}
+			while (FindNextFile(find, &find_data));
+			FindClose(find);
+		}
+	}
+
+	return 1;
+}
+
+static void wrapper_service_on_reload(void* user_data)
+{
+	wrapper_service_t* service = user_data;
+	wrapper_error_t* error = NULL;
+
+	WRAPPER_INFO(_T("A request was received to reload the configuration."));
+	if (!wrapper_reactor_add_handle(service->reactor, service->reload_event, wrapper_service_on_reload, service, NULL,
+	                                &error))
+	{
+		wrapper_error_log(error);
+		wrapper_error_free(error);
+		WRAPPER_WARNING(_T("Further requests to reload the configuration will be ignored."));
+	}
+
+	wrapper_service_get_config_time(service, &service->config_time);
+	wrapper_service_reload(service);
+}
+
+static void wrapper_service_on_reload_timer(void* user_data)
+{
+	wrapper_service_t* service = user_data;
+
+	WRAPPER_INFO(_T("The configuration file has changed."));
+	wrapper_service_get_config_time(service, &service->config_time);
+	wrapper_service_reload(service);
+}
+
+static void wrapper_service_on_change(void* user_data)
+{
+	wrapper_watch_t* watch = user_data;
+	wrapper_service_t* service = watch->service;
+	wrapper_error_t* error = NULL;
+	FILETIME time;
+
+	// Any change in the directory ends up here, e.g. the log being written, so only a change to
+	// one of the files that were read or to the drop-ins starts the timer. Every change before it
+	// expires restarts it.
+	if (wrapper_service_get_config_time(service, &time) && CompareFileTime(&time, &service->config_time))
+	{
+		wrapper_reactor_set_timer(service->reactor, &service->reload_timer, WRAPPER_RELOAD_DELAY,
+		                          wrapper_service_on_reload_timer, service);
+	}
+
+	if (!FindNextChangeNotification(watch->handle))
+	{
+		error = wrapper_error_from_system(GetLastError(), _T("Failed to watch the directory '%s' for changes"),
+		                                  watch->directory);
+	}
+	else
+	{
+		wrapper_reactor_add_handle(service->reactor, watch->handle, wrapper_service_on_change, watch, &watch->source,
+		                           &error);
+	}
+
+	if (error)
+	{
+		wrapper_error_log(error);
+		wrapper_error_free(error);
+		WRAPPER_WARNING(_T("Changes in the directory '%s' won't be applied until the service is asked to reload."),
+		                watch->directory);
+		FindCloseChangeNotification(watch->handle);
+		watch->handle = NULL;
+	}
+}
+
+//
+// Whether a change in the directory is already noticed, because it or a directory above it that
+// is watched with its subdirectories is watched.
+//
+static int wrapper_service_is_watched(const wrapper_service_t* service, const TCHAR* directory)
+{
+	for (DWORD i = 0; i < service->watch_count; i++)
+	{
+		const wrapper_watch_t* watch = &service->watches[i];
+		const size_t length = _tcslen(watch->directory);
+
+		if (0 == _tcsicmp(directory, watch->directory))
+		{
+			return 1;
+		}
+
+		if (watch->subtree && length && 0 == _tcsnicmp(directory, watch->directory, length) &&
+			(_T('\\') == directory[length] || _T('\\') == watch->directory[length - 1]))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void wrapper_service_watch_directory(wrapper_service_t* service, const TCHAR* directory, int subtree)
+{
+	wrapper_error_t* error = NULL;
+
+	if (WRAPPER_WATCH_MAX == service->watch_count)
+	{
+		WRAPPER_WARNING(_T("Changes in the directory '%s' won't be applied until the service is asked to reload, ")
+		                _T("because at most %d directories are watched."), directory, WRAPPER_WATCH_MAX);
+		return;
+	}
+
+	wrapper_watch_t* watch = &service->watches[service->watch_count];
+	watch->service = service;
+	watch->subtree = subtree;
+	StringCchCopy(watch->directory, _countof(watch->directory), directory);
+
+	watch->handle = FindFirstChangeNotification(directory, subtree,
+	                                            FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE);
+	if (INVALID_HANDLE_VALUE == watch->handle)
+	{
+		watch->handle = NULL;
+		error = wrapper_error_from_system(GetLastError(), _T("Failed to watch the directory '%s' for changes"),
+		                                  directory);
+	}
+	else
+	{
+		wrapper_reactor_add_handle(service->reactor, watch->handle, wrapper_service_on_change, watch, &watch->source,
+		                           &error);
+	}
+
+	if (error)
+	{
+		wrapper_error_log(error);
+		wrapper_error_free(error);
+		WRAPPER_WARNING(_T("Changes in the directory '%s' won't be applied until the service is asked to reload."),
+		                directory);
+		if (watch->handle)
+		{
+			FindCloseChangeNotification(watch->handle);
+			watch->handle = NULL;
+		}
+		return;
+	}
+
+	service->watch_count++;
+}
+
+static void wrapper_service_unwatch(wrapper_service_t* service)
+{
+	for (DWORD i = 0; i < service->watch_count; i++)
+	{
+		wrapper_watch_t* watch = &service->watches[i];
+		wrapper_reactor_remove(service->reactor, &watch->source);
+		if (watch->handle)
+		{
+			FindCloseChangeNotification(watch->handle);
+			watch->handle = NULL;
+		}
+	}
+	service->watch_count = 0;
+}
+
+//
+// Watches the directory of the configuration file, and the directories of the files that it
+// includes from elsewhere and of its environment files, for changes when ReloadOnChange is set,
+// and stops watching them otherwise.
+//
+static void wrapper_service_watch(wrapper_service_t* service)
+{
+	TCHAR directory[_MAX_PATH];
+
+	if (!service->config->reload_on_change)
+	{
+		wrapper_service_unwatch(service);
+		wrapper_reactor_cancel_timer(service->reactor, &service->reload_timer);
+		return;
+	}
+
+	if (service->watch_count)
+	{
+		return;
+	}
+
+	wrapper_service_get_config_time(service, &service->config_time);
+
+	// The subtree includes the drop-in directory of the configuration file
+	StringCchCopy(directory, _countof(directory), service->config_path);
+	PathCchRemoveFileSpec(directory, _countof(directory));
+	wrapper_service_watch_directory(service, directory, TRUE);
+
+	for (const TCHAR* file = service->config->files; file && *file; file += _tcslen(file) + 1)
+	{
+		if (SUCCEEDED(StringCchCopy(directory, _countof(directory), file)) &&
+			SUCCEEDED(PathCchRemoveFileSpec(directory, _countof(directory))) &&
+			!wrapper_service_is_watched(service, directory))
+		{
+			wrapper_service_watch_directory(service, directory, FALSE);
+		}
+	}
+}
+
+//
+// Appends to the reply to a control request and returns the length of the reply so far.
+//
+static DWORD wrapper_control_append(char* reply, DWORD size, DWORD length, const char* format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	const int written = _vsnprintf_s(reply + length, size - length, _TRUNCATE, format, args);
+	va_end(args);
+
+	return written < 0 ? size - 1 : length + written;
+}
+
+static DWORD wrapper_control_error(char* reply, DWORD size, wrapper_error_t* error)
+{
+#ifdef UNICODE
+	const DWORD length = wrapper_control_append(reply, size, 0, "ERROR %ls\n", error->user_message);
+#else
+	const DWORD length = wrapper_control_append(reply, size, 0, "ERROR %s\n", error->user_message);
+#endif
+	wrapper_error_free(error);
+	return length;
+}
+
+static const char* wrapper_instance_state_str(wrapper_instance_state_t state)
+{
+	switch (state)
+	{
+	case WRAPPER_INSTANCE_STOPPED:
+		return "stopped";
+	case WRAPPER_INSTANCE_RUNNING:
+		return "running";
+	case WRAPPER_INSTANCE_STOPPING:
+		return "stopping";
+	case WRAPPER_INSTANCE_RESTARTING:
+		return "restarting";
+	default:
+		return "unknown";
+	}
+}
+
+static DWORD wrapper_service_format_status(wrapper_service_t* service, char* reply, DWORD size)
+{
+	const char* state = service->paused ? "paused" : service->running ? "running" : "starting";
+	DWORD length = wrapper_control_append(reply, size, 0, "OK\nstate=%s\ntype=%s\ninstances=%lu\n", state,
+	                                      wrapper_service_type_str(service->config->type),
+	                                      service->config->instances);
+
+	for (DWORD i = 0; i < service->config->instances; i++)
+	{
+		const wrapper_instance_t* instance = &service->instances[i];
+		length = wrapper_control_append(reply, size, length,
+		                                "instance=%lu state=%s pid=%lu ready=%s restarts=%lu standby=%lu\n",
+		                                instance->number, wrapper_instance_state_str(instance->state),
+		                                instance->process ? GetProcessId(instance->process) : 0,
+		                                instance->ready ? "yes" : "no", instance->restart_state.restarts,
+		                                instance->standby ? GetProcessId(instance->standby) : 0);
+	}
+	return length;
+}
+
+//
+// Asks the instances to stop and keeps them stopped until the service continues. The reply doesn't
+// wait for them to end.
+//
+static DWORD wrapper_service_pause(wrapper_service_t* service, char* reply, DWORD size)
+{
+	if (service->stopping)
+	{
+		return wrapper_control_append(reply, size, 0, "ERROR The service is stopping\n");
+	}
+
+	if (!service->paused)
+	{
+		WRAPPER_INFO(_T("Pausing the service, which stops the child process until the service continues."));
+		service->paused = 1;
+		wrapper_instances_stop(service);
+	}
+	return wrapper_control_append(reply, size, 0, "OK\n");
+}
+
+static DWORD wrapper_service_continue(wrapper_service_t* service, char* reply, DWORD size)
+{
+	wrapper_error_t* error = NULL;
+
+	if (service->stopping)
+	{
+		return wrapper_control_append(reply, size, 0, "ERROR The service is stopping\n");
+	}
+
+	if (service->paused)
+	{
+		WRAPPER_INFO(_T("Continuing the service."));
+		service->paused = 0;
+		for (DWORD i = 0; i < service->config->instances; i++)
+		{
+			// The instances that are still stopping start again once they ended
+			if (WRAPPER_INSTANCE_STOPPED != service->instances[i].state)
+			{
+				continue;
+			}
+
+			if (!wrapper_instance_start(&service->instances[i], &error))
+			{
+				wrapper_service_fail(service, error);
+				wrapper_reactor_stop(service->reactor);
+				return wrapper_control_append(reply, size, 0, "ERROR The child process didn't start\n");
+			}
+		}
+	}
+	return wrapper_control_append(reply, size, 0, "OK\n");
+}
+
+//
+// Restarts the instances that run one at a time, each once the one before it is ready again. The
+// reply doesn't wait for that.
+//
+static DWORD wrapper_service_restart(wrapper_service_t* service, char* reply, DWORD size)
+{
+	if (service->stopping)
+	{
+		return wrapper_control_append(reply, size, 0, "ERROR The service is stopping\n");
+	}
+
+	for (DWORD i = 0; i < service->config->instances; i++)
+	{
+		wrapper_instance_t* instance = &service->instances[i];
+		instance->restart_pending = WRAPPER_INSTANCE_RUNNING == instance->state;
+	}
+
+	WRAPPER_INFO(_T("Restarting the instances one at a time on request."));
+	wrapper_service_restart_next(service);
+	return wrapper_control_append(reply, size, 0, "OK\n");
+}
+
+static DWORD wrapper_service_set_log_level(const char* argument, char* reply, DWORD size)
+{
+	TCHAR name[16] = {0};
+	wrapper_log_level_t level;
+
+	if (*argument)
+	{
+#ifdef UNICODE
+		MultiByteToWideChar(CP_UTF8, 0, argument, -1, name, _countof(name) - 1);
+#else
+		StringCchCopyA(name, _countof(name), argument);
+#endif
+		if (!wrapper_log_level_parse(name, &level))
+		{
+			return wrapper_control_append(reply, size, 0, "ERROR Unknown log level '%s'\n", argument);
+		}
+		wrapper_log_set_level(level);
+		WRAPPER_INFO(_T("Changed the log level to '%s'."), wrapper_log_level_str(level));
+	}
+
+#ifdef UNICODE
+	return wrapper_control_append(reply, size, 0, "OK\nlog-level=%ls\n", wrapper_log_level_str(wrapper_log_get_level()));
+#else
+	return wrapper_control_append(reply, size, 0, "OK\nlog-level=%s\n", wrapper_log_level_str(wrapper_log_get_level()));
+#endif
+}
+
+//
+// Handles a request on the control pipe. A request is a single line with a command and, for some
+// commands, an argument, e.g. 'log-level debug'. The reply starts with a line that is either 'OK'
+// or 'ERROR' followed by a message, and the lines after 'OK' hold what the command returns.
+//
+static DWORD wrapper_service_on_control(void* user_data, DWORD process_id, const char* message, DWORD length,
+                                        char* reply, DWORD reply_size)
+{
+	wrapper_service_t* service = user_data;
+	char command[WRAPPER_PIPE_MESSAGE_MAX_LEN + 1];
+
+	memcpy(command, message, length + 1);
+	while (length && ('\n' == command[length - 1] || '\r' == command[length - 1]))
+	{
+		command[--length] = '\0';
+	}
+
+	char* argument = strchr(command, ' ');
+	if (argument)
+	{
+		*argument++ = '\0';
+	}
+	else
+	{
+		argument = command + length;
+	}
+
+	WRAPPER_DEBUG(_T("Received the control request '%hs' from process %lu."), command, process_id);
+
+	if (0 == strcmp(command, "status"))
+	{
+		return wrapper_service_format_status(service, reply, reply_size);
+	}
+	if (0 == strcmp(command, "restart"))
+	{
+		return wrapper_service_restart(service, reply, reply_size);
+	}
+	if (0 == strcmp(command, "reload"))
+	{
+		wrapper_service_reload(service);
+		return wrapper_control_append(reply, reply_size, 0, "OK\n");
+	}
+	if (0 == strcmp(command, "pause"))
+	{
+		return wrapper_service_pause(service, reply, reply_size);
+	}
+	if (0 == strcmp(command, "continue"))
+	{
+		return wrapper_service_continue(service, reply, reply_size);
+	}
+	if (0 == strcmp(command, "log-level"))
+	{
+		return wrapper_service_set_log_level(argument, reply, reply_size);
+	}
+	if (0 == strcmp(command, "stats"))
+	{
+		size_t written = 0;
+		const DWORD header = wrapper_control_append(reply, reply_size, 0, "OK\n");
+		if (!wrapper_metrics_format(reply + header, reply_size - header, &written))
+		{
+			return wrapper_control_append(reply, reply_size, 0, "ERROR The statistics don't fit in the reply\n");
+		}
+		return header + (DWORD)written;
+	}
+
+	return wrapper_control_append(reply, reply_size, 0, "ERROR Unknown command '%s'\n", command);
+}
+
+//
+// Listens for control requests, e.g. from the status command. The service runs without them when
+// the pipe can't be created.
+//
+static void wrapper_service_start_control(wrapper_service_t* service)
+{
+	wrapper_error_t* control_error = NULL;
+	TCHAR name[MAX_PATH];
+
+	_sntprintf_s(name, _countof(name), _TRUNCATE, WRAPPER_CONTROL_PIPE_NAME_FORMAT, service->config->name);
+	if (!wrapper_pipe_server_create(&service->control, service->reactor, name, WRAPPER_CONTROL_REPLY_MAX_LEN,
+	                                wrapper_service_on_control, service, &control_error))
+	{
+		wrapper_error_log(control_error);
+		wrapper_error_free(control_error);
+		WRAPPER_WARNING(_T("The service can't be controlled through its pipe."));
+	}
+}
+
+//
+// Purpose: 
+//   The service code
+//
+// Parameters:
+//   dwArgc - Number of arguments in the lpszArgv array
+//   lpszArgv - Array of strings. The first string is the name of
+//     the service and subsequent strings are passed by the process
+//     that called the StartService function to start the service.
+// 
+// Return value:
+//   None
+//
+int wrapper_service_init(wrapper_config_t* config, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	DWORD last_error;
+	wrapper_service_t service = {0};
+
+	service.config = config;
+	service.error = error;
+	service.start_time = GetTickCount64();
+
+	wrapper_metric_set(WRAPPER_METRIC_START_TIME, wrapper_metric_now());
+	wrapper_service_report_status(SERVICE_START_PENDING, NO_ERROR, 3000, config, error);
+
+	if (SUCCEEDED(hr))
+	{
+		stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (stop_event == NULL)
+		{
+			last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(
+					last_error, _T("Failed to register the event for service '%s' that would be used to say the process has stopped."),
+					config->name);
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		service.reload_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+		reload_event = service.reload_event;
+		if (service.reload_event == NULL)
+		{
+			last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(
+					last_error, _T("Failed to register the event for service '%s' that would be used to reload the configuration."),
+					config->name);
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!wrapper_config_get_path(service.config_path, _countof(service.config_path), error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!wrapper_reactor_create(&service.reactor, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		service.instances = wrapper_allocate(sizeof *service.instances * config->instances);
+		if (!service.instances)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the instances of the child process"));
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr) && config->sockets.count)
+	{
+		if (!wrapper_sockets_create(&service.sockets, &config->sockets, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr) && WRAPPER_SERVICE_TYPE_NOTIFY == config->type)
+	{
+		TCHAR name[MAX_PATH];
+		_sntprintf_s(name, _countof(name), _TRUNCATE, WRAPPER_NOTIFY_PIPE_NAME_FORMAT, GetCurrentProcessId());
+		if (!wrapper_pipe_server_create(&service.notify, service.reactor, name, 0, wrapper_service_on_notify, &service,
+		                                error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr) && WRAPPER_SERVICE_TYPE_LOG == config->type)
+	{
+		// The output of the child is matched as it is read, before it is converted
+		if (!WideCharToMultiByte(CP_UTF8, 0, config->ready_pattern, -1, service.ready_pattern,
+		                         sizeof service.ready_pattern, NULL, NULL))
+		{
+			last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to convert the ready pattern '%s'"),
+				                                   config->ready_pattern);
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	for (DWORD i = 0; SUCCEEDED(hr) && i < config->instances; i++)
+	{
+		wrapper_instance_t* instance = &service.instances[i];
+		instance->service = &service;
+		instance->index = i;
+		instance->number = i + 1;
+		instance->state = WRAPPER_INSTANCE_STOPPED;
+		wrapper_restart_init(&instance->restart_state, (GetTickCount() ^ GetCurrentProcessId()) + i);
+		wrapper_restart_init(&instance->standby_restart_state,
+		                     (GetTickCount() ^ GetCurrentProcessId()) + config->instances + i);
+
+		if (!wrapper_string_expand_instance(instance->command_line, _countof(instance->command_line), config->command_line,
+		                                    instance->number))
+		{
+			hr = HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("The command line of instance %lu is too long"), instance->number);
+			}
+		}
+		else if (!wrapper_instance_build_environment(instance, error))
+		{
+			hr = E_FAIL;
+		}
+		else
+		{
+			wrapper_launch_prepare(&instance->launch, instance->command_line, instance->environment,
+			                       config->working_directory, service.sockets);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		wrapper_service_start_sampler(&service);
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!wrapper_service_start_health(&service, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		wrapper_service_start_metrics(&service);
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!wrapper_reactor_add_handle(service.reactor, stop_event, wrapper_service_on_stop, &service, NULL, error) ||
+			!wrapper_reactor_add_handle(service.reactor, service.reload_event, wrapper_service_on_reload, &service, NULL,
+			                            error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		wrapper_service_watch(&service);
+		wrapper_service_start_control(&service);
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		// The instances start once the ExecStartPre hooks succeeded
+		if (!wrapper_service_run_hooks(&service, WRAPPER_HOOK_START_PRE, SERVICE_START_PENDING,
+		                               wrapper_service_on_start_pre_done, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr) && error && *error)
+	{
+		// There were no hooks to wait for, and the instances failed to start right away
+		hr = E_FAIL;
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		// From here on, the hooks, the stop event, the processes, the health checks and the restarts
+		// of all the instances, as well as the requests to reload the configuration, are dealt with on
+		// this thread as they happen.
+		if (!wrapper_reactor_run(service.reactor, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (FAILED(hr) && error && *error)
+	{
+		wrapper_error_log(*error);
+	}
+
+	if (service.instances)
+	{
+		// Nothing is left running when the wrapper itself fails. The instances that were asked to stop
+		// are given the time to do so, and whatever is still left after that goes with its job.
+		if (service.reactor)
+		{
+			wrapper_service_stop_children(&service);
+			if (!wrapper_instances_stopped(&service) && !wrapper_reactor_run(service.reactor, NULL))
+			{
+				WRAPPER_WARNING(_T("The child processes that are left are terminated."));
+			}
+		}
+
+		for (DWORD i = 0; i < config->instances; i++)
+		{
+			if (WRAPPER_INSTANCE_STOPPED != service.instances[i].state)
+			{
+				wrapper_instance_ended(&service.instances[i], 0, 1, NULL);
+			}
+		}
+
+		// The hooks that still run are terminated, and the ExecStopPost hooks clean up after the
+		// child, whether or not it started. The reactor runs until they ended.
+		wrapper_hooks_free(service.hooks);
+		service.hooks = NULL;
+		wrapper_reactor_cancel_timer(service.reactor, &service.stop_timer);
+
+		wrapper_error_t* hook_error = NULL;
+		if (!wrapper_service_run_hooks(&service, WRAPPER_HOOK_STOP_POST, SERVICE_STOP_PENDING,
+		                               wrapper_service_on_stop_post_done, &hook_error))
+		{
+			wrapper_error_log(hook_error);
+			wrapper_error_free(hook_error);
+		}
+		else if (service.hooks && !wrapper_reactor_run(service.reactor, NULL))
+		{
+			WRAPPER_WARNING(_T("The %s hooks that are left are terminated."), wrapper_hook_stage_str(WRAPPER_HOOK_STOP_POST));
+		}
+		wrapper_hooks_free(service.hooks);
+		service.hooks = NULL;
+	}
+
+	if (error && *error)
+	{
+		const long code = (*error)->code;
+		WRAPPER_INFO(_T("The windows service stopped with errors."));
+		wrapper_service_report_status(SERVICE_STOPPED, code, 0, config, error);
+	}
+	else
+	{
+		WRAPPER_INFO(_T("The windows service stopped succesfully."));
+		wrapper_service_report_status(SERVICE_STOPPED, NO_ERROR, 0, config, error);
+	}
+
+	wrapper_http_server_free(service.metrics_server);
+	wrapper_pipe_server_free(service.control);
+	wrapper_pipe_server_free(service.notify);
+	wrapper_sockets_free(service.sockets);
+	wrapper_health_free(service.health);
+	wrapper_sampler_free(service.sampler);
+	wrapper_reactor_free(service.reactor);
+	for (DWORD i = 0; service.instances && i < config->instances; i++)
+	{
+		wrapper_environment_free(service.instances[i].environment);
+		wrapper_launch_free(&service.instances[i].launch);
+	}
+	wrapper_free(service.instances);
+
+	for (DWORD i = 0; i < service.watch_count; i++)
+	{
+		if (service.watches[i].handle)
+		{
+			FindCloseChangeNotification(service.watches[i].handle);
+		}
+	}
+
+	if (service.reload_event)
+	{
+		reload_event = NULL;
+		CloseHandle(service.reload_event);
+	}
+
+	if (stop_event)
+	{
+		HANDLE event = stop_event;
+		stop_event = NULL;
+		CloseHandle(event);
+	}
+
+	return 1;
+}
+
+//
+// Purpose: 
+//   Sets the current service status and reports it to the SCM.
+//
+// Parameters:
+//   state - The current state (see SERVICE_STATUS)
+//   exit_code - The system error code
+//   timeout - Estimated time for pending operation, 
+//     in milliseconds
+// 
+// Return value:
+//   None
+//
+int wrapper_service_report_status(DWORD state,
+                                  DWORD exit_code,
+                                  DWORD timeout,
+                                  wrapper_config_t* config,
+                                  wrapper_error_t** error)
+{
+	UNUSED(config);
+
+	static DWORD dwCheckPoint = 1;
+
+	SERVICE_STATUS service_status = {0};
+
+	service_status.dwServiceSpecificExitCode = 0;
+	service_status.dwCurrentState = state;
+	service_status.dwWin32ExitCode = exit_code;
+	service_status.dwWaitHint = timeout;
+	service_status.dwServiceType = SERVICE_WIN32_OWN_PROCESS;
+
+	// A service that waits for its child to be ready can still be stopped
+	if (state == SERVICE_RUNNING)
+		service_status.dwControlsAccepted = SERVICE_ACCEPT_STOP | SERVICE_ACCEPT_SHUTDOWN | SERVICE_ACCEPT_PARAMCHANGE;
+	else
+		service_status.dwControlsAccepted = SERVICE_ACCEPT_STOP | SERVICE_ACCEPT_SHUTDOWN;
+
+	if (state == SERVICE_RUNNING ||
+		state == SERVICE_STOPPED)
+		service_status.dwCheckPoint = 0;
+	else
+		service_status.dwCheckPoint = dwCheckPoint++;
+
+	const TCHAR* status_text = wrapper_service_get_status_text(state);
+	if (run_in_foreground)
+	{
+		// There is no service control manager to tell
+		WRAPPER_DEBUG(_T("The status of the wrapper is now '%s'"), status_text);
+		return 1;
+	}
+
+	WRAPPER_INFO(_T("Setting the status of the service to '%s'"), status_text);
+	if (SetServiceStatus(status_handle, &service_status))
+	{
+		WRAPPER_INFO(_T("Set the status of the service to '%s'"), status_text);
+	}
+	else
+	{
+		DWORD last_error = GetLastError();
+		if (error)
+		{
+			*error = wrapper_error_from_system(
+				last_error, _T("Failed to set the status of the service to '%s'"),
+				status_text);
+		}
+
+		return 0;
+	}
+	return 1;
+}
+
+//
+// Sets the event that tells the supervisor what the service manager or the console asked for.
+//
+static void wrapper_service_set_event(HANDLE event, const TCHAR* request)
+{
+	wrapper_error_t* error = NULL;
+	if (event)
+	{
+		WRAPPER_INFO(_T("Received %s request."), request);
+		if (SetEvent(event))
+		{
+			WRAPPER_INFO(_T("Succesfully set the %s event."), request);
+		}
+		else
+		{
+			error = wrapper_error_from_system(GetLastError(), _T("Failed to set the %s event. The service may not %s."),
+			                                  request, request);
+		}
+	}
+	else
+	{
+		error = wrapper_error_from_system(ERROR_INVALID_HANDLE, _T("Failed to set the %s event. The service isn't running."),
+		                                  request);
+	}
+
+	if (error)
+	{
+		wrapper_error_log(error);
+		wrapper_error_free(error);
+	}
+}
+
+//
+// Purpose: 
+//   Called by SCM whenever a control code is sent to the service
+//   using the ControlService function.
+//
+// Parameters:
+//   dwCtrl - control code
+// 
+// Return value:
+//   None
+//
+VOID WINAPI wrapper_service_control_handler(DWORD dwCtrl)
+{
+	switch (dwCtrl)
+	{
+	case SERVICE_CONTROL_SHUTDOWN:
+	case SERVICE_CONTROL_STOP:
+		wrapper_service_set_event(stop_event, _T("stop"));
+		break;
+
+	case SERVICE_CONTROL_PARAMCHANGE:
+		wrapper_service_set_event(reload_event, _T("reload"));
+		break;
+
+	case SERVICE_CONTROL_INTERROGATE:
+		break;
+
+	default:
+		break;
+	}
+}
+
+//
+// Purpose: 
+//   Called when CTRL+C is pressed or the console is closed while the
+//   wrapper runs in the foreground.
+//
+static BOOL WINAPI wrapper_console_ctrl_handler(DWORD type)
+{
+	switch (type)
+	{
+	case CTRL_C_EVENT:
+	case CTRL_BREAK_EVENT:
+		wrapper_service_set_event(stop_event, _T("stop"));
+		return TRUE;
+
+	case CTRL_CLOSE_EVENT:
+	case CTRL_LOGOFF_EVENT:
+	case CTRL_SHUTDOWN_EVENT:
+		// The process is terminated as soon as this returns, e.g. when a container is stopped, so
+		// wait for the children to be stopped first.
+		wrapper_service_set_event(stop_event, _T("stop"));
+		if (foreground_stopped)
+		{
+			WaitForSingleObject(foreground_stopped, INFINITE);
+		}
+		return TRUE;
+
+	default:
+		return FALSE;
+	}
+}
+
+int wrapper_log_get_path(TCHAR* destination, const size_t size, wrapper_config_t* config, wrapper_error_t** error)
+{
+	UNUSED(config);
+
+	HRESULT hr = S_OK;
+	if (!GetModuleFileName(NULL, destination, (DWORD)size))
+	{
+		hr = HRESULT_FROM_WIN32(GetLastError());
+		if (error)
+		{
+			*error = wrapper_error_from_hresult(hr, _T("Failed to get the path of the current process."));
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		PathCchRenameExtension(destination, size, _T(".log"));
+	}
+
+	if (FAILED(hr))
+	{
+		return 0;
+	}
+
+	return 1;
+}
+
+//
+// Opens the log file next to the executable and sends the messages of the wrapper to the handler,
+// which gets the log writer.
+//
+static int wrapper_service_open_log(wrapper_config_t* config, wrapper_log_func_t handler, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	TCHAR* log_path = NULL;
+
+	if (SUCCEEDED(hr))
+	{
+		log_path = wrapper_allocate_string(MAX_PATH);
+		if (!log_path)
+		{
+			hr = E_OUTOFMEMORY;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!wrapper_log_get_path(log_path, _MAX_PATH, config, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!wrapper_log_writer_create(&log_writer, log_path, config, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		wrapper_log_set_handler(handler, log_writer);
+	}
+
+	wrapper_free(log_path);
+	return SUCCEEDED(hr);
+}
+
+static void wrapper_service_close_log(void)
+{
+	if (log_writer)
+	{
+		wrapper_log_set_handler(wrapper_log_console_handler, NULL);
+		wrapper_log_writer_free(log_writer);
+		log_writer = NULL;
+	}
+}
+
+int do_run(wrapper_config_t* config, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+
+	if (SUCCEEDED(hr))
+	{
+		if (!wrapper_service_open_log(config, wrapper_log_writer_handler, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		WRAPPER_INFO(_T("Starting Service"));
+		
+#pragma warning( push )
+#pragma warning( disable: 4204 ) // nonstandard extension used: non-constant aggregate initializer
+		SERVICE_TABLE_ENTRY DispatchTable[] =
+		{
+			{
+				.lpServiceName = config->name,
+				.lpServiceProc = (LPSERVICE_MAIN_FUNCTION)wrapper_service_main
+			},
+			{
+				.lpServiceName = NULL,
+				.lpServiceProc = NULL
+			}
+		};
+#pragma warning( pop )
+
+		if (!StartServiceCtrlDispatcher(DispatchTable))
+		{
+			hr = E_FAIL;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to start the service '%s'."), config->name);
+			}
+		}
+		else
+		{
+			WRAPPER_INFO(_T("Done"));
+		}
+	}
+
+	wrapper_service_close_log();
+
+	if (FAILED(hr))
+	{
+		return 0;
+	}
+	return 1;
+}
+
+//
+// Writes the messages of the wrapper to the console as well as to the log file.
+//
+static void wrapper_foreground_log_handler(wrapper_log_level_t log_level, const TCHAR* log_domain,
+                                           const TCHAR* message, void* user_data)
+{
+	wrapper_log_writer_handler(log_level, log_domain, message, user_data);
+	wrapper_log_console_handler(log_level, log_domain, message, NULL);
+}
+
+//
+// Runs the same supervision as the service does, but in the console and without the service
+// control manager, e.g. in a container or to try a configuration out. CTRL+C stops it.
+//
+int do_run_foreground(wrapper_config_t* config, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+
+	run_in_foreground = 1;
+
+	if (SUCCEEDED(hr))
+	{
+		foreground_stopped = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (!foreground_stopped)
+		{
+			const DWORD last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to create the event that tells the wrapper stopped"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!wrapper_service_open_log(config, wrapper_foreground_log_handler, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		// The output of the child goes to the console too
+		wrapper_log_writer_set_echo(log_writer, GetStdHandle(STD_OUTPUT_HANDLE), GetStdHandle(STD_ERROR_HANDLE));
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!SetConsoleCtrlHandler(wrapper_console_ctrl_handler, TRUE))
+		{
+			const DWORD last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to handle CTRL+C in the console"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		WRAPPER_INFO(_T("Running service '%s' in the foreground. Press CTRL+C to stop it."), config->name);
+		wrapper_service_log_config(config);
+		wrapper_service_init(config, error);
+		if (error && *error)
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	wrapper_service_close_log();
+
+	if (foreground_stopped)
+	{
+		// A console control handler that waits for this may now let the process end
+		HANDLE stopped = foreground_stopped;
+		SetEvent(stopped);
+		foreground_stopped = NULL;
+		CloseHandle(stopped);
+	}
+	run_in_foreground = 0;
+
+	return SUCCEEDED(hr);
+}
+
+//
+// Runs in the foreground as the entry point of a container. The wrapper ends with the exit code
+// of the child, so that the container does too. That includes the restart policy giving up, when
+// the exit code of the crash matters most.
+//
+int do_run_container(wrapper_config_t* config, wrapper_error_t** error)
+{
+	WRAPPER_INFO(_T("Running as the entry point of a container."));
+	const int rc = do_run_foreground(config, error);
+	exit_code_of_child = (DWORD)wrapper_metric_get(WRAPPER_METRIC_LAST_EXIT_CODE);
+	if (rc || exit_code_of_child)
+	{
+		WRAPPER_INFO(_T("The wrapper ends with exit code %lu of the child process."), exit_code_of_child);
+	}
+	return rc;
+}
+
+int wrapper_service_get_exit_code(void)
+{
+	return (int)exit_code_of_child;
+}
+
+int do_run_command(wrapper_config_t* config, int argc, TCHAR* argv[], wrapper_error_t** error)
+{
+	int foreground = 0;
+	int container = 0;
+
+	for (int i = 0; i < argc; i++)
+	{
+		if (0 == lstrcmpi(argv[i], _T("--foreground")))
+		{
+			foreground = 1;
+		}
+		else if (0 == lstrcmpi(argv[i], _T("--container")))
+		{
+			container = 1;
+		}
+		else
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(E_INVALIDARG, _T("The option '%s' isn't known"), argv[i]);
+			}
+			return 0;
+		}
+	}
+
+	if (container)
+	{
+		return do_run_container(config, error);
+	}
+	return foreground ? do_run_foreground(config, error) : do_run(config, error);
+}
+
+int wrapper_get_current_process_filename(TCHAR* buffer, size_t size, wrapper_config_t* config, wrapper_error_t** error)
+{
+	UNUSED(config);
+
+	if (!GetModuleFileName(NULL, buffer, (DWORD)size))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(GetLastError(), _T("Unable to get the filename of the current process"));
+		}
+		return 0;
+	}
+	return 1;
+}
+
+int wrapper_service_open_manager(SC_HANDLE* manager, wrapper_error_t** error)
+{
+	int rc = 1;
+	*manager = OpenSCManager(NULL, NULL, SC_MANAGER_ALL_ACCESS);
+	if (NULL == *manager)
+	{
+		rc = 0;
+		if (error)
+		{
+			*error = wrapper_error_from_system(GetLastError(), _T("Unable to get the filename of the current process"));
+		}
+	}
+	return rc;
+}
+
+int wrapper_service_create(SC_HANDLE* service, const SC_HANDLE manager, wrapper_config_t* config,
+                           wrapper_error_t** error)
+{
+	int rc = 1;
+	TCHAR* path = NULL;
+	TCHAR* service_name = NULL;
+	TCHAR* display_name = NULL;
+
+	if (rc)
+	{
+		rc = wrapper_string_duplicate(&service_name, config->name, error);
+	}
+
+	if (rc)
+	{
+		if (0 == _tcslen(config->title))
+		{
+			rc = wrapper_string_duplicate(&display_name, config->name, error);
+		}
+		else
+		{
+			rc = wrapper_string_duplicate(&display_name, config->title, error);
+		}
+	}
+
+
+	if (rc)
+	{
+		path = wrapper_allocate_string(_MAX_PATH);
+		if (!path)
+		{
+			rc = 0;
+			if (error)
+			{
+				*error = wrapper_error_from_system(ERROR_OUTOFMEMORY, _T("Unable to get the filename of the current process"));
+			}
+		}
+	}
+
+	if (rc)
+	{
+		rc = wrapper_get_current_process_filename(path, _MAX_PATH, config, error);
+	}
+
+	if (rc)
+	{
+		void* load_order_group = NULL;
+		void* tag_id = NULL;
+		void* dependencies = NULL;
+		void* username = NULL;
+		void* password = NULL;
+		const long desired_access = SERVICE_ALL_ACCESS;
+		const int service_type = SERVICE_WIN32_OWN_PROCESS;
+		const int start_type = SERVICE_DEMAND_START;
+		const int error_control = SERVICE_ERROR_NORMAL;
+
+		*service = CreateService(
+			manager,
+			service_name,
+			display_name,
+			desired_access,
+			service_type,
+			start_type,
+			error_control,
+			path,
+			load_order_group,
+			tag_id,
+			dependencies,
+			username,
+			password);
+
+		if (*service == NULL)
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(GetLastError(), _T("Failed to create service '%s' (%s)"), service_name,
+				                                   display_name);
+			}
+			rc = 0;
+		}
+	}
+
+	wrapper_free(service_name);
+	wrapper_free(display_name);
+	wrapper_free(path);
+
+	return rc;
+}
+
+//
+// Purpose: 
+//   Installs a service in the SCM database
+//
+// Parameters:
+//   None
+// 
+// Return value:
+//   None
+//
+int do_install(wrapper_config_t* config, wrapper_error_t** error)
+{
+	int rc = 1;
+	SC_HANDLE service = NULL;
+	SC_HANDLE manager = NULL;
+
+	if (rc)
+	{
+		rc = wrapper_service_open_manager(&manager, error);
+	}
+
+	if (rc)
+	{
+		rc = wrapper_service_create(&service, manager, config, error);
+	}
+
+	if (rc)
+	{
+		WRAPPER_INFO(_T("The service '%s' was successfully installed"), config->name);
+	}
+
+	if (service)
+	{
+		CloseServiceHandle(service);
+	}
+
+	if (manager)
+	{
+		CloseServiceHandle(manager);
+	}
+
+	return rc;
+}
+
+int wrapper_service_open(SC_HANDLE* service, const int desired_access, const SC_HANDLE manager,
+                         wrapper_config_t* config, wrapper_error_t** error)
+{
+	int rc = 1;
+	*service = OpenService(manager, config->name, desired_access);
+	if (*service == NULL)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(GetLastError(), _T("Failed to open service '%s'"), config->name);
+		}
+		rc = 0;
+	}
+	return rc;
+}
+
+int wrapper_service_get_config(LPQUERY_SERVICE_CONFIG* service_config,
+                               const SC_HANDLE service,
+                               wrapper_config_t* config,
+                               wrapper_error_t** error)
+{
+	int rc = 1;
+	DWORD bytes_needed = 0;
+	DWORD buffer_size = 0;
+	DWORD last_error = 0;
+	*service_config = NULL;
+
+	if (rc)
+	{
+		if (!QueryServiceConfig(
+			service,
+			NULL,
+			0,
+			&bytes_needed))
+		{
+			last_error = GetLastError();
+			if (ERROR_INSUFFICIENT_BUFFER == last_error)
+			{
+				buffer_size = bytes_needed;
+				*service_config = (LPQUERY_SERVICE_CONFIG)LocalAlloc(LMEM_FIXED, buffer_size);
+			}
+			else
+			{
+				if (error)
+				{
+					*error = wrapper_error_from_system(last_error, _T("Failed to query the configuration of service '%s'"),
+					                                   config->name);
+				}
+				rc = 0;
+			}
+		}
+	}
+
+	if (rc)
+	{
+		if (!QueryServiceConfig(
+			service,
+			*service_config,
+			buffer_size,
+			&bytes_needed))
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to query the configuration of service '%s'"),
+				                                   config->name);
+			}
+			rc = 0;
+		}
+	}
+
+	if (!rc)
+	{
+		LocalFree(*service_config);
+		*service_config = NULL;
+	}
+
+	return rc;
+}
+
+int wrapper_service_get_description(LPSERVICE_DESCRIPTION* service_description, SC_HANDLE service,
+                                    wrapper_config_t* config,
+                                    wrapper_error_t** error)
+{
+	int rc = 1;
+	DWORD bytes_needed = 0;
+	DWORD buffer_size = 0;
+	DWORD last_error = 0;
+	*service_description = NULL;
+
+	if (rc)
+	{
+#pragma warning( push )
+#pragma warning( disable: 28020 )
+		if (!QueryServiceConfig2(service, SERVICE_CONFIG_DESCRIPTION, NULL, 0, &bytes_needed))
+#pragma warning( pop )
+		{
+			last_error = GetLastError();
+			if (ERROR_INSUFFICIENT_BUFFER != last_error)
+			{
+				if (error)
+				{
+					*error = wrapper_error_from_system(last_error, _T("Failed to query the description of service '%s'"),
+					                                   config->name);
+				}
+				rc = 0;
+			}
+		}
+	}
+
+	if (rc)
+	{
+		buffer_size = bytes_needed;
+		*service_description = (LPSERVICE_DESCRIPTION)LocalAlloc(LMEM_FIXED, buffer_size);
+	}
+
+	if (rc)
+	{
+		if (!QueryServiceConfig2(service, SERVICE_CONFIG_DESCRIPTION, (LPBYTE)*service_description, buffer_size,
+		                         &bytes_needed))
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to query the description of service '%s'"), config->name);
+			}
+			rc = 0;
+		}
+	}
+
+	if (!rc)
+	{
+		LocalFree(*service_description);
+		*service_description = NULL;
+	}
+
+	return rc;
+}
+
+//
+// Purpose: 
+//   Retrieves and displays the current service configuration.
+//
+// Parameters:
+//   None
+// 
+// Return value:
+//   None
+//
+int do_status(wrapper_config_t* config, wrapper_error_t** error)
+{
+	SC_HANDLE manager = NULL;
+	SC_HANDLE service = NULL;
+	LPQUERY_SERVICE_CONFIG service_config = NULL;
+	LPSERVICE_DESCRIPTION service_description = NULL;
+
+	int rc = 1;
+
+	if (rc)
+	{
+		rc = wrapper_service_open_manager(&manager, error);
+	}
+
+	if (rc)
+	{
+		rc = wrapper_service_open(&service, SERVICE_QUERY_CONFIG, manager, config, error);
+	}
+
+	if (rc)
+	{
+		rc = wrapper_service_get_config(&service_config, service, config, error);
+	}
+
+	if (rc)
+	{
+		rc = wrapper_service_get_description(&service_description, service, config, error);
+	}
+
+	if (rc)
+	{
+		WRAPPER_INFO(TEXT("Configuration:"));
+		WRAPPER_INFO(TEXT("  %-20s: %s"), _T("Name"), config->name);
+		WRAPPER_INFO(TEXT("  %-20s: %s"), _T("Description"), service_description->lpDescription ? service_description->
+			lpDescription : _T(""));
+		WRAPPER_INFO(TEXT("  %-20s: %-2d (0x%08x)"), _T("Service Type"), service_config->dwServiceType, service_config->
+			dwServiceType);
+		WRAPPER_INFO(TEXT("  %-20s: %-2d (0x%08x)"), _T("Start Type"), service_config->dwStartType, service_config->
+			dwStartType);
+		WRAPPER_INFO(TEXT("  %-20s: %-2d (0x%08x)"), _T("Error Control"), service_config->dwErrorControl, service_config->
+			dwErrorControl);
+		WRAPPER_INFO(TEXT("  %-20s: %s"), _T("Path"), service_config->lpBinaryPathName);
+		WRAPPER_INFO(TEXT("  %-20s: %s"), _T("Account"), service_config->lpServiceStartName);
+		WRAPPER_INFO(TEXT("  %-20s: %s"), _T("Load Order Group"), service_config->lpLoadOrderGroup);
+		WRAPPER_INFO(TEXT("  %-20s: %-2d (0x%08x)"), _T("Tag ID"), service_config->dwTagId, service_config->dwTagId);
+		WRAPPER_INFO(TEXT("  %-20s: %s"), _T("Dependencies"), service_config->lpDependencies);
+	}
+
+	LocalFree(service_config);
+	LocalFree(service_description);
+
+	if (service)
+		CloseServiceHandle(service);
+
+	if (manager)
+		CloseServiceHandle(manager);
+
+	return rc;
+}
+
+int wrapper_service_set_start_type(const SC_HANDLE service, int start_type, wrapper_config_t* config,
+                                   wrapper_error_t** error)
+{
+	int rc = 1;
+	if (rc)
+	{
+		const unsigned service_type = SERVICE_NO_CHANGE;
+		unsigned error_control = SERVICE_NO_CHANGE;
+		void* binary_path_name = NULL;
+		void* load_order_group = NULL;
+		void* tag_id = NULL;
+		void* dependencies = NULL;
+		void* username = NULL;
+		void* password = NULL;
+		void* display_name = NULL;
+
+		if (!ChangeServiceConfig(
+			service,
+			service_type,
+			start_type,
+			error_control,
+			binary_path_name,
+			load_order_group,
+			tag_id,
+			dependencies,
+			username,
+			password,
+			display_name))
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(GetLastError(), _T("Failed to disable service '%s'"), config->name);
+			}
+			rc = 0;
+		}
+	}
+	return rc;
+}
+
+//
+// Purpose: 
+//   Disables the service.
+//
+// Parameters:
+//   None
+// 
+// Return value:
+//   None
+//
+int do_disable(wrapper_config_t* config, wrapper_error_t** error)
+{
+	SC_HANDLE manager = NULL;
+	SC_HANDLE service = NULL;
+
+	int rc = 1;
+	if (rc)
+	{
+		rc = wrapper_service_open_manager(&manager, error);
+	}
+
+	if (rc)
+	{
+		rc = wrapper_service_open(&service, SERVICE_CHANGE_CONFIG, manager, config, error);
+	}
+
+	if (rc)
+	{
+		rc = wrapper_service_set_start_type(service, SERVICE_DISABLED, config, error);
+	}
+
+	if (rc)
+	{
+		WRAPPER_INFO(_T("Successfully disabled service '%s'"), config->name);
+	}
+
+	if (service)
+	{
+		CloseServiceHandle(service);
+	}
+
+	if (manager)
+	{
+		CloseServiceHandle(manager);
+	}
+	return rc;
+}
+
+//
+// Purpose: 
+//   Enables the service.
+//
+// Parameters:
+//   None
+// 
+// Return value:
+//   None
+//
+int do_enable(wrapper_config_t* config, wrapper_error_t** error)
+{
+	SC_HANDLE manager = NULL;
+	SC_HANDLE service = NULL;
+
+	int rc = 1;
+	if (rc)
+	{
+		rc = wrapper_service_open_manager(&manager, error);
+	}
+
+	if (rc)
+	{
+		rc = wrapper_service_open(&service, SERVICE_CHANGE_CONFIG, manager, config, error);
+	}
+
+	if (rc)
+	{
+		rc = wrapper_service_set_start_type(service, SERVICE_DEMAND_START, config, error);
+	}
+
+	if (rc)
+	{
+		WRAPPER_INFO(_T("Successfully enabled service '%s'"), config->name);
+	}
+
+	if (service)
+	{
+		CloseServiceHandle(service);
+	}
+
+	if (manager)
+	{
+		CloseServiceHandle(manager);
+	}
+	return rc;
+}
+
+int wrapper_service_set_description(SC_HANDLE service, wrapper_config_t* config, wrapper_error_t** error)
+{
+	int rc = 1;
+	SERVICE_DESCRIPTION service_description = {0};
+	service_description.lpDescription = config->description;
+	if (!ChangeServiceConfig2(service, SERVICE_CONFIG_DESCRIPTION, &service_description))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(GetLastError(), _T("Failed to set the description of service '%s'"),
+			                                   config->name);
+		}
+		rc = 0;
+	}
+	return rc;
+}
+
+int do_update(wrapper_config_t* config, wrapper_error_t** error)
+{
+	SC_HANDLE manager = NULL;
+	SC_HANDLE service = NULL;
+
+	int rc = 1;
+	if (rc)
+	{
+		rc = wrapper_service_open_manager(&manager, error);
+	}
+
+	if (rc)
+	{
+		rc = wrapper_service_open(&service, SERVICE_CHANGE_CONFIG, manager, config, error);
+	}
+
+	if (rc)
+	{
+		rc = wrapper_service_set_description(service, config, error);
+	}
+
+	if (rc)
+	{
+		WRAPPER_INFO(_T("Successfully changed the description of service '%s'"), config->name);
+	}
+
+	if (service)
+	{
+		CloseServiceHandle(service);
+	}
+
+	if (manager)
+	{
+		CloseServiceHandle(manager);
+	}
+	return rc;
+}
+
+int wrapper_service_delete2(SC_HANDLE service, wrapper_config_t* config, wrapper_error_t** error)
+{
+	int rc = 1;
+	if (!DeleteService(service))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(GetLastError(), _T("Failed to delete service '%s'"), config->name);
+		}
+		rc = 0;
+	}
+	return rc;
+}
+
+int do_delete(wrapper_config_t* config, wrapper_error_t** error)
+{
+	SC_HANDLE manager = NULL;
+	SC_HANDLE service = NULL;
+
+	int rc = 1;
+	if (rc)
+	{
+		rc = wrapper_service_open_manager(&manager, error);
+	}
+
+	if (rc)
+	{
+		rc = wrapper_service_open(&service, SERVICE_ALL_ACCESS, manager, config, error);
+	}
+
+	if (rc)
+	{
+		rc = wrapper_service_delete2(service, config, error);
+	}
+
+	if (rc)
+	{
+		WRAPPER_INFO(_T("Successfully deleted service '%s'"), config->name);
+	}
+
+	if (service)
+	{
+		CloseServiceHandle(service);
+	}
+
+	if (manager)
+	{
+		CloseServiceHandle(manager);
+	}
+
+	return rc;
+}
+
+
+BOOL wrapper_service_stop_dependent_services(SC_HANDLE schSCManager, SC_HANDLE schService);
+
+int wrapper_service_get_status(SC_HANDLE service,
+                               SERVICE_STATUS_PROCESS* status,
+                               const wrapper_config_t* config,
+                               wrapper_error_t** error)
+{
+	int rc = 1;
+	DWORD bytes_needed;
+	if (!QueryServiceStatusEx(service, SC_STATUS_PROCESS_INFO, (LPBYTE)status, sizeof(SERVICE_STATUS_PROCESS), &bytes_needed))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(GetLastError(), _T("Failed to query the status of the service '%s'"),
+			                                   config->name);
+		}
+		rc = 0;
+	}
+	else
+	{
+		WRAPPER_DEBUG(_T("Status of service '%s':"), config->name);
+		WRAPPER_DEBUG(TEXT("  %-20s: 0x%08x (%d)"), _T("Check Point"), status->dwCheckPoint, status->dwCheckPoint);
+		WRAPPER_DEBUG(TEXT("  %-20s: 0x%08x (%d)"), _T("Controls Accepted"), status->dwControlsAccepted, status->dwControlsAccepted);
+		WRAPPER_DEBUG(TEXT("  %-20s: 0x%08x (%d)"), _T("Current State"), status->dwCurrentState, status->dwCurrentState);
+		WRAPPER_DEBUG(TEXT("  %-20s: 0x%08x (%d)"), _T("Process Id"), status->dwProcessId, status->dwProcessId);
+		WRAPPER_DEBUG(TEXT("  %-20s: 0x%08x (%d)"), _T("Service Flags"), status->dwServiceFlags, status->dwServiceFlags);
+		WRAPPER_DEBUG(TEXT("  %-20s: 0x%08x (%d)"), _T("Service Type"), status->dwServiceType, status->dwServiceType);
+		WRAPPER_DEBUG(TEXT("  %-20s: 0x%08x (%d)"), _T("Service Exit Code"), status->dwServiceSpecificExitCode, status->dwServiceSpecificExitCode);
+		WRAPPER_DEBUG(TEXT("  %-20s: 0x%08x (%d)"), _T("Wait Hint"), status->dwWaitHint, status->dwWaitHint);
+		WRAPPER_DEBUG(TEXT("  %-20s: 0x%08x (%d)"), _T("Win32 Exit Code"), status->dwWin32ExitCode, status->dwWin32ExitCode);
+	}
+	return rc;
+}
+
+int wrapper_service_is_not_stopped(DWORD status)
+{
+	return status != SERVICE_STOPPED && status != SERVICE_STOP_PENDING;
+}
+
+DWORD wrapper_service_get_recommended_wait_time(const DWORD wait_hint)
+{
+	// Do not wait longer than the wait hint. A good interval is 
+	// one-tenth the wait hint, but no less than 1 second and no 
+	// more than 10 seconds. 
+	const DWORD wait_time = wait_hint / 10;
+	if (wait_time < 1000) 
+	{
+		return 1000;
+	}
+
+	if (wait_time > 10000) 
+	{
+		return 10000;
+	}
+	return wait_time;
+}
+
+int wrapper_service_wait_to_stop(SC_HANDLE service, wrapper_config_t* config, wrapper_error_t** error)
+{
+	int rc = 1;
+
+	SERVICE_STATUS_PROCESS status = {0};
+	if (rc)
+	{
+		rc = wrapper_service_get_status(service, &status, config, error);
+	}
+
+	if (rc)
+	{
+		if (wrapper_service_is_not_stopped(status.dwCurrentState))
+		{
+			WRAPPER_INFO(_T("The service '%s' is running."), config->name);
+			return 1;
+		}
+	}
+
+	WRAPPER_INFO(_T("Waiting for the service '%s' to stop."), config->name);
+	ULONGLONG start_tick_count = GetTickCount64();
+	DWORD old_check_point = status.dwCheckPoint;
+	while (rc && (status.dwCurrentState == SERVICE_STOP_PENDING))
+	{
+		const DWORD milliseconds = wrapper_service_get_recommended_wait_time(status.dwWaitHint);
+		Sleep(milliseconds);
+		if (rc)
+		{
+			rc = wrapper_service_get_status(service, &status, config, error);
+		}
+
+		if (rc)
+		{
+			if (status.dwCurrentState != SERVICE_STOP_PENDING)
+			{
+				break;
+			}
+		}
+
+		if (status.dwCheckPoint > old_check_point)
+		{
+			start_tick_count = GetTickCount64();
+			old_check_point = status.dwCheckPoint;
+			continue;
+		}
+		
+		if (GetTickCount64() - start_tick_count > status.dwWaitHint)
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(ERROR_TIMEOUT, _T("An timeout occurred while waiting for the service '%s' to stop."), config->name);
+			}
+			rc = 0;
+		}
+	}
+	return 1;
+}
+
+int wrapper_service_start(const SC_HANDLE service, const wrapper_config_t* config, wrapper_error_t** error)
+{
+	if (!StartService(service, 0, NULL)) 
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(GetLastError(), _T("Failed to start the service '%s'"), config->name);
+		}
+		return 0;
+	}
+	return 1;
+}
+
+int wrapper_service_wait_to_start(const SC_HANDLE service, const wrapper_config_t* config, wrapper_error_t** error)
+{
+	int rc = 1;
+	SERVICE_STATUS_PROCESS status = {0};
+
+	if (rc)
+	{
+		rc = wrapper_service_get_status(service, &status, config, error);
+	}
+
+	ULONGLONG start_tick_count = GetTickCount64();
+	DWORD old_check_point = status.dwCheckPoint;
+	WRAPPER_INFO(_T("Waiting for service '%s' to start."), config->name);
+
+	while (rc && (status.dwCurrentState == SERVICE_START_PENDING))
+	{
+		const DWORD milliseconds = wrapper_service_get_recommended_wait_time(status.dwWaitHint);
+		Sleep(milliseconds);
+
+		if (rc)
+		{
+			rc = wrapper_service_get_status(service, &status, config, error);
+		}
+
+		if (rc)
+		{
+			if(status.dwCurrentState != SERVICE_START_PENDING)
+			{
+				break;
+			}
+		}
+
+		if (status.dwCheckPoint > old_check_point)
+		{
+			// Continue to wait and check.
+			start_tick_count = GetTickCount64();
+			old_check_point = status.dwCheckPoint;
+		}
+		else if (GetTickCount64() - start_tick_count > status.dwWaitHint)
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(ERROR_TIMEOUT, _T("An timeout occurred while waiting for the service '%s' to start."), config->name);
+			}
+			rc = 0;
+			break;
+		}
+	}
+	return rc;
+}
+
+//
+// Purpose: 
+//   Starts the service if possible.
+//
+// Parameters:
+//   None
+// 
+// Return value:
+//   None
+//
+int do_start(wrapper_config_t* config, wrapper_error_t** error)
+{
+	SC_HANDLE manager = NULL;
+	SC_HANDLE service = NULL;
+
+	int rc = 1;
+	if (rc)
+	{
+		rc = wrapper_service_open_manager(&manager, error);
+	}
+
+	if (rc)
+	{
+		rc = wrapper_service_open(&service, SERVICE_ALL_ACCESS, manager, config, error);
+	}
+
+	if (rc)
+	{
+		rc = wrapper_service_wait_to_stop(service, config, error);
+	}
+
+	if (rc)
+	{
+		rc = wrapper_service_start(service, config, error);
+	}
+
+	if (rc)
+	{
+		rc = wrapper_service_wait_to_start(service, config, error);
+	}
+
+	SERVICE_STATUS_PROCESS status = {0};
+	if (rc)
+	{
+		rc = wrapper_service_get_status(service, &status, config, error);
+	}
+
+	if (rc)
+	{
+		if (status.dwCurrentState == SERVICE_RUNNING)
+		{
+			WRAPPER_INFO(_T("Service '%s' started successfully."), config->name);
+		}
+	}
+
+	if (service)
+	{
+		CloseServiceHandle(service);
+	}
+
+	if (manager)
+	{
+		CloseServiceHandle(manager);
+	}
+
+	return rc;
+}
+
+int wrapper_service_stop(SC_HANDLE service, wrapper_config_t* config, wrapper_error_t** error)
+{
+	SERVICE_STATUS_PROCESS status = {0};
+	if (!ControlService(service, SERVICE_CONTROL_STOP, (LPSERVICE_STATUS)&status))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(GetLastError(), _T("Failed to stop the service '%s'"), config->name);
+		}
+		return 0;
+	}
+	return 1;
+}
+
+int wrapper_service_wait_to_stop2(SC_HANDLE service, wrapper_config_t* config, wrapper_error_t** error)
+{
+	int rc = 1;
+	SERVICE_STATUS_PROCESS status = { 0 };
+
+	if (rc)
+	{
+		rc = wrapper_service_get_status(service, &status, config, error);
+	}
+
+	ULONGLONG start_tick_count = GetTickCount64();
+	DWORD old_check_point = status.dwCheckPoint;
+	while (rc && (status.dwCurrentState != SERVICE_STOPPED))
+	{
+		const DWORD milliseconds = wrapper_service_get_recommended_wait_time(status.dwWaitHint);
+		WRAPPER_INFO(_T("Waiting %dms for service '%s' to stop."), milliseconds, config->name);
+		Sleep(milliseconds);
+
+		if (rc)
+		{
+			rc = wrapper_service_get_status(service, &status, config, error);
+		}
+
+		if (rc)
+		{
+			if (status.dwCurrentState == SERVICE_STOPPED)
+			{
+				break;
+			}
+		}
+
+		if (status.dwCheckPoint > old_check_point)
+		{
+			// Continue to wait and check.
+			start_tick_count = GetTickCount64();
+			old_check_point = status.dwCheckPoint;
+		}
+		else
+		{
+			if (GetTickCount64() - start_tick_count > status.dwWaitHint)
+			{
+				if (error)
+				{
+					*error = wrapper_error_from_system(ERROR_TIMEOUT, _T("An timeout occurred while waiting for the service '%s' to stop."), config->name);
+				}
+				rc = 0;
+				break;
+			}
+		}
+	}
+
+	return rc;
+}
+
+int do_stop(wrapper_config_t* config, wrapper_error_t** error)
+{
+	SC_HANDLE manager = NULL;
+	SC_HANDLE service = NULL;
+
+	int rc = 1;
+	if (rc)
+	{
+		rc = wrapper_service_open_manager(&manager, error);
+	}
+
+	if (rc)
+	{
+		const int desired_access = SERVICE_STOP |
+			SERVICE_QUERY_STATUS |
+			SERVICE_ENUMERATE_DEPENDENTS;
+
+		rc = wrapper_service_open(&service, desired_access, manager, config, error);
+	}
+
+	SERVICE_STATUS_PROCESS status = { 0 };
+	if (rc)
+	{
+		rc = wrapper_service_get_status(service, &status, config, error);
+	}
+
+	if (rc)
+	{
+		if (status.dwCurrentState != SERVICE_STOPPED)
+		{
+			rc = wrapper_service_wait_to_stop(service, config, error);
+
+			if (rc)
+			{
+				rc = wrapper_service_stop(service, config, error);
+			}
+
+			if (rc)
+			{
+				rc = wrapper_service_wait_to_stop2(service, config, error);
+			}
+
+			WRAPPER_INFO(_T("Service '%s' stopped successfully"), config->name);
+		}
+		else
+		{
+			WRAPPER_INFO(_T("Service '%s' is already stopped."), config->name);
+		}
+	}
+
+	if (service)
+	{
+		CloseServiceHandle(service);
+	}
+	if (manager)
+	{
+		CloseServiceHandle(manager);
+	}
+	return rc;
+}
+
+int do_reload(wrapper_config_t* config, wrapper_error_t** error)
+{
+	SC_HANDLE manager = NULL;
+	SC_HANDLE service = NULL;
+
+	int rc = 1;
+	if (rc)
+	{
+		rc = wrapper_service_open_manager(&manager, error);
+	}
+
+	if (rc)
+	{
+		rc = wrapper_service_open(&service, SERVICE_PAUSE_CONTINUE, manager, config, error);
+	}
+
+	if (rc)
+	{
+		SERVICE_STATUS status = {0};
+		if (!ControlService(service, SERVICE_CONTROL_PARAMCHANGE, &status))
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(GetLastError(), _T("Failed to reload the configuration of service '%s'"),
+				                                   config->name);
+			}
+			rc = 0;
+		}
+		else
+		{
+			WRAPPER_INFO(_T("Asked service '%s' to reload its configuration"), config->name);
+		}
+	}
+
+	if (service)
+	{
+		CloseServiceHandle(service);
+	}
+	if (manager)
+	{
+		CloseServiceHandle(manager);
+	}
+	return rc;
+}
+
+
+//
+// Sends a request to the control pipe of the running service and prints what it returns.
+//
+static int wrapper_control_send(wrapper_config_t* config, const char* request, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	HANDLE pipe = INVALID_HANDLE_VALUE;
+	char* reply = NULL;
+	DWORD length = 0;
+	TCHAR name[MAX_PATH];
+	TCHAR path[MAX_PATH];
+
+	_sntprintf_s(name, _countof(name), _TRUNCATE, WRAPPER_CONTROL_PIPE_NAME_FORMAT, config->name);
+	_sntprintf_s(path, _countof(path), _TRUNCATE, _T("\\\\.\\pipe\\%s"), name);
+
+	if (SUCCEEDED(hr))
+	{
+		reply = wrapper_allocate(WRAPPER_CONTROL_REPLY_MAX_LEN + 1);
+		if (!reply)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the reply"));
+			}
+		}
+	}
+
+	while (SUCCEEDED(hr) && INVALID_HANDLE_VALUE == pipe)
+	{
+		pipe = CreateFile(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+		if (INVALID_HANDLE_VALUE != pipe)
+		{
+			break;
+		}
+
+		const DWORD last_error = GetLastError();
+		if (ERROR_PIPE_BUSY == last_error && WaitNamedPipe(path, WRAPPER_CONTROL_TIMEOUT))
+		{
+			continue;
+		}
+
+		if (error)
+		{
+			if (ERROR_FILE_NOT_FOUND == last_error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Service '%s' isn't running"), config->name);
+			}
+			else
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to connect to service '%s'"), config->name);
+			}
+		}
+		hr = HRESULT_FROM_WIN32(last_error);
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		DWORD mode = PIPE_READMODE_MESSAGE;
+		if (!SetNamedPipeHandleState(pipe, &mode, NULL, NULL) ||
+			!TransactNamedPipe(pipe, (LPVOID)request, (DWORD)strlen(request), reply, WRAPPER_CONTROL_REPLY_MAX_LEN,
+			                   &length, NULL))
+		{
+			const DWORD last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to send '%hs' to service '%s'"), request,
+				                                   config->name);
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		reply[length] = '\0';
+		if (0 == strncmp(reply, "OK\n", 3))
+		{
+			_tprintf(_T("%hs"), reply + 3);
+		}
+		else
+		{
+			reply[strcspn(reply, "\n")] = '\0';
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(E_FAIL, _T("Service '%s' refused '%hs': %hs"), config->name, request,
+				                                    0 == strncmp(reply, "ERROR ", 6) ? reply + 6 : reply);
+			}
+			hr = E_FAIL;
+		}
+	}
+
+	if (INVALID_HANDLE_VALUE != pipe)
+	{
+		CloseHandle(pipe);
+	}
+	wrapper_free(reply);
+	return SUCCEEDED(hr);
+}
+
+int do_control_status(wrapper_config_t* config, wrapper_error_t** error)
+{
+	return wrapper_control_send(config, "status", error);
+}
+
+int do_control_restart(wrapper_config_t* config, wrapper_error_t** error)
+{
+	return wrapper_control_send(config, "restart", error);
+}
+
+int do_control_pause(wrapper_config_t* config, wrapper_error_t** error)
+{
+	return wrapper_control_send(config, "pause", error);
+}
+
+int do_control_continue(wrapper_config_t* config, wrapper_error_t** error)
+{
+	return wrapper_control_send(config, "continue", error);
+}
+
+int do_control_log_level(wrapper_config_t* config, int argc, TCHAR* argv[], wrapper_error_t** error)
+{
+	char request[64] = "log-level";
+
+	if (argc > 0)
+	{
+		char level[32] = {0};
+#ifdef UNICODE
+		WideCharToMultiByte(CP_UTF8, 0, argv[0], -1, level, sizeof level - 1, NULL, NULL);
+#else
+		StringCbCopyA(level, sizeof level, argv[0]);
+#endif
+		StringCbPrintfA(request, sizeof request, "log-level %s", level);
+	}
+	return wrapper_control_send(config, request, error);
+}
+
+int do_control_stats(wrapper_config_t* config, wrapper_error_t** error)
+{
+	return wrapper_control_send(config, "stats", error);
+}
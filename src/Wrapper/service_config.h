@@ -1,15 +1,26 @@
-// Copyright (c) Werner Strydom. All rights reserved.
-// Licensed under the MIT license. See LICENSE in the project root for license information.
-
-#pragma once
-#include "wrapper-config.h"
-
-int do_install(wrapper_config_t* config, wrapper_error_t** error);
-int do_status(wrapper_config_t* config, wrapper_error_t** error);
-int do_update(wrapper_config_t* config, wrapper_error_t** error);
-int do_disable(wrapper_config_t* config, wrapper_error_t** error);
-int do_enable(wrapper_config_t* config, wrapper_error_t** error);
-int do_delete(wrapper_config_t* config, wrapper_error_t** error);
-int do_start(wrapper_config_t* config, wrapper_error_t** error);
-int do_stop(wrapper_config_t* config, wrapper_error_t** error);
-int do_run(wrapper_config_t* config, wrapper_error_t** error);
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#pragma once
+#include "wrapper-config.h"
+
+int do_install(wrapper_config_t* config, wrapper_error_t** error);
+int do_status(wrapper_config_t* config, wrapper_error_t** error);
+int do_update(wrapper_config_t* config, wrapper_error_t** error);
+int do_disable(wrapper_config_t* config, wrapper_error_t** error);
+int do_enable(wrapper_config_t* config, wrapper_error_t** error);
+int do_delete(wrapper_config_t* config, wrapper_error_t** error);
+int do_start(wrapper_config_t* config, wrapper_error_t** error);
+int do_stop(wrapper_config_t* config, wrapper_error_t** error);
+int do_reload(wrapper_config_t* config, wrapper_error_t** error);
+int do_run(wrapper_config_t* config, wrapper_error_t** error);
+int do_run_foreground(wrapper_config_t* config, wrapper_error_t** error);
+int do_run_container(wrapper_config_t* config, wrapper_error_t** error);
+int do_run_command(wrapper_config_t* config, int argc, TCHAR* argv[], wrapper_error_t** error);
+int wrapper_service_get_exit_code(void);
+int do_control_status(wrapper_config_t* config, wrapper_error_t** error);
+int do_control_restart(wrapper_config_t* config, wrapper_error_t** error);
+int do_control_pause(wrapper_config_t* config, wrapper_error_t** error);
+int do_control_continue(wrapper_config_t* config, wrapper_error_t** error);
+int do_control_log_level(wrapper_config_t* config, int argc, TCHAR* argv[], wrapper_error_t** error);
+int do_control_stats(wrapper_config_t* config, wrapper_error_t** error);
@@ -1,18 +1,21 @@
-// Copyright (c) Werner Strydom. All rights reserved.
-// Licensed under the MIT license. See LICENSE in the project root for license information.
-
-#pragma once
-#include "wrapper-error.h"
-#include "service_config.h"
-
-typedef int (*wrapper_command_func)(wrapper_config_t* config, wrapper_error_t** error);
-
-typedef struct wrapper_command_t
-{
-	TCHAR* name;
-	TCHAR* description;
-	wrapper_command_func func;
-} wrapper_command_t;
-
-int wrapper_command_execute(wrapper_command_t* commands, const TCHAR* command_text, wrapper_config_t* config,
-                            wrapper_error_t** error);
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#pragma once
+#include "wrapper-error.h"
+#include "service_config.h"
+
+typedef int (*wrapper_command_func)(wrapper_config_t* config, wrapper_error_t** error);
+typedef int (*wrapper_command_args_func)(wrapper_config_t* config, int argc, TCHAR* argv[], wrapper_error_t** error);
+
+typedef struct wrapper_command_t
+{
+	TCHAR* name;
+	TCHAR* description;
+	wrapper_command_func func;
+	// Commands that take arguments get the ones that follow the name of the command instead
+	wrapper_command_args_func func_args;
+} wrapper_command_t;
+
+int wrapper_command_execute(wrapper_command_t* commands, int argc, TCHAR* argv[], wrapper_config_t* config,
+                            wrapper_error_t** error);
@@ -1,148 +1,1388 @@
-// Copyright (c) Werner Strydom. All rights reserved.
-// Licensed under the MIT license. See LICENSE in the project root for license information.
-
-#include "stdafx.h"
-#include "wrapper-error.h"
-#include "wrapper-config.h"
-
-wrapper_config_t* wrapper_config_alloc(void)
-{
-	wrapper_config_t* config = NULL;
-	config = LocalAlloc(LPTR, sizeof(wrapper_config_t));
-	if (config)
-	{
-		config->name = LocalAlloc(LPTR, sizeof(TCHAR) * (WRAPPER_SERVICE_NAME_MAX_LEN + 1));
-		config->title = LocalAlloc(LPTR, sizeof(TCHAR) * (WRAPPER_SERVICE_TITLE_MAX_LEN + 1));
-		config->description = LocalAlloc(LPTR, sizeof(TCHAR) * (WRAPPER_SERVICE_DESCRIPTION_MAX_LEN + 1));
-		config->command_line = LocalAlloc(LPTR, sizeof(TCHAR) * (WRAPPER_SERVICE_CMDLINE_MAX_LEN + 1));
-		config->working_directory = LocalAlloc(LPTR, sizeof(TCHAR) * (WRAPPER_SERVICE_WORKDIR_MAX_LEN + 1));
-
-		// If any member is NULL, then we do not have sufficient memory. 
-		if (!config->name || !config->title || !config->description || !config->command_line || !config->working_directory)
-		{
-			wrapper_config_free(config);
-			config = NULL;
-		}
-	}
-	return config;
-}
-
-void wrapper_config_free(wrapper_config_t* config)
-{
-	if (config)
-	{
-		LocalFree(config->name);
-		LocalFree(config->title);
-		LocalFree(config->description);
-		LocalFree(config->command_line);
-		LocalFree(config);
-	}
-}
-
-int wrapper_config_get_path(TCHAR* path, const size_t size, wrapper_error_t** error)
-{
-	int rc = 1;
-	if (rc)
-	{
-		if (!GetModuleFileName(NULL, path, (DWORD)size))
-		{
-			if (error)
-			{
-				*error = wrapper_error_from_system(GetLastError(), _T("Unable to get the current module name"));
-			}
-			rc = 0;
-		}
-	}
-
-	if (rc)
-	{
-		HRESULT hr = PathCchRenameExtension(path, size, _T(".cfg"));
-		if (FAILED(hr))
-		{
-			if (error)
-			{
-				*error = wrapper_error_from_system(hr, _T("Unable to change the extension of '%s' to '.cfg'"), path);
-			}
-			rc = 0;
-		}
-	}
-
-	return rc;
-}
-
-int wrapper_config_read_string(
-	TCHAR* buffer,
-	DWORD size,
-	TCHAR* section,
-	TCHAR* key,
-	TCHAR* default_value,
-	TCHAR* path,
-	wrapper_error_t** error
-)
-{
-	if (GetPrivateProfileString(section, key, EMPTY_STRING, buffer, size, path))
-	{
-		return 1;
-	}
-
-	DWORD last_error = GetLastError();
-	if (default_value && ERROR_FILE_NOT_FOUND == last_error)
-	{
-		StringCbCopy(buffer, size, default_value);
-		return 1;
-	}
-
-	if (error)
-	{
-		*error = wrapper_error_from_system(
-			last_error, _T("Unable to read the value of '%s' in section '%s' of configuration file '%s'"), key, section, path);
-	}
-	return 0;
-}
-
-int wrapper_config_read(TCHAR* path, wrapper_config_t* config, wrapper_error_t** error)
-{
-	if (!path)
-	{
-		return 0;
-	}
-
-	if (!config)
-	{
-		return 0;
-	}
-
-	TCHAR* section_name = _T("Unit");
-
-	if (!wrapper_config_read_string(config->name, WRAPPER_SERVICE_NAME_MAX_LEN, section_name, _T("Name"), NULL, path,
-	                                error))
-	{
-		return 0;
-	}
-
-	if (!wrapper_config_read_string(config->title, WRAPPER_SERVICE_TITLE_MAX_LEN, section_name, _T("Title"), config->name,
-	                                path, error))
-	{
-		return 0;
-	}
-
-	if (!wrapper_config_read_string(config->description, WRAPPER_SERVICE_DESCRIPTION_MAX_LEN, section_name,
-	                                _T("Description"), EMPTY_STRING, path, error))
-	{
-		return 0;
-	}
-
-	if (!wrapper_config_read_string(config->command_line, WRAPPER_SERVICE_CMDLINE_MAX_LEN, section_name, _T("CommandLine"),
-	                                NULL, path, error))
-	{
-		return 0;
-	}
-
-	if (!wrapper_config_read_string(config->working_directory, WRAPPER_SERVICE_WORKDIR_MAX_LEN, section_name,
-	                                _T("WorkingDirectory"), EMPTY_STRING, path, error))
-	{
-		return 0;
-	}
-
-	return 1;
-}
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#include "stdafx.h"
+#include "wrapper-error.h"
+#include "wrapper-config.h"
+#include "wrapper-ini.h"
+#include "wrapper-utils.h"
+
+wrapper_config_t* wrapper_config_alloc(void)
+{
+	wrapper_config_t* config = NULL;
+	config = LocalAlloc(LPTR, sizeof(wrapper_config_t));
+	if (config)
+	{
+		config->name = LocalAlloc(LPTR, sizeof(TCHAR) * (WRAPPER_SERVICE_NAME_MAX_LEN + 1));
+		config->title = LocalAlloc(LPTR, sizeof(TCHAR) * (WRAPPER_SERVICE_TITLE_MAX_LEN + 1));
+		config->description = LocalAlloc(LPTR, sizeof(TCHAR) * (WRAPPER_SERVICE_DESCRIPTION_MAX_LEN + 1));
+		config->command_line = LocalAlloc(LPTR, sizeof(TCHAR) * (WRAPPER_SERVICE_CMDLINE_MAX_LEN + 1));
+		config->working_directory = LocalAlloc(LPTR, sizeof(TCHAR) * (WRAPPER_SERVICE_WORKDIR_MAX_LEN + 1));
+		config->metrics_address = LocalAlloc(LPTR, sizeof(TCHAR) * (WRAPPER_METRICS_ADDRESS_MAX_LEN + 1));
+
+		// If any member is NULL, then we do not have sufficient memory. 
+		if (!config->name || !config->title || !config->description || !config->command_line || !config->working_directory ||
+			!config->metrics_address)
+		{
+			wrapper_config_free(config);
+			config = NULL;
+		}
+	}
+	return config;
+}
+
+void wrapper_config_free(wrapper_config_t* config)
+{
+	if (config)
+	{
+		LocalFree(config->name);
+		LocalFree(config->title);
+		LocalFree(config->description);
+		LocalFree(config->command_line);
+		LocalFree(config->working_directory);
+		LocalFree(config->metrics_address);
+		LocalFree(config->environment.variables);
+		LocalFree(config->files);
+		LocalFree(config);
+	}
+}
+
+int wrapper_config_get_path(TCHAR* path, const size_t size, wrapper_error_t** error)
+{
+	int rc = 1;
+	if (rc)
+	{
+		if (!GetModuleFileName(NULL, path, (DWORD)size))
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(GetLastError(), _T("Unable to get the current module name"));
+			}
+			rc = 0;
+		}
+	}
+
+	if (rc)
+	{
+		HRESULT hr = PathCchRenameExtension(path, size, _T(".cfg"));
+		if (FAILED(hr))
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(hr, _T("Unable to change the extension of '%s' to '.cfg'"), path);
+			}
+			rc = 0;
+		}
+	}
+
+	return rc;
+}
+
+//
+// Copies the value of the key to the buffer, or an empty string when the key is missing.
+//
+static int wrapper_config_get_value(
+	TCHAR* buffer,
+	size_t size,
+	const TCHAR* section,
+	const TCHAR* key,
+	const wrapper_ini_t* ini,
+	wrapper_error_t** error
+)
+{
+	const TCHAR* value = wrapper_ini_get(ini, section, key);
+	if (FAILED(StringCchCopy(buffer, size, value ? value : EMPTY_STRING)))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INSUFFICIENT_BUFFER,
+			                                   _T("The value of '%s' in section '%s' of configuration file '%s' is longer than %lu characters"),
+			                                   key, section, wrapper_ini_get_path(ini), (DWORD)(size - 1));
+		}
+		return 0;
+	}
+	return 1;
+}
+
+int wrapper_config_read_string(
+	TCHAR* buffer,
+	DWORD size,
+	TCHAR* section,
+	TCHAR* key,
+	TCHAR* default_value,
+	const wrapper_ini_t* ini,
+	wrapper_error_t** error
+)
+{
+	const TCHAR* value = wrapper_ini_get(ini, section, key);
+	if (!value || !*value)
+	{
+		if (!default_value)
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(ERROR_NOT_FOUND,
+				                                   _T("Unable to read the value of '%s' in section '%s' of configuration file '%s'"),
+				                                   key, section, wrapper_ini_get_path(ini));
+			}
+			return 0;
+		}
+		value = default_value;
+	}
+
+	if (FAILED(StringCchCopy(buffer, size, value)))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INSUFFICIENT_BUFFER,
+			                                   _T("The value of '%s' in section '%s' of configuration file '%s' is longer than %lu characters"),
+			                                   key, section, wrapper_ini_get_path(ini), size - 1);
+		}
+		return 0;
+	}
+	return 1;
+}
+
+int wrapper_config_read_int(
+	DWORD* value,
+	TCHAR* section,
+	TCHAR* key,
+	DWORD default_value,
+	const wrapper_ini_t* ini,
+	wrapper_error_t** error
+)
+{
+	TCHAR buffer[32] = {0};
+	TCHAR* end = NULL;
+
+	if (!wrapper_config_get_value(buffer, _countof(buffer), section, key, ini, error))
+	{
+		return 0;
+	}
+
+	if (0 == buffer[0])
+	{
+		*value = default_value;
+		return 1;
+	}
+
+	const DWORD result = _tcstoul(buffer, &end, 10);
+	if (end == buffer || *end)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+			                                   _T("The value '%s' of '%s' in section '%s' of configuration file '%s' is not a valid number"),
+			                                   buffer, key, section, wrapper_ini_get_path(ini));
+		}
+		return 0;
+	}
+
+	*value = result;
+	return 1;
+}
+
+//
+// Reads a number that can't be 0, e.g. an interval that would otherwise make a loop spin.
+//
+static int wrapper_config_read_positive_int(DWORD* value, TCHAR* section, TCHAR* key, DWORD default_value,
+                                            const wrapper_ini_t* ini, wrapper_error_t** error)
+{
+	if (!wrapper_config_read_int(value, section, key, default_value, ini, error))
+	{
+		return 0;
+	}
+
+	if (*value < 1)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+			                                   _T("The value %lu of '%s' in section '%s' of configuration file '%s' must be at least 1"),
+			                                   *value, key, section, wrapper_ini_get_path(ini));
+		}
+		return 0;
+	}
+	return 1;
+}
+
+//
+// Reads a size in bytes. The value may have a K, M or G suffix, e.g. "100M".
+//
+int wrapper_config_read_size(
+	ULONGLONG* value,
+	TCHAR* section,
+	TCHAR* key,
+	ULONGLONG default_value,
+	const wrapper_ini_t* ini,
+	wrapper_error_t** error
+)
+{
+	TCHAR buffer[64] = {0};
+	TCHAR* end = NULL;
+
+	if (!wrapper_config_get_value(buffer, _countof(buffer), section, key, ini, error))
+	{
+		return 0;
+	}
+	if (0 == buffer[0])
+	{
+		*value = default_value;
+		return 1;
+	}
+
+	ULONGLONG result = _tcstoui64(buffer, &end, 10);
+	switch (*end)
+	{
+	case _T('g'):
+	case _T('G'):
+		result *= 1024;
+		// fall through
+	case _T('m'):
+	case _T('M'):
+		result *= 1024;
+		// fall through
+	case _T('k'):
+	case _T('K'):
+		result *= 1024;
+		end++;
+		break;
+	default:
+		break;
+	}
+
+	if (end == buffer || (*end && *end != _T('B') && *end != _T('b')))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+			                                   _T("The value '%s' of '%s' in section '%s' of configuration file '%s' is not a valid size"),
+			                                   buffer, key, section, wrapper_ini_get_path(ini));
+		}
+		return 0;
+	}
+
+	*value = result;
+	return 1;
+}
+
+int wrapper_config_read_double(
+	double* value,
+	TCHAR* section,
+	TCHAR* key,
+	double default_value,
+	const wrapper_ini_t* ini,
+	wrapper_error_t** error
+)
+{
+	TCHAR buffer[64] = {0};
+	TCHAR* end = NULL;
+
+	if (!wrapper_config_get_value(buffer, _countof(buffer), section, key, ini, error))
+	{
+		return 0;
+	}
+	if (0 == buffer[0])
+	{
+		*value = default_value;
+		return 1;
+	}
+
+	const double result = _tcstod(buffer, &end);
+	if (end == buffer || *end)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+			                                   _T("The value '%s' of '%s' in section '%s' of configuration file '%s' is not a valid number"),
+			                                   buffer, key, section, wrapper_ini_get_path(ini));
+		}
+		return 0;
+	}
+
+	*value = result;
+	return 1;
+}
+
+int wrapper_config_read_bool(
+	int* value,
+	TCHAR* section,
+	TCHAR* key,
+	int default_value,
+	const wrapper_ini_t* ini,
+	wrapper_error_t** error
+)
+{
+	TCHAR buffer[16] = {0};
+
+	if (!wrapper_config_get_value(buffer, _countof(buffer), section, key, ini, error))
+	{
+		return 0;
+	}
+	if (0 == buffer[0])
+	{
+		*value = default_value;
+	}
+	else if (0 == lstrcmpi(buffer, _T("yes")) || 0 == lstrcmpi(buffer, _T("true")) || 0 == lstrcmpi(buffer, _T("1")))
+	{
+		*value = 1;
+	}
+	else if (0 == lstrcmpi(buffer, _T("no")) || 0 == lstrcmpi(buffer, _T("false")) || 0 == lstrcmpi(buffer, _T("0")))
+	{
+		*value = 0;
+	}
+	else
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+			                                   _T("The value '%s' of '%s' in section '%s' of configuration file '%s' must be 'yes' or 'no'"),
+			                                   buffer, key, section, wrapper_ini_get_path(ini));
+		}
+		return 0;
+	}
+	return 1;
+}
+
+static int wrapper_config_read_restart_mode(
+	wrapper_restart_mode_t* value,
+	TCHAR* section,
+	TCHAR* key,
+	wrapper_restart_mode_t default_value,
+	const wrapper_ini_t* ini,
+	wrapper_error_t** error
+)
+{
+	TCHAR buffer[16] = {0};
+
+	if (!wrapper_config_get_value(buffer, _countof(buffer), section, key, ini, error))
+	{
+		return 0;
+	}
+	if (0 == buffer[0])
+	{
+		*value = default_value;
+	}
+	else if (0 == lstrcmpi(buffer, _T("never")) || 0 == lstrcmpi(buffer, _T("no")))
+	{
+		*value = WRAPPER_RESTART_NEVER;
+	}
+	else if (0 == lstrcmpi(buffer, _T("on-failure")))
+	{
+		*value = WRAPPER_RESTART_ON_FAILURE;
+	}
+	else if (0 == lstrcmpi(buffer, _T("always")))
+	{
+		*value = WRAPPER_RESTART_ALWAYS;
+	}
+	else
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+			                                   _T("The value '%s' of '%s' in section '%s' of configuration file '%s' must be 'never', 'on-failure' or 'always'"),
+			                                   buffer, key, section, wrapper_ini_get_path(ini));
+		}
+		return 0;
+	}
+	return 1;
+}
+
+static int wrapper_config_read_health_type(
+	wrapper_health_type_t* value,
+	TCHAR* section,
+	TCHAR* key,
+	wrapper_health_type_t default_value,
+	const wrapper_ini_t* ini,
+	wrapper_error_t** error
+)
+{
+	TCHAR buffer[16] = {0};
+
+	if (!wrapper_config_get_value(buffer, _countof(buffer), section, key, ini, error))
+	{
+		return 0;
+	}
+	if (0 == buffer[0])
+	{
+		*value = default_value;
+	}
+	else if (0 == lstrcmpi(buffer, _T("none")))
+	{
+		*value = WRAPPER_HEALTH_NONE;
+	}
+	else if (0 == lstrcmpi(buffer, _T("http")))
+	{
+		*value = WRAPPER_HEALTH_HTTP;
+	}
+	else if (0 == lstrcmpi(buffer, _T("tcp")))
+	{
+		*value = WRAPPER_HEALTH_TCP;
+	}
+	else if (0 == lstrcmpi(buffer, _T("command")))
+	{
+		*value = WRAPPER_HEALTH_COMMAND;
+	}
+	else
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+			                                   _T("The value '%s' of '%s' in section '%s' of configuration file '%s' must be 'none', 'http', 'tcp' or 'command'"),
+			                                   buffer, key, section, wrapper_ini_get_path(ini));
+		}
+		return 0;
+	}
+	return 1;
+}
+
+static int wrapper_config_read_service_type(
+	wrapper_service_type_t* value,
+	TCHAR* section,
+	TCHAR* key,
+	wrapper_service_type_t default_value,
+	const wrapper_ini_t* ini,
+	wrapper_error_t** error
+)
+{
+	TCHAR buffer[16] = {0};
+
+	if (!wrapper_config_get_value(buffer, _countof(buffer), section, key, ini, error))
+	{
+		return 0;
+	}
+	if (0 == buffer[0])
+	{
+		*value = default_value;
+	}
+	else if (0 == lstrcmpi(buffer, _T("simple")))
+	{
+		*value = WRAPPER_SERVICE_TYPE_SIMPLE;
+	}
+	else if (0 == lstrcmpi(buffer, _T("notify")))
+	{
+		*value = WRAPPER_SERVICE_TYPE_NOTIFY;
+	}
+	else if (0 == lstrcmpi(buffer, _T("health")))
+	{
+		*value = WRAPPER_SERVICE_TYPE_HEALTH;
+	}
+	else if (0 == lstrcmpi(buffer, _T("log")))
+	{
+		*value = WRAPPER_SERVICE_TYPE_LOG;
+	}
+	else
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+			                                   _T("The value '%s' of '%s' in section '%s' of configuration file '%s' must be 'simple', 'notify', 'health' or 'log'"),
+			                                   buffer, key, section, wrapper_ini_get_path(ini));
+		}
+		return 0;
+	}
+	return 1;
+}
+
+const char* wrapper_service_type_str(wrapper_service_type_t type)
+{
+	switch (type)
+	{
+	case WRAPPER_SERVICE_TYPE_SIMPLE:
+		return "simple";
+	case WRAPPER_SERVICE_TYPE_NOTIFY:
+		return "notify";
+	case WRAPPER_SERVICE_TYPE_HEALTH:
+		return "health";
+	case WRAPPER_SERVICE_TYPE_LOG:
+		return "log";
+	default:
+		return "unknown";
+	}
+}
+
+//
+// Reads a percentage, with or without the percent sign, e.g. "150%".
+//
+static int wrapper_config_read_percent(
+	DWORD* value,
+	TCHAR* section,
+	TCHAR* key,
+	DWORD default_value,
+	const wrapper_ini_t* ini,
+	wrapper_error_t** error
+)
+{
+	TCHAR buffer[16] = {0};
+	TCHAR* end = NULL;
+
+	if (!wrapper_config_get_value(buffer, _countof(buffer), section, key, ini, error))
+	{
+		return 0;
+	}
+	if (0 == buffer[0])
+	{
+		*value = default_value;
+		return 1;
+	}
+
+	const DWORD result = _tcstoul(buffer, &end, 10);
+	if (*end == _T('%'))
+	{
+		end++;
+	}
+
+	if (end == buffer || *end)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+			                                   _T("The value '%s' of '%s' in section '%s' of configuration file '%s' is not a valid percentage"),
+			                                   buffer, key, section, wrapper_ini_get_path(ini));
+		}
+		return 0;
+	}
+
+	*value = result;
+	return 1;
+}
+
+//
+// Reads a set of processors as a mask. The processors are numbered from 0 and separated by spaces
+// or commas, and a range may be given as e.g. "4-7".
+//
+static int wrapper_config_read_cpu_set(
+	ULONGLONG* value,
+	TCHAR* section,
+	TCHAR* key,
+	const wrapper_ini_t* ini,
+	wrapper_error_t** error
+)
+{
+	TCHAR buffer[256] = {0};
+	ULONGLONG result = 0;
+
+	if (!wrapper_config_get_value(buffer, _countof(buffer), section, key, ini, error))
+	{
+		return 0;
+	}
+
+	TCHAR* p = buffer;
+	while (*p)
+	{
+		if (*p == _T(' ') || *p == _T(',') || *p == _T('\t'))
+		{
+			p++;
+			continue;
+		}
+
+		TCHAR* end = NULL;
+		const unsigned long first = _tcstoul(p, &end, 10);
+		unsigned long last = first;
+		if (end != p && *end == _T('-'))
+		{
+			p = end + 1;
+			last = _tcstoul(p, &end, 10);
+		}
+
+		if (end == p || last < first || last >= 64)
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+				                                   _T("The value '%s' of '%s' in section '%s' of configuration file '%s' is not a valid set of processors"),
+				                                   buffer, key, section, wrapper_ini_get_path(ini));
+			}
+			return 0;
+		}
+
+		for (unsigned long i = first; i <= last; i++)
+		{
+			result |= 1ULL << i;
+		}
+		p = end;
+	}
+
+	*value = result;
+	return 1;
+}
+
+static int wrapper_config_read_inherit(
+	wrapper_environment_inherit_t* value,
+	TCHAR* section,
+	TCHAR* key,
+	wrapper_environment_inherit_t default_value,
+	const wrapper_ini_t* ini,
+	wrapper_error_t** error
+)
+{
+	TCHAR buffer[16] = {0};
+
+	if (!wrapper_config_get_value(buffer, _countof(buffer), section, key, ini, error))
+	{
+		return 0;
+	}
+	if (0 == buffer[0])
+	{
+		*value = default_value;
+	}
+	else if (0 == lstrcmpi(buffer, _T("yes")))
+	{
+		*value = WRAPPER_ENVIRONMENT_INHERIT_ALL;
+	}
+	else if (0 == lstrcmpi(buffer, _T("no")))
+	{
+		*value = WRAPPER_ENVIRONMENT_INHERIT_NONE;
+	}
+	else if (0 == lstrcmpi(buffer, _T("allowlist")))
+	{
+		*value = WRAPPER_ENVIRONMENT_INHERIT_ALLOWLIST;
+	}
+	else
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+			                                   _T("The value '%s' of '%s' in section '%s' of configuration file '%s' must be 'yes', 'no' or 'allowlist'"),
+			                                   buffer, key, section, wrapper_ini_get_path(ini));
+		}
+		return 0;
+	}
+	return 1;
+}
+
+//
+// Appends NAME=value to the variables of the child, which grow as needed and always end with an
+// empty string.
+//
+static int wrapper_config_add_variable(wrapper_environment_settings_t* environment, size_t* capacity,
+                                       const TCHAR* name, const TCHAR* value)
+{
+	const size_t name_length = _tcslen(name);
+	const size_t value_length = _tcslen(value);
+	const size_t used = environment->size ? environment->size - 1 : 0;
+	const size_t needed = used + name_length + value_length + 3;
+
+	if (needed > *capacity)
+	{
+		size_t new_capacity = *capacity ? *capacity * 2 : 1024;
+		while (new_capacity < needed)
+		{
+			new_capacity *= 2;
+		}
+
+		TCHAR* variables = LocalAlloc(LPTR, new_capacity * sizeof(TCHAR));
+		if (!variables)
+		{
+			return 0;
+		}
+
+		if (used)
+		{
+			memcpy(variables, environment->variables, used * sizeof(TCHAR));
+		}
+		LocalFree(environment->variables);
+		environment->variables = variables;
+		*capacity = new_capacity;
+	}
+
+	TCHAR* p = environment->variables + used;
+	memcpy(p, name, name_length * sizeof(TCHAR));
+	p += name_length;
+	*p++ = _T('=');
+	memcpy(p, value, value_length * sizeof(TCHAR));
+	p += value_length;
+	*p++ = 0;
+	*p = 0;
+	environment->size = p - environment->variables + 1;
+	return 1;
+}
+
+//
+// Appends the path to the files that were read, unless it is there already. There are only a few,
+// so the list grows one path at a time.
+//
+static int wrapper_config_add_file(wrapper_config_t* config, const TCHAR* path)
+{
+	const size_t length = _tcslen(path);
+	const size_t used = config->files_size ? config->files_size - 1 : 0;
+
+	for (const TCHAR* file = config->files; file && *file; file += _tcslen(file) + 1)
+	{
+		if (0 == _tcsicmp(file, path))
+		{
+			return 1;
+		}
+	}
+
+	TCHAR* files = LocalAlloc(LPTR, (used + length + 2) * sizeof(TCHAR));
+	if (!files)
+	{
+		return 0;
+	}
+
+	if (used)
+	{
+		memcpy(files, config->files, used * sizeof(TCHAR));
+	}
+	memcpy(files + used, path, length * sizeof(TCHAR));
+	LocalFree(config->files);
+	config->files = files;
+	config->files_size = used + length + 2;
+	return 1;
+}
+
+//
+// Reads the variables of the child from the environment files, in the order they are named, and
+// then from the Environment section, so that the section overrides the files. An environment file
+// has a NAME=value on each line and is relative to the configuration file that names it.
+//
+static int wrapper_config_read_environment(const wrapper_ini_t* ini, wrapper_config_t* config, wrapper_error_t** error)
+{
+	wrapper_environment_settings_t* environment = &config->environment;
+	HRESULT hr = S_OK;
+	size_t capacity = 0;
+	const wrapper_ini_entry_t* entry = NULL;
+	const wrapper_ini_entry_t* variable = NULL;
+
+	while (SUCCEEDED(hr) && NULL != (entry = wrapper_ini_find(ini, _T("Unit"), _T("EnvironmentFile"), entry)))
+	{
+		TCHAR directory[_MAX_PATH];
+		TCHAR path[_MAX_PATH];
+		wrapper_ini_t* file = NULL;
+
+		if (0 == *entry->value)
+		{
+			continue;
+		}
+
+		hr = StringCchCopy(directory, _countof(directory), entry->path);
+		if (SUCCEEDED(hr))
+		{
+			hr = PathCchRemoveFileSpec(directory, _countof(directory));
+		}
+		if (SUCCEEDED(hr))
+		{
+			hr = PathCchCombine(path, _countof(path), directory, entry->value);
+		}
+
+		if (FAILED(hr))
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to resolve the environment file '%s' on line %d of the configuration file '%s'"),
+				                                    entry->value, entry->line, entry->path);
+			}
+		}
+		else if (!wrapper_ini_load_file(&file, path, error))
+		{
+			hr = E_FAIL;
+		}
+		else if (!wrapper_config_add_file(config, path))
+		{
+			hr = E_OUTOFMEMORY;
+		}
+
+		variable = NULL;
+		while (SUCCEEDED(hr) && NULL != (variable = wrapper_ini_find(file, EMPTY_STRING, NULL, variable)))
+		{
+			if (!wrapper_config_add_variable(environment, &capacity, variable->key, variable->value))
+			{
+				hr = E_OUTOFMEMORY;
+			}
+		}
+
+		wrapper_ini_free(file);
+	}
+
+	variable = NULL;
+	while (SUCCEEDED(hr) && NULL != (variable = wrapper_ini_find(ini, _T("Environment"), NULL, variable)))
+	{
+		if (!wrapper_config_add_variable(environment, &capacity, variable->key, variable->value))
+		{
+			hr = E_OUTOFMEMORY;
+		}
+	}
+
+	if (E_OUTOFMEMORY == hr && error)
+	{
+		*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the environment of the child process"));
+	}
+	return SUCCEEDED(hr);
+}
+
+//
+// Reads the addresses to listen on from each of the Listen entries in the Sockets section.
+//
+static int wrapper_config_read_sockets(const wrapper_ini_t* ini, wrapper_sockets_settings_t* sockets,
+                                       wrapper_error_t** error)
+{
+	const wrapper_ini_entry_t* entry = NULL;
+
+	sockets->count = 0;
+	while (NULL != (entry = wrapper_ini_find(ini, _T("Sockets"), _T("Listen"), entry)))
+	{
+		if (0 == *entry->value)
+		{
+			continue;
+		}
+
+		if (sockets->count == WRAPPER_SOCKETS_MAX || _tcslen(entry->value) > WRAPPER_SOCKET_ADDRESS_MAX_LEN)
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+				                                   _T("The address '%s' on line %d of configuration file '%s' is too long, or there are more than %d addresses to listen on"),
+				                                   entry->value, entry->line, entry->path, WRAPPER_SOCKETS_MAX);
+			}
+			return 0;
+		}
+
+		StringCchCopy(sockets->listen[sockets->count++], WRAPPER_SOCKET_ADDRESS_MAX_LEN + 1, entry->value);
+	}
+
+	return wrapper_config_read_int(&sockets->backlog, _T("Sockets"), _T("Backlog"), WRAPPER_SOCKETS_BACKLOG_DEFAULT,
+	                               ini, error);
+}
+
+//
+// Reads the hooks of each stage from the keys of the same name, e.g. ExecStartPre, which can be
+// given more than once.
+//
+static int wrapper_config_read_hooks(const wrapper_ini_t* ini, wrapper_hooks_settings_t* hooks, wrapper_error_t** error)
+{
+	for (int stage = 0; stage < WRAPPER_HOOK_STAGE_COUNT; stage++)
+	{
+		const TCHAR* key = wrapper_hook_stage_str(stage);
+		const wrapper_ini_entry_t* entry = NULL;
+
+		hooks->count[stage] = 0;
+		while (NULL != (entry = wrapper_ini_find(ini, _T("Unit"), key, entry)))
+		{
+			if (0 == *entry->value)
+			{
+				continue;
+			}
+
+			if (hooks->count[stage] == WRAPPER_HOOKS_MAX || _tcslen(entry->value) > WRAPPER_HOOK_CMDLINE_MAX_LEN)
+			{
+				if (error)
+				{
+					*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+					                                   _T("The '%s' on line %d of configuration file '%s' is too long, or there are more than %d of them"),
+					                                   key, entry->line, entry->path, WRAPPER_HOOKS_MAX);
+				}
+				return 0;
+			}
+
+			StringCchCopy(hooks->command_line[stage][hooks->count[stage]++], WRAPPER_HOOK_CMDLINE_MAX_LEN + 1,
+			              entry->value);
+		}
+	}
+
+	if (!wrapper_config_read_int(&hooks->timeout, _T("Unit"), _T("HookTimeout"), WRAPPER_HOOK_TIMEOUT_DEFAULT, ini,
+	                             error))
+	{
+		return 0;
+	}
+
+	return wrapper_config_read_int(&hooks->workers, _T("Unit"), _T("HookWorkers"), WRAPPER_HOOK_WORKERS_DEFAULT, ini,
+	                               error);
+}
+
+static int wrapper_config_read_ini(const wrapper_ini_t* ini, wrapper_config_t* config, wrapper_error_t** error)
+{
+	const TCHAR* path = wrapper_ini_get_path(ini);
+
+	TCHAR* section_name = _T("Unit");
+
+	if (!wrapper_config_read_string(config->name, WRAPPER_SERVICE_NAME_MAX_LEN, section_name, _T("Name"), NULL, ini,
+	                                error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_string(config->title, WRAPPER_SERVICE_TITLE_MAX_LEN, section_name, _T("Title"), config->name,
+	                                ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_string(config->description, WRAPPER_SERVICE_DESCRIPTION_MAX_LEN, section_name,
+	                                _T("Description"), EMPTY_STRING, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_string(config->command_line, WRAPPER_SERVICE_CMDLINE_MAX_LEN, section_name, _T("CommandLine"),
+	                                NULL, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_string(config->working_directory, WRAPPER_SERVICE_WORKDIR_MAX_LEN, section_name,
+	                                _T("WorkingDirectory"), EMPTY_STRING, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_int(&config->instances, section_name, _T("Instances"), WRAPPER_SERVICE_INSTANCES_DEFAULT,
+	                             ini, error))
+	{
+		return 0;
+	}
+
+	if (config->instances < 1 || config->instances > WRAPPER_SERVICE_INSTANCES_MAX)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+			                                   _T("The value %lu of 'Instances' in section '%s' of configuration file '%s' must be between 1 and %d"),
+			                                   config->instances, section_name, path, WRAPPER_SERVICE_INSTANCES_MAX);
+		}
+		return 0;
+	}
+
+	if (!wrapper_config_read_inherit(&config->environment.inherit, section_name, _T("Inherit"),
+	                                 WRAPPER_ENVIRONMENT_INHERIT_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_string(config->environment.allow, WRAPPER_ENVIRONMENT_ALLOW_MAX_LEN, section_name,
+	                                _T("InheritAllow"), EMPTY_STRING, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_environment(ini, config, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_service_type(&config->type, section_name, _T("Type"), WRAPPER_SERVICE_TYPE_DEFAULT, ini,
+	                                      error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_string(config->ready_pattern, WRAPPER_READY_PATTERN_MAX_LEN, section_name,
+	                                _T("ReadyPattern"), EMPTY_STRING, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_int(&config->start_timeout, section_name, _T("StartTimeout"),
+	                             WRAPPER_START_TIMEOUT_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_int(&config->stop_timeout, section_name, _T("StopTimeout"),
+	                             WRAPPER_STOP_TIMEOUT_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_int(&config->kill_timeout, section_name, _T("KillTimeout"),
+	                             WRAPPER_KILL_TIMEOUT_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_bool(&config->reload_on_change, section_name, _T("ReloadOnChange"),
+	                              WRAPPER_RELOAD_ON_CHANGE_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_bool(&config->standby, section_name, _T("Standby"), WRAPPER_STANDBY_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_int(&config->standby_warmup, section_name, _T("StandbyWarmup"),
+	                             WRAPPER_STANDBY_WARMUP_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_restart_mode(&config->restart.mode, section_name, _T("Restart"), WRAPPER_RESTART_DEFAULT,
+	                                      ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_int(&config->restart.delay, section_name, _T("RestartDelay"),
+	                             WRAPPER_RESTART_DELAY_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_int(&config->restart.max_delay, section_name, _T("RestartMaxDelay"),
+	                             WRAPPER_RESTART_MAX_DELAY_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_double(&config->restart.multiplier, section_name, _T("RestartMultiplier"),
+	                                WRAPPER_RESTART_MULTIPLIER_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	// A delay that shrinks with each restart would turn a crash loop into a busy loop
+	if (!(config->restart.multiplier >= 1.0))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+			                                   _T("The value %g of 'RestartMultiplier' in section '%s' of configuration file '%s' must be at least 1"),
+			                                   config->restart.multiplier, section_name, path);
+		}
+		return 0;
+	}
+
+	if (!wrapper_config_read_int(&config->restart.jitter, section_name, _T("RestartJitter"),
+	                             WRAPPER_RESTART_JITTER_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (config->restart.jitter > 100)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+			                                   _T("The value %lu of 'RestartJitter' in section '%s' of configuration file '%s' must be between 0 and 100"),
+			                                   config->restart.jitter, section_name, path);
+		}
+		return 0;
+	}
+
+	if (!wrapper_config_read_int(&config->restart.limit_count, section_name, _T("RestartLimitCount"),
+	                             WRAPPER_RESTART_LIMIT_COUNT_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	// The restarts are only remembered that far back
+	if (config->restart.limit_count > WRAPPER_RESTART_HISTORY_MAX)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+			                                   _T("The value %lu of 'RestartLimitCount' in section '%s' of configuration file '%s' must be between 0 and %d"),
+			                                   config->restart.limit_count, section_name, path,
+			                                   WRAPPER_RESTART_HISTORY_MAX);
+		}
+		return 0;
+	}
+
+	if (!wrapper_config_read_int(&config->restart.limit_interval, section_name, _T("RestartLimitInterval"),
+	                             WRAPPER_RESTART_LIMIT_INTERVAL_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	TCHAR* limits_section_name = _T("Limits");
+
+	if (!wrapper_config_read_size(&config->limits.memory_max, limits_section_name, _T("MemoryMax"), 0, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_percent(&config->limits.cpu_quota, limits_section_name, _T("CPUQuota"), 0, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_cpu_set(&config->limits.cpu_affinity, limits_section_name, _T("CPUAffinity"), ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_int(&config->limits.io_weight, limits_section_name, _T("IOWeight"), 0, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_int(&config->limits.process_count_max, limits_section_name, _T("ProcessCountMax"), 0, ini,
+	                             error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_bool(&config->limits.restart, limits_section_name, _T("RestartOnLimit"), 0, ini, error))
+	{
+		return 0;
+	}
+
+	TCHAR* monitor_section_name = _T("Monitor");
+
+	if (!wrapper_config_read_int(&config->sample_interval, monitor_section_name, _T("SampleInterval"),
+	                             WRAPPER_SAMPLE_INTERVAL_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_int(&config->sample_log_interval, monitor_section_name, _T("LogInterval"),
+	                             WRAPPER_SAMPLE_LOG_INTERVAL_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	TCHAR* health_section_name = _T("Health");
+
+	if (!wrapper_config_read_health_type(&config->health.type, health_section_name, _T("Type"),
+	                                     WRAPPER_HEALTH_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_string(config->health.target, WRAPPER_HEALTH_TARGET_MAX_LEN, health_section_name,
+	                                _T("Target"), EMPTY_STRING, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_positive_int(&config->health.interval, health_section_name, _T("Interval"),
+	                                      WRAPPER_HEALTH_INTERVAL_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_positive_int(&config->health.timeout, health_section_name, _T("Timeout"),
+	                                      WRAPPER_HEALTH_TIMEOUT_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_positive_int(&config->health.failure_threshold, health_section_name, _T("FailureThreshold"),
+	                                      WRAPPER_HEALTH_FAILURE_THRESHOLD_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_int(&config->health.start_period, health_section_name, _T("StartPeriod"),
+	                             WRAPPER_HEALTH_START_PERIOD_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_sockets(ini, &config->sockets, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_hooks(ini, &config->hooks, error))
+	{
+		return 0;
+	}
+
+	TCHAR* metrics_section_name = _T("Metrics");
+
+	if (!wrapper_config_read_string(config->metrics_address, WRAPPER_METRICS_ADDRESS_MAX_LEN, metrics_section_name,
+	                                _T("Address"), WRAPPER_METRICS_ADDRESS_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_int(&config->metrics_port, metrics_section_name, _T("Port"), WRAPPER_METRICS_PORT_DEFAULT,
+	                             ini, error))
+	{
+		return 0;
+	}
+
+	TCHAR* log_section_name = _T("Log");
+
+	if (!wrapper_config_read_int(&config->log_flush_interval, log_section_name, _T("FlushInterval"),
+	                             WRAPPER_LOG_FLUSH_INTERVAL_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_int(&config->log_flush_size, log_section_name, _T("FlushSize"),
+	                             WRAPPER_LOG_FLUSH_SIZE_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_size(&config->log_max_size, log_section_name, _T("MaxSize"),
+	                              WRAPPER_LOG_MAX_SIZE_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_int(&config->log_max_age, log_section_name, _T("MaxAge"),
+	                             WRAPPER_LOG_MAX_AGE_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_int(&config->log_generations, log_section_name, _T("Generations"),
+	                             WRAPPER_LOG_GENERATIONS_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	if (!wrapper_config_read_bool(&config->log_compress, log_section_name, _T("Compress"),
+	                              WRAPPER_LOG_COMPRESS_DEFAULT, ini, error))
+	{
+		return 0;
+	}
+
+	// A child that can't tell that it is ready would keep the service from ever running
+	if ((WRAPPER_SERVICE_TYPE_HEALTH == config->type && WRAPPER_HEALTH_NONE == config->health.type) ||
+		(WRAPPER_SERVICE_TYPE_LOG == config->type && !config->ready_pattern[0]))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+			                                   _T("The type '%hs' in section '%s' of configuration file '%s' needs %s"),
+			                                   wrapper_service_type_str(config->type), section_name,
+			                                   wrapper_ini_get_path(ini),
+			                                   WRAPPER_SERVICE_TYPE_HEALTH == config->type
+				                                   ? _T("a health check")
+				                                   : _T("a 'ReadyPattern'"));
+		}
+		return 0;
+	}
+
+	return 1;
+}
+
+//
+// Reads the configuration file once and then takes the settings from what was parsed.
+//
+int wrapper_config_read(TCHAR* path, wrapper_config_t* config, wrapper_error_t** error)
+{
+	wrapper_ini_t* ini = NULL;
+
+	if (!path || !config)
+	{
+		return 0;
+	}
+
+	if (!wrapper_ini_load(&ini, path, error))
+	{
+		return 0;
+	}
+
+	int rc = wrapper_config_read_ini(ini, config, error);
+
+	const TCHAR* file = NULL;
+	for (DWORD i = 0; rc && NULL != (file = wrapper_ini_get_file(ini, i)); i++)
+	{
+		if (!wrapper_config_add_file(config, file))
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(E_OUTOFMEMORY, _T("Failed to allocate memory for the list of configuration files"));
+			}
+			rc = 0;
+		}
+	}
+
+	wrapper_ini_free(ini);
+	return rc;
+}
+
+//
+// Returns the groups of settings that differ between the two configurations, as a combination of
+// the WRAPPER_CONFIG_CHANGED_* flags.
+//
+DWORD wrapper_config_diff(const wrapper_config_t* current, const wrapper_config_t* next)
+{
+	DWORD changes = 0;
+
+	if (_tcscmp(current->name, next->name) || current->instances != next->instances || current->type != next->type ||
+		_tcscmp(current->ready_pattern, next->ready_pattern) || current->start_timeout != next->start_timeout)
+	{
+		changes |= WRAPPER_CONFIG_CHANGED_SERVICE;
+	}
+
+	if (_tcscmp(current->title, next->title) || _tcscmp(current->description, next->description))
+	{
+		changes |= WRAPPER_CONFIG_CHANGED_DESCRIPTION;
+	}
+
+	if (_tcscmp(current->command_line, next->command_line) ||
+		_tcscmp(current->working_directory, next->working_directory) ||
+		!wrapper_environment_equal(&current->environment, &next->environment))
+	{
+		changes |= WRAPPER_CONFIG_CHANGED_COMMAND;
+	}
+
+	if (current->stop_timeout != next->stop_timeout || current->kill_timeout != next->kill_timeout)
+	{
+		changes |= WRAPPER_CONFIG_CHANGED_STOP;
+	}
+
+	if (current->reload_on_change != next->reload_on_change)
+	{
+		changes |= WRAPPER_CONFIG_CHANGED_RELOAD;
+	}
+
+	if (current->standby != next->standby || current->standby_warmup != next->standby_warmup)
+	{
+		changes |= WRAPPER_CONFIG_CHANGED_STANDBY;
+	}
+
+	if (!wrapper_sockets_equal(&current->sockets, &next->sockets))
+	{
+		changes |= WRAPPER_CONFIG_CHANGED_SOCKETS;
+	}
+
+	if (!wrapper_hooks_equal(&current->hooks, &next->hooks))
+	{
+		changes |= WRAPPER_CONFIG_CHANGED_HOOKS;
+	}
+
+	const wrapper_restart_policy_t* restart = &current->restart;
+	const wrapper_restart_policy_t* next_restart = &next->restart;
+	if (restart->mode != next_restart->mode || restart->delay != next_restart->delay ||
+		restart->max_delay != next_restart->max_delay || restart->multiplier != next_restart->multiplier ||
+		restart->jitter != next_restart->jitter || restart->limit_count != next_restart->limit_count ||
+		restart->limit_interval != next_restart->limit_interval)
+	{
+		changes |= WRAPPER_CONFIG_CHANGED_RESTART;
+	}
+
+	const wrapper_job_limits_t* limits = &current->limits;
+	const wrapper_job_limits_t* next_limits = &next->limits;
+	if (limits->memory_max != next_limits->memory_max || limits->cpu_quota != next_limits->cpu_quota ||
+		limits->cpu_affinity != next_limits->cpu_affinity || limits->io_weight != next_limits->io_weight ||
+		limits->process_count_max != next_limits->process_count_max || limits->restart != next_limits->restart)
+	{
+		changes |= WRAPPER_CONFIG_CHANGED_LIMITS;
+	}
+
+	if (current->log_flush_interval != next->log_flush_interval || current->log_flush_size != next->log_flush_size ||
+		current->log_max_size != next->log_max_size || current->log_max_age != next->log_max_age ||
+		current->log_generations != next->log_generations || current->log_compress != next->log_compress)
+	{
+		changes |= WRAPPER_CONFIG_CHANGED_LOG;
+	}
+
+	if (current->sample_interval != next->sample_interval || current->sample_log_interval != next->sample_log_interval)
+	{
+		changes |= WRAPPER_CONFIG_CHANGED_MONITOR;
+	}
+
+	const wrapper_health_settings_t* health = &current->health;
+	const wrapper_health_settings_t* next_health = &next->health;
+	if (health->type != next_health->type || _tcscmp(health->target, next_health->target) ||
+		health->interval != next_health->interval || health->timeout != next_health->timeout ||
+		health->failure_threshold != next_health->failure_threshold || health->start_period != next_health->start_period)
+	{
+		changes |= WRAPPER_CONFIG_CHANGED_HEALTH;
+	}
+
+	if (_tcscmp(current->metrics_address, next->metrics_address) || current->metrics_port != next->metrics_port)
+	{
+		changes |= WRAPPER_CONFIG_CHANGED_METRICS;
+	}
+
+	return changes;
+}
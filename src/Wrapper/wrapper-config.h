@@ -1,38 +1,190 @@
-// Copyright (c) Werner Strydom. All rights reserved.
-// Licensed under the MIT license. See LICENSE in the project root for license information.
-
-#pragma once
-
-#define WRAPPER_SERVICE_NAME_MAX_LEN 256
-#define WRAPPER_SERVICE_TITLE_MAX_LEN 256
-#define WRAPPER_SERVICE_DESCRIPTION_MAX_LEN 4096
-#define WRAPPER_SERVICE_CMDLINE_MAX_LEN 4096
-#define WRAPPER_SERVICE_WORKDIR_MAX_LEN 260 // _MAX_PATH
-
-#define EMPTY_STRING _T("")
-
-#include "wrapper-error.h"
-
-typedef struct wrapper_config_t
-{
-	TCHAR* name;
-	TCHAR* command_line;
-	TCHAR* title;
-	TCHAR* description;
-	TCHAR* working_directory;
-} wrapper_config_t;
-
-wrapper_config_t* wrapper_config_alloc(void);
-void wrapper_config_free(wrapper_config_t* config);
-
-int wrapper_config_get_path(TCHAR* path, const size_t size, wrapper_error_t** error);
-int wrapper_config_read(TCHAR* path, wrapper_config_t* config, wrapper_error_t** error);
-int wrapper_config_read_string(
-	TCHAR* buffer,
-	DWORD size,
-	TCHAR* section,
-	TCHAR* key,
-	TCHAR* default_value,
-	TCHAR* path,
-	wrapper_error_t** error
-);
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#pragma once
+
+#define WRAPPER_SERVICE_NAME_MAX_LEN 256
+#define WRAPPER_SERVICE_TITLE_MAX_LEN 256
+#define WRAPPER_SERVICE_DESCRIPTION_MAX_LEN 4096
+#define WRAPPER_SERVICE_CMDLINE_MAX_LEN 4096
+#define WRAPPER_SERVICE_WORKDIR_MAX_LEN 260 // _MAX_PATH
+#define WRAPPER_METRICS_ADDRESS_MAX_LEN 64
+#define WRAPPER_READY_PATTERN_MAX_LEN 256
+
+// The instances are stopped together with a single WaitForMultipleObjects, which takes up to
+// MAXIMUM_WAIT_OBJECTS handles.
+#define WRAPPER_SERVICE_INSTANCES_MAX MAXIMUM_WAIT_OBJECTS
+#define WRAPPER_SERVICE_INSTANCES_DEFAULT 1
+
+#define WRAPPER_LOG_FLUSH_INTERVAL_DEFAULT 1000
+#define WRAPPER_LOG_FLUSH_SIZE_DEFAULT 65536
+#define WRAPPER_LOG_MAX_SIZE_DEFAULT 0
+#define WRAPPER_LOG_MAX_AGE_DEFAULT 0
+#define WRAPPER_LOG_GENERATIONS_DEFAULT 5
+#define WRAPPER_LOG_COMPRESS_DEFAULT 1
+
+#define WRAPPER_SAMPLE_INTERVAL_DEFAULT 5000
+#define WRAPPER_SAMPLE_LOG_INTERVAL_DEFAULT 60000
+
+#define WRAPPER_HEALTH_DEFAULT WRAPPER_HEALTH_NONE
+#define WRAPPER_HEALTH_INTERVAL_DEFAULT 30000
+#define WRAPPER_HEALTH_TIMEOUT_DEFAULT 5000
+#define WRAPPER_HEALTH_FAILURE_THRESHOLD_DEFAULT 3
+#define WRAPPER_HEALTH_START_PERIOD_DEFAULT 0
+
+#define WRAPPER_METRICS_ADDRESS_DEFAULT _T("127.0.0.1")
+#define WRAPPER_METRICS_PORT_DEFAULT 0
+
+#define WRAPPER_SOCKETS_BACKLOG_DEFAULT 0
+
+#define WRAPPER_HOOK_TIMEOUT_DEFAULT 90000
+#define WRAPPER_HOOK_WORKERS_DEFAULT 4
+
+#define WRAPPER_STOP_TIMEOUT_DEFAULT 10000
+#define WRAPPER_KILL_TIMEOUT_DEFAULT 5000
+#define WRAPPER_RELOAD_ON_CHANGE_DEFAULT 1
+#define WRAPPER_STANDBY_DEFAULT 0
+#define WRAPPER_STANDBY_WARMUP_DEFAULT 0
+#define WRAPPER_ENVIRONMENT_INHERIT_DEFAULT WRAPPER_ENVIRONMENT_INHERIT_ALL
+#define WRAPPER_SERVICE_TYPE_DEFAULT WRAPPER_SERVICE_TYPE_SIMPLE
+#define WRAPPER_START_TIMEOUT_DEFAULT 90000
+
+#define WRAPPER_RESTART_DEFAULT WRAPPER_RESTART_NEVER
+#define WRAPPER_RESTART_DELAY_DEFAULT 100
+#define WRAPPER_RESTART_MAX_DELAY_DEFAULT 60000
+#define WRAPPER_RESTART_MULTIPLIER_DEFAULT 2.0
+#define WRAPPER_RESTART_JITTER_DEFAULT 10
+#define WRAPPER_RESTART_LIMIT_COUNT_DEFAULT 5
+#define WRAPPER_RESTART_LIMIT_INTERVAL_DEFAULT 60000
+
+#define EMPTY_STRING _T("")
+
+// The groups of settings that wrapper_config_diff compares
+#define WRAPPER_CONFIG_CHANGED_SERVICE 0x0001     // Name, Instances, Type, ReadyPattern, StartTimeout
+#define WRAPPER_CONFIG_CHANGED_DESCRIPTION 0x0002 // Title, Description
+#define WRAPPER_CONFIG_CHANGED_COMMAND 0x0004     // CommandLine, WorkingDirectory, environment
+#define WRAPPER_CONFIG_CHANGED_STOP 0x0008
+#define WRAPPER_CONFIG_CHANGED_RELOAD 0x0010
+#define WRAPPER_CONFIG_CHANGED_RESTART 0x0020
+#define WRAPPER_CONFIG_CHANGED_LIMITS 0x0040
+#define WRAPPER_CONFIG_CHANGED_LOG 0x0080
+#define WRAPPER_CONFIG_CHANGED_MONITOR 0x0100
+#define WRAPPER_CONFIG_CHANGED_HEALTH 0x0200
+#define WRAPPER_CONFIG_CHANGED_METRICS 0x0400
+#define WRAPPER_CONFIG_CHANGED_STANDBY 0x0800
+#define WRAPPER_CONFIG_CHANGED_SOCKETS 0x1000
+#define WRAPPER_CONFIG_CHANGED_HOOKS 0x2000
+
+#include "wrapper-environment.h"
+#include "wrapper-error.h"
+#include "wrapper-health.h"
+#include "wrapper-hooks.h"
+#include "wrapper-ini.h"
+#include "wrapper-job.h"
+#include "wrapper-restart.h"
+#include "wrapper-sockets.h"
+
+//
+// How the wrapper learns that the child is ready, after which the service is reported as running.
+//
+typedef enum
+{
+	WRAPPER_SERVICE_TYPE_SIMPLE, // As soon as the child was started
+	WRAPPER_SERVICE_TYPE_NOTIFY, // When the child sends 'READY=1' to the pipe in NOTIFY_SOCKET
+	WRAPPER_SERVICE_TYPE_HEALTH, // When the child passed its first health check
+	WRAPPER_SERVICE_TYPE_LOG,    // When the child wrote a line that matches ReadyPattern
+} wrapper_service_type_t;
+
+typedef struct wrapper_config_t
+{
+	TCHAR* name;
+	TCHAR* command_line;
+	TCHAR* title;
+	TCHAR* description;
+	TCHAR* working_directory;
+	DWORD instances;
+	wrapper_environment_settings_t environment;
+	wrapper_service_type_t type;
+	TCHAR ready_pattern[WRAPPER_READY_PATTERN_MAX_LEN + 1];
+	DWORD start_timeout;
+
+	DWORD stop_timeout;
+	DWORD kill_timeout;
+	int reload_on_change;
+	int standby;
+	DWORD standby_warmup;
+
+	DWORD log_flush_interval;
+	DWORD log_flush_size;
+	ULONGLONG log_max_size;
+	DWORD log_max_age;
+	DWORD log_generations;
+	int log_compress;
+
+	wrapper_restart_policy_t restart;
+	wrapper_job_limits_t limits;
+
+	DWORD sample_interval;
+	DWORD sample_log_interval;
+
+	wrapper_health_settings_t health;
+	wrapper_sockets_settings_t sockets;
+	wrapper_hooks_settings_t hooks;
+
+	TCHAR* metrics_address;
+	DWORD metrics_port;
+
+	// The files that were read, i.e. the configuration files and the environment files, each
+	// followed by a null character, with an empty string at the end
+	TCHAR* files;
+	size_t files_size;
+} wrapper_config_t;
+
+wrapper_config_t* wrapper_config_alloc(void);
+void wrapper_config_free(wrapper_config_t* config);
+
+int wrapper_config_get_path(TCHAR* path, const size_t size, wrapper_error_t** error);
+int wrapper_config_read(TCHAR* path, wrapper_config_t* config, wrapper_error_t** error);
+const char* wrapper_service_type_str(wrapper_service_type_t type);
+DWORD wrapper_config_diff(const wrapper_config_t* current, const wrapper_config_t* next);
+int wrapper_config_read_string(
+	TCHAR* buffer,
+	DWORD size,
+	TCHAR* section,
+	TCHAR* key,
+	TCHAR* default_value,
+	const wrapper_ini_t* ini,
+	wrapper_error_t** error
+);
+int wrapper_config_read_int(
+	DWORD* value,
+	TCHAR* section,
+	TCHAR* key,
+	DWORD default_value,
+	const wrapper_ini_t* ini,
+	wrapper_error_t** error
+);
+int wrapper_config_read_size(
+	ULONGLONG* value,
+	TCHAR* section,
+	TCHAR* key,
+	ULONGLONG default_value,
+	const wrapper_ini_t* ini,
+	wrapper_error_t** error
+);
+int wrapper_config_read_double(
+	double* value,
+	TCHAR* section,
+	TCHAR* key,
+	double default_value,
+	const wrapper_ini_t* ini,
+	wrapper_error_t** error
+);
+int wrapper_config_read_bool(
+	int* value,
+	TCHAR* section,
+	TCHAR* key,
+	int default_value,
+	const wrapper_ini_t* ini,
+	wrapper_error_t** error
+);
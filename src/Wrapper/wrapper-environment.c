@@ -0,0 +1,244 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#include "stdafx.h"
+#include "wrapper-environment.h"
+#include "wrapper-memory.h"
+
+typedef struct wrapper_environment_entry_t
+{
+	const TCHAR* text;
+	size_t name_length;
+	size_t length;
+	DWORD order;
+} wrapper_environment_entry_t;
+
+static size_t wrapper_environment_count(const TCHAR* strings)
+{
+	size_t count = 0;
+	for (const TCHAR* p = strings; p && *p; p += _tcslen(p) + 1)
+	{
+		count++;
+	}
+	return count;
+}
+
+static int wrapper_environment_name_equal(const TCHAR* a, size_t a_length, const TCHAR* b, size_t b_length)
+{
+	return CSTR_EQUAL == CompareStringOrdinal(a, (int)a_length, b, (int)b_length, TRUE);
+}
+
+//
+// SystemRoot is inherited whatever the settings are, since parts of Windows, e.g. Winsock, don't
+// work without it.
+//
+static int wrapper_environment_is_allowed(const wrapper_environment_settings_t* settings, const TCHAR* name,
+                                          size_t length)
+{
+	if (WRAPPER_ENVIRONMENT_INHERIT_ALL == settings->inherit ||
+		wrapper_environment_name_equal(name, length, _T("SystemRoot"), 10))
+	{
+		return 1;
+	}
+
+	if (WRAPPER_ENVIRONMENT_INHERIT_NONE == settings->inherit)
+	{
+		return 0;
+	}
+
+	for (const TCHAR* p = settings->allow; *p;)
+	{
+		const TCHAR* end = p;
+		while (*end && *end != _T(';') && *end != _T(',') && *end != _T(' '))
+		{
+			end++;
+		}
+
+		if (end > p && wrapper_environment_name_equal(p, end - p, name, length))
+		{
+			return 1;
+		}
+		p = *end ? end + 1 : end;
+	}
+	return 0;
+}
+
+static void wrapper_environment_add(wrapper_environment_entry_t* entries, size_t* count, DWORD* order,
+                                    const TCHAR* strings, const wrapper_environment_settings_t* settings)
+{
+	for (const TCHAR* p = strings; p && *p; p += _tcslen(p) + 1)
+	{
+		// The variables that hold the current directory of each drive start with '=', e.g. '=C:'
+		const TCHAR* equals = _tcschr(p + 1, _T('='));
+		if (!equals)
+		{
+			continue;
+		}
+
+		const size_t name_length = equals - p;
+		if (settings && !wrapper_environment_is_allowed(settings, p, name_length))
+		{
+			continue;
+		}
+
+		wrapper_environment_entry_t* entry = &entries[(*count)++];
+		entry->text = p;
+		entry->name_length = name_length;
+		entry->length = _tcslen(p);
+		entry->order = (*order)++;
+	}
+}
+
+//
+// Windows expects the variables in a block to be sorted by name, ignoring case, as if the names were
+// in upper case. Variables with the same name stay in the order they were added.
+//
+static int wrapper_environment_compare(const void* a, const void* b)
+{
+	const wrapper_environment_entry_t* x = a;
+	const wrapper_environment_entry_t* y = b;
+
+	const int result = CompareStringOrdinal(x->text, (int)x->name_length, y->text, (int)y->name_length, TRUE);
+	if (CSTR_EQUAL != result)
+	{
+		return result - CSTR_EQUAL;
+	}
+	return x->order < y->order ? -1 : x->order > y->order;
+}
+
+//
+// Builds the environment block of the child in a single allocation: the variables it inherits from
+// the wrapper, then the ones from the settings, then the extra ones, e.g. the number of the
+// instance. When a name appears more than once, the last value wins. The block is built once and
+// can be passed to CreateProcess as often as needed.
+//
+int wrapper_environment_build(TCHAR** block, const wrapper_environment_settings_t* settings, const TCHAR* extra,
+                              wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	TCHAR* inherited = NULL;
+	wrapper_environment_entry_t* entries = NULL;
+	size_t count = 0;
+	size_t size = 1;
+	DWORD order = 0;
+	TCHAR* result = NULL;
+
+	*block = NULL;
+
+	if (SUCCEEDED(hr))
+	{
+		inherited = GetEnvironmentStrings();
+		if (!inherited)
+		{
+			const DWORD last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to get the environment of the wrapper"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		const size_t capacity = wrapper_environment_count(inherited) + wrapper_environment_count(settings->variables) +
+			wrapper_environment_count(extra);
+		entries = wrapper_allocate((capacity ? capacity : 1) * sizeof *entries);
+		if (!entries)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the environment of the child process"));
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		wrapper_environment_add(entries, &count, &order, inherited, settings);
+		wrapper_environment_add(entries, &count, &order, settings->variables, NULL);
+		wrapper_environment_add(entries, &count, &order, extra, NULL);
+		qsort(entries, count, sizeof *entries, wrapper_environment_compare);
+
+		// Only the last of the entries with the same name is kept, unless its value is empty
+		for (size_t i = 0; i < count; i++)
+		{
+			const wrapper_environment_entry_t* entry = &entries[i];
+			if ((i + 1 < count && wrapper_environment_name_equal(entry->text, entry->name_length, entries[i + 1].text,
+			                                                     entries[i + 1].name_length)) ||
+				entry->length == entry->name_length + 1)
+			{
+				entries[i].length = 0;
+				continue;
+			}
+			size += entry->length + 1;
+		}
+
+		// An empty block still ends with two terminators
+		result = wrapper_allocate_string(size > 1 ? size : 2);
+		if (!result)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the environment of the child process"));
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		TCHAR* p = result;
+		for (size_t i = 0; i < count; i++)
+		{
+			if (entries[i].length)
+			{
+				memcpy(p, entries[i].text, entries[i].length * sizeof(TCHAR));
+				p += entries[i].length + 1;
+			}
+		}
+		*block = result;
+	}
+
+	wrapper_free(entries);
+	if (inherited)
+	{
+		FreeEnvironmentStrings(inherited);
+	}
+	return SUCCEEDED(hr);
+}
+
+//
+// Appends NAME=value to a list of strings that ends with an empty string, such as the extra
+// variables of wrapper_environment_build. The length is that of the list without the empty string.
+//
+int wrapper_environment_append(TCHAR* strings, size_t size, size_t* length, const TCHAR* name, const TCHAR* value)
+{
+	const size_t name_length = _tcslen(name);
+	const size_t value_length = _tcslen(value);
+	if (*length + name_length + value_length + 3 > size)
+	{
+		return 0;
+	}
+
+	TCHAR* p = strings + *length;
+	memcpy(p, name, name_length * sizeof(TCHAR));
+	p[name_length] = _T('=');
+	memcpy(p + name_length + 1, value, value_length * sizeof(TCHAR));
+	p[name_length + 1 + value_length] = 0;
+	p[name_length + 2 + value_length] = 0;
+	*length += name_length + value_length + 2;
+	return 1;
+}
+
+void wrapper_environment_free(TCHAR* block)
+{
+	wrapper_free(block);
+}
+
+int wrapper_environment_equal(const wrapper_environment_settings_t* a, const wrapper_environment_settings_t* b)
+{
+	return a->inherit == b->inherit && 0 == _tcscmp(a->allow, b->allow) && a->size == b->size &&
+		(0 == a->size || 0 == memcmp(a->variables, b->variables, a->size * sizeof(TCHAR)));
+}
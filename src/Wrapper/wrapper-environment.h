@@ -0,0 +1,42 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#pragma once
+#include "wrapper-error.h"
+
+#define WRAPPER_ENVIRONMENT_ALLOW_MAX_LEN 1024
+
+// CreateProcess takes an environment block of TCHAR only when it is told so
+#ifdef UNICODE
+#define WRAPPER_ENVIRONMENT_CREATE_FLAGS CREATE_UNICODE_ENVIRONMENT
+#else
+#define WRAPPER_ENVIRONMENT_CREATE_FLAGS 0
+#endif
+
+typedef enum
+{
+	WRAPPER_ENVIRONMENT_INHERIT_ALL,
+	WRAPPER_ENVIRONMENT_INHERIT_NONE,
+	WRAPPER_ENVIRONMENT_INHERIT_ALLOWLIST,
+} wrapper_environment_inherit_t;
+
+//
+// The variables the child gets on top of the ones it inherits from the wrapper. They are kept as
+// NAME=value strings, one after the other in the order they were read, and end with an empty
+// string, like an environment block. A variable with an empty value removes the inherited one. The
+// allow list holds the names of the variables that are inherited with
+// WRAPPER_ENVIRONMENT_INHERIT_ALLOWLIST, separated by ';', ',' or spaces.
+//
+typedef struct wrapper_environment_settings_t
+{
+	wrapper_environment_inherit_t inherit;
+	TCHAR allow[WRAPPER_ENVIRONMENT_ALLOW_MAX_LEN + 1];
+	TCHAR* variables;
+	size_t size; // In characters, including the empty string at the end
+} wrapper_environment_settings_t;
+
+int wrapper_environment_build(TCHAR** block, const wrapper_environment_settings_t* settings, const TCHAR* extra,
+                              wrapper_error_t** error);
+int wrapper_environment_append(TCHAR* strings, size_t size, size_t* length, const TCHAR* name, const TCHAR* value);
+void wrapper_environment_free(TCHAR* block);
+int wrapper_environment_equal(const wrapper_environment_settings_t* a, const wrapper_environment_settings_t* b);
@@ -0,0 +1,878 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#define WRAPPER_LOG_DOMAIN _T("health")
+
+#include "stdafx.h"
+#include "wrapper-health.h"
+#include "wrapper-log.h"
+#include "wrapper-memory.h"
+#include "wrapper-metrics.h"
+#include "wrapper-string.h"
+
+#define WRAPPER_HEALTH_HOST_MAX_LEN 256
+#define WRAPPER_HEALTH_PORT_MAX_LEN 16
+#define WRAPPER_HEALTH_REQUEST_MAX_LEN 2048
+#define WRAPPER_HEALTH_STATUS_LINE_MIN_LEN 12 // "HTTP/1.1 200"
+
+//
+// Each instance of the child has a probe with its own target and schedule.
+//
+typedef struct wrapper_health_probe_t
+{
+	DWORD index;
+	TCHAR target[WRAPPER_HEALTH_TARGET_MAX_LEN + 1];
+	TCHAR host[WRAPPER_HEALTH_HOST_MAX_LEN + 1];
+	TCHAR port[WRAPPER_HEALTH_PORT_MAX_LEN + 1];
+	char request[WRAPPER_HEALTH_REQUEST_MAX_LEN];
+	int request_length;
+	TCHAR command_line[WRAPPER_HEALTH_TARGET_MAX_LEN + 1];
+	HANDLE unhealthy_event;
+	HANDLE ready_event;
+
+	// Guarded by the lock of the health check
+	int active;
+	DWORD generation;
+	ULONGLONG child_started;
+	ULONGLONG due;
+	DWORD failures;
+	int ready;
+} wrapper_health_probe_t;
+
+//
+// A single thread runs the probes of all instances of the child one after the other. It sleeps
+// until the next probe is due, or until a child is started or has ended, so it costs nothing in
+// between. Each probe is bounded by the timeout, which keeps the schedule from drifting much.
+//
+struct wrapper_health_t
+{
+	SRWLOCK lock;
+	wrapper_health_settings_t settings;
+	DWORD log_interval;
+	int started;
+	HANDLE stop_event;
+	HANDLE wake_event;
+	HANDLE thread;
+	DWORD count;
+	wrapper_health_probe_t* probes;
+};
+
+//
+// Splits "host:port" or "[address]:port" in two. Without a port, the default port is used if there
+// is one.
+//
+static int wrapper_health_split_address(wrapper_health_probe_t* probe, const TCHAR* address, size_t length,
+                                        const TCHAR* default_port)
+{
+	const TCHAR* host = address;
+	size_t host_length = length;
+	const TCHAR* port = NULL;
+
+	if (length && _T('[') == address[0])
+	{
+		const TCHAR* end = address + 1;
+		while (end < address + length && _T(']') != *end)
+		{
+			end++;
+		}
+
+		if (end == address + length)
+		{
+			return 0;
+		}
+
+		host = address + 1;
+		host_length = end - host;
+		if (end + 1 < address + length)
+		{
+			if (_T(':') != end[1])
+			{
+				return 0;
+			}
+			port = end + 2;
+		}
+	}
+	else
+	{
+		for (size_t i = length; i > 0; i--)
+		{
+			if (_T(':') == address[i - 1])
+			{
+				host_length = i - 1;
+				port = address + i;
+				break;
+			}
+		}
+	}
+
+	const size_t port_length = port ? address + length - port : 0;
+	if (0 == host_length || host_length > WRAPPER_HEALTH_HOST_MAX_LEN || port_length > WRAPPER_HEALTH_PORT_MAX_LEN)
+	{
+		return 0;
+	}
+
+	if (0 == port_length && !default_port)
+	{
+		return 0;
+	}
+
+	if (FAILED(StringCchCopyN(probe->host, _countof(probe->host), host, host_length)))
+	{
+		return 0;
+	}
+
+	if (port_length)
+	{
+		return SUCCEEDED(StringCchCopyN(probe->port, _countof(probe->port), port, port_length));
+	}
+	return SUCCEEDED(StringCchCopy(probe->port, _countof(probe->port), default_port));
+}
+
+//
+// Breaks an URL such as http://localhost:8080/health down into the address to connect to, and
+// builds the request once, so that each probe only has to send it.
+//
+static int wrapper_health_prepare_http(wrapper_health_probe_t* probe, wrapper_error_t** error)
+{
+	const TCHAR* url = probe->target;
+	const TCHAR* scheme = _T("http://");
+	const size_t scheme_length = _tcslen(scheme);
+	TCHAR request[WRAPPER_HEALTH_REQUEST_MAX_LEN];
+
+	if (_tcsnicmp(url, scheme, scheme_length))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+			                                   _T("The health check target '%s' must be an URL that starts with 'http://'"),
+			                                   url);
+		}
+		return 0;
+	}
+
+	const TCHAR* authority = url + scheme_length;
+	const TCHAR* path = _tcschr(authority, _T('/'));
+	const size_t authority_length = path ? (size_t)(path - authority) : _tcslen(authority);
+	if (!path)
+	{
+		path = _T("/");
+	}
+
+	if (!wrapper_health_split_address(probe, authority, authority_length, _T("80")))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+			                                   _T("The health check target '%s' doesn't have a valid host and port"), url);
+		}
+		return 0;
+	}
+
+	HRESULT hr = StringCchPrintf(request, _countof(request),
+	                             _T("GET %s HTTP/1.0\r\nHost: %.*s\r\nUser-Agent: phaka-wrapper\r\nConnection: close\r\n\r\n"),
+	                             path, (int)authority_length, authority);
+	if (SUCCEEDED(hr))
+	{
+#ifdef UNICODE
+		probe->request_length = WideCharToMultiByte(CP_UTF8, 0, request, -1, probe->request,
+		                                             sizeof probe->request, NULL, NULL) - 1;
+		if (probe->request_length < 0)
+		{
+			hr = HRESULT_FROM_WIN32(GetLastError());
+		}
+#else
+		hr = StringCbCopyA(probe->request, sizeof probe->request, request);
+		probe->request_length = (int)strlen(probe->request);
+#endif
+	}
+
+	if (FAILED(hr) && error)
+	{
+		*error = wrapper_error_from_hresult(hr, _T("The health check target '%s' is too long"), url);
+	}
+	return SUCCEEDED(hr);
+}
+
+static DWORD wrapper_health_remaining(ULONGLONG deadline)
+{
+	const ULONGLONG now = GetTickCount64();
+	return deadline > now ? (DWORD)(deadline - now) : 0;
+}
+
+//
+// Connects to the first address of the host that accepts the connection before the deadline. The
+// connect is non-blocking so that an address that drops the packets can't hold up the probe.
+//
+static SOCKET wrapper_health_connect(wrapper_health_probe_t* probe, ULONGLONG deadline, wrapper_error_t** error)
+{
+	ADDRINFOT hints = {0};
+	ADDRINFOT* addresses = NULL;
+	SOCKET result = INVALID_SOCKET;
+	int last_error = WSAETIMEDOUT;
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+
+	const int rc = GetAddrInfo(probe->host, probe->port, &hints, &addresses);
+	if (rc)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(rc, _T("Failed to resolve '%s'"), probe->host);
+		}
+		return INVALID_SOCKET;
+	}
+
+	for (ADDRINFOT* address = addresses; address && INVALID_SOCKET == result; address = address->ai_next)
+	{
+		const SOCKET candidate = WSASocket(address->ai_family, address->ai_socktype, address->ai_protocol, NULL, 0,
+		                                   WSA_FLAG_NO_HANDLE_INHERIT);
+		if (INVALID_SOCKET == candidate)
+		{
+			last_error = WSAGetLastError();
+			continue;
+		}
+
+		u_long non_blocking = 1;
+		ioctlsocket(candidate, FIONBIO, &non_blocking);
+		if (SOCKET_ERROR == connect(candidate, address->ai_addr, (int)address->ai_addrlen) &&
+			WSAEWOULDBLOCK != WSAGetLastError())
+		{
+			last_error = WSAGetLastError();
+			closesocket(candidate);
+			continue;
+		}
+
+		fd_set writable;
+		fd_set failed;
+		FD_ZERO(&writable);
+		FD_ZERO(&failed);
+		FD_SET(candidate, &writable);
+		FD_SET(candidate, &failed);
+
+		const DWORD remaining = wrapper_health_remaining(deadline);
+		struct timeval timeout;
+		timeout.tv_sec = remaining / 1000;
+		timeout.tv_usec = (remaining % 1000) * 1000;
+
+		const int selected = select(0, NULL, &writable, &failed, &timeout);
+		if (selected > 0 && FD_ISSET(candidate, &writable))
+		{
+			non_blocking = 0;
+			ioctlsocket(candidate, FIONBIO, &non_blocking);
+			result = candidate;
+		}
+		else
+		{
+			if (0 == selected)
+			{
+				last_error = WSAETIMEDOUT;
+			}
+			else if (selected > 0)
+			{
+				int socket_error = 0;
+				int size = sizeof socket_error;
+				getsockopt(candidate, SOL_SOCKET, SO_ERROR, (char*)&socket_error, &size);
+				last_error = socket_error;
+			}
+			else
+			{
+				last_error = WSAGetLastError();
+			}
+			closesocket(candidate);
+		}
+	}
+
+	FreeAddrInfo(addresses);
+
+	if (INVALID_SOCKET == result && error)
+	{
+		*error = wrapper_error_from_system(last_error, _T("Failed to connect to '%s' port %s"), probe->host,
+		                                   probe->port);
+	}
+	return result;
+}
+
+static int wrapper_health_probe_tcp(wrapper_health_probe_t* probe, ULONGLONG deadline, wrapper_error_t** error)
+{
+	const SOCKET socket = wrapper_health_connect(probe, deadline, error);
+	if (INVALID_SOCKET == socket)
+	{
+		return 0;
+	}
+	closesocket(socket);
+	return 1;
+}
+
+//
+// Sends the request and reads no more than the status line. Any status below 400 means healthy,
+// so that a redirect to a login page doesn't count as a failure.
+//
+static int wrapper_health_probe_http(wrapper_health_probe_t* probe, ULONGLONG deadline, wrapper_error_t** error)
+{
+	char response[64];
+	int received = 0;
+	int last_error = 0;
+
+	const SOCKET socket = wrapper_health_connect(probe, deadline, error);
+	if (INVALID_SOCKET == socket)
+	{
+		return 0;
+	}
+
+	const DWORD timeout = wrapper_health_remaining(deadline) + 1;
+	setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, (const char*)&timeout, sizeof timeout);
+	setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&timeout, sizeof timeout);
+
+	for (int sent = 0; sent < probe->request_length && !last_error;)
+	{
+		const int rc = send(socket, probe->request + sent, probe->request_length - sent, 0);
+		if (rc > 0)
+		{
+			sent += rc;
+		}
+		else
+		{
+			last_error = WSAGetLastError();
+		}
+	}
+
+	while (!last_error && received < WRAPPER_HEALTH_STATUS_LINE_MIN_LEN)
+	{
+		const int rc = recv(socket, response + received, (int)sizeof response - 1 - received, 0);
+		if (rc > 0)
+		{
+			received += rc;
+		}
+		else
+		{
+			last_error = rc ? WSAGetLastError() : WSAECONNRESET;
+		}
+	}
+	closesocket(socket);
+
+	if (last_error)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(last_error, _T("Failed to get a response from '%s'"),
+			                                   probe->target);
+		}
+		return 0;
+	}
+
+	response[received] = 0;
+	int status = 0;
+	if (0 == strncmp(response, "HTTP/", 5))
+	{
+		const char* space = strchr(response, ' ');
+		if (space)
+		{
+			status = atoi(space + 1);
+		}
+	}
+
+	if (status < 200 || status >= 400)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA, _T("The response from '%s' has status %d"),
+			                                   probe->target, status);
+		}
+		return 0;
+	}
+	return 1;
+}
+
+//
+// Runs the command without a console and without any of the handles of the wrapper. The command is
+// healthy when it exits with 0 in time, and is terminated when it doesn't.
+//
+static int wrapper_health_probe_command(wrapper_health_probe_t* probe, ULONGLONG deadline, wrapper_error_t** error)
+{
+	STARTUPINFO startupinfo = {0};
+	PROCESS_INFORMATION process_information = {0};
+	DWORD exit_code = 0;
+
+	startupinfo.cb = sizeof startupinfo;
+
+	// CreateProcess may write to the command line, so it gets a fresh copy each time
+	StringCchCopy(probe->command_line, _countof(probe->command_line), probe->target);
+	if (!CreateProcess(NULL, probe->command_line, NULL, NULL, FALSE, CREATE_NO_WINDOW, NULL, NULL, &startupinfo,
+	                   &process_information))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(GetLastError(), _T("Failed to start the health check command '%s'"),
+			                                   probe->target);
+		}
+		return 0;
+	}
+
+	CloseHandle(process_information.hThread);
+
+	int rc = 1;
+	if (WAIT_OBJECT_0 != WaitForSingleObject(process_information.hProcess, wrapper_health_remaining(deadline)))
+	{
+		TerminateProcess(process_information.hProcess, 1);
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_TIMEOUT, _T("The health check command '%s' did not end in time"),
+			                                   probe->target);
+		}
+		rc = 0;
+	}
+	else if (GetExitCodeProcess(process_information.hProcess, &exit_code) && exit_code)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA, _T("The health check command '%s' exited with code %lu"),
+			                                   probe->target, exit_code);
+		}
+		rc = 0;
+	}
+
+	CloseHandle(process_information.hProcess);
+	return rc;
+}
+
+static int wrapper_health_probe(wrapper_health_t* health, wrapper_health_probe_t* probe, wrapper_error_t** error)
+{
+	const ULONGLONG deadline = GetTickCount64() + health->settings.timeout;
+	switch (health->settings.type)
+	{
+	case WRAPPER_HEALTH_HTTP:
+		return wrapper_health_probe_http(probe, deadline, error);
+	case WRAPPER_HEALTH_TCP:
+		return wrapper_health_probe_tcp(probe, deadline, error);
+	case WRAPPER_HEALTH_COMMAND:
+		return wrapper_health_probe_command(probe, deadline, error);
+	default:
+		return 1;
+	}
+}
+
+static void wrapper_health_log_latency(wrapper_log_level_t level)
+{
+	char text[512];
+	if (wrapper_metric_format_histogram(text, sizeof text, WRAPPER_METRIC_HEALTH_LATENCY))
+	{
+		wrapper_log(level, WRAPPER_LOG_DOMAIN, _T("Health check latency: %hs"), text);
+	}
+}
+
+//
+// Counts the outcome of a probe against the child it was meant for. A probe that overlapped with
+// a restart of the child is ignored.
+//
+static void wrapper_health_record(wrapper_health_t* health, wrapper_health_probe_t* probe, DWORD generation,
+                                  int healthy, wrapper_error_t* probe_error, ULONGLONG duration)
+{
+	const ULONGLONG now = GetTickCount64();
+	const DWORD instance = probe->index + 1;
+	DWORD failures = 0;
+	DWORD previous_failures = 0;
+	int counted = 0;
+	int unhealthy = 0;
+	int ready = 0;
+
+	wrapper_metric_add(WRAPPER_METRIC_HEALTH_CHECKS, 1);
+	wrapper_metric_observe(WRAPPER_METRIC_HEALTH_LATENCY, (LONG64)duration);
+	wrapper_metric_set(WRAPPER_METRIC_HEALTHY, healthy);
+	if (!healthy)
+	{
+		wrapper_metric_add(WRAPPER_METRIC_HEALTH_FAILURES, 1);
+	}
+
+	AcquireSRWLockExclusive(&health->lock);
+	if (probe->active && generation == probe->generation)
+	{
+		probe->due = now + health->settings.interval;
+		previous_failures = probe->failures;
+		if (healthy)
+		{
+			ready = !probe->ready;
+			probe->failures = 0;
+			probe->ready = 1;
+		}
+		else if (probe->ready || now - probe->child_started >= health->settings.start_period)
+		{
+			probe->failures++;
+			counted = 1;
+		}
+
+		failures = probe->failures;
+		if (failures >= health->settings.failure_threshold)
+		{
+			probe->active = 0;
+			unhealthy = 1;
+		}
+	}
+	ReleaseSRWLockExclusive(&health->lock);
+
+	if (ready)
+	{
+		SetEvent(probe->ready_event);
+	}
+
+	if (healthy)
+	{
+		if (previous_failures)
+		{
+			WRAPPER_INFO(_T("The health check of instance %lu passed again after %lu failures."), instance,
+			             previous_failures);
+		}
+	}
+	else if (counted)
+	{
+		WRAPPER_WARNING(_T("The health check of instance %lu failed (%lu of %lu): %s [0x%08x]"), instance, failures,
+		                health->settings.failure_threshold, probe_error ? probe_error->user_message : _T(""),
+		                probe_error ? probe_error->code : 0);
+	}
+	else
+	{
+		WRAPPER_DEBUG(_T("The health check of instance %lu failed within the start period: %s"), instance,
+		              probe_error ? probe_error->user_message : _T(""));
+	}
+
+	if (unhealthy)
+	{
+		WRAPPER_ERROR(_T("Instance %lu of the child process is unhealthy after %lu failed health checks in a row."),
+		              instance, failures);
+		wrapper_health_log_latency(WRAPPER_LOG_LEVEL_WARNING);
+		SetEvent(probe->unhealthy_event);
+	}
+}
+
+static DWORD WINAPI wrapper_health_thread(LPVOID parameter)
+{
+	wrapper_health_t* health = parameter;
+	HANDLE events[2];
+	ULONGLONG last_logged = GetTickCount64();
+
+	events[0] = health->stop_event;
+	events[1] = health->wake_event;
+
+	for (;;)
+	{
+		DWORD timeout = INFINITE;
+		wrapper_health_probe_t* next = NULL;
+		DWORD generation = 0;
+
+		AcquireSRWLockShared(&health->lock);
+		for (DWORD i = 0; i < health->count; i++)
+		{
+			wrapper_health_probe_t* probe = &health->probes[i];
+			if (probe->active && (!next || probe->due < next->due))
+			{
+				next = probe;
+			}
+		}
+
+		if (next)
+		{
+			generation = next->generation;
+			timeout = wrapper_health_remaining(next->due);
+		}
+		ReleaseSRWLockShared(&health->lock);
+
+		const DWORD result = WaitForMultipleObjects(_countof(events), events, FALSE, timeout);
+		if (WAIT_OBJECT_0 + 1 == result)
+		{
+			// A child was started or has ended, so the schedule changed
+			continue;
+		}
+
+		if (WAIT_TIMEOUT != result)
+		{
+			break;
+		}
+
+		wrapper_error_t* probe_error = NULL;
+		const ULONGLONG start = GetTickCount64();
+		const int healthy = wrapper_health_probe(health, next, &probe_error);
+		wrapper_health_record(health, next, generation, healthy, probe_error, GetTickCount64() - start);
+		wrapper_error_free(probe_error);
+
+		const ULONGLONG now = GetTickCount64();
+		if (health->log_interval && now - last_logged >= health->log_interval)
+		{
+			last_logged = now;
+			wrapper_health_log_latency(WRAPPER_LOG_LEVEL_INFO);
+		}
+	}
+
+	return 0;
+}
+
+static int wrapper_health_prepare(wrapper_health_t* health, wrapper_health_probe_t* probe, wrapper_error_t** error)
+{
+	if (!wrapper_string_expand_instance(probe->target, _countof(probe->target), health->settings.target,
+	                                    probe->index + 1))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INSUFFICIENT_BUFFER, _T("The health check target '%s' is too long"),
+			                                   health->settings.target);
+		}
+		return 0;
+	}
+
+	probe->unhealthy_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	probe->ready_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!probe->unhealthy_event || !probe->ready_event)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(GetLastError(), _T("Failed to create the event of the health check"));
+		}
+		return 0;
+	}
+
+	if (WRAPPER_HEALTH_HTTP == health->settings.type)
+	{
+		return wrapper_health_prepare_http(probe, error);
+	}
+
+	if (WRAPPER_HEALTH_TCP == health->settings.type &&
+		!wrapper_health_split_address(probe, probe->target, _tcslen(probe->target), NULL))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+			                                   _T("The health check target '%s' must be a host and a port"),
+			                                   probe->target);
+		}
+		return 0;
+	}
+	return 1;
+}
+
+int wrapper_health_create(wrapper_health_t** health, const wrapper_health_settings_t* settings, DWORD count,
+                          DWORD log_interval, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	DWORD last_error;
+	wrapper_health_t* result = NULL;
+
+	if (SUCCEEDED(hr))
+	{
+		result = wrapper_allocate(sizeof *result);
+		if (result)
+		{
+			result->probes = wrapper_allocate(sizeof *result->probes * count);
+		}
+
+		if (!result || !result->probes)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the health check"));
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		InitializeSRWLock(&result->lock);
+		result->settings = *settings;
+		result->log_interval = log_interval;
+		result->count = count;
+		if (0 == result->settings.failure_threshold)
+		{
+			result->settings.failure_threshold = 1;
+		}
+
+		if (0 == result->settings.interval || 0 == result->settings.target[0])
+		{
+			hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("A health check needs both a target and an interval"));
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr) && WRAPPER_HEALTH_COMMAND != result->settings.type)
+	{
+		WSADATA data;
+		const int rc = WSAStartup(MAKEWORD(2, 2), &data);
+		if (rc)
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(rc, _T("Failed to initialize Windows Sockets"));
+			}
+			hr = HRESULT_FROM_WIN32(rc);
+		}
+		else
+		{
+			result->started = 1;
+		}
+	}
+
+	for (DWORD i = 0; i < count && SUCCEEDED(hr); i++)
+	{
+		result->probes[i].index = i;
+		if (!wrapper_health_prepare(result, &result->probes[i], error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		result->stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+		result->wake_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+		if (!result->stop_event || !result->wake_event)
+		{
+			last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to create the events of the health check"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		result->thread = CreateThread(NULL, 0, wrapper_health_thread, result, 0, NULL);
+		if (!result->thread)
+		{
+			last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to start the health check thread"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (FAILED(hr))
+	{
+		wrapper_health_free(result);
+		result = NULL;
+	}
+
+	*health = result;
+	return SUCCEEDED(hr);
+}
+
+void wrapper_health_free(wrapper_health_t* health)
+{
+	if (health)
+	{
+		if (health->thread)
+		{
+			SetEvent(health->stop_event);
+			WaitForSingleObject(health->thread, INFINITE);
+			CloseHandle(health->thread);
+		}
+
+		if (health->stop_event)
+		{
+			CloseHandle(health->stop_event);
+		}
+
+		if (health->wake_event)
+		{
+			CloseHandle(health->wake_event);
+		}
+
+		for (DWORD i = 0; health->probes && i < health->count; i++)
+		{
+			if (health->probes[i].unhealthy_event)
+			{
+				CloseHandle(health->probes[i].unhealthy_event);
+			}
+			if (health->probes[i].ready_event)
+			{
+				CloseHandle(health->probes[i].ready_event);
+			}
+		}
+		wrapper_free(health->probes);
+
+		if (health->started)
+		{
+			WSACleanup();
+		}
+
+		wrapper_free(health);
+	}
+}
+
+//
+// Starts checking an instance of the child that was just started. The first probe runs an interval
+// later, and the failures are counted from scratch.
+//
+void wrapper_health_start(wrapper_health_t* health, DWORD index)
+{
+	if (health && index < health->count)
+	{
+		wrapper_health_probe_t* probe = &health->probes[index];
+		const ULONGLONG now = GetTickCount64();
+
+		ResetEvent(probe->unhealthy_event);
+		ResetEvent(probe->ready_event);
+		AcquireSRWLockExclusive(&health->lock);
+		probe->active = 1;
+		probe->generation++;
+		probe->child_started = now;
+		probe->due = now + health->settings.interval;
+		probe->failures = 0;
+		probe->ready = 0;
+		ReleaseSRWLockExclusive(&health->lock);
+		SetEvent(health->wake_event);
+	}
+}
+
+//
+// Stops checking an instance until its next child is started.
+//
+void wrapper_health_pause(wrapper_health_t* health, DWORD index)
+{
+	if (health && index < health->count)
+	{
+		AcquireSRWLockExclusive(&health->lock);
+		health->probes[index].active = 0;
+		health->probes[index].generation++;
+		ReleaseSRWLockExclusive(&health->lock);
+		SetEvent(health->wake_event);
+	}
+}
+
+//
+// Gets the event that is set once an instance failed enough health checks in a row.
+//
+HANDLE wrapper_health_get_event(wrapper_health_t* health, DWORD index)
+{
+	return health && index < health->count ? health->probes[index].unhealthy_event : NULL;
+}
+
+//
+// Gets the event that is set once the child of an instance passed its first health check.
+//
+HANDLE wrapper_health_get_ready_event(wrapper_health_t* health, DWORD index)
+{
+	return health && index < health->count ? health->probes[index].ready_event : NULL;
+}
+
+const char* wrapper_health_type_str(wrapper_health_type_t type)
+{
+	switch (type)
+	{
+	case WRAPPER_HEALTH_NONE:
+		return "none";
+	case WRAPPER_HEALTH_HTTP:
+		return "http";
+	case WRAPPER_HEALTH_TCP:
+		return "tcp";
+	case WRAPPER_HEALTH_COMMAND:
+		return "command";
+	default:
+		return "unknown";
+	}
+}
@@ -0,0 +1,43 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#pragma once
+#include "wrapper-error.h"
+
+#define WRAPPER_HEALTH_TARGET_MAX_LEN 1024
+
+typedef enum
+{
+	WRAPPER_HEALTH_NONE,
+	WRAPPER_HEALTH_HTTP,
+	WRAPPER_HEALTH_TCP,
+	WRAPPER_HEALTH_COMMAND,
+} wrapper_health_type_t;
+
+//
+// The target depends on the type of the probe: a URL such as http://127.0.0.1:8080/health, an
+// address such as 127.0.0.1:8080, or a command line. A '%i' in the target is replaced with the
+// number of the instance. Failures within the start period after the child started don't count,
+// unless a probe already succeeded.
+//
+typedef struct wrapper_health_settings_t
+{
+	wrapper_health_type_t type;
+	TCHAR target[WRAPPER_HEALTH_TARGET_MAX_LEN + 1];
+	DWORD interval;
+	DWORD timeout;
+	DWORD failure_threshold;
+	DWORD start_period;
+} wrapper_health_settings_t;
+
+typedef struct wrapper_health_t wrapper_health_t;
+
+int wrapper_health_create(wrapper_health_t** health, const wrapper_health_settings_t* settings, DWORD count,
+                          DWORD log_interval, wrapper_error_t** error);
+void wrapper_health_free(wrapper_health_t* health);
+
+void wrapper_health_start(wrapper_health_t* health, DWORD index);
+void wrapper_health_pause(wrapper_health_t* health, DWORD index);
+HANDLE wrapper_health_get_event(wrapper_health_t* health, DWORD index);
+HANDLE wrapper_health_get_ready_event(wrapper_health_t* health, DWORD index);
+const char* wrapper_health_type_str(wrapper_health_type_t type);
@@ -0,0 +1,457 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#include "stdafx.h"
+#include "wrapper-hooks.h"
+#include "wrapper-environment.h"
+#include "wrapper-job.h"
+#include "wrapper-log-writer.h"
+#include "wrapper-memory.h"
+#include "wrapper-process.h"
+#include "wrapper-relay.h"
+
+#define WRAPPER_HOOKS_PROGRESS_INTERVAL 1000
+
+//
+// A hook runs like the child does: with the environment and working directory of the child, in a
+// job object of its own so that whatever it starts ends with it, and with its output relayed to the
+// log, tagged with the stage and number of the hook, e.g. 'stdout.ExecStartPre.2'.
+//
+typedef struct wrapper_hook_t
+{
+	wrapper_hooks_t* hooks;
+	DWORD number;
+	const TCHAR* command_line;
+	HANDLE process;
+	wrapper_job_t* job;
+	wrapper_relay_t* relay;
+	ULONGLONG start;
+	wrapper_reactor_source_t* exit_source;
+	wrapper_timer_t timer;
+	int timed_out;
+	TCHAR buffer[WRAPPER_HOOK_CMDLINE_MAX_LEN + 1];
+} wrapper_hook_t;
+
+//
+// The hooks of a stage that run on the reactor. The stage keeps copies of the command lines and
+// the working directory, since a reload may change the settings while it runs. Each hook slot is
+// used by the next hook once the hook in it ended.
+//
+struct wrapper_hooks_t
+{
+	wrapper_reactor_t* reactor;
+	wrapper_hook_stage_t stage;
+	DWORD count;
+	DWORD timeout;
+	DWORD workers;
+	DWORD next;
+	DWORD active;
+	ULONGLONG start;
+	TCHAR* environment;
+	TCHAR working_directory[MAX_PATH];
+	wrapper_log_writer_t* writer;
+	wrapper_hooks_progress_t progress;
+	wrapper_hooks_done_t done;
+	void* user_data;
+	wrapper_error_t* error;
+	wrapper_timer_t progress_timer;
+	wrapper_timer_t done_timer;
+	wrapper_hook_t hooks[WRAPPER_HOOKS_MAX];
+	TCHAR command_line[WRAPPER_HOOKS_MAX][WRAPPER_HOOK_CMDLINE_MAX_LEN + 1];
+};
+
+const TCHAR* wrapper_hook_stage_str(wrapper_hook_stage_t stage)
+{
+	switch (stage)
+	{
+	case WRAPPER_HOOK_START_PRE:
+		return _T("ExecStartPre");
+	case WRAPPER_HOOK_START_POST:
+		return _T("ExecStartPost");
+	case WRAPPER_HOOK_STOP_POST:
+		return _T("ExecStopPost");
+	default:
+		return _T("unknown");
+	}
+}
+
+static void wrapper_hook_close(wrapper_hook_t* hook)
+{
+	wrapper_reactor_remove(hook->hooks->reactor, &hook->exit_source);
+	wrapper_reactor_cancel_timer(hook->hooks->reactor, &hook->timer);
+
+	if (hook->process)
+	{
+		CloseHandle(hook->process);
+		hook->process = NULL;
+	}
+
+	// Whatever the hook left behind is terminated along with the job, which also breaks the pipes
+	// of the relay those processes may have inherited
+	wrapper_job_free(hook->job);
+	hook->job = NULL;
+	wrapper_relay_free(hook->relay);
+	hook->relay = NULL;
+}
+
+static int wrapper_hook_start(wrapper_hook_t* hook, wrapper_hook_stage_t stage, const TCHAR* environment,
+                              const TCHAR* working_directory, wrapper_log_writer_t* writer, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	STARTUPINFOEX startupinfo = {0};
+	PROCESS_INFORMATION process_information = {0};
+	const wrapper_job_limits_t limits = {0};
+	HANDLE handles[2];
+	TCHAR tag[32];
+
+	_sntprintf_s(tag, _countof(tag), _TRUNCATE, _T("%s.%lu"), wrapper_hook_stage_str(stage), hook->number);
+
+	if (SUCCEEDED(hr) && writer)
+	{
+		if (!wrapper_relay_create(&hook->relay, writer, tag, NULL, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		wrapper_error_t* job_error = NULL;
+		if (!wrapper_job_create(&hook->job, &limits, &job_error))
+		{
+			wrapper_error_log(job_error);
+			wrapper_error_free(job_error);
+			WRAPPER_WARNING(_T("The processes started by hook '%s' won't be stopped with it."), tag);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		// CreateProcess may write to the command line, so it gets a copy
+		StringCchCopy(hook->buffer, _countof(hook->buffer), hook->command_line);
+
+		startupinfo.StartupInfo.cb = sizeof startupinfo.StartupInfo;
+		startupinfo.StartupInfo.dwFlags |= STARTF_USESTDHANDLES;
+		startupinfo.StartupInfo.hStdOutput = wrapper_relay_get_output(hook->relay);
+		startupinfo.StartupInfo.hStdError = wrapper_relay_get_error(hook->relay);
+
+		// A hook only inherits the pipes of its relay, not e.g. the sockets the child listens on
+		handles[0] = startupinfo.StartupInfo.hStdOutput;
+		handles[1] = startupinfo.StartupInfo.hStdError;
+		wrapper_error_t* list_error = NULL;
+		if (hook->relay && !wrapper_process_create_handle_list(&startupinfo.lpAttributeList, handles, _countof(handles),
+		                                                       &list_error))
+		{
+			wrapper_error_log(list_error);
+			wrapper_error_free(list_error);
+			WRAPPER_WARNING(_T("Hook '%s' inherits all the inheritable handles of the wrapper."), tag);
+		}
+		if (startupinfo.lpAttributeList)
+		{
+			startupinfo.StartupInfo.cb = sizeof startupinfo;
+		}
+
+		WRAPPER_INFO(_T("Starting hook '%s' with command line '%s'"), tag, hook->command_line);
+		if (!CreateProcess(NULL, hook->buffer, NULL, NULL, hook->relay != NULL,
+		                   (hook->job ? CREATE_SUSPENDED : 0) | CREATE_NO_WINDOW |
+		                   (startupinfo.lpAttributeList ? EXTENDED_STARTUPINFO_PRESENT : 0) |
+		                   WRAPPER_ENVIRONMENT_CREATE_FLAGS,
+		                   (LPVOID)environment, working_directory, &startupinfo.StartupInfo, &process_information))
+		{
+			const DWORD last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to start hook '%s' with command line '%s'"), tag,
+				                                   hook->command_line);
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+		wrapper_process_free_handle_list(startupinfo.lpAttributeList);
+	}
+
+	if (SUCCEEDED(hr) && hook->job)
+	{
+		wrapper_error_t* job_error = NULL;
+		if (!wrapper_job_assign(hook->job, process_information.hProcess, &job_error))
+		{
+			wrapper_error_log(job_error);
+			wrapper_error_free(job_error);
+		}
+		ResumeThread(process_information.hThread);
+	}
+
+	// The hook has its own copies of the pipes now, if it was started at all
+	wrapper_relay_detach(hook->relay);
+
+	if (process_information.hThread)
+	{
+		CloseHandle(process_information.hThread);
+	}
+
+	hook->process = process_information.hProcess;
+	hook->start = GetTickCount64();
+	if (FAILED(hr))
+	{
+		wrapper_hook_close(hook);
+	}
+	return SUCCEEDED(hr);
+}
+
+static void wrapper_hooks_fail(wrapper_hooks_t* hooks, wrapper_error_t* error)
+{
+	if (hooks->error)
+	{
+		wrapper_error_free(error);
+	}
+	else
+	{
+		hooks->error = error;
+	}
+}
+
+static void wrapper_hooks_on_done(void* user_data)
+{
+	wrapper_hooks_t* hooks = user_data;
+	wrapper_error_t* error = hooks->error;
+
+	wrapper_reactor_cancel_timer(hooks->reactor, &hooks->progress_timer);
+	WRAPPER_INFO(_T("The %s hooks took %llu ms."), wrapper_hook_stage_str(hooks->stage), GetTickCount64() - hooks->start);
+
+	// The callback may free the stage
+	hooks->error = NULL;
+	hooks->done(hooks->user_data, error);
+}
+
+static void wrapper_hooks_on_progress(void* user_data)
+{
+	wrapper_hooks_t* hooks = user_data;
+
+	if (hooks->progress)
+	{
+		hooks->progress(hooks->user_data);
+	}
+	wrapper_reactor_set_timer(hooks->reactor, &hooks->progress_timer, WRAPPER_HOOKS_PROGRESS_INTERVAL,
+	                          wrapper_hooks_on_progress, hooks);
+}
+
+static void wrapper_hook_on_exit(void* user_data);
+static void wrapper_hook_on_timeout(void* user_data);
+
+//
+// Starts the hooks that are left until workers of them run, and ends the stage once the last one
+// ended. A hook that can't be started fails the stage, but the others still run. The stage ends
+// from the reactor, so that done is never called from within wrapper_hooks_start.
+//
+static void wrapper_hooks_launch(wrapper_hooks_t* hooks)
+{
+	for (DWORD i = 0; i < hooks->workers && hooks->next < hooks->count;)
+	{
+		wrapper_hook_t* hook = &hooks->hooks[i];
+		if (hook->process)
+		{
+			i++;
+			continue;
+		}
+
+		hook->number = hooks->next + 1;
+		hook->command_line = hooks->command_line[hooks->next++];
+		hook->timed_out = 0;
+
+		wrapper_error_t* error = NULL;
+		if (!wrapper_hook_start(hook, hooks->stage, hooks->environment,
+		                        *hooks->working_directory ? hooks->working_directory : NULL, hooks->writer, &error) ||
+			!wrapper_reactor_add_handle(hooks->reactor, hook->process, wrapper_hook_on_exit, hook, &hook->exit_source,
+			                            &error))
+		{
+			// A hook that can't be waited for can't be left running either
+			if (hook->process)
+			{
+				TerminateProcess(hook->process, ERROR_OPERATION_ABORTED);
+			}
+			wrapper_hook_close(hook);
+			wrapper_error_log(error);
+			wrapper_hooks_fail(hooks, error);
+			continue;
+		}
+
+		if (hooks->timeout)
+		{
+			wrapper_reactor_set_timer(hooks->reactor, &hook->timer, hooks->timeout, wrapper_hook_on_timeout, hook);
+		}
+		hooks->active++;
+		i++;
+	}
+
+	if (0 == hooks->active && hooks->next >= hooks->count)
+	{
+		wrapper_reactor_set_timer(hooks->reactor, &hooks->done_timer, 0, wrapper_hooks_on_done, hooks);
+	}
+}
+
+static void wrapper_hook_on_exit(void* user_data)
+{
+	wrapper_hook_t* hook = user_data;
+	wrapper_hooks_t* hooks = hook->hooks;
+	const ULONGLONG duration = GetTickCount64() - hook->start;
+	const TCHAR* name = wrapper_hook_stage_str(hooks->stage);
+	DWORD exit_code = 0;
+
+	GetExitCodeProcess(hook->process, &exit_code);
+	if (hook->timed_out)
+	{
+		// It failed when it ran out of time
+	}
+	else if (0 == exit_code)
+	{
+		WRAPPER_INFO(_T("Hook '%s.%lu' ended after %llu ms."), name, hook->number, duration);
+	}
+	else
+	{
+		WRAPPER_ERROR(_T("Hook '%s.%lu' failed with exit code %lu (0x%08x) after %llu ms."), name, hook->number,
+		              exit_code, exit_code, duration);
+		wrapper_hooks_fail(hooks, wrapper_error_from_system(ERROR_PROCESS_ABORTED, _T("%s '%s' failed with exit code %lu"),
+		                                                    name, hook->command_line, exit_code));
+	}
+
+	wrapper_hook_close(hook);
+	hooks->active--;
+	wrapper_hooks_launch(hooks);
+}
+
+//
+// A hook that doesn't end in time is terminated, and fails. The stage goes on once it ended.
+//
+static void wrapper_hook_on_timeout(void* user_data)
+{
+	wrapper_hook_t* hook = user_data;
+	wrapper_hooks_t* hooks = hook->hooks;
+	const TCHAR* name = wrapper_hook_stage_str(hooks->stage);
+
+	WRAPPER_ERROR(_T("Hook '%s.%lu' didn't end within %lu ms and is terminated."), name, hook->number, hooks->timeout);
+	if (!hook->job || !wrapper_job_terminate(hook->job, ERROR_TIMEOUT, NULL, NULL))
+	{
+		TerminateProcess(hook->process, ERROR_TIMEOUT);
+	}
+
+	hook->timed_out = 1;
+	wrapper_hooks_fail(hooks, wrapper_error_from_system(ERROR_TIMEOUT, _T("%s '%s' didn't end within %lu ms"), name,
+	                                                    hook->command_line, hooks->timeout));
+}
+
+//
+// Runs the hooks of a stage on the reactor and calls done once they all ended. Every hook runs,
+// even when another one failed, since they don't depend on each other; the stage fails when any of
+// them did, with the error of the first one that failed. The stage takes over the environment block
+// and copies the command lines, since a reload may change the settings while it runs.
+//
+int wrapper_hooks_start(wrapper_hooks_t** hooks, wrapper_reactor_t* reactor, const wrapper_hooks_settings_t* settings,
+                        wrapper_hook_stage_t stage, TCHAR* environment, const TCHAR* working_directory,
+                        wrapper_log_writer_t* writer, wrapper_hooks_progress_t progress, wrapper_hooks_done_t done,
+                        void* user_data, wrapper_error_t** error)
+{
+	wrapper_hooks_t* result = wrapper_allocate(sizeof *result);
+	if (!result)
+	{
+		wrapper_environment_free(environment);
+		if (error)
+		{
+			*error = wrapper_error_from_hresult(E_OUTOFMEMORY, _T("Failed to allocate memory for the %s hooks"),
+			                                    wrapper_hook_stage_str(stage));
+		}
+		*hooks = NULL;
+		return 0;
+	}
+
+	result->reactor = reactor;
+	result->stage = stage;
+	result->count = min(settings->count[stage], WRAPPER_HOOKS_MAX);
+	result->timeout = settings->timeout;
+	result->workers = settings->workers ? min(settings->workers, WRAPPER_HOOKS_MAX) : 1;
+	result->start = GetTickCount64();
+	result->environment = environment;
+	result->writer = writer;
+	result->progress = progress;
+	result->done = done;
+	result->user_data = user_data;
+	if (working_directory)
+	{
+		StringCchCopy(result->working_directory, _countof(result->working_directory), working_directory);
+	}
+
+	for (DWORD i = 0; i < WRAPPER_HOOKS_MAX; i++)
+	{
+		result->hooks[i].hooks = result;
+	}
+	for (DWORD i = 0; i < result->count; i++)
+	{
+		StringCchCopy(result->command_line[i], _countof(result->command_line[i]), settings->command_line[stage][i]);
+	}
+
+	WRAPPER_INFO(_T("Running %lu %s hooks, %lu at a time."), result->count, wrapper_hook_stage_str(stage),
+	             min(result->workers, result->count));
+	wrapper_reactor_set_timer(reactor, &result->progress_timer, WRAPPER_HOOKS_PROGRESS_INTERVAL,
+	                          wrapper_hooks_on_progress, result);
+	wrapper_hooks_launch(result);
+
+	*hooks = result;
+	return 1;
+}
+
+//
+// Ends a stage without calling done. The hooks that still run are terminated along with whatever
+// they started.
+//
+void wrapper_hooks_free(wrapper_hooks_t* hooks)
+{
+	if (!hooks)
+	{
+		return;
+	}
+
+	if (hooks->active)
+	{
+		WRAPPER_WARNING(_T("Terminating the %lu %s hooks that still run."), hooks->active,
+		                wrapper_hook_stage_str(hooks->stage));
+	}
+
+	for (DWORD i = 0; i < WRAPPER_HOOKS_MAX; i++)
+	{
+		wrapper_hook_t* hook = &hooks->hooks[i];
+		if (hook->process)
+		{
+			TerminateProcess(hook->process, ERROR_OPERATION_ABORTED);
+		}
+		wrapper_hook_close(hook);
+	}
+
+	wrapper_reactor_cancel_timer(hooks->reactor, &hooks->progress_timer);
+	wrapper_reactor_cancel_timer(hooks->reactor, &hooks->done_timer);
+	wrapper_environment_free(hooks->environment);
+	wrapper_error_free(hooks->error);
+	wrapper_free(hooks);
+}
+
+int wrapper_hooks_equal(const wrapper_hooks_settings_t* a, const wrapper_hooks_settings_t* b)
+{
+	if (a->timeout != b->timeout || a->workers != b->workers)
+	{
+		return 0;
+	}
+
+	for (int stage = 0; stage < WRAPPER_HOOK_STAGE_COUNT; stage++)
+	{
+		if (a->count[stage] != b->count[stage])
+		{
+			return 0;
+		}
+
+		for (DWORD i = 0; i < a->count[stage]; i++)
+		{
+			if (_tcscmp(a->command_line[stage][i], b->command_line[stage][i]))
+			{
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
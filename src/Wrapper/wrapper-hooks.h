@@ -0,0 +1,51 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#pragma once
+#include "wrapper-error.h"
+#include "wrapper-reactor.h"
+
+#define WRAPPER_HOOKS_MAX 8
+#define WRAPPER_HOOK_CMDLINE_MAX_LEN 1024
+
+typedef enum
+{
+	WRAPPER_HOOK_START_PRE,  // ExecStartPre, before the child is started
+	WRAPPER_HOOK_START_POST, // ExecStartPost, once the child is ready
+	WRAPPER_HOOK_STOP_POST,  // ExecStopPost, after the child stopped
+	WRAPPER_HOOK_STAGE_COUNT,
+} wrapper_hook_stage_t;
+
+//
+// The command lines to run at each stage, in the order they were configured. The hooks of a stage
+// run side by side, but no more than workers at a time, and each must end within the timeout,
+// unless it is 0.
+//
+typedef struct wrapper_hooks_settings_t
+{
+	DWORD count[WRAPPER_HOOK_STAGE_COUNT];
+	TCHAR command_line[WRAPPER_HOOK_STAGE_COUNT][WRAPPER_HOOKS_MAX][WRAPPER_HOOK_CMDLINE_MAX_LEN + 1];
+	DWORD timeout;
+	DWORD workers;
+} wrapper_hooks_settings_t;
+
+// The hooks are read with the configuration, which the log writer depends on
+struct wrapper_log_writer_t;
+
+// The hooks of a stage that run on the reactor
+typedef struct wrapper_hooks_t wrapper_hooks_t;
+
+// Called about once a second while the hooks of a stage run, e.g. to report progress to the SCM
+typedef void (*wrapper_hooks_progress_t)(void* user_data);
+
+// Called on the thread of the reactor once all the hooks of a stage ended. The error is NULL when
+// they all succeeded, and belongs to the callback otherwise.
+typedef void (*wrapper_hooks_done_t)(void* user_data, wrapper_error_t* error);
+
+const TCHAR* wrapper_hook_stage_str(wrapper_hook_stage_t stage);
+int wrapper_hooks_start(wrapper_hooks_t** hooks, wrapper_reactor_t* reactor, const wrapper_hooks_settings_t* settings,
+                        wrapper_hook_stage_t stage, TCHAR* environment, const TCHAR* working_directory,
+                        struct wrapper_log_writer_t* writer, wrapper_hooks_progress_t progress,
+                        wrapper_hooks_done_t done, void* user_data, wrapper_error_t** error);
+void wrapper_hooks_free(wrapper_hooks_t* hooks);
+int wrapper_hooks_equal(const wrapper_hooks_settings_t* a, const wrapper_hooks_settings_t* b);
@@ -0,0 +1,303 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#include "stdafx.h"
+#include "wrapper-http.h"
+#include "wrapper-memory.h"
+
+#define WRAPPER_HTTP_RECEIVE_TIMEOUT 2000
+#define WRAPPER_HTTP_SEND_TIMEOUT 2000
+#define WRAPPER_HTTP_ACCEPT_BACKOFF_MAX 1000
+
+//
+// A deliberately small HTTP server. It only answers GET requests, one connection at a time, with
+// a single thread, which is plenty for a scraper that polls every few seconds.
+//
+struct wrapper_http_server_t
+{
+	SOCKET socket;
+	HANDLE thread;
+	wrapper_http_handler_t handler;
+	void* user_data;
+	int started;
+	char request[WRAPPER_HTTP_REQUEST_MAX_LEN];
+	char body[WRAPPER_HTTP_RESPONSE_MAX_LEN];
+	char header[256];
+};
+
+static const char* wrapper_http_get_reason(int status)
+{
+	switch (status)
+	{
+	case 200:
+		return "OK";
+	case 404:
+		return "Not Found";
+	case 405:
+		return "Method Not Allowed";
+	case 503:
+		return "Service Unavailable";
+	default:
+		return "Internal Server Error";
+	}
+}
+
+static void wrapper_http_send(SOCKET client, const char* data, size_t length)
+{
+	while (length > 0)
+	{
+		const int sent = send(client, data, (int)length, 0);
+		if (sent <= 0)
+		{
+			return;
+		}
+		data += sent;
+		length -= sent;
+	}
+}
+
+static void wrapper_http_serve(wrapper_http_server_t* server, SOCKET client)
+{
+	int received = 0;
+	const DWORD receive_timeout = WRAPPER_HTTP_RECEIVE_TIMEOUT;
+	const DWORD send_timeout = WRAPPER_HTTP_SEND_TIMEOUT;
+
+	// A client that stops reading or writing can't hold up the only thread, which the server waits
+	// for when it is freed
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, (const char*)&receive_timeout, sizeof receive_timeout);
+	setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, (const char*)&send_timeout, sizeof send_timeout);
+
+	// Only the request line matters, so stop reading at the end of the headers or when the buffer
+	// is full.
+	while (received < WRAPPER_HTTP_REQUEST_MAX_LEN - 1)
+	{
+		const int count = recv(client, server->request + received, WRAPPER_HTTP_REQUEST_MAX_LEN - 1 - received, 0);
+		if (count <= 0)
+		{
+			break;
+		}
+		received += count;
+		server->request[received] = 0;
+		if (strstr(server->request, "\r\n\r\n"))
+		{
+			break;
+		}
+	}
+	server->request[received] = 0;
+
+	int status = 405;
+	size_t length = 0;
+	if (0 == strncmp(server->request, "GET ", 4))
+	{
+		char* path = server->request + 4;
+		char* path_end = strchr(path, ' ');
+		if (path_end)
+		{
+			*path_end = 0;
+			status = server->handler(path, server->body, sizeof server->body, &length, server->user_data);
+		}
+	}
+
+	if (status != 200)
+	{
+		StringCbCopyA(server->body, sizeof server->body, wrapper_http_get_reason(status));
+		length = strlen(server->body);
+	}
+
+	StringCbPrintfA(server->header, sizeof server->header,
+	                "HTTP/1.1 %d %s\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+	                "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+	                status, wrapper_http_get_reason(status), length);
+	wrapper_http_send(client, server->header, strlen(server->header));
+	wrapper_http_send(client, server->body, length);
+	shutdown(client, SD_SEND);
+}
+
+static DWORD WINAPI wrapper_http_thread(LPVOID parameter)
+{
+	wrapper_http_server_t* server = parameter;
+	DWORD backoff = 0;
+
+	// Closing the listening socket makes accept fail, which is how the thread is stopped
+	for (;;)
+	{
+		SOCKET client = accept(server->socket, NULL, NULL);
+		if (INVALID_SOCKET == client)
+		{
+			if (WSAEINTR == WSAGetLastError() || WSAENOTSOCK == WSAGetLastError() || INVALID_SOCKET == server->socket)
+			{
+				break;
+			}
+
+			// E.g. when the system runs out of buffers, which doesn't clear up by trying again at once
+			backoff = backoff ? min(backoff * 2, WRAPPER_HTTP_ACCEPT_BACKOFF_MAX) : 10;
+			Sleep(backoff);
+			continue;
+		}
+
+		backoff = 0;
+		wrapper_http_serve(server, client);
+		closesocket(client);
+	}
+
+	return 0;
+}
+
+static int wrapper_http_server_listen(wrapper_http_server_t* server, const TCHAR* address, DWORD port,
+                                      wrapper_error_t** error)
+{
+	SOCKADDR_STORAGE storage = {0};
+	int storage_length = 0;
+
+	SOCKADDR_IN* ipv4 = (SOCKADDR_IN*)&storage;
+	SOCKADDR_IN6* ipv6 = (SOCKADDR_IN6*)&storage;
+	if (1 == InetPton(AF_INET, address, &ipv4->sin_addr))
+	{
+		ipv4->sin_family = AF_INET;
+		ipv4->sin_port = htons((u_short)port);
+		storage_length = sizeof *ipv4;
+	}
+	else if (1 == InetPton(AF_INET6, address, &ipv6->sin6_addr))
+	{
+		ipv6->sin6_family = AF_INET6;
+		ipv6->sin6_port = htons((u_short)port);
+		storage_length = sizeof *ipv6;
+	}
+	else
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA, _T("The address '%s' is not a valid IP address"), address);
+		}
+		return 0;
+	}
+
+	server->socket = WSASocket(storage.ss_family, SOCK_STREAM, IPPROTO_TCP, NULL, 0, WSA_FLAG_NO_HANDLE_INHERIT);
+	if (INVALID_SOCKET == server->socket)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(WSAGetLastError(), _T("Failed to create a socket to listen on"));
+		}
+		return 0;
+	}
+
+	// Another process must not be able to take over the port
+	BOOL exclusive = TRUE;
+	setsockopt(server->socket, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, (const char*)&exclusive, sizeof exclusive);
+
+	if (SOCKET_ERROR == bind(server->socket, (SOCKADDR*)&storage, storage_length) ||
+		SOCKET_ERROR == listen(server->socket, SOMAXCONN))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(WSAGetLastError(), _T("Failed to listen on %s port %lu"), address, port);
+		}
+		return 0;
+	}
+
+	return 1;
+}
+
+int wrapper_http_server_create(wrapper_http_server_t** server,
+                               const TCHAR* address,
+                               DWORD port,
+                               wrapper_http_handler_t handler,
+                               void* user_data,
+                               wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	wrapper_http_server_t* result = NULL;
+
+	if (SUCCEEDED(hr))
+	{
+		result = wrapper_allocate(sizeof *result);
+		if (!result)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the HTTP server"));
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		result->socket = INVALID_SOCKET;
+		result->handler = handler;
+		result->user_data = user_data;
+
+		WSADATA data;
+		const int rc = WSAStartup(MAKEWORD(2, 2), &data);
+		if (rc)
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(rc, _T("Failed to initialize Windows Sockets"));
+			}
+			hr = HRESULT_FROM_WIN32(rc);
+		}
+		else
+		{
+			result->started = 1;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!wrapper_http_server_listen(result, address, port, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		result->thread = CreateThread(NULL, 0, wrapper_http_thread, result, 0, NULL);
+		if (!result->thread)
+		{
+			const DWORD last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to start the HTTP server thread"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (FAILED(hr))
+	{
+		wrapper_http_server_free(result);
+		result = NULL;
+	}
+
+	*server = result;
+	return SUCCEEDED(hr);
+}
+
+void wrapper_http_server_free(wrapper_http_server_t* server)
+{
+	if (server)
+	{
+		if (INVALID_SOCKET != server->socket)
+		{
+			const SOCKET socket = server->socket;
+			server->socket = INVALID_SOCKET;
+			closesocket(socket);
+		}
+
+		if (server->thread)
+		{
+			WaitForSingleObject(server->thread, INFINITE);
+			CloseHandle(server->thread);
+		}
+
+		if (server->started)
+		{
+			WSACleanup();
+		}
+
+		wrapper_free(server);
+	}
+}
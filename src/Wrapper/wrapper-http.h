@@ -0,0 +1,23 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#pragma once
+#include "wrapper-error.h"
+
+#define WRAPPER_HTTP_REQUEST_MAX_LEN 4096
+#define WRAPPER_HTTP_RESPONSE_MAX_LEN 65536
+
+//
+// Fills in the body of the response to a GET request for the path and returns the HTTP status.
+//
+typedef int (*wrapper_http_handler_t)(const char* path, char* body, size_t size, size_t* length, void* user_data);
+
+typedef struct wrapper_http_server_t wrapper_http_server_t;
+
+int wrapper_http_server_create(wrapper_http_server_t** server,
+                               const TCHAR* address,
+                               DWORD port,
+                               wrapper_http_handler_t handler,
+                               void* user_data,
+                               wrapper_error_t** error);
+void wrapper_http_server_free(wrapper_http_server_t* server);
@@ -0,0 +1,1017 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#include "stdafx.h"
+#include "wrapper-ini.h"
+#include "wrapper-memory.h"
+
+#define WRAPPER_INI_SIZE_MAX (16 * 1024 * 1024)
+
+//
+// The entries of a section follow each other in the table, so a section only needs to know where
+// they start. A section that appears more than once in the file has a record for each time.
+//
+typedef struct wrapper_ini_section_t
+{
+	const TCHAR* name;
+	DWORD first;
+	DWORD count;
+} wrapper_ini_section_t;
+
+//
+// Everything lives in one block of memory: this structure, the sections, the entries, the text of
+// the file and its path. There is an entry and a section for each line at most, so the size of the
+// block is known once the lines are counted.
+//
+typedef struct wrapper_ini_document_t
+{
+	struct wrapper_ini_document_t* previous;
+	struct wrapper_ini_document_t* next;
+	const TCHAR* path;
+	wrapper_ini_section_t* sections;
+	DWORD section_count;
+	wrapper_ini_entry_t* entries;
+	DWORD entry_count;
+	TCHAR* text;
+} wrapper_ini_document_t;
+
+//
+// The values with variables in them are replaced once they are resolved, and the new values are
+// appended to chunks of memory that live as long as the table.
+//
+typedef struct wrapper_ini_chunk_t
+{
+	struct wrapper_ini_chunk_t* next;
+	size_t capacity;
+	size_t used;
+	TCHAR data[1];
+} wrapper_ini_chunk_t;
+
+#define WRAPPER_INI_CHUNK_LEN 16384
+
+#define WRAPPER_INI_UNRESOLVED 0
+#define WRAPPER_INI_RESOLVING 1
+#define WRAPPER_INI_RESOLVED 2
+
+//
+// The files are kept in the order they are read, so that a file that is read later overrides the
+// ones that were read before it.
+//
+struct wrapper_ini_t
+{
+	wrapper_ini_document_t* first;
+	wrapper_ini_document_t* last;
+	wrapper_ini_chunk_t* chunks;
+};
+
+//
+// Converts the text of the file to TCHAR, or only counts the characters when text is NULL. Without
+// a byte order mark, the text is UTF-8, unless it isn't valid UTF-8, in which case it is taken to be
+// in the ANSI code page, like GetPrivateProfileString does.
+//
+static size_t wrapper_ini_decode(TCHAR* text, size_t capacity, const BYTE* bytes, size_t size, int utf16)
+{
+	if (0 == size)
+	{
+		return 0;
+	}
+
+#ifdef UNICODE
+	if (utf16)
+	{
+		const size_t length = size / sizeof(WCHAR);
+		if (text)
+		{
+			memcpy(text, bytes, length * sizeof(WCHAR));
+		}
+		return length;
+	}
+
+	int length = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, (LPCCH)bytes, (int)size, text, (int)capacity);
+	if (0 == length)
+	{
+		length = MultiByteToWideChar(CP_ACP, 0, (LPCCH)bytes, (int)size, text, (int)capacity);
+	}
+	return length;
+#else
+	if (utf16)
+	{
+		return WideCharToMultiByte(CP_ACP, 0, (LPCWCH)bytes, (int)(size / sizeof(WCHAR)), text, (int)capacity, NULL,
+		                           NULL);
+	}
+
+	if (text)
+	{
+		memcpy(text, bytes, size);
+	}
+	return size;
+#endif
+}
+
+//
+// Trims the whitespace around the characters from begin up to end, and terminates them.
+//
+static TCHAR* wrapper_ini_trim(TCHAR* begin, TCHAR* end)
+{
+	while (begin < end && (*begin == _T(' ') || *begin == _T('\t')))
+	{
+		begin++;
+	}
+
+	while (end > begin && (end[-1] == _T(' ') || end[-1] == _T('\t') || end[-1] == _T('\r')))
+	{
+		end--;
+	}
+
+	*end = 0;
+	return begin;
+}
+
+static void wrapper_ini_add_section(wrapper_ini_document_t* ini, const TCHAR* name)
+{
+	wrapper_ini_section_t* section = &ini->sections[ini->section_count++];
+	section->name = name;
+	section->first = ini->entry_count;
+	section->count = 0;
+}
+
+//
+// Splits the text into lines, sections and keys in place. The names and values are terminated
+// where they end in the text, so nothing is copied.
+//
+static void wrapper_ini_tokenize(wrapper_ini_document_t* ini)
+{
+	TCHAR* p = ini->text;
+	DWORD line = 0;
+
+	while (*p)
+	{
+		TCHAR* end = p;
+		while (*end && *end != _T('\n'))
+		{
+			end++;
+		}
+		TCHAR* next = *end ? end + 1 : end;
+		line++;
+
+		TCHAR* start = wrapper_ini_trim(p, end);
+		if (*start == _T('['))
+		{
+			TCHAR* close = _tcschr(start, _T(']'));
+			if (close)
+			{
+				wrapper_ini_add_section(ini, wrapper_ini_trim(start + 1, close));
+			}
+		}
+		else if (*start && *start != _T(';') && *start != _T('#'))
+		{
+			TCHAR* equals = _tcschr(start, _T('='));
+			if (equals && equals != start)
+			{
+				TCHAR* value_end = equals + _tcslen(equals);
+				TCHAR* key = wrapper_ini_trim(start, equals);
+				TCHAR* value = wrapper_ini_trim(equals + 1, value_end);
+				const size_t length = _tcslen(value);
+				if (length >= 2 && (value[0] == _T('"') || value[0] == _T('\'')) && value[length - 1] == value[0])
+				{
+					value[length - 1] = 0;
+					value++;
+				}
+
+				if (*key)
+				{
+					if (0 == ini->section_count)
+					{
+						// Keys before the first section belong to a section without a name
+						wrapper_ini_add_section(ini, _T(""));
+					}
+
+					wrapper_ini_entry_t* entry = &ini->entries[ini->entry_count++];
+					entry->section = ini->sections[ini->section_count - 1].name;
+					entry->key = key;
+					entry->value = value;
+					entry->path = ini->path;
+					entry->line = line;
+					ini->sections[ini->section_count - 1].count++;
+				}
+			}
+		}
+
+		p = next;
+	}
+}
+
+static int wrapper_ini_parse(wrapper_ini_document_t** ini, const void* data, size_t size, const TCHAR* path,
+                             wrapper_error_t** error)
+{
+	const BYTE* bytes = data;
+	wrapper_ini_document_t* result = NULL;
+	size_t lines = 1;
+
+	const int utf16 = size >= 2 && bytes[0] == 0xFF && bytes[1] == 0xFE;
+	if (utf16)
+	{
+		bytes += 2;
+		size -= 2;
+		for (size_t i = 0; i + 1 < size; i += 2)
+		{
+			lines += bytes[i] == '\n' && bytes[i + 1] == 0;
+		}
+	}
+	else
+	{
+		if (size >= 3 && bytes[0] == 0xEF && bytes[1] == 0xBB && bytes[2] == 0xBF)
+		{
+			bytes += 3;
+			size -= 3;
+		}
+		for (size_t i = 0; i < size; i++)
+		{
+			lines += bytes[i] == '\n';
+		}
+	}
+
+	const size_t length = wrapper_ini_decode(NULL, 0, bytes, size, utf16);
+	const size_t path_length = _tcslen(path) + 1;
+	const size_t block_size = sizeof(wrapper_ini_document_t) +
+		lines * (sizeof(wrapper_ini_section_t) + sizeof(wrapper_ini_entry_t)) +
+		(length + 1 + path_length) * sizeof(TCHAR);
+
+	result = wrapper_allocate(block_size);
+	if (!result)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_hresult(E_OUTOFMEMORY, _T("Failed to allocate memory for the configuration file '%s'"),
+			                                    path);
+		}
+		*ini = NULL;
+		return 0;
+	}
+
+	result->sections = (wrapper_ini_section_t*)(result + 1);
+	result->entries = (wrapper_ini_entry_t*)(result->sections + lines);
+	result->text = (TCHAR*)(result->entries + lines);
+
+	wrapper_ini_decode(result->text, length, bytes, size, utf16);
+	result->text[length] = 0;
+
+	TCHAR* path_copy = result->text + length + 1;
+	memcpy(path_copy, path, path_length * sizeof(TCHAR));
+	result->path = path_copy;
+
+	wrapper_ini_tokenize(result);
+
+	*ini = result;
+	return 1;
+}
+
+static int wrapper_ini_read(wrapper_ini_document_t** ini, const TCHAR* path, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	HANDLE file = INVALID_HANDLE_VALUE;
+	LARGE_INTEGER size = {0};
+	BYTE* data = NULL;
+	DWORD read = 0;
+
+	*ini = NULL;
+
+	if (SUCCEEDED(hr))
+	{
+		file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+		                  FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (INVALID_HANDLE_VALUE == file)
+		{
+			const DWORD last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to open the configuration file '%s'"), path);
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!GetFileSizeEx(file, &size))
+		{
+			const DWORD last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to get the size of the configuration file '%s'"),
+				                                   path);
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+		else if (size.QuadPart > WRAPPER_INI_SIZE_MAX)
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(ERROR_FILE_TOO_LARGE,
+				                                   _T("The configuration file '%s' is larger than %d bytes"), path,
+				                                   WRAPPER_INI_SIZE_MAX);
+			}
+			hr = HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		data = wrapper_allocate((size_t)size.QuadPart + 1);
+		if (!data)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the configuration file '%s'"),
+				                                    path);
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!ReadFile(file, data, (DWORD)size.QuadPart, &read, NULL))
+		{
+			const DWORD last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to read the configuration file '%s'"), path);
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!wrapper_ini_parse(ini, data, read, path, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	wrapper_free(data);
+	if (INVALID_HANDLE_VALUE != file)
+	{
+		CloseHandle(file);
+	}
+	return SUCCEEDED(hr);
+}
+
+static void wrapper_ini_append(wrapper_ini_t* ini, wrapper_ini_document_t* document)
+{
+	document->previous = ini->last;
+	document->next = NULL;
+	if (ini->last)
+	{
+		ini->last->next = document;
+	}
+	else
+	{
+		ini->first = document;
+	}
+	ini->last = document;
+}
+
+//
+// Resolves the path of the file that an 'Include' key names, relative to the directory of the file
+// the key is in.
+//
+static int wrapper_ini_get_include_path(TCHAR* buffer, size_t size, const wrapper_ini_entry_t* entry,
+                                        wrapper_error_t** error)
+{
+	TCHAR directory[_MAX_PATH];
+
+	HRESULT hr = StringCchCopy(directory, _countof(directory), entry->path);
+	if (SUCCEEDED(hr))
+	{
+		hr = PathCchRemoveFileSpec(directory, _countof(directory));
+	}
+	if (SUCCEEDED(hr))
+	{
+		hr = PathCchCombine(buffer, size, directory, entry->value);
+	}
+
+	if (FAILED(hr) && error)
+	{
+		*error = wrapper_error_from_hresult(hr, _T("Failed to resolve the file '%s' included on line %d of the configuration file '%s'"),
+		                                    entry->value, entry->line, entry->path);
+	}
+	return SUCCEEDED(hr);
+}
+
+//
+// Reads the file and then the files it includes, depth first, so that each included file follows
+// the one that includes it. The chain holds the files that are being read, to detect a file that
+// includes itself, directly or through another file. A file that was read before isn't read again.
+//
+static int wrapper_ini_include(wrapper_ini_t* ini, const TCHAR* path, const TCHAR** chain, DWORD depth,
+                               wrapper_error_t** error)
+{
+	wrapper_ini_document_t* document = NULL;
+
+	for (DWORD i = 0; i < depth; i++)
+	{
+		if (0 == _tcsicmp(chain[i], path))
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(ERROR_CIRCULAR_DEPENDENCY,
+				                                   _T("The configuration file '%s' includes itself through '%s'"), path,
+				                                   chain[depth - 1]);
+			}
+			return 0;
+		}
+	}
+
+	for (document = ini->first; document; document = document->next)
+	{
+		if (0 == _tcsicmp(document->path, path))
+		{
+			return 1;
+		}
+	}
+
+	if (WRAPPER_INI_DEPTH_MAX == depth)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_BAD_CONFIGURATION,
+			                                   _T("The configuration file '%s' is included more than %d levels deep"), path,
+			                                   WRAPPER_INI_DEPTH_MAX);
+		}
+		return 0;
+	}
+
+	if (!wrapper_ini_read(&document, path, error))
+	{
+		return 0;
+	}
+
+	wrapper_ini_append(ini, document);
+	chain[depth] = document->path;
+
+	for (DWORD i = 0; i < document->entry_count; i++)
+	{
+		const wrapper_ini_entry_t* entry = &document->entries[i];
+		TCHAR include[_MAX_PATH];
+
+		if (_tcsicmp(entry->key, _T("Include")) || 0 == *entry->value)
+		{
+			continue;
+		}
+
+		if (!wrapper_ini_get_include_path(include, _countof(include), entry, error) ||
+			!wrapper_ini_include(ini, include, chain, depth + 1, error))
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int wrapper_ini_compare_names(const void* a, const void* b)
+{
+	return _tcsicmp((const TCHAR*)a, (const TCHAR*)b);
+}
+
+//
+// Reads the files with the extension .cfg in the drop-in directory of the file, in alphabetical
+// order. The directory is optional.
+//
+static int wrapper_ini_include_drop_ins(wrapper_ini_t* ini, const TCHAR* path, const TCHAR** chain,
+                                        wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	TCHAR pattern[_MAX_PATH];
+	TCHAR (*names)[_MAX_PATH] = NULL;
+	DWORD count = 0;
+	WIN32_FIND_DATA data;
+	HANDLE find = INVALID_HANDLE_VALUE;
+
+	if (SUCCEEDED(hr))
+	{
+		hr = StringCchPrintf(pattern, _countof(pattern), _T("%s.d\\*.cfg"), path);
+		if (FAILED(hr) && error)
+		{
+			*error = wrapper_error_from_hresult(hr, _T("The path of the drop-in directory of '%s' is too long"), path);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		find = FindFirstFile(pattern, &data);
+		if (INVALID_HANDLE_VALUE == find)
+		{
+			const DWORD last_error = GetLastError();
+			if (ERROR_FILE_NOT_FOUND == last_error || ERROR_PATH_NOT_FOUND == last_error)
+			{
+				return 1;
+			}
+
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to list the drop-in directory of '%s'"), path);
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		names = wrapper_allocate(WRAPPER_INI_DROP_INS_MAX * sizeof(names[0]));
+		if (!names)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the drop-in files of '%s'"),
+				                                    path);
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		do
+		{
+			// The pattern also matches the short names, so 'a.cfgold' could match '*.cfg'
+			if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ||
+				_tcsicmp(PathFindExtension(data.cFileName), _T(".cfg")))
+			{
+				continue;
+			}
+
+			if (WRAPPER_INI_DROP_INS_MAX == count)
+			{
+				hr = HRESULT_FROM_WIN32(ERROR_BAD_CONFIGURATION);
+				if (error)
+				{
+					*error = wrapper_error_from_system(ERROR_BAD_CONFIGURATION,
+					                                   _T("The drop-in directory of '%s' has more than %d files"), path,
+					                                   WRAPPER_INI_DROP_INS_MAX);
+				}
+				break;
+			}
+
+			StringCchCopy(names[count++], _countof(names[0]), data.cFileName);
+		}
+		while (FindNextFile(find, &data));
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		qsort(names, count, sizeof(names[0]), wrapper_ini_compare_names);
+
+		for (DWORD i = 0; SUCCEEDED(hr) && i < count; i++)
+		{
+			TCHAR file[_MAX_PATH];
+			hr = StringCchPrintf(file, _countof(file), _T("%s.d\\%s"), path, names[i]);
+			if (FAILED(hr))
+			{
+				if (error)
+				{
+					*error = wrapper_error_from_hresult(hr, _T("The path of the drop-in file '%s' of '%s' is too long"),
+					                                    names[i], path);
+				}
+			}
+			else if (!wrapper_ini_include(ini, file, chain, 0, error))
+			{
+				hr = E_FAIL;
+			}
+		}
+	}
+
+	wrapper_free(names);
+	if (INVALID_HANDLE_VALUE != find)
+	{
+		FindClose(find);
+	}
+	return SUCCEEDED(hr);
+}
+
+static const TCHAR* wrapper_ini_store(wrapper_ini_t* ini, const TCHAR* value, size_t length)
+{
+	wrapper_ini_chunk_t* chunk = ini->chunks;
+	if (!chunk || chunk->capacity - chunk->used < length + 1)
+	{
+		const size_t capacity = length + 1 > WRAPPER_INI_CHUNK_LEN ? length + 1 : WRAPPER_INI_CHUNK_LEN;
+		chunk = wrapper_allocate(sizeof(wrapper_ini_chunk_t) + capacity * sizeof(TCHAR));
+		if (!chunk)
+		{
+			return NULL;
+		}
+
+		chunk->next = ini->chunks;
+		chunk->capacity = capacity;
+		ini->chunks = chunk;
+	}
+
+	TCHAR* result = chunk->data + chunk->used;
+	memcpy(result, value, length * sizeof(TCHAR));
+	result[length] = 0;
+	chunk->used += length + 1;
+	return result;
+}
+
+//
+// Returns the entry of the key in the section. When the key appears more than once, the last one
+// wins, so that a later assignment, or a file that is read later, overrides an earlier one.
+//
+static wrapper_ini_entry_t* wrapper_ini_get_entry(const wrapper_ini_t* ini, const TCHAR* section, const TCHAR* key)
+{
+	for (const wrapper_ini_document_t* document = ini->last; document; document = document->previous)
+	{
+		for (DWORD s = document->section_count; s > 0; s--)
+		{
+			const wrapper_ini_section_t* current = &document->sections[s - 1];
+			if (_tcsicmp(current->name, section))
+			{
+				continue;
+			}
+
+			for (DWORD i = current->first + current->count; i > current->first; i--)
+			{
+				if (0 == _tcsicmp(document->entries[i - 1].key, key))
+				{
+					return &document->entries[i - 1];
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
+//
+// Replaces the variables in the value of the entry. The values that an entry refers to are resolved
+// first, and each value is resolved once, however many entries refer to it.
+//
+static int wrapper_ini_resolve_entry(wrapper_ini_t* ini, wrapper_ini_entry_t* entry, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	TCHAR* buffer = NULL;
+	size_t length = 0;
+
+	if (WRAPPER_INI_RESOLVED == entry->state)
+	{
+		return 1;
+	}
+
+	if (WRAPPER_INI_RESOLVING == entry->state)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_CIRCULAR_DEPENDENCY,
+			                                   _T("The value of '%s' in section '%s' on line %d of the configuration file '%s' refers to itself"),
+			                                   entry->key, entry->section, entry->line, entry->path);
+		}
+		return 0;
+	}
+
+	if (!_tcschr(entry->value, _T('$')))
+	{
+		entry->state = WRAPPER_INI_RESOLVED;
+		return 1;
+	}
+
+	entry->state = WRAPPER_INI_RESOLVING;
+
+	if (SUCCEEDED(hr))
+	{
+		buffer = wrapper_allocate_string(WRAPPER_INI_VALUE_MAX_LEN + 1);
+		if (!buffer)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the value of '%s' in section '%s'"),
+				                                    entry->key, entry->section);
+			}
+		}
+	}
+
+	for (const TCHAR* p = entry->value; SUCCEEDED(hr) && *p;)
+	{
+		const TCHAR* append = p;
+		size_t count = 1;
+
+		if (p[0] == _T('$') && p[1] == _T('$'))
+		{
+			p += 2;
+		}
+		else if (p[0] == _T('$') && p[1] == _T('{'))
+		{
+			const TCHAR* name = p + 2;
+			const TCHAR* close = _tcschr(name, _T('}'));
+			TCHAR variable[256];
+
+			count = 0;
+			if (!close || FAILED(StringCchCopyN(variable, _countof(variable), name, close - name)))
+			{
+				hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+				if (error)
+				{
+					*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+					                                   _T("A variable in the value of '%s' in section '%s' on line %d of the configuration file '%s' isn't closed with '}'"),
+					                                   entry->key, entry->section, entry->line, entry->path);
+				}
+				break;
+			}
+			p = close + 1;
+
+			if (0 == _tcsnicmp(variable, _T("env:"), 4))
+			{
+				// A variable that isn't set is empty, like it is in a shell
+				const size_t remaining = WRAPPER_INI_VALUE_MAX_LEN + 1 - length;
+				const DWORD written = GetEnvironmentVariable(variable + 4, buffer + length, (DWORD)remaining);
+				if (written >= remaining)
+				{
+					hr = HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+				}
+				else
+				{
+					length += written;
+				}
+			}
+			else if (0 == _tcsnicmp(variable, _T("unit:"), 5))
+			{
+				wrapper_ini_entry_t* reference = wrapper_ini_get_entry(ini, _T("Unit"), variable + 5);
+				if (!reference)
+				{
+					hr = HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+					if (error)
+					{
+						*error = wrapper_error_from_system(ERROR_NOT_FOUND,
+						                                   _T("The value of '%s' in section '%s' on line %d of the configuration file '%s' refers to '%s', which isn't in section 'Unit'"),
+						                                   entry->key, entry->section, entry->line, entry->path,
+						                                   variable + 5);
+					}
+				}
+				else if (!wrapper_ini_resolve_entry(ini, reference, error))
+				{
+					hr = E_FAIL;
+				}
+				else
+				{
+					append = reference->value;
+					count = _tcslen(append);
+				}
+			}
+			else
+			{
+				hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+				if (error)
+				{
+					*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+					                                   _T("The value of '%s' in section '%s' on line %d of the configuration file '%s' has an unknown variable '${%s}'"),
+					                                   entry->key, entry->section, entry->line, entry->path, variable);
+				}
+			}
+		}
+		else
+		{
+			p++;
+		}
+
+		if (SUCCEEDED(hr) && count > WRAPPER_INI_VALUE_MAX_LEN - length)
+		{
+			hr = HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+		}
+
+		if (HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER) == hr)
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(ERROR_INSUFFICIENT_BUFFER,
+				                                   _T("The value of '%s' in section '%s' on line %d of the configuration file '%s' is longer than %d characters"),
+				                                   entry->key, entry->section, entry->line, entry->path,
+				                                   WRAPPER_INI_VALUE_MAX_LEN);
+			}
+		}
+		else if (SUCCEEDED(hr))
+		{
+			memcpy(buffer + length, append, count * sizeof(TCHAR));
+			length += count;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		const TCHAR* value = wrapper_ini_store(ini, buffer, length);
+		if (!value)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the value of '%s' in section '%s'"),
+				                                    entry->key, entry->section);
+			}
+		}
+		else
+		{
+			entry->value = value;
+		}
+	}
+
+	wrapper_free(buffer);
+	entry->state = SUCCEEDED(hr) ? WRAPPER_INI_RESOLVED : WRAPPER_INI_UNRESOLVED;
+	return SUCCEEDED(hr);
+}
+
+int wrapper_ini_load(wrapper_ini_t** ini, const TCHAR* path, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	wrapper_ini_t* result = NULL;
+	TCHAR full_path[_MAX_PATH];
+	const TCHAR* chain[WRAPPER_INI_DEPTH_MAX];
+
+	*ini = NULL;
+
+	if (SUCCEEDED(hr))
+	{
+		result = wrapper_allocate(sizeof(wrapper_ini_t));
+		if (!result)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the configuration file '%s'"),
+				                                    path);
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		const DWORD length = GetFullPathName(path, _countof(full_path), full_path, NULL);
+		if (0 == length || length >= _countof(full_path))
+		{
+			const DWORD last_error = length ? ERROR_FILENAME_EXCED_RANGE : GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to get the full path of the configuration file '%s'"),
+				                                   path);
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!wrapper_ini_include(result, full_path, chain, 0, error) ||
+			!wrapper_ini_include_drop_ins(result, full_path, chain, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	for (wrapper_ini_document_t* document = SUCCEEDED(hr) ? result->first : NULL; document; document = document->next)
+	{
+		for (DWORD i = 0; SUCCEEDED(hr) && i < document->entry_count; i++)
+		{
+			if (!wrapper_ini_resolve_entry(result, &document->entries[i], error))
+			{
+				hr = E_FAIL;
+			}
+		}
+	}
+
+	if (FAILED(hr))
+	{
+		wrapper_ini_free(result);
+		return 0;
+	}
+
+	*ini = result;
+	return 1;
+}
+
+//
+// Reads a single file as it is, without includes, drop-ins or variables, e.g. an environment file.
+//
+int wrapper_ini_load_file(wrapper_ini_t** ini, const TCHAR* path, wrapper_error_t** error)
+{
+	wrapper_ini_document_t* document = NULL;
+	wrapper_ini_t* result = NULL;
+
+	*ini = NULL;
+
+	result = wrapper_allocate(sizeof(wrapper_ini_t));
+	if (!result)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_hresult(E_OUTOFMEMORY, _T("Failed to allocate memory for the file '%s'"), path);
+		}
+		return 0;
+	}
+
+	if (!wrapper_ini_read(&document, path, error))
+	{
+		wrapper_ini_free(result);
+		return 0;
+	}
+
+	wrapper_ini_append(result, document);
+	*ini = result;
+	return 1;
+}
+
+void wrapper_ini_free(wrapper_ini_t* ini)
+{
+	if (!ini)
+	{
+		return;
+	}
+
+	wrapper_ini_document_t* document = ini->first;
+	while (document)
+	{
+		wrapper_ini_document_t* next = document->next;
+		wrapper_free(document);
+		document = next;
+	}
+
+	wrapper_ini_chunk_t* chunk = ini->chunks;
+	while (chunk)
+	{
+		wrapper_ini_chunk_t* next = chunk->next;
+		wrapper_free(chunk);
+		chunk = next;
+	}
+
+	wrapper_free(ini);
+}
+
+const TCHAR* wrapper_ini_get_path(const wrapper_ini_t* ini)
+{
+	return ini->first->path;
+}
+
+//
+// Returns the path of a file that was read, in the order they were read, or NULL when the index is
+// past the last one.
+//
+const TCHAR* wrapper_ini_get_file(const wrapper_ini_t* ini, DWORD index)
+{
+	const wrapper_ini_document_t* document = ini->first;
+	while (document && index--)
+	{
+		document = document->next;
+	}
+	return document ? document->path : NULL;
+}
+
+const TCHAR* wrapper_ini_get(const wrapper_ini_t* ini, const TCHAR* section, const TCHAR* key)
+{
+	const wrapper_ini_entry_t* entry = wrapper_ini_get_entry(ini, section, key);
+	return entry ? entry->value : NULL;
+}
+
+//
+// Returns the entry of the key in the section that follows the previous one, or the first one when
+// previous is NULL, to go through all the values of a key that appears more than once, in all the
+// files in the order they were read. When key is NULL, any key matches.
+//
+const wrapper_ini_entry_t* wrapper_ini_find(const wrapper_ini_t* ini, const TCHAR* section, const TCHAR* key,
+                                            const wrapper_ini_entry_t* previous)
+{
+	const wrapper_ini_document_t* document = ini->first;
+	DWORD start = 0;
+
+	if (previous)
+	{
+		while (document && (previous < document->entries || previous >= document->entries + document->entry_count))
+		{
+			document = document->next;
+		}
+		if (!document)
+		{
+			return NULL;
+		}
+		start = (DWORD)(previous - document->entries) + 1;
+	}
+
+	for (; document; document = document->next, start = 0)
+	{
+		for (DWORD s = 0; s < document->section_count; s++)
+		{
+			const wrapper_ini_section_t* current = &document->sections[s];
+			const DWORD end = current->first + current->count;
+			if (end <= start || _tcsicmp(current->name, section))
+			{
+				continue;
+			}
+
+			for (DWORD i = current->first > start ? current->first : start; i < end; i++)
+			{
+				if (!key || 0 == _tcsicmp(document->entries[i].key, key))
+				{
+					return &document->entries[i];
+				}
+			}
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,47 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#pragma once
+#include "wrapper-error.h"
+
+#define WRAPPER_INI_DEPTH_MAX 8
+#define WRAPPER_INI_DROP_INS_MAX 64
+#define WRAPPER_INI_VALUE_MAX_LEN 32767
+
+//
+// A configuration file in the INI format, read and parsed in a single pass. The file may be
+// encoded in UTF-8 or UTF-16, with or without a byte order mark. The names and values point into
+// the text of the file, which is kept in the same block of memory as the table that indexes it, so
+// that parsing doesn't allocate memory for each value.
+//
+// Lines that start with ';' or '#' are comments. Whitespace around names and values is ignored,
+// as are quotes around a whole value. Sections and keys may appear more than once.
+//
+// An 'Include' key in any section reads another file, relative to the one that includes it, and
+// the files with the extension .cfg in the directory named after the file with '.d' appended, e.g.
+// wrapper.cfg.d, are read in alphabetical order after it. Each file is read once, however often
+// it is included. Once all files are read, '${env:NAME}' in a value is replaced with the
+// environment variable NAME, '${unit:Key}' with the value of Key in section Unit, and '$$' with '$'.
+//
+
+typedef struct wrapper_ini_entry_t
+{
+	const TCHAR* section;
+	const TCHAR* key;
+	const TCHAR* value;
+	const TCHAR* path;
+	DWORD line;
+	int state; // Whether the variables in the value were replaced yet
+} wrapper_ini_entry_t;
+
+typedef struct wrapper_ini_t wrapper_ini_t;
+
+int wrapper_ini_load(wrapper_ini_t** ini, const TCHAR* path, wrapper_error_t** error);
+int wrapper_ini_load_file(wrapper_ini_t** ini, const TCHAR* path, wrapper_error_t** error);
+void wrapper_ini_free(wrapper_ini_t* ini);
+
+const TCHAR* wrapper_ini_get_path(const wrapper_ini_t* ini);
+const TCHAR* wrapper_ini_get_file(const wrapper_ini_t* ini, DWORD index);
+const TCHAR* wrapper_ini_get(const wrapper_ini_t* ini, const TCHAR* section, const TCHAR* key);
+const wrapper_ini_entry_t* wrapper_ini_find(const wrapper_ini_t* ini, const TCHAR* section, const TCHAR* key,
+                                            const wrapper_ini_entry_t* previous);
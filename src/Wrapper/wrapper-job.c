@@ -0,0 +1,441 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#include "stdafx.h"
+#include "wrapper-job.h"
+#include "wrapper-memory.h"
+#include "wrapper-log.h"
+
+// A child that hits a limit and is restarted for it ends with this exit code
+#define WRAPPER_JOB_LIMIT_EXIT_CODE ERROR_NOT_ENOUGH_QUOTA
+#define WRAPPER_JOB_KEY_STOP 0
+
+//
+// The child is started inside a job object, so that every process it starts belongs to the same
+// job. The job is set to kill on close and the wrapper holds the only handle to it, which means
+// the whole tree is torn down when the job is freed, and also when the wrapper itself dies.
+//
+// The limits are enforced by the job too. The job posts a message to a completion port when a
+// limit is hit, which a thread picks up to log it and, if asked to, to terminate the processes so
+// that the restart policy can start the child again.
+//
+struct wrapper_job_t
+{
+	HANDLE handle;
+	HANDLE port;
+	HANDLE thread;
+	wrapper_job_limits_t limits;
+};
+
+int wrapper_job_has_limits(const wrapper_job_limits_t* limits)
+{
+	return limits->memory_max || limits->cpu_quota || limits->cpu_affinity || limits->io_weight ||
+		limits->process_count_max;
+}
+
+//
+// Windows has no I/O weight, so the weight is mapped to the priority class of the processes. The
+// I/O priority of a thread follows the priority class for the lowest class, and the scheduler
+// favours the higher classes, which comes closest. A weight of 100 is the default.
+//
+static DWORD wrapper_job_get_priority_class(DWORD io_weight)
+{
+	if (io_weight <= 10)
+	{
+		return IDLE_PRIORITY_CLASS;
+	}
+	if (io_weight < 100)
+	{
+		return BELOW_NORMAL_PRIORITY_CLASS;
+	}
+	if (io_weight < 1000)
+	{
+		return io_weight == 100 ? NORMAL_PRIORITY_CLASS : ABOVE_NORMAL_PRIORITY_CLASS;
+	}
+	return HIGH_PRIORITY_CLASS;
+}
+
+static int wrapper_job_set_limits(wrapper_job_t* job, wrapper_error_t** error)
+{
+	const wrapper_job_limits_t* limits = &job->limits;
+
+	JOBOBJECT_EXTENDED_LIMIT_INFORMATION information = {0};
+	information.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+
+	if (limits->memory_max)
+	{
+		information.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_JOB_MEMORY;
+		information.JobMemoryLimit = (SIZE_T)limits->memory_max;
+	}
+
+	if (limits->process_count_max)
+	{
+		information.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_ACTIVE_PROCESS;
+		information.BasicLimitInformation.ActiveProcessLimit = limits->process_count_max;
+	}
+
+	if (limits->cpu_affinity)
+	{
+		DWORD_PTR process_mask = 0;
+		DWORD_PTR system_mask = 0;
+		GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask);
+		const DWORD_PTR mask = (DWORD_PTR)limits->cpu_affinity & system_mask;
+		if (!mask)
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(ERROR_INVALID_PARAMETER,
+				                                   _T("None of the processors in the CPU affinity 0x%llx exist"),
+				                                   limits->cpu_affinity);
+			}
+			return 0;
+		}
+		information.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_AFFINITY;
+		information.BasicLimitInformation.Affinity = mask;
+	}
+
+	if (limits->io_weight)
+	{
+		information.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_PRIORITY_CLASS;
+		information.BasicLimitInformation.PriorityClass = wrapper_job_get_priority_class(limits->io_weight);
+	}
+
+	if (!SetInformationJobObject(job->handle, JobObjectExtendedLimitInformation, &information, sizeof information))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(GetLastError(), _T("Failed to set the limits of the job object"));
+		}
+		return 0;
+	}
+
+	if (limits->cpu_quota)
+	{
+		// The quota is a percentage of a single processor, while the rate of a job is in hundredths
+		// of a percent of all of the processors.
+		const DWORD processors = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+		DWORD rate = (DWORD)((ULONGLONG)limits->cpu_quota * 100 / (processors ? processors : 1));
+		rate = rate < 1 ? 1 : rate > 10000 ? 10000 : rate;
+
+		JOBOBJECT_CPU_RATE_CONTROL_INFORMATION rate_information = {0};
+		rate_information.ControlFlags = JOB_OBJECT_CPU_RATE_CONTROL_ENABLE | JOB_OBJECT_CPU_RATE_CONTROL_HARD_CAP;
+		rate_information.CpuRate = rate;
+		if (!SetInformationJobObject(job->handle, JobObjectCpuRateControlInformation, &rate_information,
+		                             sizeof rate_information))
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(GetLastError(), _T("Failed to set the CPU quota of the job object"));
+			}
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static DWORD WINAPI wrapper_job_thread(LPVOID parameter)
+{
+	wrapper_job_t* job = parameter;
+	DWORD message;
+	ULONG_PTR key;
+	LPOVERLAPPED overlapped;
+
+	while (GetQueuedCompletionStatus(job->port, &message, &key, &overlapped, INFINITE))
+	{
+		if (WRAPPER_JOB_KEY_STOP == key)
+		{
+			break;
+		}
+
+		// For these messages, the overlapped pointer carries the identifier of the process
+		const DWORD pid = (DWORD)(ULONG_PTR)overlapped;
+		int limit_hit = 0;
+		switch (message)
+		{
+		case JOB_OBJECT_MSG_JOB_MEMORY_LIMIT:
+			WRAPPER_WARNING(_T("Process %lu hit the memory limit of %llu bytes of the child process."), pid,
+			                job->limits.memory_max);
+			limit_hit = 1;
+			break;
+
+		case JOB_OBJECT_MSG_ACTIVE_PROCESS_LIMIT:
+			WRAPPER_WARNING(_T("The child process hit the limit of %lu processes."), job->limits.process_count_max);
+			limit_hit = 1;
+			break;
+
+		case JOB_OBJECT_MSG_ABNORMAL_EXIT_PROCESS:
+			WRAPPER_WARNING(_T("Process %lu, started by the child process, ended abnormally."), pid);
+			break;
+
+		default:
+			break;
+		}
+
+		if (limit_hit && job->limits.restart)
+		{
+			WRAPPER_WARNING(_T("Terminating the child process and its descendants because a limit was hit."));
+			TerminateJobObject(job->handle, WRAPPER_JOB_LIMIT_EXIT_CODE);
+		}
+	}
+
+	return 0;
+}
+
+int wrapper_job_create(wrapper_job_t** job, const wrapper_job_limits_t* limits, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	DWORD last_error;
+	wrapper_job_t* result = NULL;
+
+	if (SUCCEEDED(hr))
+	{
+		result = wrapper_allocate(sizeof *result);
+		if (!result)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the job object"));
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		result->handle = CreateJobObject(NULL, NULL);
+		if (!result->handle)
+		{
+			last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to create a job object for the child process"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		result->limits = *limits;
+		if (!wrapper_job_set_limits(result, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		result->port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+		if (!result->port)
+		{
+			last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to create a completion port for the job object"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		JOBOBJECT_ASSOCIATE_COMPLETION_PORT port_information = {0};
+		port_information.CompletionKey = result;
+		port_information.CompletionPort = result->port;
+		if (!SetInformationJobObject(result->handle, JobObjectAssociateCompletionPortInformation, &port_information,
+		                             sizeof port_information))
+		{
+			last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to associate the completion port with the job object"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		result->thread = CreateThread(NULL, 0, wrapper_job_thread, result, 0, NULL);
+		if (!result->thread)
+		{
+			last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to start the thread that monitors the job object"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (FAILED(hr))
+	{
+		wrapper_job_free(result);
+		result = NULL;
+	}
+
+	*job = result;
+	return SUCCEEDED(hr);
+}
+
+//
+// Applies new limits to the processes that already run in the job.
+//
+int wrapper_job_update(wrapper_job_t* job, const wrapper_job_limits_t* limits, wrapper_error_t** error)
+{
+	const DWORD cpu_quota = job->limits.cpu_quota;
+	job->limits = *limits;
+	if (!wrapper_job_set_limits(job, error))
+	{
+		return 0;
+	}
+
+	if (cpu_quota && !limits->cpu_quota)
+	{
+		JOBOBJECT_CPU_RATE_CONTROL_INFORMATION rate_information = {0};
+		if (!SetInformationJobObject(job->handle, JobObjectCpuRateControlInformation, &rate_information,
+		                             sizeof rate_information))
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(GetLastError(), _T("Failed to remove the CPU quota of the job object"));
+			}
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void wrapper_job_free(wrapper_job_t* job)
+{
+	if (job)
+	{
+		if (job->thread)
+		{
+			PostQueuedCompletionStatus(job->port, 0, WRAPPER_JOB_KEY_STOP, NULL);
+			WaitForSingleObject(job->thread, INFINITE);
+			CloseHandle(job->thread);
+		}
+
+		if (job->handle)
+		{
+			CloseHandle(job->handle);
+		}
+
+		if (job->port)
+		{
+			CloseHandle(job->port);
+		}
+		wrapper_free(job);
+	}
+}
+
+//
+// The process should be created suspended and only resumed once it was assigned, otherwise it
+// could start processes outside of the job.
+//
+int wrapper_job_assign(wrapper_job_t* job, HANDLE process, wrapper_error_t** error)
+{
+	if (!AssignProcessToJobObject(job->handle, process))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(GetLastError(), _T("Failed to assign the child process to the job object"));
+		}
+		return 0;
+	}
+	return 1;
+}
+
+DWORD wrapper_job_get_process_count(wrapper_job_t* job)
+{
+	JOBOBJECT_BASIC_ACCOUNTING_INFORMATION information = {0};
+	if (!job || !QueryInformationJobObject(job->handle, JobObjectBasicAccountingInformation, &information,
+	                                       sizeof information, NULL))
+	{
+		return 0;
+	}
+	return information.ActiveProcesses;
+}
+
+//
+// Determines whether the process runs in the job, e.g. a process that the child started.
+//
+int wrapper_job_contains(wrapper_job_t* job, HANDLE process)
+{
+	BOOL result = FALSE;
+	if (!job || !IsProcessInJob(process, job->handle, &result))
+	{
+		return 0;
+	}
+	return result;
+}
+
+//
+// Gets the processor time, in 100 nanosecond units, and the number of bytes read and written by
+// all the processes that ever ran in the job, and the number of processes running in it now.
+//
+int wrapper_job_get_accounting(wrapper_job_t* job, ULONGLONG* cpu_time, ULONGLONG* read_bytes, ULONGLONG* write_bytes,
+                               DWORD* process_count)
+{
+	JOBOBJECT_BASIC_AND_IO_ACCOUNTING_INFORMATION information = {0};
+	if (!job || !QueryInformationJobObject(job->handle, JobObjectBasicAndIoAccountingInformation, &information,
+	                                       sizeof information, NULL))
+	{
+		return 0;
+	}
+
+	*cpu_time = information.BasicInfo.TotalUserTime.QuadPart + information.BasicInfo.TotalKernelTime.QuadPart;
+	*read_bytes = information.IoInfo.ReadTransferCount;
+	*write_bytes = information.IoInfo.WriteTransferCount;
+	*process_count = information.BasicInfo.ActiveProcesses;
+	return 1;
+}
+
+//
+// Gets the identifiers of up to size processes running in the job, and returns how many it got.
+//
+DWORD wrapper_job_get_process_ids(wrapper_job_t* job, DWORD* pids, DWORD size)
+{
+	BYTE buffer[sizeof(JOBOBJECT_BASIC_PROCESS_ID_LIST) + 255 * sizeof(ULONG_PTR)];
+	JOBOBJECT_BASIC_PROCESS_ID_LIST* list = (JOBOBJECT_BASIC_PROCESS_ID_LIST*)buffer;
+	if (!job)
+	{
+		return 0;
+	}
+
+	// With more processes than fit in the buffer, the call fails with ERROR_MORE_DATA but still
+	// fills in as many as fit.
+	list->NumberOfProcessIdsInList = 0;
+	if (!QueryInformationJobObject(job->handle, JobObjectBasicProcessIdList, list, sizeof buffer, NULL) &&
+		ERROR_MORE_DATA != GetLastError())
+	{
+		return 0;
+	}
+
+	DWORD count = 0;
+	for (DWORD i = 0; i < list->NumberOfProcessIdsInList && count < size; i++)
+	{
+		pids[count++] = (DWORD)list->ProcessIdList[i];
+	}
+	return count;
+}
+
+int wrapper_job_terminate(wrapper_job_t* job, UINT exit_code, DWORD* count, wrapper_error_t** error)
+{
+	if (count)
+	{
+		*count = wrapper_job_get_process_count(job);
+	}
+
+	if (!TerminateJobObject(job->handle, exit_code))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(GetLastError(), _T("Failed to terminate the processes in the job object"));
+		}
+		return 0;
+	}
+	return 1;
+}
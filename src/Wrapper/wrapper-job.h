@@ -0,0 +1,30 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#pragma once
+#include "wrapper-error.h"
+
+typedef struct wrapper_job_t wrapper_job_t;
+
+typedef struct wrapper_job_limits_t
+{
+	ULONGLONG memory_max;
+	DWORD cpu_quota;
+	ULONGLONG cpu_affinity;
+	DWORD io_weight;
+	DWORD process_count_max;
+	int restart;
+} wrapper_job_limits_t;
+
+int wrapper_job_create(wrapper_job_t** job, const wrapper_job_limits_t* limits, wrapper_error_t** error);
+void wrapper_job_free(wrapper_job_t* job);
+int wrapper_job_update(wrapper_job_t* job, const wrapper_job_limits_t* limits, wrapper_error_t** error);
+
+int wrapper_job_assign(wrapper_job_t* job, HANDLE process, wrapper_error_t** error);
+int wrapper_job_terminate(wrapper_job_t* job, UINT exit_code, DWORD* count, wrapper_error_t** error);
+DWORD wrapper_job_get_process_count(wrapper_job_t* job);
+int wrapper_job_contains(wrapper_job_t* job, HANDLE process);
+int wrapper_job_has_limits(const wrapper_job_limits_t* limits);
+int wrapper_job_get_accounting(wrapper_job_t* job, ULONGLONG* cpu_time, ULONGLONG* read_bytes, ULONGLONG* write_bytes,
+                               DWORD* process_count);
+DWORD wrapper_job_get_process_ids(wrapper_job_t* job, DWORD* pids, DWORD size);
@@ -0,0 +1,1025 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#include "stdafx.h"
+#include "wrapper-log-writer.h"
+#include "wrapper-memory.h"
+#include "wrapper-metrics.h"
+#include "wrapper-string.h"
+#include "wrapper-utils.h"
+
+#define WRAPPER_LOG_WRITER_QUEUE_MASK (WRAPPER_LOG_WRITER_QUEUE_SIZE - 1)
+#define WRAPPER_LOG_WRITER_LINE_MAX_LEN (WRAPPER_LOG_WRITER_MESSAGE_MAX_LEN + 128)
+#define WRAPPER_LOG_WRITER_CACHE_LINE 64
+#define WRAPPER_LOG_WRITER_TICKS_PER_SECOND 10000000ULL
+
+typedef struct wrapper_log_record_t
+{
+	volatile LONG64 sequence;
+	wrapper_log_level_t log_level;
+	FILETIME timestamp;
+	wrapper_log_chunk_t* chunk;
+	TCHAR domain[WRAPPER_LOG_WRITER_DOMAIN_MAX_LEN];
+	TCHAR message[WRAPPER_LOG_WRITER_MESSAGE_MAX_LEN];
+} wrapper_log_record_t;
+
+//
+// The settings that can change while the writer runs. They are handed over to the writer thread,
+// which applies them between two writes.
+//
+typedef struct wrapper_log_writer_settings_t
+{
+	ULONGLONG max_size;
+	DWORD max_age;
+	DWORD generations;
+	int compress;
+	DWORD flush_interval;
+	DWORD flush_size;
+} wrapper_log_writer_settings_t;
+
+//
+// The queue is a bounded multi-producer, single-consumer ring. Each record carries a sequence
+// number that tells producers whether the slot is free and tells the writer whether it was
+// published, so neither side needs a lock.
+//
+struct wrapper_log_writer_t
+{
+	volatile LONG64 enqueue_position;
+	BYTE enqueue_padding[WRAPPER_LOG_WRITER_CACHE_LINE - sizeof(LONG64)];
+	LONG64 dequeue_position;
+	BYTE dequeue_padding[WRAPPER_LOG_WRITER_CACHE_LINE - sizeof(LONG64)];
+
+	volatile LONG waiting;
+	volatile LONG stopping;
+	volatile LONG64 dropped;
+	LONG64 dropped_reported;
+
+	wrapper_log_record_t* records;
+	HANDLE thread;
+	HANDLE wake_event;
+	HANDLE file;
+	TCHAR* path;
+	DWORD pid;
+
+	ULONGLONG file_size;
+	ULONGLONG file_time;
+
+	// When the file can't be renamed away, it is written on, and the next rotation is counted from
+	// the size it had then
+	ULONGLONG rotate_size;
+	DWORD rotate_error;
+	ULONGLONG max_size;
+	DWORD max_age;
+	DWORD generations;
+	int compress;
+	HANDLE compress_thread;
+	HANDLE compress_event;
+
+	DWORD flush_interval;
+	DWORD flush_size;
+	char* buffer;
+	DWORD buffer_length;
+	DWORD buffer_size;
+	ULONGLONG buffer_tick_count;
+
+	SLIST_HEADER chunks;
+	HANDLE chunk_event;
+	volatile LONG chunk_count;
+
+	// Where the output of the child is echoed to as well, if anywhere
+	HANDLE echo_output;
+	HANDLE echo_error;
+
+	SRWLOCK settings_lock;
+	wrapper_log_writer_settings_t settings;
+	volatile LONG reconfigure;
+};
+
+static void wrapper_log_writer_append(wrapper_log_writer_t* writer, const TCHAR* text, int length)
+{
+	char* destination = writer->buffer + writer->buffer_length;
+	const int available = (int)(writer->buffer_size - writer->buffer_length);
+
+#ifdef UNICODE
+	const int bytes = WideCharToMultiByte(CP_UTF8, 0, text, length, destination, available, NULL, NULL);
+#else
+	const int bytes = length < available ? length : available;
+	memcpy(destination, text, bytes);
+#endif
+
+	if (bytes > 0)
+	{
+		if (0 == writer->buffer_length)
+		{
+			writer->buffer_tick_count = GetTickCount64();
+		}
+		writer->buffer_length += bytes;
+	}
+}
+
+static ULONGLONG wrapper_log_writer_get_time(void)
+{
+	FILETIME now;
+	ULARGE_INTEGER time;
+
+	GetSystemTimeAsFileTime(&now);
+	time.LowPart = now.dwLowDateTime;
+	time.HighPart = now.dwHighDateTime;
+	return time.QuadPart;
+}
+
+static void wrapper_log_writer_get_generation_path(wrapper_log_writer_t* writer, DWORD generation, TCHAR* path,
+                                                   size_t size)
+{
+	_sntprintf_s(path, size, _TRUNCATE, _T("%s.%lu"), writer->path, generation);
+}
+
+static int wrapper_log_writer_open(wrapper_log_writer_t* writer)
+{
+	// The file stays open for the lifetime of the writer. Sharing delete access allows the file
+	// to be renamed while it is open.
+	writer->file = CreateFile(writer->path,
+	                          FILE_APPEND_DATA | FILE_READ_ATTRIBUTES | FILE_WRITE_ATTRIBUTES,
+	                          FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+	                          NULL,
+	                          OPEN_ALWAYS,
+	                          FILE_ATTRIBUTE_NORMAL,
+	                          NULL);
+	if (INVALID_HANDLE_VALUE == writer->file)
+	{
+		return 0;
+	}
+
+	FILETIME creation_time = {0};
+	LARGE_INTEGER size = {0};
+	if (ERROR_ALREADY_EXISTS != GetLastError())
+	{
+		// A file created shortly after another was renamed away inherits its creation time
+		// (file system tunneling), which would make the new file look old right away.
+		GetSystemTimeAsFileTime(&creation_time);
+		SetFileTime(writer->file, &creation_time, NULL, NULL);
+	}
+	else
+	{
+		GetFileTime(writer->file, &creation_time, NULL, NULL);
+	}
+	GetFileSizeEx(writer->file, &size);
+
+	writer->file_time = ((ULONGLONG)creation_time.dwHighDateTime << 32) | creation_time.dwLowDateTime;
+	writer->file_size = size.QuadPart;
+	return 1;
+}
+
+static void wrapper_log_writer_compress(const TCHAR* path)
+{
+	HANDLE file = CreateFile(path,
+	                         FILE_READ_DATA | FILE_WRITE_DATA,
+	                         FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+	                         NULL,
+	                         OPEN_EXISTING,
+	                         FILE_ATTRIBUTE_NORMAL,
+	                         NULL);
+	if (INVALID_HANDLE_VALUE == file)
+	{
+		wrapper_error_t* error = wrapper_error_from_system(GetLastError(), _T("Failed to open '%s' to compress it"), path);
+		wrapper_error_log(error);
+		wrapper_error_free(error);
+		return;
+	}
+
+	USHORT format = COMPRESSION_FORMAT_DEFAULT;
+	DWORD bytes = 0;
+	if (!DeviceIoControl(file, FSCTL_SET_COMPRESSION, &format, sizeof format, NULL, 0, &bytes, NULL))
+	{
+		wrapper_error_t* error = wrapper_error_from_system(GetLastError(), _T("Failed to compress '%s'"), path);
+		wrapper_error_log(error);
+		wrapper_error_free(error);
+	}
+	CloseHandle(file);
+}
+
+//
+// Rotated files are compressed by NTFS so that they stay readable with any tool. Compressing a
+// large file takes a while, so it happens on a background thread with low CPU and I/O priority.
+//
+static DWORD WINAPI wrapper_log_writer_compress_thread(LPVOID parameter)
+{
+	wrapper_log_writer_t* writer = parameter;
+	TCHAR path[MAX_PATH + 16];
+
+	SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+
+	while (WAIT_OBJECT_0 == WaitForSingleObject(writer->compress_event, INFINITE) && !writer->stopping)
+	{
+		wrapper_log_writer_get_generation_path(writer, 1, path, _countof(path));
+		wrapper_log_writer_compress(path);
+	}
+	return 0;
+}
+
+static void wrapper_log_writer_rotate(wrapper_log_writer_t* writer)
+{
+	TCHAR source[MAX_PATH + 16];
+	TCHAR destination[MAX_PATH + 16];
+
+	BOOL rotated = FALSE;
+
+	CloseHandle(writer->file);
+	writer->file = INVALID_HANDLE_VALUE;
+
+	if (writer->generations)
+	{
+		for (DWORD generation = writer->generations - 1; generation > 0; generation--)
+		{
+			wrapper_log_writer_get_generation_path(writer, generation, source, _countof(source));
+			wrapper_log_writer_get_generation_path(writer, generation + 1, destination, _countof(destination));
+			MoveFileEx(source, destination, MOVEFILE_REPLACE_EXISTING);
+		}
+
+		wrapper_log_writer_get_generation_path(writer, 1, destination, _countof(destination));
+		rotated = MoveFileEx(writer->path, destination, MOVEFILE_REPLACE_EXISTING);
+	}
+	else
+	{
+		rotated = DeleteFile(writer->path);
+	}
+
+	const DWORD last_error = rotated ? ERROR_SUCCESS : GetLastError();
+	wrapper_log_writer_open(writer);
+
+	if (!rotated)
+	{
+		// E.g. a reader opened the file without sharing delete. Trying again on every write would only
+		// reopen the same file, so wait for the next limit instead.
+		writer->rotate_error = last_error;
+		writer->rotate_size = writer->file_size;
+		writer->file_time = wrapper_log_writer_get_time();
+		return;
+	}
+
+	writer->rotate_size = 0;
+	wrapper_metric_add(WRAPPER_METRIC_LOG_ROTATIONS, 1);
+
+	if (writer->compress && writer->compress_event)
+	{
+		SetEvent(writer->compress_event);
+	}
+}
+
+//
+// Deletes the rotated files from the generation on, which are left behind when Generations was
+// lowered. The generations are numbered without gaps, so the first one that is missing ends them.
+//
+static void wrapper_log_writer_delete_generations(wrapper_log_writer_t* writer, DWORD first)
+{
+	TCHAR path[MAX_PATH + 16];
+
+	for (DWORD generation = first; generation; generation++)
+	{
+		wrapper_log_writer_get_generation_path(writer, generation, path, _countof(path));
+		if (!DeleteFile(path))
+		{
+			const DWORD last_error = GetLastError();
+			if (ERROR_FILE_NOT_FOUND == last_error || ERROR_PATH_NOT_FOUND == last_error)
+			{
+				break;
+			}
+		}
+	}
+}
+
+static int wrapper_log_writer_should_rotate(wrapper_log_writer_t* writer, DWORD length)
+{
+	if (writer->file == INVALID_HANDLE_VALUE || 0 == writer->file_size)
+	{
+		return 0;
+	}
+
+	if (writer->max_size && writer->file_size - writer->rotate_size + length > writer->max_size)
+	{
+		return 1;
+	}
+
+	if (writer->max_age)
+	{
+		const ULONGLONG age = (wrapper_log_writer_get_time() - writer->file_time) / WRAPPER_LOG_WRITER_TICKS_PER_SECOND;
+		if (age >= writer->max_age)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void wrapper_log_writer_write(wrapper_log_writer_t* writer, const char* data, DWORD length)
+{
+	if (wrapper_log_writer_should_rotate(writer, length))
+	{
+		wrapper_log_writer_rotate(writer);
+	}
+
+	if (writer->file == INVALID_HANDLE_VALUE)
+	{
+		wrapper_log_writer_open(writer);
+	}
+
+	if (writer->file != INVALID_HANDLE_VALUE)
+	{
+		DWORD written = 0;
+		if (WriteFile(writer->file, data, length, &written, NULL))
+		{
+			writer->file_size += written;
+			wrapper_metric_add(WRAPPER_METRIC_LOG_BYTES_WRITTEN, written);
+		}
+	}
+}
+
+static void wrapper_log_writer_flush(wrapper_log_writer_t* writer)
+{
+	if (writer->buffer_length)
+	{
+		wrapper_log_writer_write(writer, writer->buffer, writer->buffer_length);
+	}
+	writer->buffer_length = 0;
+}
+
+//
+// A log that isn't written to is rotated by its age as well, instead of on the next write, which
+// may not come for a long time. Returns the number of milliseconds until the file is old enough.
+//
+static DWORD wrapper_log_writer_rotate_by_age(wrapper_log_writer_t* writer)
+{
+	if (!writer->max_age || writer->file == INVALID_HANDLE_VALUE || 0 == writer->file_size)
+	{
+		return INFINITE;
+	}
+
+	const ULONGLONG age = wrapper_log_writer_get_time() - writer->file_time;
+	const ULONGLONG limit = writer->max_age * WRAPPER_LOG_WRITER_TICKS_PER_SECOND;
+	if (age < limit)
+	{
+		const ULONGLONG remaining = (limit - age) / 10000 + 1;
+		return remaining < INFINITE ? (DWORD)remaining : INFINITE - 1;
+	}
+
+	wrapper_log_writer_flush(writer);
+	wrapper_log_writer_rotate(writer);
+	return writer->max_age * 1000ULL < INFINITE ? writer->max_age * 1000 : INFINITE - 1;
+}
+
+static int wrapper_log_writer_format_line(wrapper_log_writer_t* writer,
+                                         TCHAR* line,
+                                         size_t size,
+                                         const FILETIME* timestamp,
+                                         wrapper_log_level_t log_level,
+                                         const TCHAR* log_domain,
+                                         const TCHAR* message,
+                                         const TCHAR* terminator)
+{
+	SYSTEMTIME time = {0};
+
+	FileTimeToSystemTime(timestamp, &time);
+
+	int length = _sntprintf_s(line,
+	                          size,
+	                          _TRUNCATE,
+	                          _T("%04d/%02d/%02d %02d:%02d:%02d: [%5d]: %8s: %12s: %s%s"),
+	                          time.wYear,
+	                          time.wMonth,
+	                          time.wDay,
+	                          time.wHour,
+	                          time.wMinute,
+	                          time.wSecond,
+	                          writer->pid,
+	                          wrapper_log_level_str(log_level),
+	                          log_domain,
+	                          message,
+	                          terminator);
+	if (length < 0)
+	{
+		// The line was truncated, but it should still end the line in the file
+		length = (int)size - 1;
+		line[length - 1] = _T('\n');
+	}
+	return length;
+}
+
+static void wrapper_log_writer_format(wrapper_log_writer_t* writer,
+                                      const FILETIME* timestamp,
+                                      wrapper_log_level_t log_level,
+                                      const TCHAR* log_domain,
+                                      const TCHAR* message,
+                                      const TCHAR* terminator)
+{
+	TCHAR line[WRAPPER_LOG_WRITER_LINE_MAX_LEN];
+
+	const int length = wrapper_log_writer_format_line(writer, line, _countof(line), timestamp, log_level, log_domain,
+	                                                  message, terminator);
+	wrapper_log_writer_append(writer, line, length);
+}
+
+//
+// Chunks of raw output are written as they are, with the usual log line header in front of each
+// line. The header is only formatted once per chunk. Small lines are batched with the other
+// buffered lines; large lines are written straight from the chunk so that the data is never
+// copied again.
+//
+static void wrapper_log_writer_format_chunk(wrapper_log_writer_t* writer, wrapper_log_record_t* record)
+{
+	wrapper_log_chunk_t* chunk = record->chunk;
+	TCHAR header[WRAPPER_LOG_WRITER_LINE_MAX_LEN];
+
+	const int header_length = wrapper_log_writer_format_line(writer, header, _countof(header), &record->timestamp,
+	                                                         record->log_level, record->domain, EMPTY_STRING,
+	                                                         EMPTY_STRING);
+
+	const HANDLE echo = record->log_level <= WRAPPER_LOG_LEVEL_WARNING ? writer->echo_error : writer->echo_output;
+	if (echo)
+	{
+		DWORD written = 0;
+		WriteFile(echo, chunk->data, chunk->length, &written, NULL);
+	}
+
+	const int terminated = chunk->length && chunk->data[chunk->length - 1] == '\n';
+
+	const char* line = chunk->data;
+	const char* end = chunk->data + chunk->length;
+	do
+	{
+		const char* newline = memchr(line, '\n', end - line);
+		const DWORD length = (DWORD)(newline ? newline + 1 - line : end - line);
+
+		// Anything beyond the flush size was flushed after the previous line, so the header fits
+		wrapper_log_writer_append(writer, header, header_length);
+
+		// Keep one byte spare for the line terminator
+		if (length < writer->flush_size && length < writer->buffer_size - writer->buffer_length)
+		{
+			memcpy(writer->buffer + writer->buffer_length, line, length);
+			writer->buffer_length += length;
+		}
+		else
+		{
+			wrapper_log_writer_flush(writer);
+			wrapper_log_writer_write(writer, line, length);
+		}
+
+		if (writer->buffer_length >= writer->flush_size)
+		{
+			wrapper_log_writer_flush(writer);
+		}
+		line += length;
+	}
+	while (line < end);
+
+	if (!terminated)
+	{
+		wrapper_log_writer_append(writer, _T("\n"), 1);
+	}
+
+	wrapper_log_writer_release_chunk(writer, chunk);
+}
+
+static wrapper_log_record_t* wrapper_log_writer_peek(wrapper_log_writer_t* writer)
+{
+	wrapper_log_record_t* record = &writer->records[writer->dequeue_position & WRAPPER_LOG_WRITER_QUEUE_MASK];
+	if (record->sequence != writer->dequeue_position + 1)
+	{
+		return NULL;
+	}
+	return record;
+}
+
+static void wrapper_log_writer_release(wrapper_log_writer_t* writer, wrapper_log_record_t* record)
+{
+	InterlockedExchange64(&record->sequence, writer->dequeue_position + WRAPPER_LOG_WRITER_QUEUE_SIZE);
+	writer->dequeue_position++;
+}
+
+static void wrapper_log_writer_report_dropped(wrapper_log_writer_t* writer)
+{
+	const LONG64 dropped = writer->dropped;
+	if (dropped != writer->dropped_reported)
+	{
+		FILETIME timestamp;
+		TCHAR message[128];
+
+		GetSystemTimeAsFileTime(&timestamp);
+		_sntprintf_s(message, _countof(message), _TRUNCATE, _T("%lld log records were dropped because the queue was full"),
+		             dropped - writer->dropped_reported);
+		wrapper_log_writer_format(writer, &timestamp, WRAPPER_LOG_LEVEL_WARNING, WRAPPER_LOG_DOMAIN, message, _T("\n"));
+		writer->dropped_reported = dropped;
+	}
+}
+
+static void wrapper_log_writer_report_rotate(wrapper_log_writer_t* writer)
+{
+	if (writer->rotate_error)
+	{
+		FILETIME timestamp;
+		TCHAR message[MAX_PATH + 128];
+
+		GetSystemTimeAsFileTime(&timestamp);
+		_sntprintf_s(message, _countof(message), _TRUNCATE,
+		             _T("Failed to rotate the log file '%s' (error %lu). It is rotated at the next limit instead."),
+		             writer->path, writer->rotate_error);
+		wrapper_log_writer_format(writer, &timestamp, WRAPPER_LOG_LEVEL_WARNING, WRAPPER_LOG_DOMAIN, message, _T("\n"));
+		writer->rotate_error = 0;
+	}
+}
+
+static void wrapper_log_writer_apply(wrapper_log_writer_t* writer)
+{
+	wrapper_log_writer_settings_t settings;
+
+	AcquireSRWLockShared(&writer->settings_lock);
+	settings = writer->settings;
+	ReleaseSRWLockShared(&writer->settings_lock);
+
+	// The buffer is empty after a flush, so it can be replaced by one that fits the new flush size
+	wrapper_log_writer_flush(writer);
+	if (settings.flush_size != writer->flush_size)
+	{
+		const DWORD buffer_size = settings.flush_size + WRAPPER_LOG_WRITER_LINE_MAX_LEN * 3;
+		char* buffer = wrapper_allocate(buffer_size);
+		if (buffer)
+		{
+			wrapper_free(writer->buffer);
+			writer->buffer = buffer;
+			writer->buffer_size = buffer_size;
+			writer->flush_size = settings.flush_size;
+		}
+	}
+
+	if (settings.generations < writer->generations)
+	{
+		wrapper_log_writer_delete_generations(writer, settings.generations + 1);
+	}
+
+	writer->max_size = settings.max_size;
+	writer->max_age = settings.max_age;
+	writer->generations = settings.generations;
+	writer->compress = settings.compress;
+	writer->flush_interval = settings.flush_interval;
+
+	if (writer->compress && writer->generations && !writer->compress_thread)
+	{
+		if (!writer->compress_event)
+		{
+			writer->compress_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+		}
+		if (writer->compress_event)
+		{
+			writer->compress_thread = CreateThread(NULL, 0, wrapper_log_writer_compress_thread, writer, 0, NULL);
+		}
+	}
+}
+
+static DWORD WINAPI wrapper_log_writer_thread(LPVOID parameter)
+{
+	wrapper_log_writer_t* writer = parameter;
+
+	// Generations may also have been lowered while the wrapper didn't run
+	wrapper_log_writer_delete_generations(writer, writer->generations + 1);
+
+	for (;;)
+	{
+		if (InterlockedExchange(&writer->reconfigure, 0))
+		{
+			wrapper_log_writer_apply(writer);
+		}
+
+		wrapper_log_record_t* record;
+		while ((record = wrapper_log_writer_peek(writer)) != NULL)
+		{
+			if (record->chunk)
+			{
+				wrapper_log_writer_format_chunk(writer, record);
+			}
+			else
+			{
+				wrapper_log_writer_format(writer, &record->timestamp, record->log_level, record->domain, record->message,
+				                          _T("\n"));
+			}
+			wrapper_log_writer_release(writer, record);
+
+			if (writer->buffer_length >= writer->flush_size)
+			{
+				wrapper_log_writer_flush(writer);
+			}
+		}
+
+		const DWORD rotate_timeout = wrapper_log_writer_rotate_by_age(writer);
+
+		wrapper_log_writer_report_dropped(writer);
+		wrapper_log_writer_report_rotate(writer);
+
+		DWORD timeout = INFINITE;
+		if (writer->buffer_length)
+		{
+			const ULONGLONG elapsed = GetTickCount64() - writer->buffer_tick_count;
+			if (elapsed >= writer->flush_interval)
+			{
+				wrapper_log_writer_flush(writer);
+			}
+			else
+			{
+				timeout = (DWORD)(writer->flush_interval - elapsed);
+			}
+		}
+		if (rotate_timeout < timeout)
+		{
+			timeout = rotate_timeout;
+		}
+
+		if (writer->stopping)
+		{
+			if (wrapper_log_writer_peek(writer))
+			{
+				continue;
+			}
+			break;
+		}
+
+		// Producers only signal the event when the writer announced it is about to sleep. Check the
+		// queue again afterwards so that a record published in between is not left behind.
+		InterlockedExchange(&writer->waiting, 1);
+		if (!wrapper_log_writer_peek(writer))
+		{
+			WaitForSingleObject(writer->wake_event, timeout);
+		}
+		InterlockedExchange(&writer->waiting, 0);
+	}
+
+	wrapper_log_writer_flush(writer);
+	return 0;
+}
+
+static int wrapper_log_writer_try_push(wrapper_log_writer_t* writer,
+                                       wrapper_log_level_t log_level,
+                                       const TCHAR* log_domain,
+                                       const TCHAR* message,
+                                       wrapper_log_chunk_t* chunk)
+{
+	wrapper_log_record_t* record;
+	LONG64 position = writer->enqueue_position;
+	for (;;)
+	{
+		record = &writer->records[position & WRAPPER_LOG_WRITER_QUEUE_MASK];
+		const LONG64 difference = record->sequence - position;
+		if (difference == 0)
+		{
+			const LONG64 observed = InterlockedCompareExchange64(&writer->enqueue_position, position + 1, position);
+			if (observed == position)
+			{
+				break;
+			}
+			position = observed;
+		}
+		else if (difference < 0)
+		{
+			return 0;
+		}
+		else
+		{
+			position = writer->enqueue_position;
+		}
+	}
+
+	record->log_level = log_level;
+	record->chunk = chunk;
+	GetSystemTimeAsFileTime(&record->timestamp);
+	StringCchCopy(record->domain, _countof(record->domain), log_domain ? log_domain : EMPTY_STRING);
+	StringCchCopy(record->message, _countof(record->message), message ? message : EMPTY_STRING);
+	InterlockedExchange64(&record->sequence, position + 1);
+
+	if (writer->waiting && InterlockedExchange(&writer->waiting, 0))
+	{
+		SetEvent(writer->wake_event);
+	}
+	return 1;
+}
+
+int wrapper_log_writer_push(wrapper_log_writer_t* writer,
+                            wrapper_log_level_t log_level,
+                            const TCHAR* log_domain,
+                            const TCHAR* message)
+{
+	if (wrapper_log_writer_try_push(writer, log_level, log_domain, message, NULL))
+	{
+		return 1;
+	}
+
+	// The queue is full. Give the writer a chance to catch up once rather than blocking the caller.
+	SetEvent(writer->wake_event);
+	SwitchToThread();
+	if (wrapper_log_writer_try_push(writer, log_level, log_domain, message, NULL))
+	{
+		return 1;
+	}
+
+	InterlockedIncrement64(&writer->dropped);
+	wrapper_metric_add(WRAPPER_METRIC_LOG_RECORDS_DROPPED, 1);
+	return 0;
+}
+
+//
+// Chunks are allocated on first use and recycled through a lock-free list, so at most
+// WRAPPER_LOG_CHUNK_MAX_COUNT chunks exist. When all of them are waiting to be written, the
+// caller waits for the writer to return one.
+//
+wrapper_log_chunk_t* wrapper_log_writer_acquire_chunk(wrapper_log_writer_t* writer, DWORD timeout)
+{
+	const ULONGLONG start_tick_count = GetTickCount64();
+	for (;;)
+	{
+		wrapper_log_chunk_t* chunk = (wrapper_log_chunk_t*)InterlockedPopEntrySList(&writer->chunks);
+		if (chunk)
+		{
+			chunk->length = 0;
+			return chunk;
+		}
+
+		if (InterlockedIncrement(&writer->chunk_count) <= WRAPPER_LOG_CHUNK_MAX_COUNT)
+		{
+			chunk = wrapper_allocate(sizeof *chunk);
+			if (chunk)
+			{
+				return chunk;
+			}
+		}
+		InterlockedDecrement(&writer->chunk_count);
+
+		const ULONGLONG elapsed = GetTickCount64() - start_tick_count;
+		if (timeout != INFINITE && elapsed >= timeout)
+		{
+			return NULL;
+		}
+
+		// The event is only a hint, so wait briefly and check the list again
+		WaitForSingleObject(writer->chunk_event, 10);
+	}
+}
+
+void wrapper_log_writer_release_chunk(wrapper_log_writer_t* writer, wrapper_log_chunk_t* chunk)
+{
+	if (chunk)
+	{
+		InterlockedPushEntrySList(&writer->chunks, &chunk->entry);
+		SetEvent(writer->chunk_event);
+	}
+}
+
+int wrapper_log_writer_push_chunk(wrapper_log_writer_t* writer,
+                                  wrapper_log_level_t log_level,
+                                  const TCHAR* log_domain,
+                                  wrapper_log_chunk_t* chunk)
+{
+	// Output of the child process is never dropped; wait for the writer to make room instead
+	while (!wrapper_log_writer_try_push(writer, log_level, log_domain, NULL, chunk))
+	{
+		if (writer->stopping)
+		{
+			wrapper_log_writer_release_chunk(writer, chunk);
+			return 0;
+		}
+		SetEvent(writer->wake_event);
+		Sleep(1);
+	}
+	return 1;
+}
+
+//
+// Echoes the output of the child to the given handles as it is written to the log, without the
+// line headers. It must be called before any output is pushed.
+//
+void wrapper_log_writer_set_echo(wrapper_log_writer_t* writer, HANDLE output, HANDLE error)
+{
+	writer->echo_output = output;
+	writer->echo_error = error;
+}
+
+LONG64 wrapper_log_writer_get_dropped(wrapper_log_writer_t* writer)
+{
+	return writer ? writer->dropped : 0;
+}
+
+void wrapper_log_writer_handler(wrapper_log_level_t log_level,
+                                const TCHAR* log_domain,
+                                const TCHAR* message,
+                                void* user_data)
+{
+	wrapper_log_writer_t* writer = user_data;
+	if (writer)
+	{
+		wrapper_log_writer_push(writer, log_level, log_domain, message);
+	}
+}
+
+static void wrapper_log_writer_get_settings(wrapper_log_writer_settings_t* settings, const wrapper_config_t* config)
+{
+	settings->max_size = config->log_max_size;
+	settings->max_age = config->log_max_age;
+	settings->generations = config->log_generations;
+	settings->compress = config->log_compress;
+	settings->flush_interval = config->log_flush_interval;
+	settings->flush_size = config->log_flush_size;
+}
+
+int wrapper_log_writer_create(wrapper_log_writer_t** writer, const TCHAR* path, wrapper_config_t* config,
+                              wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	wrapper_log_writer_t* result = NULL;
+
+	if (SUCCEEDED(hr))
+	{
+		result = wrapper_allocate(sizeof *result);
+		if (!result)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the log writer"));
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		result->file = INVALID_HANDLE_VALUE;
+		result->pid = GetCurrentProcessId();
+		InitializeSRWLock(&result->settings_lock);
+		wrapper_log_writer_get_settings(&result->settings, config);
+		result->max_size = result->settings.max_size;
+		result->max_age = result->settings.max_age;
+		result->generations = result->settings.generations;
+		result->compress = result->settings.compress;
+		result->flush_interval = result->settings.flush_interval;
+		result->flush_size = result->settings.flush_size;
+		result->buffer_size = result->flush_size + WRAPPER_LOG_WRITER_LINE_MAX_LEN * 3;
+		result->records = wrapper_allocate(sizeof(wrapper_log_record_t) * WRAPPER_LOG_WRITER_QUEUE_SIZE);
+		result->buffer = wrapper_allocate(result->buffer_size);
+		if (!result->records || !result->buffer)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the log queue"));
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		for (LONG64 i = 0; i < WRAPPER_LOG_WRITER_QUEUE_SIZE; i++)
+		{
+			result->records[i].sequence = i;
+		}
+
+		InitializeSListHead(&result->chunks);
+
+		if (!wrapper_string_duplicate(&result->path, (TCHAR*)path, error))
+		{
+			hr = E_OUTOFMEMORY;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!wrapper_log_writer_open(result))
+		{
+			DWORD last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to open the log file '%s'"), result->path);
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		result->wake_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+		result->chunk_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+		if (!result->wake_event || !result->chunk_event)
+		{
+			DWORD last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to create the event for the log writer"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr) && result->compress && result->generations)
+	{
+		result->compress_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+		if (result->compress_event)
+		{
+			result->compress_thread = CreateThread(NULL, 0, wrapper_log_writer_compress_thread, result, 0, NULL);
+		}
+
+		if (!result->compress_event || !result->compress_thread)
+		{
+			DWORD last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to start the log compression thread"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		result->thread = CreateThread(NULL, 0, wrapper_log_writer_thread, result, 0, NULL);
+		if (!result->thread)
+		{
+			DWORD last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to start the log writer thread"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (FAILED(hr))
+	{
+		wrapper_log_writer_free(result);
+		result = NULL;
+	}
+
+	*writer = result;
+	return SUCCEEDED(hr);
+}
+
+//
+// Hands the settings of the log in the configuration over to the writer thread, e.g. after the
+// configuration was read again. Lines that are already buffered are written with the old settings.
+//
+void wrapper_log_writer_configure(wrapper_log_writer_t* writer, const wrapper_config_t* config)
+{
+	AcquireSRWLockExclusive(&writer->settings_lock);
+	wrapper_log_writer_get_settings(&writer->settings, config);
+	ReleaseSRWLockExclusive(&writer->settings_lock);
+
+	InterlockedExchange(&writer->reconfigure, 1);
+	SetEvent(writer->wake_event);
+}
+
+void wrapper_log_writer_free(wrapper_log_writer_t* writer)
+{
+	if (writer)
+	{
+		InterlockedExchange(&writer->stopping, 1);
+
+		if (writer->thread)
+		{
+			SetEvent(writer->wake_event);
+			WaitForSingleObject(writer->thread, INFINITE);
+			CloseHandle(writer->thread);
+		}
+
+		if (writer->compress_thread)
+		{
+			SetEvent(writer->compress_event);
+			WaitForSingleObject(writer->compress_thread, INFINITE);
+			CloseHandle(writer->compress_thread);
+		}
+
+		if (writer->compress_event)
+		{
+			CloseHandle(writer->compress_event);
+		}
+
+		if (writer->wake_event)
+		{
+			CloseHandle(writer->wake_event);
+		}
+
+		if (writer->chunk_event)
+		{
+			CloseHandle(writer->chunk_event);
+		}
+
+		wrapper_log_chunk_t* chunk;
+		while ((chunk = (wrapper_log_chunk_t*)InterlockedPopEntrySList(&writer->chunks)) != NULL)
+		{
+			wrapper_free(chunk);
+		}
+
+		if (writer->file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(writer->file);
+		}
+
+		wrapper_free(writer->path);
+		wrapper_free(writer->buffer);
+		wrapper_free(writer->records);
+		wrapper_free(writer);
+	}
+}
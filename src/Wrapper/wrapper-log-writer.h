@@ -0,0 +1,47 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#pragma once
+#include "wrapper-error.h"
+#include "wrapper-log.h"
+#include "wrapper-config.h"
+
+#define WRAPPER_LOG_WRITER_QUEUE_SIZE 1024 // must be a power of two
+#define WRAPPER_LOG_WRITER_MESSAGE_MAX_LEN WRAPPER_LOG_MESSAGE_MAX_LEN
+#define WRAPPER_LOG_WRITER_DOMAIN_MAX_LEN 32
+#define WRAPPER_LOG_CHUNK_SIZE 65536
+#define WRAPPER_LOG_CHUNK_MAX_COUNT 16
+
+typedef struct wrapper_log_writer_t wrapper_log_writer_t;
+
+typedef struct wrapper_log_chunk_t
+{
+	SLIST_ENTRY entry;
+	DWORD length;
+	char data[WRAPPER_LOG_CHUNK_SIZE];
+} wrapper_log_chunk_t;
+
+int wrapper_log_writer_create(wrapper_log_writer_t** writer, const TCHAR* path, wrapper_config_t* config,
+                              wrapper_error_t** error);
+void wrapper_log_writer_free(wrapper_log_writer_t* writer);
+void wrapper_log_writer_configure(wrapper_log_writer_t* writer, const wrapper_config_t* config);
+
+int wrapper_log_writer_push(wrapper_log_writer_t* writer,
+                            wrapper_log_level_t log_level,
+                            const TCHAR* log_domain,
+                            const TCHAR* message);
+
+wrapper_log_chunk_t* wrapper_log_writer_acquire_chunk(wrapper_log_writer_t* writer, DWORD timeout);
+void wrapper_log_writer_release_chunk(wrapper_log_writer_t* writer, wrapper_log_chunk_t* chunk);
+int wrapper_log_writer_push_chunk(wrapper_log_writer_t* writer,
+                                  wrapper_log_level_t log_level,
+                                  const TCHAR* log_domain,
+                                  wrapper_log_chunk_t* chunk);
+
+void wrapper_log_writer_set_echo(wrapper_log_writer_t* writer, HANDLE output, HANDLE error);
+LONG64 wrapper_log_writer_get_dropped(wrapper_log_writer_t* writer);
+
+void wrapper_log_writer_handler(wrapper_log_level_t log_level,
+                                const TCHAR* log_domain,
+                                const TCHAR* message,
+                                void* user_data);
@@ -0,0 +1,221 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#include "stdafx.h"
+#include "wrapper-metrics.h"
+
+#define WRAPPER_METRICS_CACHE_LINE 64
+#define WRAPPER_METRICS_EPOCH 116444736000000000ULL // 1970-01-01 in FILETIME ticks
+
+typedef enum
+{
+	WRAPPER_METRIC_KIND_COUNTER,
+	WRAPPER_METRIC_KIND_GAUGE,
+	WRAPPER_METRIC_KIND_TIME,
+	WRAPPER_METRIC_KIND_UPTIME,
+	WRAPPER_METRIC_KIND_HISTOGRAM,
+} wrapper_metric_kind_t;
+
+typedef struct wrapper_metric_descriptor_t
+{
+	const char* name;
+	const char* help;
+	wrapper_metric_kind_t kind;
+	LONG64 scale;
+} wrapper_metric_descriptor_t;
+
+typedef struct wrapper_metric_value_t
+{
+	volatile LONG64 value;
+	BYTE padding[WRAPPER_METRICS_CACHE_LINE - sizeof(LONG64)];
+} wrapper_metric_value_t;
+
+//
+// Times are kept in milliseconds since 1970 and durations in milliseconds, and are written out in
+// seconds. An uptime is kept as the time something started and written out as the seconds since.
+//
+static const wrapper_metric_descriptor_t wrapper_metric_descriptors[WRAPPER_METRIC_COUNT] =
+{
+	{"wrapper_start_time_seconds", "Time the wrapper started since the epoch", WRAPPER_METRIC_KIND_TIME, 1000},
+	{"wrapper_child_uptime_seconds", "Time since the child process started", WRAPPER_METRIC_KIND_UPTIME, 1000},
+	{"wrapper_child_restarts_total", "Number of times the child process was restarted", WRAPPER_METRIC_KIND_COUNTER, 1},
+	{"wrapper_child_last_exit_code", "Exit code of the child process when it last ended", WRAPPER_METRIC_KIND_GAUGE, 1},
+	{"wrapper_child_stop_duration_seconds", "Time it took the child process to stop the last time", WRAPPER_METRIC_KIND_GAUGE, 1000},
+	{"wrapper_log_written_bytes_total", "Number of bytes written to the log file", WRAPPER_METRIC_KIND_COUNTER, 1},
+	{"wrapper_log_dropped_records_total", "Number of log records dropped because the queue was full", WRAPPER_METRIC_KIND_COUNTER, 1},
+	{"wrapper_log_rotations_total", "Number of times the log file was rotated", WRAPPER_METRIC_KIND_COUNTER, 1},
+	{"wrapper_child_stdout_bytes_total", "Number of bytes read from the standard output of the child process", WRAPPER_METRIC_KIND_COUNTER, 1},
+	{"wrapper_child_stderr_bytes_total", "Number of bytes read from the standard error of the child process", WRAPPER_METRIC_KIND_COUNTER, 1},
+	{"wrapper_child_cpu_seconds_total", "Processor time used by the processes of the child since it started", WRAPPER_METRIC_KIND_COUNTER, 1000},
+	{"wrapper_child_cpu_usage_ratio", "Share of a single processor used by the processes of the child", WRAPPER_METRIC_KIND_GAUGE, 10000},
+	{"wrapper_child_working_set_bytes", "Working set of the processes of the child", WRAPPER_METRIC_KIND_GAUGE, 1},
+	{"wrapper_child_private_bytes", "Private memory committed by the processes of the child", WRAPPER_METRIC_KIND_GAUGE, 1},
+	{"wrapper_child_processes", "Number of processes of the child", WRAPPER_METRIC_KIND_GAUGE, 1},
+	{"wrapper_child_threads", "Number of threads in the processes of the child", WRAPPER_METRIC_KIND_GAUGE, 1},
+	{"wrapper_child_handles", "Number of handles held by the processes of the child", WRAPPER_METRIC_KIND_GAUGE, 1},
+	{"wrapper_instances_running", "Number of instances of the child process that are running", WRAPPER_METRIC_KIND_GAUGE, 1},
+	{"wrapper_health_checks_total", "Number of health checks of the child process", WRAPPER_METRIC_KIND_COUNTER, 1},
+	{"wrapper_health_check_failures_total", "Number of failed health checks of the child process", WRAPPER_METRIC_KIND_COUNTER, 1},
+	{"wrapper_healthy", "Whether the last health check of the child process succeeded", WRAPPER_METRIC_KIND_GAUGE, 1},
+	{"wrapper_health_check_duration_seconds", "Time the health checks of the child process took", WRAPPER_METRIC_KIND_HISTOGRAM, 1000},
+};
+
+// The upper bounds of the buckets of a histogram, in milliseconds
+static const LONG64 wrapper_metric_buckets[WRAPPER_METRIC_HISTOGRAM_BUCKETS] =
+{
+	1, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000
+};
+
+static DECLSPEC_ALIGN(WRAPPER_METRICS_CACHE_LINE) wrapper_metric_value_t wrapper_metric_values[WRAPPER_METRIC_COUNT];
+
+void wrapper_metric_add(wrapper_metric_t metric, LONG64 value)
+{
+	InterlockedExchangeAdd64(&wrapper_metric_values[metric].value, value);
+}
+
+void wrapper_metric_set(wrapper_metric_t metric, LONG64 value)
+{
+	InterlockedExchange64(&wrapper_metric_values[metric].value, value);
+}
+
+LONG64 wrapper_metric_get(wrapper_metric_t metric)
+{
+	return wrapper_metric_values[metric].value;
+}
+
+void wrapper_metric_observe(wrapper_metric_t metric, LONG64 value)
+{
+	int bucket = 0;
+	while (bucket < WRAPPER_METRIC_HISTOGRAM_BUCKETS && value > wrapper_metric_buckets[bucket])
+	{
+		bucket++;
+	}
+
+	InterlockedIncrement64(&wrapper_metric_values[metric + bucket].value);
+	InterlockedExchangeAdd64(&wrapper_metric_values[metric + WRAPPER_METRIC_HISTOGRAM_BUCKETS + 1].value, value);
+	InterlockedIncrement64(&wrapper_metric_values[metric + WRAPPER_METRIC_HISTOGRAM_BUCKETS + 2].value);
+}
+
+//
+// Writes the buckets of a histogram on a single line, e.g. for the log.
+//
+int wrapper_metric_format_histogram(char* buffer, size_t size, wrapper_metric_t metric)
+{
+	char* end = buffer;
+	size_t remaining = size;
+	const LONG64 count = wrapper_metric_values[metric + WRAPPER_METRIC_HISTOGRAM_BUCKETS + 2].value;
+	const LONG64 sum = wrapper_metric_values[metric + WRAPPER_METRIC_HISTOGRAM_BUCKETS + 1].value;
+
+	HRESULT hr = StringCbPrintfExA(end, remaining, &end, &remaining, 0, "count=%lld mean=%lldms", count,
+	                               count ? sum / count : 0);
+	for (int i = 0; i < WRAPPER_METRIC_HISTOGRAM_BUCKETS && SUCCEEDED(hr); i++)
+	{
+		hr = StringCbPrintfExA(end, remaining, &end, &remaining, 0, " le%lldms=%lld", wrapper_metric_buckets[i],
+		                       wrapper_metric_values[metric + i].value);
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		hr = StringCbPrintfExA(end, remaining, &end, &remaining, 0, " more=%lld",
+		                       wrapper_metric_values[metric + WRAPPER_METRIC_HISTOGRAM_BUCKETS].value);
+	}
+	return SUCCEEDED(hr);
+}
+
+static HRESULT wrapper_metrics_format_histogram(char** end, size_t* remaining, int metric)
+{
+	const wrapper_metric_descriptor_t* descriptor = &wrapper_metric_descriptors[metric];
+	LONG64 cumulative = 0;
+
+	HRESULT hr = StringCbPrintfExA(*end, *remaining, end, remaining, 0, "# HELP %s %s\n# TYPE %s histogram\n",
+	                               descriptor->name, descriptor->help, descriptor->name);
+	for (int i = 0; i < WRAPPER_METRIC_HISTOGRAM_BUCKETS && SUCCEEDED(hr); i++)
+	{
+		const LONG64 bound = wrapper_metric_buckets[i];
+		cumulative += wrapper_metric_values[metric + i].value;
+		hr = StringCbPrintfExA(*end, *remaining, end, remaining, 0, "%s_bucket{le=\"%lld.%03lld\"} %lld\n",
+		                       descriptor->name, bound / descriptor->scale, bound % descriptor->scale, cumulative);
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		const LONG64 sum = wrapper_metric_values[metric + WRAPPER_METRIC_HISTOGRAM_BUCKETS + 1].value;
+		const LONG64 count = wrapper_metric_values[metric + WRAPPER_METRIC_HISTOGRAM_BUCKETS + 2].value;
+		hr = StringCbPrintfExA(*end, *remaining, end, remaining, 0,
+		                       "%s_bucket{le=\"+Inf\"} %lld\n%s_sum %lld.%03lld\n%s_count %lld\n",
+		                       descriptor->name, count, descriptor->name, sum / descriptor->scale,
+		                       sum % descriptor->scale, descriptor->name, count);
+	}
+	return hr;
+}
+
+//
+// Gets the current time in milliseconds since 1970.
+//
+LONG64 wrapper_metric_now(void)
+{
+	FILETIME now;
+	GetSystemTimeAsFileTime(&now);
+	return (LONG64)((((ULONGLONG)now.dwHighDateTime << 32 | now.dwLowDateTime) - WRAPPER_METRICS_EPOCH) / 10000);
+}
+
+//
+// Writes the metrics in the Prometheus text format.
+//
+int wrapper_metrics_format(char* buffer, size_t size, size_t* length)
+{
+	char* end = buffer;
+	size_t remaining = size;
+	const LONG64 now = wrapper_metric_now();
+
+	for (int i = 0; i < WRAPPER_METRIC_COUNT; i++)
+	{
+		const wrapper_metric_descriptor_t* descriptor = &wrapper_metric_descriptors[i];
+		if (!descriptor->name)
+		{
+			// The other slots of a histogram
+			continue;
+		}
+
+		if (WRAPPER_METRIC_KIND_HISTOGRAM == descriptor->kind)
+		{
+			if (FAILED(wrapper_metrics_format_histogram(&end, &remaining, i)))
+			{
+				return 0;
+			}
+			continue;
+		}
+
+		LONG64 value = wrapper_metric_values[i].value;
+		if (WRAPPER_METRIC_KIND_UPTIME == descriptor->kind)
+		{
+			value = value ? now - value : 0;
+		}
+
+		const char* type = WRAPPER_METRIC_KIND_COUNTER == descriptor->kind ? "counter" : "gauge";
+		const LONG64 whole = value / descriptor->scale;
+		const LONG64 fraction = (value < 0 ? -value : value) % descriptor->scale;
+
+		HRESULT hr;
+		if (descriptor->scale > 1)
+		{
+			hr = StringCbPrintfExA(end, remaining, &end, &remaining, 0, "# HELP %s %s\n# TYPE %s %s\n%s %s%lld.%0*lld\n",
+			                       descriptor->name, descriptor->help, descriptor->name, type, descriptor->name,
+			                       value < 0 && 0 == whole ? "-" : "", whole, descriptor->scale == 1000 ? 3 : 4,
+			                       fraction);
+		}
+		else
+		{
+			hr = StringCbPrintfExA(end, remaining, &end, &remaining, 0, "# HELP %s %s\n# TYPE %s %s\n%s %lld\n",
+			                       descriptor->name, descriptor->help, descriptor->name, type, descriptor->name, value);
+		}
+
+		if (FAILED(hr))
+		{
+			return 0;
+		}
+	}
+
+	*length = size - remaining;
+	return 1;
+}
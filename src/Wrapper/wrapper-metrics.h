@@ -0,0 +1,51 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#pragma once
+
+// A histogram takes a slot for each bucket, one for the values beyond the last bucket, and one each
+// for the sum and the count of the values.
+#define WRAPPER_METRIC_HISTOGRAM_BUCKETS 12
+#define WRAPPER_METRIC_HISTOGRAM_SLOTS (WRAPPER_METRIC_HISTOGRAM_BUCKETS + 3)
+
+//
+// The metrics are kept in a flat array of 64-bit values indexed by wrapper_metric_t. Updating a
+// metric is a single interlocked instruction on its own cache line, so it's cheap enough for the
+// paths that handle every log record. Only reading them all out takes any time.
+//
+typedef enum
+{
+	WRAPPER_METRIC_START_TIME,
+	WRAPPER_METRIC_CHILD_START_TIME,
+	WRAPPER_METRIC_RESTARTS,
+	WRAPPER_METRIC_LAST_EXIT_CODE,
+	WRAPPER_METRIC_STOP_DURATION,
+	WRAPPER_METRIC_LOG_BYTES_WRITTEN,
+	WRAPPER_METRIC_LOG_RECORDS_DROPPED,
+	WRAPPER_METRIC_LOG_ROTATIONS,
+	WRAPPER_METRIC_STDOUT_BYTES,
+	WRAPPER_METRIC_STDERR_BYTES,
+	WRAPPER_METRIC_CHILD_CPU_TIME,
+	WRAPPER_METRIC_CHILD_CPU_USAGE,
+	WRAPPER_METRIC_CHILD_WORKING_SET,
+	WRAPPER_METRIC_CHILD_PRIVATE_BYTES,
+	WRAPPER_METRIC_CHILD_PROCESSES,
+	WRAPPER_METRIC_CHILD_THREADS,
+	WRAPPER_METRIC_CHILD_HANDLES,
+	WRAPPER_METRIC_INSTANCES_RUNNING,
+	WRAPPER_METRIC_HEALTH_CHECKS,
+	WRAPPER_METRIC_HEALTH_FAILURES,
+	WRAPPER_METRIC_HEALTHY,
+	WRAPPER_METRIC_HEALTH_LATENCY,
+	WRAPPER_METRIC_HEALTH_LATENCY_END = WRAPPER_METRIC_HEALTH_LATENCY + WRAPPER_METRIC_HISTOGRAM_SLOTS - 1,
+	WRAPPER_METRIC_COUNT
+} wrapper_metric_t;
+
+void wrapper_metric_add(wrapper_metric_t metric, LONG64 value);
+void wrapper_metric_set(wrapper_metric_t metric, LONG64 value);
+LONG64 wrapper_metric_get(wrapper_metric_t metric);
+LONG64 wrapper_metric_now(void);
+void wrapper_metric_observe(wrapper_metric_t metric, LONG64 value);
+int wrapper_metric_format_histogram(char* buffer, size_t size, wrapper_metric_t metric);
+
+int wrapper_metrics_format(char* buffer, size_t size, size_t* length);
@@ -0,0 +1,357 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#include "stdafx.h"
+#include "wrapper-pipe.h"
+#include "wrapper-memory.h"
+#include "wrapper-log.h"
+
+#define WRAPPER_PIPE_PATH_FORMAT _T("\\\\.\\pipe\\%s")
+#define WRAPPER_PIPE_SLOT_COUNT 4
+
+typedef enum
+{
+	WRAPPER_PIPE_LISTENING,
+	WRAPPER_PIPE_READING,
+	WRAPPER_PIPE_WRITING,
+} wrapper_pipe_state_t;
+
+typedef struct wrapper_pipe_slot_t
+{
+	wrapper_pipe_server_t* server;
+	HANDLE pipe;
+	OVERLAPPED overlapped;
+	wrapper_reactor_source_t* source;
+	wrapper_pipe_state_t state;
+	int truncated;
+	DWORD process_id;
+	DWORD length;
+	char message[WRAPPER_PIPE_MESSAGE_MAX_LEN + 1];
+	char* reply;
+} wrapper_pipe_slot_t;
+
+//
+// A server for local clients that talk to the wrapper in messages, on a message mode pipe, so that
+// each write of a client is a message. The children send notifications this way, and the commands
+// of the wrapper control the service that runs.
+//
+// A few instances of the pipe are kept listening, so that several clients can connect at the same
+// time. Each instance is driven by the reactor: its event is signalled when a client connected, or
+// a message was read or a reply written, after which the next operation is started. Nothing
+// blocks the thread of the reactor, not even a client that doesn't read its replies.
+//
+struct wrapper_pipe_server_t
+{
+	wrapper_reactor_t* reactor;
+	wrapper_pipe_callback_t callback;
+	void* user_data;
+	DWORD reply_size;
+	TCHAR path[MAX_PATH];
+	wrapper_pipe_slot_t slots[WRAPPER_PIPE_SLOT_COUNT];
+};
+
+static void wrapper_pipe_on_event(void* user_data);
+
+static int wrapper_pipe_wait(wrapper_pipe_slot_t* slot, wrapper_error_t** error)
+{
+	return wrapper_reactor_add_handle(slot->server->reactor, slot->overlapped.hEvent, wrapper_pipe_on_event, slot,
+	                                  &slot->source, error);
+}
+
+static int wrapper_pipe_listen(wrapper_pipe_slot_t* slot, wrapper_error_t** error)
+{
+	slot->state = WRAPPER_PIPE_LISTENING;
+	slot->process_id = 0;
+	slot->length = 0;
+	slot->truncated = 0;
+
+	ResetEvent(slot->overlapped.hEvent);
+	if (!ConnectNamedPipe(slot->pipe, &slot->overlapped))
+	{
+		const DWORD last_error = GetLastError();
+		if (ERROR_PIPE_CONNECTED == last_error)
+		{
+			// The client connected before the pipe was listening
+			SetEvent(slot->overlapped.hEvent);
+		}
+		else if (ERROR_IO_PENDING != last_error)
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to listen on the pipe '%s'"),
+				                                   slot->server->path);
+			}
+			return 0;
+		}
+	}
+	return wrapper_pipe_wait(slot, error);
+}
+
+//
+// Waits for the client that went away to be replaced by the next one.
+//
+static int wrapper_pipe_reset(wrapper_pipe_slot_t* slot, wrapper_error_t** error)
+{
+	DisconnectNamedPipe(slot->pipe);
+	return wrapper_pipe_listen(slot, error);
+}
+
+static int wrapper_pipe_read(wrapper_pipe_slot_t* slot, wrapper_error_t** error)
+{
+	slot->state = WRAPPER_PIPE_READING;
+	if (!ReadFile(slot->pipe, slot->message + slot->length, WRAPPER_PIPE_MESSAGE_MAX_LEN - slot->length, NULL,
+	              &slot->overlapped))
+	{
+		const DWORD last_error = GetLastError();
+		if (ERROR_IO_PENDING != last_error && ERROR_MORE_DATA != last_error)
+		{
+			return wrapper_pipe_reset(slot, error);
+		}
+	}
+	return wrapper_pipe_wait(slot, error);
+}
+
+static int wrapper_pipe_write(wrapper_pipe_slot_t* slot, DWORD length, wrapper_error_t** error)
+{
+	slot->state = WRAPPER_PIPE_WRITING;
+	if (!WriteFile(slot->pipe, slot->reply, length, NULL, &slot->overlapped) && ERROR_IO_PENDING != GetLastError())
+	{
+		return wrapper_pipe_reset(slot, error);
+	}
+	return wrapper_pipe_wait(slot, error);
+}
+
+//
+// Hands the message that was read to the callback, and then sends the reply, if there is one, or
+// reads the next message.
+//
+static int wrapper_pipe_dispatch(wrapper_pipe_slot_t* slot, wrapper_error_t** error)
+{
+	wrapper_pipe_server_t* server = slot->server;
+	DWORD length = 0;
+
+	if (slot->truncated)
+	{
+		WRAPPER_WARNING(_T("Ignored a message of process %lu on the pipe '%s' that is longer than %d bytes."),
+		                slot->process_id, server->path, WRAPPER_PIPE_MESSAGE_MAX_LEN);
+	}
+	else
+	{
+		slot->message[slot->length] = '\0';
+		length = server->callback(server->user_data, slot->process_id, slot->message, slot->length, slot->reply,
+		                          slot->reply ? server->reply_size : 0);
+	}
+
+	slot->length = 0;
+	slot->truncated = 0;
+	return length ? wrapper_pipe_write(slot, length, error) : wrapper_pipe_read(slot, error);
+}
+
+static void wrapper_pipe_on_event(void* user_data)
+{
+	wrapper_pipe_slot_t* slot = user_data;
+	wrapper_error_t* error = NULL;
+	DWORD bytes = 0;
+	int result;
+
+	if (GetOverlappedResult(slot->pipe, &slot->overlapped, &bytes, FALSE))
+	{
+		switch (slot->state)
+		{
+		case WRAPPER_PIPE_LISTENING:
+			GetNamedPipeClientProcessId(slot->pipe, &slot->process_id);
+			result = wrapper_pipe_read(slot, &error);
+			break;
+
+		case WRAPPER_PIPE_READING:
+			slot->length += bytes;
+			result = wrapper_pipe_dispatch(slot, &error);
+			break;
+
+		default:
+			result = wrapper_pipe_read(slot, &error);
+			break;
+		}
+	}
+	else if (WRAPPER_PIPE_READING == slot->state && ERROR_MORE_DATA == GetLastError())
+	{
+		// The rest of a message that doesn't fit is read, but the message is dropped
+		slot->length += bytes;
+		if (slot->length >= WRAPPER_PIPE_MESSAGE_MAX_LEN)
+		{
+			slot->length = 0;
+			slot->truncated = 1;
+		}
+		result = wrapper_pipe_read(slot, &error);
+	}
+	else
+	{
+		result = wrapper_pipe_reset(slot, &error);
+	}
+
+	if (!result)
+	{
+		wrapper_error_log(error);
+		wrapper_error_free(error);
+	}
+}
+
+static int wrapper_pipe_open(wrapper_pipe_slot_t* slot, int first, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	DWORD last_error;
+	wrapper_pipe_server_t* server = slot->server;
+
+	if (SUCCEEDED(hr) && server->reply_size)
+	{
+		slot->reply = wrapper_allocate(server->reply_size);
+		if (!slot->reply)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the replies on the pipe '%s'"),
+				                                    server->path);
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		slot->pipe = CreateNamedPipe(server->path,
+		                             (server->reply_size ? PIPE_ACCESS_DUPLEX : PIPE_ACCESS_INBOUND) |
+		                             FILE_FLAG_OVERLAPPED | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+		                             PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+		                             WRAPPER_PIPE_SLOT_COUNT,
+		                             server->reply_size,
+		                             WRAPPER_PIPE_MESSAGE_MAX_LEN,
+		                             0,
+		                             NULL);
+		if (INVALID_HANDLE_VALUE == slot->pipe)
+		{
+			slot->pipe = NULL;
+			last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to create the pipe '%s'"), server->path);
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		slot->overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (!slot->overlapped.hEvent)
+		{
+			last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to create the event for the pipe '%s'"),
+				                                   server->path);
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!wrapper_pipe_listen(slot, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	return SUCCEEDED(hr);
+}
+
+//
+// Creates the server for the pipe with the name, which is prefixed with '\\.\pipe\'. A server with
+// a reply size of 0 only receives messages.
+//
+int wrapper_pipe_server_create(wrapper_pipe_server_t** server, wrapper_reactor_t* reactor, const TCHAR* name,
+                               DWORD reply_size, wrapper_pipe_callback_t callback, void* user_data,
+                               wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	wrapper_pipe_server_t* result = NULL;
+
+	if (SUCCEEDED(hr))
+	{
+		result = wrapper_allocate(sizeof *result);
+		if (!result)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the pipe '%s'"), name);
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		result->reactor = reactor;
+		result->callback = callback;
+		result->user_data = user_data;
+		result->reply_size = reply_size;
+		_sntprintf_s(result->path, _countof(result->path), _TRUNCATE, WRAPPER_PIPE_PATH_FORMAT, name);
+
+		for (int i = 0; i < WRAPPER_PIPE_SLOT_COUNT && SUCCEEDED(hr); i++)
+		{
+			result->slots[i].server = result;
+			if (!wrapper_pipe_open(&result->slots[i], 0 == i, error))
+			{
+				hr = E_FAIL;
+			}
+		}
+	}
+
+	if (FAILED(hr))
+	{
+		wrapper_pipe_server_free(result);
+		result = NULL;
+	}
+
+	*server = result;
+	return SUCCEEDED(hr);
+}
+
+//
+// Must be called on the thread of the reactor, before the reactor is freed.
+//
+void wrapper_pipe_server_free(wrapper_pipe_server_t* server)
+{
+	if (server)
+	{
+		for (int i = 0; i < WRAPPER_PIPE_SLOT_COUNT; i++)
+		{
+			wrapper_pipe_slot_t* slot = &server->slots[i];
+			wrapper_reactor_remove(server->reactor, &slot->source);
+
+			if (slot->pipe)
+			{
+				// The pending operation still refers to the slot, so wait for it to be cancelled
+				DWORD bytes;
+				if (CancelIoEx(slot->pipe, &slot->overlapped))
+				{
+					GetOverlappedResult(slot->pipe, &slot->overlapped, &bytes, TRUE);
+				}
+				CloseHandle(slot->pipe);
+			}
+
+			if (slot->overlapped.hEvent)
+			{
+				CloseHandle(slot->overlapped.hEvent);
+			}
+			wrapper_free(slot->reply);
+		}
+
+		wrapper_free(server);
+	}
+}
+
+const TCHAR* wrapper_pipe_server_get_path(wrapper_pipe_server_t* server)
+{
+	return server ? server->path : NULL;
+}
@@ -0,0 +1,24 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#pragma once
+#include "wrapper-error.h"
+#include "wrapper-reactor.h"
+
+#define WRAPPER_PIPE_MESSAGE_MAX_LEN 4096
+
+typedef struct wrapper_pipe_server_t wrapper_pipe_server_t;
+
+//
+// Called on the thread of the reactor with each message a client sent. When the server replies,
+// the callback writes the reply to the buffer and returns its length, or 0 to not reply.
+//
+typedef DWORD (*wrapper_pipe_callback_t)(void* user_data, DWORD process_id, const char* message, DWORD length,
+                                         char* reply, DWORD reply_size);
+
+int wrapper_pipe_server_create(wrapper_pipe_server_t** server, wrapper_reactor_t* reactor, const TCHAR* name,
+                               DWORD reply_size, wrapper_pipe_callback_t callback, void* user_data,
+                               wrapper_error_t** error);
+void wrapper_pipe_server_free(wrapper_pipe_server_t* server);
+
+const TCHAR* wrapper_pipe_server_get_path(wrapper_pipe_server_t* server);
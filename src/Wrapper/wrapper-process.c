@@ -0,0 +1,269 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#include "stdafx.h"
+#include "wrapper-process.h"
+#include "wrapper-memory.h"
+
+#define WRAPPER_PROCESS_SNAPSHOT_SIZE 256
+
+int wrapper_process_snapshot(PROCESSENTRY32** entries, DWORD* count, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	HANDLE snapshot = NULL;
+	PROCESSENTRY32* result = NULL;
+	DWORD capacity = WRAPPER_PROCESS_SNAPSHOT_SIZE;
+	DWORD size = 0;
+
+	if (SUCCEEDED(hr))
+	{
+		snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+		if (INVALID_HANDLE_VALUE == snapshot)
+		{
+			snapshot = NULL;
+			const DWORD last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to take a snapshot of the running processes"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		result = wrapper_allocate(capacity * sizeof *result);
+		if (!result)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the snapshot of the running processes"));
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		PROCESSENTRY32 entry = {0};
+		entry.dwSize = sizeof entry;
+		BOOL more = Process32First(snapshot, &entry);
+		while (more && SUCCEEDED(hr))
+		{
+			if (size == capacity)
+			{
+				PROCESSENTRY32* grown = wrapper_allocate(2 * capacity * sizeof *grown);
+				if (!grown)
+				{
+					hr = E_OUTOFMEMORY;
+					if (error)
+					{
+						*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the snapshot of the running processes"));
+					}
+					break;
+				}
+				memcpy(grown, result, size * sizeof *grown);
+				wrapper_free(result);
+				result = grown;
+				capacity *= 2;
+			}
+
+			result[size++] = entry;
+			more = Process32Next(snapshot, &entry);
+		}
+	}
+
+	if (snapshot)
+	{
+		CloseHandle(snapshot);
+	}
+
+	if (FAILED(hr))
+	{
+		wrapper_free(result);
+		result = NULL;
+		size = 0;
+	}
+
+	*entries = result;
+	*count = size;
+	return SUCCEEDED(hr);
+}
+
+static ULONGLONG wrapper_process_get_creation_time(HANDLE process)
+{
+	FILETIME creation_time, exit_time, kernel_time, user_time;
+	if (!GetProcessTimes(process, &creation_time, &exit_time, &kernel_time, &user_time))
+	{
+		return 0;
+	}
+	return (ULONGLONG)creation_time.dwHighDateTime << 32 | creation_time.dwLowDateTime;
+}
+
+//
+// Terminates a process and all of its descendants. Windows doesn't keep track of the process tree,
+// so the descendants are found through the parent process identifiers in a snapshot. Identifiers
+// are reused, so a process that was created before the root can't be one of its descendants and is
+// left alone. The root is terminated first so that it can't start any more processes.
+//
+int wrapper_process_terminate_tree(HANDLE process, UINT exit_code, DWORD* count, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	PROCESSENTRY32* entries = NULL;
+	DWORD* tree = NULL;
+	DWORD entry_count = 0;
+	DWORD tree_count = 0;
+	DWORD terminated = 0;
+
+	const ULONGLONG root_creation_time = wrapper_process_get_creation_time(process);
+
+	if (SUCCEEDED(hr))
+	{
+		if (!wrapper_process_snapshot(&entries, &entry_count, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		tree = wrapper_allocate((entry_count + 1) * sizeof *tree);
+		if (!tree)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the process tree"));
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		tree[tree_count++] = GetProcessId(process);
+		for (DWORD i = 0; i < tree_count; i++)
+		{
+			for (DWORD j = 0; j < entry_count; j++)
+			{
+				if (entries[j].th32ParentProcessID == tree[i] && entries[j].th32ProcessID != tree[i])
+				{
+					tree[tree_count++] = entries[j].th32ProcessID;
+					// Every process is added at most once, which also guards against cycles
+					entries[j].th32ParentProcessID = 0;
+				}
+			}
+		}
+
+		if (TerminateProcess(process, exit_code))
+		{
+			terminated++;
+		}
+
+		for (DWORD i = 1; i < tree_count; i++)
+		{
+			HANDLE descendant = OpenProcess(PROCESS_TERMINATE | PROCESS_QUERY_LIMITED_INFORMATION, FALSE, tree[i]);
+			if (descendant)
+			{
+				if (wrapper_process_get_creation_time(descendant) >= root_creation_time &&
+					TerminateProcess(descendant, exit_code))
+				{
+					terminated++;
+				}
+				CloseHandle(descendant);
+			}
+		}
+	}
+
+	wrapper_free(tree);
+	wrapper_free(entries);
+
+	if (count)
+	{
+		*count = terminated;
+	}
+
+	return SUCCEEDED(hr);
+}
+
+//
+// Creates the attribute list that limits the handles a process inherits to the ones given,
+// instead of every inheritable handle of the wrapper, e.g. the sockets of one child ending up in a
+// hook. The list refers to the array rather than copying it, so the array must outlive the list,
+// and the handles in it may be replaced before each CreateProcess as long as there are as many.
+//
+int wrapper_process_create_handle_list(LPPROC_THREAD_ATTRIBUTE_LIST* list, HANDLE* handles, DWORD count,
+                                       wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	LPPROC_THREAD_ATTRIBUTE_LIST result = NULL;
+	SIZE_T size = 0;
+	int initialized = 0;
+
+	if (SUCCEEDED(hr))
+	{
+		// This only gets the size, so it fails with ERROR_INSUFFICIENT_BUFFER
+		InitializeProcThreadAttributeList(NULL, 1, 0, &size);
+		result = wrapper_allocate(size);
+		if (!result)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the handles to inherit"));
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!InitializeProcThreadAttributeList(result, 1, 0, &size))
+		{
+			const DWORD last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to create the list of handles to inherit"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+		else
+		{
+			initialized = 1;
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		if (!UpdateProcThreadAttribute(result, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, handles, count * sizeof(HANDLE),
+		                               NULL, NULL))
+		{
+			const DWORD last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to set the list of handles to inherit"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (FAILED(hr))
+	{
+		if (initialized)
+		{
+			DeleteProcThreadAttributeList(result);
+		}
+		wrapper_free(result);
+		result = NULL;
+	}
+
+	*list = result;
+	return SUCCEEDED(hr);
+}
+
+void wrapper_process_free_handle_list(LPPROC_THREAD_ATTRIBUTE_LIST list)
+{
+	if (list)
+	{
+		DeleteProcThreadAttributeList(list);
+		wrapper_free(list);
+	}
+}
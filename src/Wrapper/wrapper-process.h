@@ -0,0 +1,11 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#pragma once
+#include "wrapper-error.h"
+
+int wrapper_process_snapshot(PROCESSENTRY32** entries, DWORD* count, wrapper_error_t** error);
+int wrapper_process_terminate_tree(HANDLE process, UINT exit_code, DWORD* count, wrapper_error_t** error);
+int wrapper_process_create_handle_list(LPPROC_THREAD_ATTRIBUTE_LIST* list, HANDLE* handles, DWORD count,
+                                       wrapper_error_t** error);
+void wrapper_process_free_handle_list(LPPROC_THREAD_ATTRIBUTE_LIST list);
@@ -0,0 +1,300 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#include "stdafx.h"
+#include "wrapper-reactor.h"
+#include "wrapper-memory.h"
+#include "wrapper-utils.h"
+
+//
+// The reactor runs everything that supervises the child on the thread that calls
+// wrapper_reactor_run. Handles are waited on by the thread pool, which posts a packet to a
+// completion port once a handle is signalled. The completion key is the source itself, so a
+// packet is dispatched without looking anything up, and there is no limit on the number of
+// handles. Timers are kept in a timer wheel and bound how long the thread waits for a packet.
+//
+// All functions except wrapper_reactor_create and wrapper_reactor_free must be called from the
+// thread that runs the reactor, typically from the callbacks.
+//
+struct wrapper_reactor_t
+{
+	HANDLE port;
+	wrapper_timer_wheel_t wheel;
+	wrapper_reactor_source_t* sources;
+	int stopping;
+};
+
+//
+// A handle is waited on once. Once it is signalled and its callback was called, the source is gone
+// and the pointer the caller kept to it is set to NULL.
+//
+struct wrapper_reactor_source_t
+{
+	wrapper_reactor_t* reactor;
+	wrapper_reactor_source_t* next;
+	wrapper_reactor_source_t* previous;
+	wrapper_reactor_source_t** owner;
+	HANDLE wait;
+	wrapper_reactor_callback_t callback;
+	void* user_data;
+	volatile LONG posted;
+	int removed;
+};
+
+static VOID CALLBACK wrapper_reactor_signalled(PVOID parameter, BOOLEAN timed_out)
+{
+	wrapper_reactor_source_t* source = parameter;
+	UNUSED(timed_out);
+
+	InterlockedExchange(&source->posted, 1);
+	PostQueuedCompletionStatus(source->reactor->port, 0, (ULONG_PTR)source, NULL);
+}
+
+static void wrapper_reactor_source_free(wrapper_reactor_t* reactor, wrapper_reactor_source_t* source)
+{
+	if (source->previous)
+	{
+		source->previous->next = source->next;
+	}
+	else
+	{
+		reactor->sources = source->next;
+	}
+
+	if (source->next)
+	{
+		source->next->previous = source->previous;
+	}
+
+	if (source->owner)
+	{
+		*source->owner = NULL;
+	}
+	wrapper_free(source);
+}
+
+//
+// Stops waiting for the handle. Waits for a callback of the thread pool that is already running,
+// so that afterwards it's known whether a packet for the source is on its way.
+//
+static void wrapper_reactor_source_unregister(wrapper_reactor_source_t* source)
+{
+	if (source->wait)
+	{
+		UnregisterWaitEx(source->wait, INVALID_HANDLE_VALUE);
+		source->wait = NULL;
+	}
+}
+
+int wrapper_reactor_create(wrapper_reactor_t** reactor, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	wrapper_reactor_t* result = NULL;
+
+	if (SUCCEEDED(hr))
+	{
+		result = wrapper_allocate(sizeof *result);
+		if (!result)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the reactor"));
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		wrapper_timer_wheel_init(&result->wheel, GetTickCount64());
+
+		result->port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+		if (!result->port)
+		{
+			const DWORD last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to create the completion port of the reactor"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (FAILED(hr))
+	{
+		wrapper_reactor_free(result);
+		result = NULL;
+	}
+
+	*reactor = result;
+	return SUCCEEDED(hr);
+}
+
+void wrapper_reactor_free(wrapper_reactor_t* reactor)
+{
+	if (reactor)
+	{
+		while (reactor->sources)
+		{
+			wrapper_reactor_source_t* source = reactor->sources;
+			wrapper_reactor_source_unregister(source);
+			wrapper_reactor_source_free(reactor, source);
+		}
+
+		if (reactor->port)
+		{
+			CloseHandle(reactor->port);
+		}
+
+		wrapper_free(reactor);
+	}
+}
+
+//
+// Calls back once the handle is signalled. The handle must stay open until then, or until the
+// source is removed.
+//
+int wrapper_reactor_add_handle(wrapper_reactor_t* reactor, HANDLE handle, wrapper_reactor_callback_t callback,
+                               void* user_data, wrapper_reactor_source_t** source, wrapper_error_t** error)
+{
+	wrapper_reactor_source_t* result = wrapper_allocate(sizeof *result);
+	if (!result)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_hresult(E_OUTOFMEMORY, _T("Failed to allocate memory for a reactor source"));
+		}
+		return 0;
+	}
+
+	result->reactor = reactor;
+	result->owner = source;
+	result->callback = callback;
+	result->user_data = user_data;
+
+	if (!RegisterWaitForSingleObject(&result->wait, handle, wrapper_reactor_signalled, result, INFINITE,
+	                                 WT_EXECUTEONLYONCE | WT_EXECUTEINWAITTHREAD))
+	{
+		const DWORD last_error = GetLastError();
+		if (error)
+		{
+			*error = wrapper_error_from_system(last_error, _T("Failed to wait for a handle"));
+		}
+		wrapper_free(result);
+		return 0;
+	}
+
+	result->next = reactor->sources;
+	if (reactor->sources)
+	{
+		reactor->sources->previous = result;
+	}
+	reactor->sources = result;
+
+	if (source)
+	{
+		*source = result;
+	}
+	return 1;
+}
+
+//
+// Stops waiting for the handle of the source, if it is still there, and sets the pointer to NULL.
+// When the handle was signalled already, the packet that is on its way is ignored.
+//
+void wrapper_reactor_remove(wrapper_reactor_t* reactor, wrapper_reactor_source_t** source)
+{
+	if (!source || !*source)
+	{
+		return;
+	}
+
+	wrapper_reactor_source_t* removed = *source;
+	*source = NULL;
+	removed->owner = NULL;
+
+	wrapper_reactor_source_unregister(removed);
+	if (removed->posted)
+	{
+		removed->removed = 1;
+	}
+	else
+	{
+		wrapper_reactor_source_free(reactor, removed);
+	}
+}
+
+void wrapper_reactor_set_timer(wrapper_reactor_t* reactor, wrapper_timer_t* timer, DWORD delay,
+                               wrapper_timer_callback_t callback, void* user_data)
+{
+	wrapper_timer_schedule(&reactor->wheel, timer, GetTickCount64(), delay, callback, user_data);
+}
+
+void wrapper_reactor_cancel_timer(wrapper_reactor_t* reactor, wrapper_timer_t* timer)
+{
+	wrapper_timer_cancel(&reactor->wheel, timer);
+}
+
+static void wrapper_reactor_dispatch(wrapper_reactor_t* reactor, wrapper_reactor_source_t* source)
+{
+	const wrapper_reactor_callback_t callback = source->callback;
+	void* user_data = source->user_data;
+	const int removed = source->removed;
+
+	// The source is gone before the callback runs, so the callback can wait for the handle again
+	wrapper_reactor_source_unregister(source);
+	wrapper_reactor_source_free(reactor, source);
+
+	if (!removed)
+	{
+		callback(user_data);
+	}
+}
+
+//
+// Dispatches the signalled handles and the timers that are due until the reactor is stopped.
+//
+int wrapper_reactor_run(wrapper_reactor_t* reactor, wrapper_error_t** error)
+{
+	reactor->stopping = 0;
+	while (!reactor->stopping)
+	{
+		wrapper_timer_wheel_advance(&reactor->wheel, GetTickCount64());
+		if (reactor->stopping)
+		{
+			break;
+		}
+
+		const unsigned long next = wrapper_timer_wheel_next(&reactor->wheel, GetTickCount64());
+		const DWORD timeout = WRAPPER_TIMER_NONE == next ? INFINITE : next;
+
+		DWORD bytes = 0;
+		ULONG_PTR key = 0;
+		OVERLAPPED* overlapped = NULL;
+		if (!GetQueuedCompletionStatus(reactor->port, &bytes, &key, &overlapped, timeout))
+		{
+			const DWORD last_error = GetLastError();
+			if (WAIT_TIMEOUT == last_error)
+			{
+				continue;
+			}
+
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to wait for the completion port of the reactor"));
+			}
+			return 0;
+		}
+
+		wrapper_reactor_dispatch(reactor, (wrapper_reactor_source_t*)key);
+	}
+	return 1;
+}
+
+//
+// Makes wrapper_reactor_run return once the current callback returns.
+//
+void wrapper_reactor_stop(wrapper_reactor_t* reactor)
+{
+	reactor->stopping = 1;
+}
@@ -0,0 +1,25 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#pragma once
+#include "wrapper-error.h"
+#include "wrapper-timer.h"
+
+typedef struct wrapper_reactor_t wrapper_reactor_t;
+typedef struct wrapper_reactor_source_t wrapper_reactor_source_t;
+
+typedef void (*wrapper_reactor_callback_t)(void* user_data);
+
+int wrapper_reactor_create(wrapper_reactor_t** reactor, wrapper_error_t** error);
+void wrapper_reactor_free(wrapper_reactor_t* reactor);
+
+int wrapper_reactor_add_handle(wrapper_reactor_t* reactor, HANDLE handle, wrapper_reactor_callback_t callback,
+                               void* user_data, wrapper_reactor_source_t** source, wrapper_error_t** error);
+void wrapper_reactor_remove(wrapper_reactor_t* reactor, wrapper_reactor_source_t** source);
+
+void wrapper_reactor_set_timer(wrapper_reactor_t* reactor, wrapper_timer_t* timer, DWORD delay,
+                               wrapper_timer_callback_t callback, void* user_data);
+void wrapper_reactor_cancel_timer(wrapper_reactor_t* reactor, wrapper_timer_t* timer);
+
+int wrapper_reactor_run(wrapper_reactor_t* reactor, wrapper_error_t** error);
+void wrapper_reactor_stop(wrapper_reactor_t* reactor);
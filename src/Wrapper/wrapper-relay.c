@@ -0,0 +1,507 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#include "stdafx.h"
+#include "wrapper-relay.h"
+#include "wrapper-memory.h"
+#include "wrapper-metrics.h"
+
+#define WRAPPER_RELAY_PIPE_NAME_FORMAT _T("\\\\.\\pipe\\phaka-wrapper-%lu-%ld-%s")
+#define WRAPPER_RELAY_STREAM_COUNT 2
+#define WRAPPER_RELAY_DRAIN_TIMEOUT 5000
+#define WRAPPER_RELAY_NAME_MAX_LEN 32
+
+typedef struct wrapper_relay_stream_t
+{
+	TCHAR name[WRAPPER_RELAY_NAME_MAX_LEN];
+	wrapper_log_level_t log_level;
+	wrapper_metric_t metric;
+	HANDLE pipe;
+	HANDLE child;
+	OVERLAPPED overlapped;
+	wrapper_log_chunk_t* chunk;
+	int closed;
+} wrapper_relay_stream_t;
+
+//
+// The relay owns the reading end of a pipe for each of the standard output and standard error
+// streams of the child. A single thread keeps an overlapped read pending on each pipe and reads
+// straight into chunks owned by the log writer, which writes them without copying them again.
+//
+struct wrapper_relay_t
+{
+	wrapper_log_writer_t* writer;
+	wrapper_relay_stream_t streams[WRAPPER_RELAY_STREAM_COUNT];
+	HANDLE thread;
+	volatile LONG stopping;
+	char* ready_pattern;
+	HANDLE ready_event;
+};
+
+static volatile LONG wrapper_relay_pipe_count = 0;
+
+static int wrapper_relay_stream_open(wrapper_relay_stream_t* stream, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	DWORD last_error;
+	TCHAR name[MAX_PATH];
+
+	_sntprintf_s(name, _countof(name), _TRUNCATE, WRAPPER_RELAY_PIPE_NAME_FORMAT, GetCurrentProcessId(),
+	             InterlockedIncrement(&wrapper_relay_pipe_count), stream->name);
+
+	if (SUCCEEDED(hr))
+	{
+		stream->pipe = CreateNamedPipe(name,
+		                               PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+		                               PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+		                               1,
+		                               0,
+		                               WRAPPER_LOG_CHUNK_SIZE,
+		                               0,
+		                               NULL);
+		if (INVALID_HANDLE_VALUE == stream->pipe)
+		{
+			stream->pipe = NULL;
+			last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to create the pipe '%s'"), name);
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		SECURITY_ATTRIBUTES security_attributes = {0};
+		security_attributes.nLength = sizeof security_attributes;
+		security_attributes.bInheritHandle = TRUE;
+
+		stream->child = CreateFile(name, GENERIC_WRITE, 0, &security_attributes, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+		                           NULL);
+		if (INVALID_HANDLE_VALUE == stream->child)
+		{
+			stream->child = NULL;
+			last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to connect to the pipe '%s'"), name);
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		stream->overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (!stream->overlapped.hEvent)
+		{
+			last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to create the event for the pipe '%s'"), name);
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	return SUCCEEDED(hr);
+}
+
+//
+// Matches a line against a pattern in which '*' matches any run of characters and '?' matches a
+// single character. The pattern has to match the whole line.
+//
+static int wrapper_relay_match(const char* pattern, const char* line, const char* end)
+{
+	const char* star = NULL;
+	const char* resume = NULL;
+
+	while (line < end)
+	{
+		if (*pattern == '*')
+		{
+			star = pattern++;
+			resume = line;
+		}
+		else if (*pattern && (*pattern == '?' || *pattern == *line))
+		{
+			pattern++;
+			line++;
+		}
+		else if (star)
+		{
+			pattern = star + 1;
+			line = ++resume;
+		}
+		else
+		{
+			return 0;
+		}
+	}
+
+	while (*pattern == '*')
+	{
+		pattern++;
+	}
+	return !*pattern;
+}
+
+//
+// Looks for the line that tells that the child is ready, until it was found once.
+//
+static void wrapper_relay_watch(wrapper_relay_t* relay, const char* data, DWORD length)
+{
+	const char* end = data + length;
+	for (const char* line = data; line < end && relay->ready_pattern;)
+	{
+		const char* line_end = memchr(line, '\n', end - line);
+		const char* next = line_end ? line_end + 1 : end;
+		if (!line_end)
+		{
+			line_end = end;
+		}
+		if (line_end > line && line_end[-1] == '\r')
+		{
+			line_end--;
+		}
+
+		if (wrapper_relay_match(relay->ready_pattern, line, line_end))
+		{
+			wrapper_free(relay->ready_pattern);
+			relay->ready_pattern = NULL;
+			SetEvent(relay->ready_event);
+		}
+		line = next;
+	}
+}
+
+//
+// Only whole lines are handed to the writer. The partial line at the end of a chunk is carried
+// over into the next chunk, unless the chunk is full or the stream was closed.
+//
+static void wrapper_relay_stream_submit(wrapper_relay_t* relay, wrapper_relay_stream_t* stream, int closing)
+{
+	wrapper_log_chunk_t* chunk = stream->chunk;
+	if (!chunk || !chunk->length)
+	{
+		return;
+	}
+
+	DWORD end = chunk->length;
+	while (end > 0 && chunk->data[end - 1] != '\n')
+	{
+		end--;
+	}
+
+	if (closing || 0 == end)
+	{
+		if (!closing && chunk->length < WRAPPER_LOG_CHUNK_SIZE)
+		{
+			return;
+		}
+		end = chunk->length;
+	}
+
+	if (relay->ready_pattern)
+	{
+		wrapper_relay_watch(relay, chunk->data, end);
+	}
+
+	wrapper_log_chunk_t* next = NULL;
+	const DWORD remainder = chunk->length - end;
+	if (remainder)
+	{
+		next = wrapper_log_writer_acquire_chunk(relay->writer, INFINITE);
+		if (next)
+		{
+			memcpy(next->data, chunk->data + end, remainder);
+			next->length = remainder;
+			chunk->length = end;
+		}
+	}
+
+	wrapper_log_writer_push_chunk(relay->writer, stream->log_level, stream->name, chunk);
+	stream->chunk = next;
+}
+
+static int wrapper_relay_stream_read(wrapper_relay_t* relay, wrapper_relay_stream_t* stream)
+{
+	if (relay->stopping)
+	{
+		return 0;
+	}
+
+	if (!stream->chunk)
+	{
+		stream->chunk = wrapper_log_writer_acquire_chunk(relay->writer, INFINITE);
+		if (!stream->chunk)
+		{
+			return 0;
+		}
+	}
+
+	wrapper_log_chunk_t* chunk = stream->chunk;
+	if (!ReadFile(stream->pipe, chunk->data + chunk->length, WRAPPER_LOG_CHUNK_SIZE - chunk->length, NULL,
+	              &stream->overlapped))
+	{
+		if (ERROR_IO_PENDING != GetLastError())
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void wrapper_relay_stream_close(wrapper_relay_t* relay, wrapper_relay_stream_t* stream)
+{
+	wrapper_relay_stream_submit(relay, stream, 1);
+	wrapper_log_writer_release_chunk(relay->writer, stream->chunk);
+	stream->chunk = NULL;
+	stream->closed = 1;
+}
+
+static DWORD WINAPI wrapper_relay_thread(LPVOID parameter)
+{
+	wrapper_relay_t* relay = parameter;
+	HANDLE events[WRAPPER_RELAY_STREAM_COUNT];
+	wrapper_relay_stream_t* streams[WRAPPER_RELAY_STREAM_COUNT];
+
+	for (int i = 0; i < WRAPPER_RELAY_STREAM_COUNT; i++)
+	{
+		if (!wrapper_relay_stream_read(relay, &relay->streams[i]))
+		{
+			wrapper_relay_stream_close(relay, &relay->streams[i]);
+		}
+	}
+
+	for (;;)
+	{
+		DWORD count = 0;
+		for (int i = 0; i < WRAPPER_RELAY_STREAM_COUNT; i++)
+		{
+			if (!relay->streams[i].closed)
+			{
+				events[count] = relay->streams[i].overlapped.hEvent;
+				streams[count] = &relay->streams[i];
+				count++;
+			}
+		}
+
+		if (0 == count)
+		{
+			break;
+		}
+
+		const DWORD result = WaitForMultipleObjects(count, events, FALSE, INFINITE);
+		if (result >= WAIT_OBJECT_0 + count)
+		{
+			break;
+		}
+
+		wrapper_relay_stream_t* stream = streams[result - WAIT_OBJECT_0];
+		DWORD bytes = 0;
+		if (GetOverlappedResult(stream->pipe, &stream->overlapped, &bytes, FALSE))
+		{
+			stream->chunk->length += bytes;
+			wrapper_metric_add(stream->metric, bytes);
+			wrapper_relay_stream_submit(relay, stream, 0);
+			if (!wrapper_relay_stream_read(relay, stream))
+			{
+				wrapper_relay_stream_close(relay, stream);
+			}
+		}
+		else
+		{
+			// The pipe is broken once the child and its descendants closed it, or aborted when the
+			// relay is stopped.
+			wrapper_relay_stream_close(relay, stream);
+		}
+	}
+
+	return 0;
+}
+
+static void wrapper_relay_stream_init(wrapper_relay_stream_t* stream, const TCHAR* name, const TCHAR* tag,
+                                      wrapper_log_level_t log_level, wrapper_metric_t metric)
+{
+	// The output of each instance is tagged with its number, e.g. 'stdout.2', and that of a hook
+	// with the name of the hook
+	if (tag)
+	{
+		_sntprintf_s(stream->name, _countof(stream->name), _TRUNCATE, _T("%s.%s"), name, tag);
+	}
+	else
+	{
+		_sntprintf_s(stream->name, _countof(stream->name), _TRUNCATE, _T("%s"), name);
+	}
+	stream->log_level = log_level;
+	stream->metric = metric;
+}
+
+//
+// Creates the relay for the child, or for whatever the tag names, e.g. an instance of the child. When
+// there is a ready pattern, the event of the relay is set once the child wrote a matching line.
+//
+int wrapper_relay_create(wrapper_relay_t** relay, wrapper_log_writer_t* writer, const TCHAR* tag,
+                         const char* ready_pattern, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	wrapper_relay_t* result = NULL;
+
+	if (SUCCEEDED(hr))
+	{
+		result = wrapper_allocate(sizeof *result);
+		if (!result)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the output relay"));
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		result->writer = writer;
+		wrapper_relay_stream_init(&result->streams[0], _T("stdout"), tag, WRAPPER_LOG_LEVEL_INFO,
+		                          WRAPPER_METRIC_STDOUT_BYTES);
+		wrapper_relay_stream_init(&result->streams[1], _T("stderr"), tag, WRAPPER_LOG_LEVEL_WARNING,
+		                          WRAPPER_METRIC_STDERR_BYTES);
+
+		for (int i = 0; i < WRAPPER_RELAY_STREAM_COUNT && SUCCEEDED(hr); i++)
+		{
+			if (!wrapper_relay_stream_open(&result->streams[i], error))
+			{
+				hr = E_FAIL;
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr) && ready_pattern)
+	{
+		const size_t size = strlen(ready_pattern) + 1;
+		result->ready_pattern = wrapper_allocate(size);
+		result->ready_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (!result->ready_pattern || !result->ready_event)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate the ready pattern of the output relay"));
+			}
+		}
+		else
+		{
+			memcpy(result->ready_pattern, ready_pattern, size);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		result->thread = CreateThread(NULL, 0, wrapper_relay_thread, result, 0, NULL);
+		if (!result->thread)
+		{
+			DWORD last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to start the output relay thread"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (FAILED(hr))
+	{
+		wrapper_relay_free(result);
+		result = NULL;
+	}
+
+	*relay = result;
+	return SUCCEEDED(hr);
+}
+
+HANDLE wrapper_relay_get_output(wrapper_relay_t* relay)
+{
+	return relay ? relay->streams[0].child : NULL;
+}
+
+HANDLE wrapper_relay_get_error(wrapper_relay_t* relay)
+{
+	return relay ? relay->streams[1].child : NULL;
+}
+
+HANDLE wrapper_relay_get_ready_event(wrapper_relay_t* relay)
+{
+	return relay ? relay->ready_event : NULL;
+}
+
+//
+// Closes the ends of the pipes that were meant for the child. Once the child inherited them, the
+// wrapper must let go of its copies so that the pipes break when the child exits.
+//
+void wrapper_relay_detach(wrapper_relay_t* relay)
+{
+	if (relay)
+	{
+		for (int i = 0; i < WRAPPER_RELAY_STREAM_COUNT; i++)
+		{
+			if (relay->streams[i].child)
+			{
+				CloseHandle(relay->streams[i].child);
+				relay->streams[i].child = NULL;
+			}
+		}
+	}
+}
+
+void wrapper_relay_free(wrapper_relay_t* relay)
+{
+	if (relay)
+	{
+		wrapper_relay_detach(relay);
+
+		if (relay->thread)
+		{
+			// Descendants of the child may have inherited the pipes and keep them open, so stop
+			// waiting for the pipes to break after a while.
+			if (WAIT_TIMEOUT == WaitForSingleObject(relay->thread, WRAPPER_RELAY_DRAIN_TIMEOUT))
+			{
+				InterlockedExchange(&relay->stopping, 1);
+				do
+				{
+					for (int i = 0; i < WRAPPER_RELAY_STREAM_COUNT; i++)
+					{
+						CancelIoEx(relay->streams[i].pipe, NULL);
+					}
+				}
+				while (WAIT_TIMEOUT == WaitForSingleObject(relay->thread, 100));
+			}
+			CloseHandle(relay->thread);
+		}
+
+		for (int i = 0; i < WRAPPER_RELAY_STREAM_COUNT; i++)
+		{
+			wrapper_relay_stream_t* stream = &relay->streams[i];
+			if (stream->pipe)
+			{
+				CloseHandle(stream->pipe);
+			}
+
+			if (stream->overlapped.hEvent)
+			{
+				CloseHandle(stream->overlapped.hEvent);
+			}
+
+			wrapper_log_writer_release_chunk(relay->writer, stream->chunk);
+		}
+
+		if (relay->ready_event)
+		{
+			CloseHandle(relay->ready_event);
+		}
+		wrapper_free(relay->ready_pattern);
+		wrapper_free(relay);
+	}
+}
@@ -0,0 +1,17 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#pragma once
+#include "wrapper-error.h"
+#include "wrapper-log-writer.h"
+
+typedef struct wrapper_relay_t wrapper_relay_t;
+
+int wrapper_relay_create(wrapper_relay_t** relay, wrapper_log_writer_t* writer, const TCHAR* tag,
+                         const char* ready_pattern, wrapper_error_t** error);
+void wrapper_relay_free(wrapper_relay_t* relay);
+
+HANDLE wrapper_relay_get_output(wrapper_relay_t* relay);
+HANDLE wrapper_relay_get_error(wrapper_relay_t* relay);
+void wrapper_relay_detach(wrapper_relay_t* relay);
+HANDLE wrapper_relay_get_ready_event(wrapper_relay_t* relay);
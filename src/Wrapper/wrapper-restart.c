@@ -0,0 +1,133 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#include "stdafx.h"
+#include "wrapper-restart.h"
+
+static double wrapper_restart_random(wrapper_restart_state_t* state)
+{
+	// xorshift32, which is plenty to spread out the restarts of several services
+	unsigned long x = state->random;
+	x ^= (x << 13) & 0xFFFFFFFFUL;
+	x ^= x >> 17;
+	x ^= (x << 5) & 0xFFFFFFFFUL;
+	state->random = x;
+	return (double)x / 4294967296.0;
+}
+
+void wrapper_restart_init(wrapper_restart_state_t* state, unsigned long seed)
+{
+	memset(state, 0, sizeof *state);
+	state->random = seed ? seed & 0xFFFFFFFFUL : 0x9E3779B9UL;
+}
+
+void wrapper_restart_started(wrapper_restart_state_t* state, unsigned long long now)
+{
+	state->started = now;
+}
+
+static unsigned long wrapper_restart_count_recent(const wrapper_restart_policy_t* policy,
+                                                  const wrapper_restart_state_t* state,
+                                                  unsigned long long now)
+{
+	unsigned long count = 0;
+	const unsigned long size = state->restarts < WRAPPER_RESTART_HISTORY_MAX ? state->restarts : WRAPPER_RESTART_HISTORY_MAX;
+	for (unsigned long i = 0; i < size; i++)
+	{
+		if (now - state->history[i] < policy->limit_interval)
+		{
+			count++;
+		}
+	}
+	return count;
+}
+
+wrapper_restart_decision_t wrapper_restart_next(const wrapper_restart_policy_t* policy,
+                                                wrapper_restart_state_t* state,
+                                                unsigned long long now,
+                                                unsigned long exit_code,
+                                                unsigned long* delay)
+{
+	*delay = 0;
+
+	if (WRAPPER_RESTART_NEVER == policy->mode)
+	{
+		return WRAPPER_RESTART_DECISION_STOP;
+	}
+
+	if (WRAPPER_RESTART_ON_FAILURE == policy->mode && 0 == exit_code)
+	{
+		return WRAPPER_RESTART_DECISION_STOP;
+	}
+
+	// A child that stayed up for a whole interval is considered healthy again, so the backoff
+	// starts over.
+	if (policy->limit_interval && now - state->started >= policy->limit_interval)
+	{
+		state->attempt = 0;
+	}
+
+	if (policy->limit_count && policy->limit_interval)
+	{
+		const unsigned long limit = policy->limit_count < WRAPPER_RESTART_HISTORY_MAX
+			                            ? policy->limit_count
+			                            : WRAPPER_RESTART_HISTORY_MAX;
+		if (wrapper_restart_count_recent(policy, state, now) >= limit)
+		{
+			return WRAPPER_RESTART_DECISION_GIVE_UP;
+		}
+	}
+
+	// Without a longest delay, the delay still has to fit in an unsigned long, however many times
+	// the child was restarted
+	const double longest = policy->max_delay ? (double)policy->max_delay : (double)ULONG_MAX;
+	double value = policy->delay;
+	if (state->attempt && policy->multiplier > 1.0)
+	{
+		value *= pow(policy->multiplier, (double)state->attempt);
+	}
+
+	if (value > longest)
+	{
+		value = longest;
+	}
+
+	if (policy->jitter)
+	{
+		const double spread = policy->jitter / 100.0;
+		value *= 1.0 + spread * (2.0 * wrapper_restart_random(state) - 1.0);
+	}
+
+	// The jitter may lengthen a delay that is at the limit, which still holds
+	if (value > longest)
+	{
+		value = longest;
+	}
+
+	*delay = value > 0 ? (unsigned long)value : 0;
+
+	state->history[state->history_next] = now;
+	state->history_next = (state->history_next + 1) % WRAPPER_RESTART_HISTORY_MAX;
+	if (state->attempt < ULONG_MAX)
+	{
+		state->attempt++;
+	}
+	state->restarts++;
+
+	return WRAPPER_RESTART_DECISION_RESTART;
+}
+
+const char* wrapper_restart_mode_str(wrapper_restart_mode_t mode)
+{
+	switch (mode)
+	{
+	case WRAPPER_RESTART_NEVER:
+		return "never";
+	case WRAPPER_RESTART_ON_FAILURE:
+		return "on-failure";
+	case WRAPPER_RESTART_ALWAYS:
+		return "always";
+	default:
+		return "unknown";
+	}
+}
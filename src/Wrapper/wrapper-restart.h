@@ -0,0 +1,55 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#pragma once
+
+//
+// The restart policy only deals in numbers; the caller supplies the clock and the exit code of
+// the child. That keeps it free of any platform API so it can be exercised with a fake clock.
+//
+
+#define WRAPPER_RESTART_HISTORY_MAX 64
+
+typedef enum
+{
+	WRAPPER_RESTART_NEVER,
+	WRAPPER_RESTART_ON_FAILURE,
+	WRAPPER_RESTART_ALWAYS,
+} wrapper_restart_mode_t;
+
+typedef enum
+{
+	WRAPPER_RESTART_DECISION_STOP,
+	WRAPPER_RESTART_DECISION_RESTART,
+	WRAPPER_RESTART_DECISION_GIVE_UP,
+} wrapper_restart_decision_t;
+
+typedef struct wrapper_restart_policy_t
+{
+	wrapper_restart_mode_t mode;
+	unsigned long delay;
+	unsigned long max_delay;
+	double multiplier;
+	unsigned long jitter;
+	unsigned long limit_count;
+	unsigned long limit_interval;
+} wrapper_restart_policy_t;
+
+typedef struct wrapper_restart_state_t
+{
+	unsigned long attempt;
+	unsigned long restarts;
+	unsigned long long started;
+	unsigned long long history[WRAPPER_RESTART_HISTORY_MAX];
+	unsigned long history_next;
+	unsigned long random;
+} wrapper_restart_state_t;
+
+void wrapper_restart_init(wrapper_restart_state_t* state, unsigned long seed);
+void wrapper_restart_started(wrapper_restart_state_t* state, unsigned long long now);
+wrapper_restart_decision_t wrapper_restart_next(const wrapper_restart_policy_t* policy,
+                                                wrapper_restart_state_t* state,
+                                                unsigned long long now,
+                                                unsigned long exit_code,
+                                                unsigned long* delay);
+const char* wrapper_restart_mode_str(wrapper_restart_mode_t mode);
@@ -0,0 +1,307 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#define WRAPPER_LOG_DOMAIN _T("sampler")
+
+#include "stdafx.h"
+#include "wrapper-sampler.h"
+#include "wrapper-log.h"
+#include "wrapper-memory.h"
+#include "wrapper-metrics.h"
+#include "wrapper-process.h"
+
+//
+// A thread samples the resource use of the processes in the jobs of the instances of the child at a
+// fixed interval and keeps the most recent samples in a ring. The job accounting gives the totals
+// for a whole tree in a single call; only the memory and handle counts need a call for each process.
+//
+struct wrapper_sampler_t
+{
+	SRWLOCK lock;
+	wrapper_job_t* jobs[WRAPPER_SERVICE_INSTANCES_MAX];
+	DWORD interval;
+	DWORD log_interval;
+	HANDLE stop_event;
+	HANDLE thread;
+	wrapper_sample_t samples[WRAPPER_SAMPLER_RING_SIZE];
+	DWORD next;
+	DWORD count;
+	DWORD pids[WRAPPER_SAMPLER_PROCESS_MAX];
+};
+
+static void wrapper_sampler_count_threads(wrapper_sample_t* sample, const DWORD* pids, DWORD count)
+{
+	PROCESSENTRY32* entries = NULL;
+	DWORD entry_count = 0;
+
+	if (wrapper_process_snapshot(&entries, &entry_count, NULL))
+	{
+		for (DWORD i = 0; i < entry_count; i++)
+		{
+			for (DWORD j = 0; j < count; j++)
+			{
+				if (entries[i].th32ProcessID == pids[j])
+				{
+					sample->thread_count += entries[i].cntThreads;
+					break;
+				}
+			}
+		}
+		wrapper_free(entries);
+	}
+}
+
+static int wrapper_sampler_take(wrapper_sampler_t* sampler, wrapper_sample_t* sample)
+{
+	int rc = 0;
+	FILETIME now;
+
+	memset(sample, 0, sizeof *sample);
+	GetSystemTimeAsFileTime(&now);
+	sample->time = (ULONGLONG)now.dwHighDateTime << 32 | now.dwLowDateTime;
+
+	DWORD count = 0;
+	AcquireSRWLockShared(&sampler->lock);
+	for (DWORD i = 0; i < WRAPPER_SERVICE_INSTANCES_MAX; i++)
+	{
+		ULONGLONG cpu_time = 0;
+		ULONGLONG read_bytes = 0;
+		ULONGLONG write_bytes = 0;
+		DWORD process_count = 0;
+		if (sampler->jobs[i] && wrapper_job_get_accounting(sampler->jobs[i], &cpu_time, &read_bytes, &write_bytes,
+		                                                   &process_count))
+		{
+			sample->cpu_time += cpu_time;
+			sample->read_bytes += read_bytes;
+			sample->write_bytes += write_bytes;
+			sample->process_count += process_count;
+			count += wrapper_job_get_process_ids(sampler->jobs[i], sampler->pids + count,
+			                                     WRAPPER_SAMPLER_PROCESS_MAX - count);
+			rc = 1;
+		}
+	}
+	ReleaseSRWLockShared(&sampler->lock);
+
+	for (DWORD i = 0; i < count; i++)
+	{
+		HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, sampler->pids[i]);
+		if (process)
+		{
+			PROCESS_MEMORY_COUNTERS_EX counters = {0};
+			if (GetProcessMemoryInfo(process, (PROCESS_MEMORY_COUNTERS*)&counters, sizeof counters))
+			{
+				sample->working_set += counters.WorkingSetSize;
+				sample->private_bytes += counters.PrivateUsage;
+			}
+
+			DWORD handle_count = 0;
+			if (GetProcessHandleCount(process, &handle_count))
+			{
+				sample->handle_count += handle_count;
+			}
+			CloseHandle(process);
+		}
+	}
+
+	if (count)
+	{
+		wrapper_sampler_count_threads(sample, sampler->pids, count);
+	}
+
+	return rc;
+}
+
+static void wrapper_sampler_add(wrapper_sampler_t* sampler, wrapper_sample_t* sample)
+{
+	AcquireSRWLockExclusive(&sampler->lock);
+
+	// The processor usage is in hundredths of a percent of a single processor since the previous
+	// sample. The job accounting restarts with the job, so there's no usage across a restart.
+	if (sampler->count)
+	{
+		const DWORD previous_index = (sampler->next + WRAPPER_SAMPLER_RING_SIZE - 1) % WRAPPER_SAMPLER_RING_SIZE;
+		const wrapper_sample_t* previous = &sampler->samples[previous_index];
+		if (sample->time > previous->time && sample->cpu_time >= previous->cpu_time)
+		{
+			sample->cpu_usage = (DWORD)((sample->cpu_time - previous->cpu_time) * 10000 / (sample->time - previous->time));
+		}
+	}
+
+	sampler->samples[sampler->next] = *sample;
+	sampler->next = (sampler->next + 1) % WRAPPER_SAMPLER_RING_SIZE;
+	if (sampler->count < WRAPPER_SAMPLER_RING_SIZE)
+	{
+		sampler->count++;
+	}
+
+	ReleaseSRWLockExclusive(&sampler->lock);
+}
+
+int wrapper_sample_format(char* buffer, size_t size, const wrapper_sample_t* sample)
+{
+	return SUCCEEDED(StringCbPrintfA(buffer, size,
+		"cpu=%lu.%02lu%% processes=%lu threads=%lu handles=%lu working_set=%llu private_bytes=%llu "
+		"read_bytes=%llu write_bytes=%llu cpu_time=%llu",
+		sample->cpu_usage / 100, sample->cpu_usage % 100, sample->process_count, sample->thread_count,
+		sample->handle_count, sample->working_set, sample->private_bytes, sample->read_bytes, sample->write_bytes,
+		sample->cpu_time / 10000));
+}
+
+static DWORD WINAPI wrapper_sampler_thread(LPVOID parameter)
+{
+	wrapper_sampler_t* sampler = parameter;
+	wrapper_sample_t sample;
+	char text[512];
+	ULONGLONG last_logged = GetTickCount64();
+
+	while (WAIT_TIMEOUT == WaitForSingleObject(sampler->stop_event, sampler->interval))
+	{
+		if (!wrapper_sampler_take(sampler, &sample))
+		{
+			continue;
+		}
+		wrapper_sampler_add(sampler, &sample);
+
+		wrapper_metric_set(WRAPPER_METRIC_CHILD_CPU_TIME, (LONG64)(sample.cpu_time / 10000));
+		wrapper_metric_set(WRAPPER_METRIC_CHILD_CPU_USAGE, sample.cpu_usage);
+		wrapper_metric_set(WRAPPER_METRIC_CHILD_WORKING_SET, (LONG64)sample.working_set);
+		wrapper_metric_set(WRAPPER_METRIC_CHILD_PRIVATE_BYTES, (LONG64)sample.private_bytes);
+		wrapper_metric_set(WRAPPER_METRIC_CHILD_PROCESSES, sample.process_count);
+		wrapper_metric_set(WRAPPER_METRIC_CHILD_THREADS, sample.thread_count);
+		wrapper_metric_set(WRAPPER_METRIC_CHILD_HANDLES, sample.handle_count);
+
+		const ULONGLONG now = GetTickCount64();
+		if (sampler->log_interval && now - last_logged >= sampler->log_interval)
+		{
+			last_logged = now;
+			if (wrapper_sample_format(text, sizeof text, &sample))
+			{
+				WRAPPER_INFO(_T("%hs"), text);
+			}
+		}
+	}
+
+	return 0;
+}
+
+int wrapper_sampler_create(wrapper_sampler_t** sampler, wrapper_config_t* config, wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	DWORD last_error;
+	wrapper_sampler_t* result = NULL;
+
+	if (SUCCEEDED(hr))
+	{
+		result = wrapper_allocate(sizeof *result);
+		if (!result)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the resource sampler"));
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		InitializeSRWLock(&result->lock);
+		result->interval = config->sample_interval;
+		result->log_interval = config->sample_log_interval;
+
+		result->stop_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (!result->stop_event)
+		{
+			last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to create the stop event of the resource sampler"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		result->thread = CreateThread(NULL, 0, wrapper_sampler_thread, result, 0, NULL);
+		if (!result->thread)
+		{
+			last_error = GetLastError();
+			if (error)
+			{
+				*error = wrapper_error_from_system(last_error, _T("Failed to start the resource sampler thread"));
+			}
+			hr = HRESULT_FROM_WIN32(last_error);
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		// The sampler only reads counters, so it shouldn't compete with the child for the processor
+		SetThreadPriority(result->thread, THREAD_PRIORITY_BELOW_NORMAL);
+	}
+
+	if (FAILED(hr))
+	{
+		wrapper_sampler_free(result);
+		result = NULL;
+	}
+
+	*sampler = result;
+	return SUCCEEDED(hr);
+}
+
+void wrapper_sampler_free(wrapper_sampler_t* sampler)
+{
+	if (sampler)
+	{
+		if (sampler->thread)
+		{
+			SetEvent(sampler->stop_event);
+			WaitForSingleObject(sampler->thread, INFINITE);
+			CloseHandle(sampler->thread);
+		}
+
+		if (sampler->stop_event)
+		{
+			CloseHandle(sampler->stop_event);
+		}
+
+		wrapper_free(sampler);
+	}
+}
+
+//
+// Sets the job of an instance to sample. The job must be taken away from the sampler before it is
+// freed.
+//
+void wrapper_sampler_set_job(wrapper_sampler_t* sampler, DWORD index, wrapper_job_t* job)
+{
+	if (sampler && index < WRAPPER_SERVICE_INSTANCES_MAX)
+	{
+		AcquireSRWLockExclusive(&sampler->lock);
+		sampler->jobs[index] = job;
+		ReleaseSRWLockExclusive(&sampler->lock);
+	}
+}
+
+//
+// Copies up to size of the most recent samples, oldest first, and returns how many were copied.
+//
+DWORD wrapper_sampler_get_samples(wrapper_sampler_t* sampler, wrapper_sample_t* samples, DWORD size)
+{
+	if (!sampler)
+	{
+		return 0;
+	}
+
+	AcquireSRWLockShared(&sampler->lock);
+	const DWORD count = sampler->count < size ? sampler->count : size;
+	for (DWORD i = 0; i < count; i++)
+	{
+		const DWORD index = (sampler->next + WRAPPER_SAMPLER_RING_SIZE - count + i) % WRAPPER_SAMPLER_RING_SIZE;
+		samples[i] = sampler->samples[index];
+	}
+	ReleaseSRWLockShared(&sampler->lock);
+	return count;
+}
@@ -0,0 +1,37 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#pragma once
+#include "wrapper-error.h"
+#include "wrapper-config.h"
+#include "wrapper-job.h"
+
+#define WRAPPER_SAMPLER_RING_SIZE 720
+#define WRAPPER_SAMPLER_PROCESS_MAX 256
+
+//
+// The resource use of the child and all of its descendants at a point in time. The processor
+// time and the bytes read and written include the processes that already ended.
+//
+typedef struct wrapper_sample_t
+{
+	ULONGLONG time;
+	ULONGLONG cpu_time;
+	DWORD cpu_usage;
+	DWORD process_count;
+	DWORD thread_count;
+	DWORD handle_count;
+	ULONGLONG working_set;
+	ULONGLONG private_bytes;
+	ULONGLONG read_bytes;
+	ULONGLONG write_bytes;
+} wrapper_sample_t;
+
+typedef struct wrapper_sampler_t wrapper_sampler_t;
+
+int wrapper_sampler_create(wrapper_sampler_t** sampler, wrapper_config_t* config, wrapper_error_t** error);
+void wrapper_sampler_free(wrapper_sampler_t* sampler);
+
+void wrapper_sampler_set_job(wrapper_sampler_t* sampler, DWORD index, wrapper_job_t* job);
+DWORD wrapper_sampler_get_samples(wrapper_sampler_t* sampler, wrapper_sample_t* samples, DWORD size);
+int wrapper_sample_format(char* buffer, size_t size, const wrapper_sample_t* sample);
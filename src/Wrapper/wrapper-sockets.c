@@ -0,0 +1,259 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#include "stdafx.h"
+#include "wrapper-sockets.h"
+#include "wrapper-memory.h"
+
+//
+// The wrapper listens on the sockets itself, for as long as the service runs, and each child
+// inherits them. A connection that arrives while the child is restarted waits in the backlog of
+// the socket until the next child accepts it, instead of being refused because nothing listens.
+//
+struct wrapper_sockets_t
+{
+	DWORD count;
+	SOCKET sockets[WRAPPER_SOCKETS_MAX];
+	int started;
+};
+
+//
+// Splits an address such as '0.0.0.0:8080', '[::]:8080' or '8080', where a port on its own
+// listens on all the IPv4 addresses.
+//
+static int wrapper_sockets_parse(const TCHAR* address, SOCKADDR_STORAGE* storage, int* storage_length)
+{
+	TCHAR host[WRAPPER_SOCKET_ADDRESS_MAX_LEN + 1] = _T("0.0.0.0");
+	const TCHAR* port = address;
+
+	const TCHAR* colon = _tcsrchr(address, _T(':'));
+	if (colon)
+	{
+		const TCHAR* start = address;
+		const TCHAR* end = colon;
+		if (_T('[') == *start && end > start && _T(']') == end[-1])
+		{
+			start++;
+			end--;
+		}
+		if (FAILED(StringCchCopyN(host, _countof(host), start, end - start)))
+		{
+			return 0;
+		}
+		port = colon + 1;
+	}
+
+	TCHAR* port_end = NULL;
+	const unsigned long number = _tcstoul(port, &port_end, 10);
+	if (port_end == port || *port_end || number > 65535)
+	{
+		return 0;
+	}
+
+	SOCKADDR_IN* ipv4 = (SOCKADDR_IN*)storage;
+	SOCKADDR_IN6* ipv6 = (SOCKADDR_IN6*)storage;
+	if (1 == InetPton(AF_INET, host, &ipv4->sin_addr))
+	{
+		ipv4->sin_family = AF_INET;
+		ipv4->sin_port = htons((u_short)number);
+		*storage_length = sizeof *ipv4;
+	}
+	else if (1 == InetPton(AF_INET6, host, &ipv6->sin6_addr))
+	{
+		ipv6->sin6_family = AF_INET6;
+		ipv6->sin6_port = htons((u_short)number);
+		*storage_length = sizeof *ipv6;
+	}
+	else
+	{
+		return 0;
+	}
+	return 1;
+}
+
+static int wrapper_sockets_listen(wrapper_sockets_t* sockets, const TCHAR* address, DWORD backlog,
+                                  wrapper_error_t** error)
+{
+	SOCKADDR_STORAGE storage = {0};
+	int storage_length = 0;
+
+	if (!wrapper_sockets_parse(address, &storage, &storage_length))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(ERROR_INVALID_DATA,
+			                                   _T("The address '%s' to listen on is not a valid IP address and port"),
+			                                   address);
+		}
+		return 0;
+	}
+
+	// Unlike the socket of the metrics server, these sockets are meant to be inherited
+	const SOCKET socket = WSASocket(storage.ss_family, SOCK_STREAM, IPPROTO_TCP, NULL, 0, 0);
+	if (INVALID_SOCKET == socket)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(WSAGetLastError(), _T("Failed to create a socket to listen on '%s'"),
+			                                   address);
+		}
+		return 0;
+	}
+	sockets->sockets[sockets->count++] = socket;
+
+	// Another process must not be able to take over the port
+	BOOL exclusive = TRUE;
+	setsockopt(socket, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, (const char*)&exclusive, sizeof exclusive);
+
+	if (!SetHandleInformation((HANDLE)socket, HANDLE_FLAG_INHERIT, HANDLE_FLAG_INHERIT))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(GetLastError(), _T("Failed to make the socket on '%s' inheritable"),
+			                                   address);
+		}
+		return 0;
+	}
+
+	if (SOCKET_ERROR == bind(socket, (SOCKADDR*)&storage, storage_length) ||
+		SOCKET_ERROR == listen(socket, backlog ? (int)backlog : SOMAXCONN))
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_system(WSAGetLastError(), _T("Failed to listen on '%s'"), address);
+		}
+		return 0;
+	}
+
+	return 1;
+}
+
+int wrapper_sockets_create(wrapper_sockets_t** sockets, const wrapper_sockets_settings_t* settings,
+                           wrapper_error_t** error)
+{
+	HRESULT hr = S_OK;
+	wrapper_sockets_t* result = NULL;
+
+	if (SUCCEEDED(hr))
+	{
+		result = wrapper_allocate(sizeof *result);
+		if (!result)
+		{
+			hr = E_OUTOFMEMORY;
+			if (error)
+			{
+				*error = wrapper_error_from_hresult(hr, _T("Failed to allocate memory for the listening sockets"));
+			}
+		}
+	}
+
+	if (SUCCEEDED(hr))
+	{
+		WSADATA data;
+		const int rc = WSAStartup(MAKEWORD(2, 2), &data);
+		if (rc)
+		{
+			if (error)
+			{
+				*error = wrapper_error_from_system(rc, _T("Failed to initialize Windows Sockets"));
+			}
+			hr = HRESULT_FROM_WIN32(rc);
+		}
+		else
+		{
+			result->started = 1;
+		}
+	}
+
+	for (DWORD i = 0; SUCCEEDED(hr) && i < settings->count; i++)
+	{
+		if (!wrapper_sockets_listen(result, settings->listen[i], settings->backlog, error))
+		{
+			hr = E_FAIL;
+		}
+	}
+
+	if (FAILED(hr))
+	{
+		wrapper_sockets_free(result);
+		result = NULL;
+	}
+
+	*sockets = result;
+	return SUCCEEDED(hr);
+}
+
+void wrapper_sockets_free(wrapper_sockets_t* sockets)
+{
+	if (sockets)
+	{
+		for (DWORD i = 0; i < sockets->count; i++)
+		{
+			closesocket(sockets->sockets[i]);
+		}
+
+		if (sockets->started)
+		{
+			WSACleanup();
+		}
+
+		wrapper_free(sockets);
+	}
+}
+
+DWORD wrapper_sockets_get_count(wrapper_sockets_t* sockets)
+{
+	return sockets ? sockets->count : 0;
+}
+
+//
+// Copies the handles of the sockets, so that they can be listed among the handles a child inherits.
+//
+DWORD wrapper_sockets_get_handles(wrapper_sockets_t* sockets, HANDLE* handles, DWORD size)
+{
+	DWORD count = 0;
+	for (; sockets && count < sockets->count && count < size; count++)
+	{
+		handles[count] = (HANDLE)sockets->sockets[count];
+	}
+	return count;
+}
+
+//
+// Formats the handles of the sockets, in the order they are listed in the configuration and
+// separated by ':', e.g. '340:344'. An inherited handle has the same value in the child.
+//
+int wrapper_sockets_format(wrapper_sockets_t* sockets, TCHAR* buffer, size_t size)
+{
+	size_t length = 0;
+
+	buffer[0] = 0;
+	for (DWORD i = 0; sockets && i < sockets->count; i++)
+	{
+		const int written = _sntprintf_s(buffer + length, size - length, _TRUNCATE, i ? _T(":%llu") : _T("%llu"),
+		                                 (ULONGLONG)sockets->sockets[i]);
+		if (written < 0)
+		{
+			return 0;
+		}
+		length += written;
+	}
+	return 1;
+}
+
+int wrapper_sockets_equal(const wrapper_sockets_settings_t* a, const wrapper_sockets_settings_t* b)
+{
+	if (a->count != b->count || a->backlog != b->backlog)
+	{
+		return 0;
+	}
+
+	for (DWORD i = 0; i < a->count; i++)
+	{
+		if (_tcscmp(a->listen[i], b->listen[i]))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
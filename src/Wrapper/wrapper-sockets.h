@@ -0,0 +1,30 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#pragma once
+#include "wrapper-error.h"
+
+#define WRAPPER_SOCKETS_MAX 16
+#define WRAPPER_SOCKET_ADDRESS_MAX_LEN 64
+
+// The variables that tell the child which sockets it inherited, like LISTEN_FDS does on Linux
+#define WRAPPER_SOCKETS_COUNT_VARIABLE _T("LISTEN_FDS")
+#define WRAPPER_SOCKETS_VARIABLE _T("LISTEN_SOCKETS")
+
+typedef struct wrapper_sockets_settings_t
+{
+	DWORD count;
+	DWORD backlog;
+	TCHAR listen[WRAPPER_SOCKETS_MAX][WRAPPER_SOCKET_ADDRESS_MAX_LEN + 1];
+} wrapper_sockets_settings_t;
+
+typedef struct wrapper_sockets_t wrapper_sockets_t;
+
+int wrapper_sockets_create(wrapper_sockets_t** sockets, const wrapper_sockets_settings_t* settings,
+                           wrapper_error_t** error);
+void wrapper_sockets_free(wrapper_sockets_t* sockets);
+
+DWORD wrapper_sockets_get_count(wrapper_sockets_t* sockets);
+DWORD wrapper_sockets_get_handles(wrapper_sockets_t* sockets, HANDLE* handles, DWORD size);
+int wrapper_sockets_format(wrapper_sockets_t* sockets, TCHAR* buffer, size_t size);
+int wrapper_sockets_equal(const wrapper_sockets_settings_t* a, const wrapper_sockets_settings_t* b);
@@ -1,43 +1,83 @@
-// Copyright (c) Werner Strydom. All rights reserved.
-// Licensed under the MIT license. See LICENSE in the project root for license information.
-
-#include "stdafx.h"
-#include "wrapper-string.h"
-#include "wrapper-memory.h"
-#include "wrapper-error.h"
-
-void wrapper_string_trim_right(TCHAR* chars)
-{
-	for (size_t i = _tcslen(chars); i > 0; i--)
-	{
-		TCHAR c = chars[i-1];
-		if (!_istspace(c))
-		{
-			return;
-		}
-		chars[i-1] = 0;
-	}
-}
-
-void wrapper_string_copy(TCHAR* destination, const size_t destination_max_size, TCHAR* source)
-{
-	StringCbCopy(destination, destination_max_size * sizeof(TCHAR), source);
-}
-
-int wrapper_string_duplicate(TCHAR** result, TCHAR* source, wrapper_error_t** error)
-{
-	const size_t length = _tcslen(source) + 1;
-	*result = wrapper_allocate_string(length);
-	if (!*result)
-	{
-		if (error)
-		{
-			*error = wrapper_error_from_hresult(E_OUTOFMEMORY, _T(""));
-		}
-	}
-	else
-	{
-		wrapper_string_copy(*result, length, source);
-	}
-	return *result != NULL;
-}
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#include "stdafx.h"
+#include "wrapper-string.h"
+#include "wrapper-memory.h"
+#include "wrapper-error.h"
+
+void wrapper_string_trim_right(TCHAR* chars)
+{
+	for (size_t i = _tcslen(chars); i > 0; i--)
+	{
+		TCHAR c = chars[i-1];
+		if (!_istspace(c))
+		{
+			return;
+		}
+		chars[i-1] = 0;
+	}
+}
+
+void wrapper_string_copy(TCHAR* destination, const size_t destination_max_size, TCHAR* source)
+{
+	StringCbCopy(destination, destination_max_size * sizeof(TCHAR), source);
+}
+
+int wrapper_string_duplicate(TCHAR** result, TCHAR* source, wrapper_error_t** error)
+{
+	const size_t length = _tcslen(source) + 1;
+	*result = wrapper_allocate_string(length);
+	if (!*result)
+	{
+		if (error)
+		{
+			*error = wrapper_error_from_hresult(E_OUTOFMEMORY, _T(""));
+		}
+	}
+	else
+	{
+		wrapper_string_copy(*result, length, source);
+	}
+	return *result != NULL;
+}
+
+//
+// Copies the source and replaces '%i' with the number of the instance and '%%' with '%'. Returns 0
+// when the result doesn't fit.
+//
+int wrapper_string_expand_instance(TCHAR* destination, const size_t destination_max_size, const TCHAR* source,
+                                   DWORD instance)
+{
+	TCHAR number[16];
+	size_t length = 0;
+
+	_sntprintf_s(number, _countof(number), _TRUNCATE, _T("%lu"), instance);
+
+	for (const TCHAR* c = source; *c; c++)
+	{
+		const TCHAR* insert = c;
+		size_t insert_length = 1;
+		if (_T('%') == c[0] && _T('i') == c[1])
+		{
+			insert = number;
+			insert_length = _tcslen(number);
+			c++;
+		}
+		else if (_T('%') == c[0] && _T('%') == c[1])
+		{
+			c++;
+		}
+
+		if (length + insert_length >= destination_max_size)
+		{
+			destination[length] = 0;
+			return 0;
+		}
+		memcpy(destination + length, insert, insert_length * sizeof(TCHAR));
+		length += insert_length;
+	}
+
+	destination[length] = 0;
+	return 1;
+}
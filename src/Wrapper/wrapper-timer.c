@@ -0,0 +1,159 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#include "stdafx.h"
+#include "wrapper-timer.h"
+
+//
+// Each slot holds a circular list of the timers that are due in a tick that maps to the slot. A
+// timer further away than a whole turn of the wheel shares its slot with nearer timers, and is
+// skipped until its tick comes around.
+//
+
+static void wrapper_timer_list_init(wrapper_timer_t* head)
+{
+	head->next = head;
+	head->previous = head;
+}
+
+static void wrapper_timer_list_append(wrapper_timer_t* head, wrapper_timer_t* timer)
+{
+	timer->next = head;
+	timer->previous = head->previous;
+	head->previous->next = timer;
+	head->previous = timer;
+}
+
+static void wrapper_timer_list_remove(wrapper_timer_t* timer)
+{
+	timer->previous->next = timer->next;
+	timer->next->previous = timer->previous;
+	timer->next = timer;
+	timer->previous = timer;
+}
+
+void wrapper_timer_wheel_init(wrapper_timer_wheel_t* wheel, unsigned long long now)
+{
+	for (unsigned long i = 0; i < WRAPPER_TIMER_WHEEL_SIZE; i++)
+	{
+		wrapper_timer_list_init(&wheel->slots[i]);
+	}
+	wheel->tick = now / WRAPPER_TIMER_TICK;
+	wheel->count = 0;
+}
+
+//
+// Schedules the timer to fire delay milliseconds from now, or reschedules it if it's pending. The
+// timer fires on the first tick at or after that time, so never early.
+//
+void wrapper_timer_schedule(wrapper_timer_wheel_t* wheel, wrapper_timer_t* timer, unsigned long long now,
+                            unsigned long delay, wrapper_timer_callback_t callback, void* user_data)
+{
+	wrapper_timer_cancel(wheel, timer);
+
+	unsigned long long due = (now + delay + WRAPPER_TIMER_TICK - 1) / WRAPPER_TIMER_TICK;
+	if (due <= wheel->tick)
+	{
+		due = wheel->tick + 1;
+	}
+
+	timer->due = due;
+	timer->callback = callback;
+	timer->user_data = user_data;
+	timer->pending = 1;
+	wrapper_timer_list_append(&wheel->slots[due % WRAPPER_TIMER_WHEEL_SIZE], timer);
+	wheel->count++;
+}
+
+void wrapper_timer_cancel(wrapper_timer_wheel_t* wheel, wrapper_timer_t* timer)
+{
+	if (timer->pending)
+	{
+		wrapper_timer_list_remove(timer);
+		timer->pending = 0;
+		wheel->count--;
+	}
+}
+
+//
+// Fires the timers that are due by now and returns how many fired. The callbacks may schedule and
+// cancel timers, including the ones that are about to fire.
+//
+unsigned long wrapper_timer_wheel_advance(wrapper_timer_wheel_t* wheel, unsigned long long now)
+{
+	const unsigned long long tick = now / WRAPPER_TIMER_TICK;
+	wrapper_timer_t expired;
+	unsigned long fired = 0;
+
+	if (tick <= wheel->tick)
+	{
+		return 0;
+	}
+
+	// After a whole turn, every slot has been looked at, however far the clock moved
+	const unsigned long long steps = tick - wheel->tick < WRAPPER_TIMER_WHEEL_SIZE
+		                                 ? tick - wheel->tick
+		                                 : WRAPPER_TIMER_WHEEL_SIZE;
+
+	wrapper_timer_list_init(&expired);
+	for (unsigned long long i = 1; i <= steps; i++)
+	{
+		wrapper_timer_t* head = &wheel->slots[(wheel->tick + i) % WRAPPER_TIMER_WHEEL_SIZE];
+		wrapper_timer_t* timer = head->next;
+		while (timer != head)
+		{
+			wrapper_timer_t* next = timer->next;
+			if (timer->due <= tick)
+			{
+				wrapper_timer_list_remove(timer);
+				wrapper_timer_list_append(&expired, timer);
+			}
+			timer = next;
+		}
+	}
+	wheel->tick = tick;
+
+	while (expired.next != &expired)
+	{
+		wrapper_timer_t* timer = expired.next;
+		wrapper_timer_list_remove(timer);
+		timer->pending = 0;
+		wheel->count--;
+		fired++;
+		timer->callback(timer->user_data);
+	}
+
+	return fired;
+}
+
+//
+// Gets the number of milliseconds until the next timer is due, or WRAPPER_TIMER_NONE when there
+// are no timers. A timer more than a turn away is waited for a turn at a time.
+//
+unsigned long wrapper_timer_wheel_next(const wrapper_timer_wheel_t* wheel, unsigned long long now)
+{
+	if (0 == wheel->count)
+	{
+		return WRAPPER_TIMER_NONE;
+	}
+
+	unsigned long long due = wheel->tick + WRAPPER_TIMER_WHEEL_SIZE;
+	for (unsigned long long i = 1; i <= WRAPPER_TIMER_WHEEL_SIZE; i++)
+	{
+		const wrapper_timer_t* head = &wheel->slots[(wheel->tick + i) % WRAPPER_TIMER_WHEEL_SIZE];
+		const wrapper_timer_t* timer = head->next;
+		while (timer != head && timer->due != wheel->tick + i)
+		{
+			timer = timer->next;
+		}
+
+		if (timer != head)
+		{
+			due = wheel->tick + i;
+			break;
+		}
+	}
+
+	const unsigned long long time = due * WRAPPER_TIMER_TICK;
+	return time > now ? (unsigned long)(time - now) : 0;
+}
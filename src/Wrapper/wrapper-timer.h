@@ -0,0 +1,44 @@
+// Copyright (c) Werner Strydom. All rights reserved.
+// Licensed under the MIT license. See LICENSE in the project root for license information.
+
+#pragma once
+
+//
+// A hashed timer wheel. Scheduling and cancelling a timer take constant time, whatever the number
+// of timers. Like the restart policy, it only deals in numbers and the caller supplies the clock in
+// milliseconds, so it can be exercised with a fake clock.
+//
+
+#define WRAPPER_TIMER_WHEEL_SIZE 256
+#define WRAPPER_TIMER_TICK 10 // milliseconds
+#define WRAPPER_TIMER_NONE 0xFFFFFFFFUL
+
+typedef void (*wrapper_timer_callback_t)(void* user_data);
+
+//
+// Timers are meant to be embedded in the structure they act on, so that scheduling one never has to
+// allocate memory.
+//
+typedef struct wrapper_timer_t
+{
+	struct wrapper_timer_t* next;
+	struct wrapper_timer_t* previous;
+	unsigned long long due;
+	wrapper_timer_callback_t callback;
+	void* user_data;
+	int pending;
+} wrapper_timer_t;
+
+typedef struct wrapper_timer_wheel_t
+{
+	wrapper_timer_t slots[WRAPPER_TIMER_WHEEL_SIZE];
+	unsigned long long tick;
+	unsigned long count;
+} wrapper_timer_wheel_t;
+
+void wrapper_timer_wheel_init(wrapper_timer_wheel_t* wheel, unsigned long long now);
+void wrapper_timer_schedule(wrapper_timer_wheel_t* wheel, wrapper_timer_t* timer, unsigned long long now,
+                            unsigned long delay, wrapper_timer_callback_t callback, void* user_data);
+void wrapper_timer_cancel(wrapper_timer_wheel_t* wheel, wrapper_timer_t* timer);
+unsigned long wrapper_timer_wheel_advance(wrapper_timer_wheel_t* wheel, unsigned long long now);
+unsigned long wrapper_timer_wheel_next(const wrapper_timer_wheel_t* wheel, unsigned long long now);
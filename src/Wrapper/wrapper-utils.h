@@ -1,5 +1,5 @@
-#pragma once
-
-#ifndef UNUSED
-#define UNUSED(x) (void)(x)
+#pragma once
+
+#ifndef UNUSED
+#define UNUSED(x) (void)(x)
 #endif
\ No newline at end of file